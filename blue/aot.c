@@ -0,0 +1,581 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "compiler.h"
+#include "memory.h"
+
+// ahead of time translation of a script to C. every instruction becomes a
+// few lines of C over the same stack the interpreter uses, so the host
+// compiler sees straight-line code instead of a dispatch loop and can keep
+// constants and the stack top in registers. numbers are handled inline,
+// everything else steps through the interpreter one instruction at a time
+// exactly like the baseline jit. the program embeds its source and compiles
+// it on startup, which is cheap next to running it, so objects are built
+// by the normal compiler and the runtime is the same one blue links against
+
+// functions of a program in a fixed order: the script, then every function
+// constant depth first. translating and loading walk them the same way
+typedef struct
+{
+    int count;
+    int capacity;
+    ObjFunction **functions;
+} FunctionList;
+
+static void collectFunctions(FunctionList *list, ObjFunction *function)
+{
+    if (list->capacity < list->count + 1)
+    {
+        int oldCapacity = list->capacity;
+        list->capacity = GROW_CAPACITY(oldCapacity);
+        list->functions = GROW_ARRAY(ObjFunction *, list->functions, oldCapacity, list->capacity);
+    }
+
+    list->functions[list->count++] = function;
+
+    ValueArray *constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++)
+    {
+        if (IS_FUNCTION(constants->values[i]))
+            collectFunctions(list, AS_FUNCTION(constants->values[i]));
+    }
+}
+
+static void freeFunctionList(FunctionList *list)
+{
+    FREE_ARRAY(ObjFunction *, list->functions, list->capacity);
+}
+
+// FNV-1a of the bytecode and the number of constants, a translation is only
+// used for the exact chunk it was made from
+static uint32_t hashChunk(Chunk *chunk)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < chunk->count; i++)
+    {
+        hash ^= chunk->code[i];
+        hash *= 16777619;
+    }
+
+    hash ^= (uint32_t)chunk->constants.count;
+    hash *= 16777619;
+    return hash;
+}
+
+static uint16_t readShort(uint8_t *ip)
+{
+    return (uint16_t)((ip[0] << 8) | ip[1]);
+}
+
+// labels are only written where something jumps, so none go unused
+static bool *findTargets(Chunk *chunk)
+{
+    bool *targets = ALLOCATE(bool, chunk->count + 1);
+    memset(targets, 0, sizeof(bool) * (chunk->count + 1));
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        uint8_t *ip = chunk->code + offset;
+        int length = instructionLength(chunk, offset);
+
+        switch (*ip)
+        {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_FOR_RANGE:
+            targets[offset + length + readShort(ip + length - 2)] = true;
+            break;
+        case OP_LOOP:
+        case OP_FOR_STEP:
+            targets[offset + length - readShort(ip + length - 2)] = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return targets;
+}
+
+// numbers become literals the C compiler can fold, anything else is
+// read from the chunk's constants
+static void translateConstant(FILE *out, Chunk *chunk, int index)
+{
+    Value constant = chunk->constants.values[index];
+
+    if (IS_INT(constant) && AS_INT(constant) != INT64_MIN)
+        fprintf(out, "    *top++ = INT_VAL(INT64_C(%" PRId64 "));\n", AS_INT(constant));
+    else if (IS_DOUBLE(constant) && isfinite(constant.as.number))
+        fprintf(out, "    *top++ = NUMBER_VAL(%a);\n", constant.as.number);
+    else
+        fprintf(out, "    *top++ = constants[%d];\n", index);
+}
+
+// call into the runtime with the stack written back, ip just past the
+// opcode as the interpreter leaves it for error traces
+static void translateHelper(FILE *out, int offset, const char *call)
+{
+    fprintf(out, "    AOT_SYNC(%d);\n", offset + 1);
+    fprintf(out, "    if (!%s)\n        return false;\n", call);
+    fputs("    AOT_RELOAD();\n", out);
+}
+
+static void translateInstruction(FILE *out, Chunk *chunk, int offset)
+{
+    uint8_t *ip = chunk->code + offset;
+    int length = instructionLength(chunk, offset);
+    char call[64];
+
+    switch (*ip)
+    {
+    case OP_CONSTANT:
+        translateConstant(out, chunk, ip[1]);
+        break;
+    case OP_NIL:
+        fputs("    *top++ = NIL_VAL;\n", out);
+        break;
+    case OP_TRUE:
+        fputs("    *top++ = BOOL_VAL(true);\n", out);
+        break;
+    case OP_FALSE:
+        fputs("    *top++ = BOOL_VAL(false);\n", out);
+        break;
+    case OP_POP:
+        fputs("    top--;\n", out);
+        break;
+    case OP_GET_LOCAL:
+        fprintf(out, "    *top++ = slots[%d];\n", ip[1]);
+        break;
+    case OP_SET_LOCAL:
+        fprintf(out, "    slots[%d] = top[-1];\n", ip[1]);
+        break;
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    {
+        // an undefined global is left to the interpreter to report
+        fprintf(out, "    {\n        static AotGlobal cache;\n");
+        fprintf(out, "        Value *global = AOT_GLOBAL(cache, AS_STRING(constants[%d]));\n", ip[1]);
+        fprintf(out, "        if (global == NULL)\n            AOT_STEP(%d);\n", offset);
+        if (*ip == OP_GET_GLOBAL)
+            fputs("        else\n            *top++ = *global;\n    }\n", out);
+        else
+            fputs("        else\n            AOT_SET_GLOBAL(global, top[-1]);\n    }\n", out);
+        break;
+    }
+    case OP_EQUAL:
+        fputs("    top[-2] = BOOL_VAL(valuesEquate(top[-2], top[-1]));\n    top--;\n", out);
+        break;
+    case OP_GREATER:
+        fprintf(out, "    AOT_COMPARE(%d, >);\n", offset);
+        break;
+    case OP_LESS:
+        fprintf(out, "    AOT_COMPARE(%d, <);\n", offset);
+        break;
+    case OP_ADD:
+        fprintf(out, "    AOT_ARITH(%d, __builtin_add_overflow, +);\n", offset);
+        break;
+    case OP_SUBTRACT:
+        fprintf(out, "    AOT_ARITH(%d, __builtin_sub_overflow, -);\n", offset);
+        break;
+    case OP_MULTIPLY:
+        fprintf(out, "    AOT_ARITH(%d, __builtin_mul_overflow, *);\n", offset);
+        break;
+    case OP_DIVIDE:
+        fprintf(out, "    AOT_DIVIDE(%d);\n", offset);
+        break;
+    case OP_NOT:
+        fputs("    top[-1] = BOOL_VAL(AOT_FALSEY(top[-1]));\n", out);
+        break;
+    case OP_NEGATE:
+        fprintf(out, "    AOT_NEGATE(%d);\n", offset);
+        break;
+    case OP_PRINT:
+        fputs("    printlnValue(&vm->output, *--top);\n", out);
+        break;
+    case OP_JUMP:
+        fprintf(out, "    goto L%d;\n", offset + length + readShort(ip + 1));
+        break;
+    case OP_JUMP_IF_FALSE:
+        fprintf(out, "    if (AOT_FALSEY(top[-1]))\n        goto L%d;\n", offset + length + readShort(ip + 1));
+        break;
+    case OP_LOOP:
+        fprintf(out, "    goto L%d;\n", offset + length - readShort(ip + 1));
+        break;
+    case OP_FOR_RANGE:
+    {
+        // integers inline, the interpreter checks anything else
+        int exit = offset + length + readShort(ip + 3);
+        fprintf(out, "    if (IS_INT(slots[%d]) && IS_INT(slots[%d]))\n    {\n", ip[1], ip[2]);
+        fprintf(out, "        if (AS_INT(slots[%d]) >= AS_INT(slots[%d]))\n            goto L%d;\n    }\n",
+                ip[1], ip[2], exit);
+        fprintf(out, "    else\n    {\n        AOT_STEP(%d);\n", offset);
+        fprintf(out, "        if (frame->ip != code + %d)\n            goto L%d;\n    }\n", offset + length, exit);
+        break;
+    }
+    case OP_FOR_STEP:
+    {
+        int body = offset + length - readShort(ip + 4);
+        Value step = chunk->constants.values[ip[3]];
+        fputs("    {\n", out);
+        if (IS_INT(step))
+        {
+            fputs("        int64_t next;\n", out);
+            fprintf(out, "        if (IS_INT(slots[%d]) && IS_INT(slots[%d]) &&\n", ip[1], ip[2]);
+            fprintf(out, "            !__builtin_add_overflow(AS_INT(slots[%d]), INT64_C(%" PRId64 "), &next))\n",
+                    ip[1], AS_INT(step));
+            fprintf(out, "        {\n            slots[%d] = INT_VAL(next);\n", ip[1]);
+            fprintf(out, "            if (next < AS_INT(slots[%d]))\n                goto L%d;\n        }\n", ip[2], body);
+            fputs("        else\n", out);
+        }
+        fprintf(out, "        {\n            AOT_STEP(%d);\n", offset);
+        fprintf(out, "            if (frame->ip != code + %d)\n                goto L%d;\n        }\n", offset + length, body);
+        fputs("    }\n", out);
+        break;
+    }
+    case OP_CALL:
+        snprintf(call, sizeof(call), "compiledCall(vm, %d)", ip[1]);
+        translateHelper(out, offset, call);
+        break;
+    case OP_RETURN:
+        fprintf(out, "    AOT_SYNC(%d);\n    compiledReturn(vm);\n    return true;\n", offset);
+        break;
+    default:
+        fprintf(out, "    AOT_STEP(%d);\n", offset);
+        break;
+    }
+}
+
+static void translateFunction(FILE *out, ObjFunction *function, int index)
+{
+    Chunk *chunk = &function->chunk;
+    bool *targets = findTargets(chunk);
+
+    fprintf(out, "// %s\n", function->name == NULL ? "script" : function->name->chars);
+    fprintf(out, "static bool function%d(VM *vm, CallFrame *frame)\n{\n", index);
+    fputs("    Value *slots = frame->slots;\n", out);
+    fputs("    Value *constants = frame->function->chunk.constants.values;\n", out);
+    fputs("    uint8_t *code = frame->function->chunk.code;\n", out);
+    fputs("    Value *top = vm->stackTop;\n", out);
+    fputs("    (void)slots;\n    (void)constants;\n\n", out);
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        if (targets[offset])
+            fprintf(out, "L%d:;\n", offset);
+        translateInstruction(out, chunk, offset);
+    }
+
+    fputs("}\n\n", out);
+    FREE_ARRAY(bool, targets, chunk->count + 1);
+}
+
+// the source as a string literal, one line of blue per line of C
+static void translateSource(FILE *out, const char *source)
+{
+    fputs("static const char source[] =\n    \"", out);
+
+    for (const char *c = source; *c != '\0'; c++)
+    {
+        switch (*c)
+        {
+        case '\n':
+            fputs(c[1] == '\0' ? "\\n" : "\\n\"\n    \"", out);
+            break;
+        case '"':
+        case '\\':
+        case '?':
+            // ? so no trigraph can form
+            fputc('\\', out);
+            fputc(*c, out);
+            break;
+        default:
+            if (*c >= ' ' && *c <= '~')
+                fputc(*c, out);
+            else
+                fprintf(out, "\\%03o", (unsigned char)*c);
+            break;
+        }
+    }
+
+    fputs("\";\n\n", out);
+}
+
+// first line of every translation, so a rebuild knows the file is its own
+static const char generatedLine[] = "// generated by blue --compile, edit the blue source instead\n";
+
+bool aotTranslate(ObjFunction *script, const char *source, FILE *out)
+{
+    FunctionList list = {0, 0, NULL};
+    collectFunctions(&list, script);
+
+    fputs(generatedLine, out);
+    fputs("\n", out);
+    fputs("#include \"aot.h\"\n\n", out);
+    translateSource(out, source);
+
+    for (int i = 0; i < list.count; i++)
+    {
+        translateFunction(out, list.functions[i], i);
+    }
+
+    fputs("static const AotFunction functions[] = {\n", out);
+    for (int i = 0; i < list.count; i++)
+    {
+        Chunk *chunk = &list.functions[i]->chunk;
+        fprintf(out, "    {function%d, %d, %" PRIu32 "u},\n", i, chunk->count, hashChunk(chunk));
+    }
+    fputs("};\n\n", out);
+
+    fprintf(out, "int main()\n{\n    return aotMain(source, functions, %d);\n}\n", list.count);
+
+    freeFunctionList(&list);
+    return !ferror(out);
+}
+
+int aotMain(const char *source, const AotFunction *functions, int count)
+{
+    VM *vm = ALLOCATE(VM, 1);
+    initVM(vm);
+
+    ObjFunction *script = compile(vm, source);
+    if (script == NULL)
+    {
+        freeVM(vm);
+        FREE(VM, vm);
+        return 65;
+    }
+
+    // a function that no longer compiles to the bytecode it was
+    // translated from is left to the interpreter
+    FunctionList list = {0, 0, NULL};
+    collectFunctions(&list, script);
+    for (int i = 0; i < list.count && i < count; i++)
+    {
+        Chunk *chunk = &list.functions[i]->chunk;
+        if (chunk->count == functions[i].codeCount && hashChunk(chunk) == functions[i].codeHash)
+            list.functions[i]->aot = functions[i].entry;
+    }
+    freeFunctionList(&list);
+
+    InterpretResult result = interpretFunction(vm, script);
+    freeVM(vm);
+    FREE(VM, vm);
+
+    if (result == INTERPRET_RUNTIME_ERROR)
+        return 70;
+    return 0;
+}
+
+Value *aotFindGlobal(VM *vm, AotGlobal *cache, ObjString *name)
+{
+    Value *global = tableGetSlot(&vm->globals, name);
+    if (global != NULL)
+    {
+        cache->values = vm->globals.values;
+        cache->index = (int)(global - vm->globals.values);
+    }
+
+    return global;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <dirent.h>
+
+// growable command line
+typedef struct
+{
+    int count;
+    int capacity;
+    char *chars;
+} Command;
+
+static void appendCommand(Command *command, const char *text)
+{
+    int length = (int)strlen(text);
+    if (command->capacity < command->count + length + 1)
+    {
+        int oldCapacity = command->capacity;
+        while (command->capacity < command->count + length + 1)
+        {
+            command->capacity = GROW_CAPACITY(command->capacity);
+        }
+        command->chars = GROW_ARRAY(char, command->chars, oldCapacity, command->capacity);
+    }
+
+    memcpy(command->chars + command->count, text, length + 1);
+    command->count += length;
+}
+
+// single quoted for the shell
+static void appendQuoted(Command *command, const char *path)
+{
+    appendCommand(command, " '");
+    for (const char *c = path; *c != '\0'; c++)
+    {
+        char one[2] = {*c, '\0'};
+        appendCommand(command, *c == '\'' ? "'\\''" : one);
+    }
+    appendCommand(command, "'");
+}
+
+// the runtime is every source file next to this one but main.c, found
+// through BLUE_HOME, else BLUE_RUNTIME_DIR given when blue was built, else
+// the directory of this file if it was compiled by an absolute path.
+// false when none is known, a relative path would depend on the cwd
+static bool runtimeDirectory(char *directory, size_t size)
+{
+    const char *home = getenv("BLUE_HOME");
+    if (home != NULL)
+    {
+        snprintf(directory, size, "%s", home);
+        return true;
+    }
+
+#ifdef BLUE_RUNTIME_DIR
+    snprintf(directory, size, "%s", BLUE_RUNTIME_DIR);
+    return true;
+#else
+    if (__FILE__[0] != '/')
+        return false;
+
+    snprintf(directory, size, "%s", __FILE__);
+    *strrchr(directory, '/') = '\0';
+    return true;
+#endif
+}
+
+static int buildExecutable(const char *cPath, const char *executable)
+{
+    char directory[1024];
+    if (!runtimeDirectory(directory, sizeof(directory)))
+    {
+        fprintf(stderr, "Could not find the blue runtime, set BLUE_HOME to blue's source directory "
+                        "or build with -DBLUE_RUNTIME_DIR.\n");
+        return 74;
+    }
+
+    // a directory of other C files would build as the runtime otherwise
+    char marker[2048];
+    snprintf(marker, sizeof(marker), "%s/aot.h", directory);
+    FILE *header = fopen(marker, "r");
+    DIR *dir = header == NULL ? NULL : opendir(directory);
+    if (header != NULL)
+        fclose(header);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not find the blue runtime in %s, set BLUE_HOME.\n", directory);
+        return 74;
+    }
+
+    const char *cc = getenv("CC");
+    Command command = {0, 0, NULL};
+    appendCommand(&command, cc != NULL ? cc : "cc");
+    appendCommand(&command, " -O2 -std=c11 -I");
+    appendQuoted(&command, directory);
+    appendCommand(&command, " -o");
+    appendQuoted(&command, executable);
+    appendQuoted(&command, cPath);
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+        if (length < 3 || strcmp(entry->d_name + length - 2, ".c") != 0 || strcmp(entry->d_name, "main.c") == 0)
+            continue;
+
+        char path[2048];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        appendQuoted(&command, path);
+    }
+    closedir(dir);
+
+    appendCommand(&command, " -lm -lpthread");
+
+    int status = system(command.chars);
+    FREE_ARRAY(char, command.chars, command.capacity);
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Could not build %s.\n", executable);
+        return 74;
+    }
+
+    return 0;
+}
+
+#else
+
+static int buildExecutable(const char *cPath, const char *executable)
+{
+    fprintf(stderr, "Building needs a POSIX host, the translation is in %s.\n", cPath);
+    return 74;
+}
+
+#endif
+
+// does path not exist yet, or hold what aotTranslate wrote
+static bool isTranslation(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return true;
+
+    char line[sizeof(generatedLine)];
+    bool generated = fgets(line, sizeof(line), file) != NULL && strcmp(line, generatedLine) == 0;
+    fclose(file);
+    return generated;
+}
+
+int aotCompileFile(VM *vm, const char *path, const char *source)
+{
+    ObjFunction *script = compile(vm, source);
+    if (script == NULL)
+        return 65;
+
+    // fib.blue builds fib from fib.c
+    size_t length = strlen(path);
+    if (length > 5 && strcmp(path + length - 5, ".blue") == 0)
+        length -= 5;
+
+    char *executable = ALLOCATE(char, length + 1);
+    memcpy(executable, path, length);
+    executable[length] = '\0';
+
+    char *cPath = ALLOCATE(char, length + 3);
+    memcpy(cPath, path, length);
+    memcpy(cPath + length, ".c", 3);
+
+    // only an earlier translation is replaced, never a file of someone else's
+    int status = 0;
+    FILE *out = NULL;
+    if (!isTranslation(cPath))
+    {
+        fprintf(stderr, "Will not overwrite %s, it isn't a translation from blue --compile.\n", cPath);
+        status = 74;
+    }
+    else if ((out = fopen(cPath, "w")) == NULL)
+    {
+        fprintf(stderr, "Could not write this file: %s\n", cPath);
+        status = 74;
+    }
+    else
+    {
+        bool written = aotTranslate(script, source, out);
+        if (fclose(out) != 0 || !written)
+        {
+            fprintf(stderr, "Could not write this file: %s\n", cPath);
+            status = 74;
+        }
+    }
+
+    if (status == 0)
+        status = buildExecutable(cPath, executable);
+
+    FREE_ARRAY(char, executable, length + 1);
+    FREE_ARRAY(char, cPath, length + 3);
+    return status;
+}
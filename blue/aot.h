@@ -0,0 +1,142 @@
+#ifndef blue_aot_h
+#define blue_aot_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+// one function of a translated program. the program embeds its source and
+// compiles it on startup, each function is matched to its translation by
+// position and checked against the bytecode it was translated from
+typedef struct
+{
+    bool (*entry)(VM *vm, CallFrame *frame);
+    int codeCount;
+    uint32_t codeHash;
+} AotFunction;
+
+// where a global instruction last found its variable
+typedef struct
+{
+    Value *values;
+    int index;
+} AotGlobal;
+
+// write a C translation unit for a compiled script
+bool aotTranslate(ObjFunction *script, const char *source, FILE *out);
+
+// translate the file at path and build an executable next to it,
+// returns the exit code for the driver
+int aotCompileFile(VM *vm, const char *path, const char *source);
+
+// main of a translated program
+int aotMain(const char *source, const AotFunction *functions, int count);
+
+// look a global up and remember where it is, NULL if it is undefined
+Value *aotFindGlobal(VM *vm, AotGlobal *cache, ObjString *name);
+
+// the generated code keeps the stack top in a local, written back around
+// anything in the runtime that touches the vm stack. ip is only set for
+// error traces and for instructions left to the interpreter
+#define AOT_SYNC(offset) (vm->stackTop = top, frame->ip = code + (offset))
+#define AOT_RELOAD() (top = vm->stackTop)
+
+// run one instruction in the interpreter
+#define AOT_STEP(offset)          \
+    do                            \
+    {                             \
+        AOT_SYNC(offset);         \
+        if (!stepInstruction(vm)) \
+            return false;         \
+        AOT_RELOAD();             \
+    } while (false)
+
+// the value of a global, straight from the table while nothing moved it
+#define AOT_GLOBAL(cache, name)                                                  \
+    ((cache).values == vm->globals.values && (cache).index < vm->globals.capacity && \
+             vm->globals.keys[(cache).index] == (name)                              \
+         ? &vm->globals.values[(cache).index]                                       \
+         : aotFindGlobal(vm, &(cache), (name)))
+
+// a global written in place, counted like the interpreter counts writes
+// that may turn a global into a function or class or back
+#define AOT_SET_GLOBAL(global, value)           \
+    do                                          \
+    {                                           \
+        if (IS_OBJ(*(global)) || IS_OBJ(value)) \
+            vm->globalsVersion++;               \
+        *(global) = (value);                    \
+    } while (false)
+
+#define AOT_FALSEY(value) (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))
+
+// arithmetic and comparison inline for numbers, like the interpreter an
+// overflowing integer op is redone with doubles. anything else steps
+#define AOT_ARITH(offset, overflowOp, op)                                              \
+    do                                                                                 \
+    {                                                                                  \
+        int64_t result;                                                                \
+        if (IS_INT(top[-2]) && IS_INT(top[-1]) &&                                      \
+            !overflowOp(AS_INT(top[-2]), AS_INT(top[-1]), &result))                    \
+        {                                                                              \
+            top[-2] = INT_VAL(result);                                                 \
+            top--;                                                                     \
+        }                                                                              \
+        else if (IS_NUMBER(top[-2]) && IS_NUMBER(top[-1]))                             \
+        {                                                                              \
+            top[-2] = NUMBER_VAL(AS_NUMBER(top[-2]) op AS_NUMBER(top[-1]));            \
+            top--;                                                                     \
+        }                                                                              \
+        else                                                                           \
+        {                                                                              \
+            AOT_STEP(offset);                                                          \
+        }                                                                              \
+    } while (false)
+
+#define AOT_DIVIDE(offset)                                                             \
+    do                                                                                 \
+    {                                                                                  \
+        if (IS_NUMBER(top[-2]) && IS_NUMBER(top[-1]))                                  \
+        {                                                                              \
+            top[-2] = NUMBER_VAL(AS_NUMBER(top[-2]) / AS_NUMBER(top[-1]));             \
+            top--;                                                                     \
+        }                                                                              \
+        else                                                                           \
+        {                                                                              \
+            AOT_STEP(offset);                                                          \
+        }                                                                              \
+    } while (false)
+
+#define AOT_COMPARE(offset, op)                                                        \
+    do                                                                                 \
+    {                                                                                  \
+        if (IS_INT(top[-2]) && IS_INT(top[-1]))                                        \
+        {                                                                              \
+            top[-2] = BOOL_VAL(AS_INT(top[-2]) op AS_INT(top[-1]));                    \
+            top--;                                                                     \
+        }                                                                              \
+        else if (IS_NUMBER(top[-2]) && IS_NUMBER(top[-1]))                             \
+        {                                                                              \
+            top[-2] = BOOL_VAL(AS_NUMBER(top[-2]) op AS_NUMBER(top[-1]));              \
+            top--;                                                                     \
+        }                                                                              \
+        else                                                                           \
+        {                                                                              \
+            AOT_STEP(offset);                                                          \
+        }                                                                              \
+    } while (false)
+
+#define AOT_NEGATE(offset)                                                             \
+    do                                                                                 \
+    {                                                                                  \
+        if (IS_INT(top[-1]) && AS_INT(top[-1]) != INT64_MIN)                           \
+            top[-1] = INT_VAL(-AS_INT(top[-1]));                                       \
+        else if (IS_NUMBER(top[-1]))                                                   \
+            top[-1] = NUMBER_VAL(-AS_NUMBER(top[-1]));                                 \
+        else                                                                           \
+            AOT_STEP(offset);                                                          \
+    } while (false)
+
+#endif
@@ -0,0 +1,255 @@
+// MAP_ANONYMOUS is outside strict ISO C
+#define _DEFAULT_SOURCE
+
+#include <string.h>
+
+#include "assembler.h"
+#include "memory.h"
+
+#ifdef BLUE_JIT
+
+#include <sys/mman.h>
+
+// x86-64 encoding for the jits, just the instruction forms they use
+
+void initAssembler(Assembler *as, int labelCount)
+{
+    as->count = 0;
+    as->capacity = 0;
+    as->code = NULL;
+    as->labelCount = labelCount;
+    as->labels = ALLOCATE(int, labelCount);
+    for (int i = 0; i < labelCount; i++)
+    {
+        as->labels[i] = -1;
+    }
+    as->fixupCount = 0;
+    as->fixupCapacity = 0;
+    as->fixups = NULL;
+}
+
+void freeAssembler(Assembler *as)
+{
+    FREE_ARRAY(uint8_t, as->code, as->capacity);
+    FREE_ARRAY(int, as->labels, as->labelCount);
+    FREE_ARRAY(Fixup, as->fixups, as->fixupCapacity);
+    as->code = NULL;
+    as->labels = NULL;
+    as->fixups = NULL;
+}
+
+void emit8(Assembler *as, uint8_t byte)
+{
+    if (as->capacity < as->count + 1)
+    {
+        int oldCapacity = as->capacity;
+        as->capacity = GROW_CAPACITY(oldCapacity);
+        as->code = GROW_ARRAY(uint8_t, as->code, oldCapacity, as->capacity);
+    }
+
+    as->code[as->count++] = byte;
+}
+
+void emit32(Assembler *as, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        emit8(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+void emit64(Assembler *as, uint64_t value)
+{
+    emit32(as, (uint32_t)value);
+    emit32(as, (uint32_t)(value >> 32));
+}
+
+// rex prefix, left out when no bit is set
+static void emitRex(Assembler *as, bool wide, int reg, int base)
+{
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) | (base >> 3);
+    if (rex != 0x40)
+        emit8(as, rex);
+}
+
+// legacy prefix, rex, then one or two opcode bytes
+static void emitOpcode(Assembler *as, uint8_t prefix, bool wide, int opcode, int reg, int base)
+{
+    if (prefix != 0)
+        emit8(as, prefix);
+
+    emitRex(as, wide, reg, base);
+
+    if (opcode > 0xff)
+        emit8(as, (uint8_t)(opcode >> 8));
+    emit8(as, (uint8_t)opcode);
+}
+
+void emitMem(Assembler *as, uint8_t prefix, bool wide, int opcode, int reg, int base, int32_t disp)
+{
+    emitOpcode(as, prefix, wide, opcode, reg, base);
+
+    // mod 10 is always a 32 bit displacement, rsp and r12 need a sib byte
+    emit8(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+        emit8(as, 0x24);
+    emit32(as, (uint32_t)disp);
+}
+
+void emitReg(Assembler *as, uint8_t prefix, bool wide, int opcode, int reg, int rm)
+{
+    emitOpcode(as, prefix, wide, opcode, reg, rm);
+    emit8(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void loadQ(Assembler *as, int reg, int base, int32_t disp)
+{
+    emitMem(as, 0, true, 0x8b, reg, base, disp);
+}
+
+void storeQ(Assembler *as, int base, int32_t disp, int reg)
+{
+    emitMem(as, 0, true, 0x89, reg, base, disp);
+}
+
+void storeImm32(Assembler *as, int base, int32_t disp, uint32_t value)
+{
+    emitMem(as, 0, false, 0xc7, 0, base, disp);
+    emit32(as, value);
+}
+
+void cmpImm32(Assembler *as, int base, int32_t disp, uint32_t value)
+{
+    emitMem(as, 0, false, 0x81, 7, base, disp);
+    emit32(as, value);
+}
+
+void cmpImm8(Assembler *as, int base, int32_t disp, uint8_t value)
+{
+    emitMem(as, 0, false, 0x80, 7, base, disp);
+    emit8(as, value);
+}
+
+void movImm64(Assembler *as, int reg, uint64_t value)
+{
+    emitRex(as, true, 0, reg);
+    emit8(as, 0xb8 + (reg & 7));
+    emit64(as, value);
+}
+
+void arithImm(Assembler *as, int extension, int reg, int32_t value)
+{
+    emitRex(as, true, 0, reg);
+    emit8(as, 0x81);
+    emit8(as, 0xc0 | (extension << 3) | (reg & 7));
+    emit32(as, (uint32_t)value);
+}
+
+void push64(Assembler *as, int reg)
+{
+    if (reg >= 8)
+        emit8(as, 0x41);
+    emit8(as, 0x50 + (reg & 7));
+}
+
+void pop64(Assembler *as, int reg)
+{
+    if (reg >= 8)
+        emit8(as, 0x41);
+    emit8(as, 0x58 + (reg & 7));
+}
+
+void setBool(Assembler *as, int cc)
+{
+    emit8(as, 0x0f);
+    emit8(as, 0x90 | cc);
+    emit8(as, 0xc0);
+    emit8(as, 0x0f);
+    emit8(as, 0xb6);
+    emit8(as, 0xc0);
+}
+
+void callRax(Assembler *as)
+{
+    emit8(as, 0xff);
+    emit8(as, 0xd0);
+}
+
+int jcc(Assembler *as, int cc)
+{
+    emit8(as, 0x0f);
+    emit8(as, 0x80 | cc);
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+int jmp(Assembler *as)
+{
+    emit8(as, 0xe9);
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+void patchRel32(Assembler *as, int at, int target)
+{
+    int32_t rel = target - (at + 4);
+    memcpy(as->code + at, &rel, sizeof(rel));
+}
+
+void patchHere(Assembler *as, int at)
+{
+    patchRel32(as, at, as->count);
+}
+
+void placeLabel(Assembler *as, int label)
+{
+    as->labels[label] = as->count;
+}
+
+void jumpToLabel(Assembler *as, int at, int label)
+{
+    if (as->fixupCapacity < as->fixupCount + 1)
+    {
+        int oldCapacity = as->fixupCapacity;
+        as->fixupCapacity = GROW_CAPACITY(oldCapacity);
+        as->fixups = GROW_ARRAY(Fixup, as->fixups, oldCapacity, as->fixupCapacity);
+    }
+
+    as->fixups[as->fixupCount].at = at;
+    as->fixups[as->fixupCount].label = label;
+    as->fixupCount++;
+}
+
+void patchLabels(Assembler *as)
+{
+    for (int i = 0; i < as->fixupCount; i++)
+    {
+        patchRel32(as, as->fixups[i].at, as->labels[as->fixups[i].label]);
+    }
+}
+
+// written once, then made executable and never writable again
+void *makeExecutable(Assembler *as, size_t *size)
+{
+    *size = (size_t)as->count;
+    void *code = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return NULL;
+
+    memcpy(code, as->code, *size);
+
+    if (mprotect(code, *size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, *size);
+        return NULL;
+    }
+
+    return code;
+}
+
+void freeExecutable(void *code, size_t size)
+{
+    munmap(code, size);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef blue_assembler_h
+#define blue_assembler_h
+
+#include "common.h"
+#include "jit.h"
+
+#ifdef BLUE_JIT
+
+// general purpose registers by encoding
+enum
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+};
+
+// condition codes for jcc and setcc
+enum
+{
+    CC_O = 0x0,
+    CC_NO = 0x1,
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_P = 0xa,
+    CC_NP = 0xb,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+    CC_G = 0xf,
+};
+
+// a jump to a label, patched once every label has an address
+typedef struct
+{
+    int at;
+    int label;
+} Fixup;
+
+// machine code being written, with numbered labels the caller places
+typedef struct
+{
+    int count;
+    int capacity;
+    uint8_t *code;
+
+    // code offset of each label, -1 until placed
+    int labelCount;
+    int *labels;
+
+    int fixupCount;
+    int fixupCapacity;
+    Fixup *fixups;
+} Assembler;
+
+void initAssembler(Assembler *as, int labelCount);
+void freeAssembler(Assembler *as);
+
+void emit8(Assembler *as, uint8_t byte);
+void emit32(Assembler *as, uint32_t value);
+void emit64(Assembler *as, uint64_t value);
+
+// opcode with a [base + disp32] operand; prefix is 0x66, 0xf2 or 0 for none
+// and two byte opcodes are passed as 0x0fxx
+void emitMem(Assembler *as, uint8_t prefix, bool wide, int opcode, int reg, int base, int32_t disp);
+
+// opcode with two register operands, prefix as for emitMem
+void emitReg(Assembler *as, uint8_t prefix, bool wide, int opcode, int reg, int rm);
+
+// mov between a register and memory
+void loadQ(Assembler *as, int reg, int base, int32_t disp);
+void storeQ(Assembler *as, int base, int32_t disp, int reg);
+
+// 32 bit immediate stores and compares, and a byte compare
+void storeImm32(Assembler *as, int base, int32_t disp, uint32_t value);
+void cmpImm32(Assembler *as, int base, int32_t disp, uint32_t value);
+void cmpImm8(Assembler *as, int base, int32_t disp, uint8_t value);
+
+void movImm64(Assembler *as, int reg, uint64_t value);
+
+// add (extension 0) or sub (extension 5) a 32 bit immediate to a register
+void arithImm(Assembler *as, int extension, int reg, int32_t value);
+
+void push64(Assembler *as, int reg);
+void pop64(Assembler *as, int reg);
+
+// setcc al then zero extend into rax
+void setBool(Assembler *as, int cc);
+
+// call the function whose address is in rax
+void callRax(Assembler *as);
+
+// jumps return the offset of their rel32 for patching
+int jcc(Assembler *as, int cc);
+int jmp(Assembler *as);
+
+// point a rel32 at a code offset, or at the current position
+void patchRel32(Assembler *as, int at, int target);
+void patchHere(Assembler *as, int at);
+
+// labels for jumps whose target is emitted later
+void placeLabel(Assembler *as, int label);
+void jumpToLabel(Assembler *as, int at, int label);
+void patchLabels(Assembler *as);
+
+// copy the finished code into a new read and execute mapping, NULL on failure
+void *makeExecutable(Assembler *as, size_t *size);
+void freeExecutable(void *code, size_t size);
+
+#endif
+
+#endif
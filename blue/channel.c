@@ -0,0 +1,168 @@
+#include <stdatomic.h>
+
+#include "channel.h"
+#include "memory.h"
+
+#ifdef BLUE_THREADS
+#include <pthread.h>
+#endif
+
+// an intrusive multi-producer single-consumer queue: a sender swaps its
+// message in as the head and then links the old head to it, the receiver
+// walks from the tail. the stub node keeps the list from ever being empty
+struct Channel
+{
+    // handles in every vm and every message carrying the channel
+    atomic_int references;
+
+    _Atomic(Message *) head;
+    Message *tail;
+    Message stub;
+
+#ifdef BLUE_THREADS
+    // held by the receiver while it takes from the tail, so receivers in
+    // different vms take turns. senders only touch it to wake a sleeper
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;
+    atomic_int sleepers;
+#endif
+};
+
+Channel *createChannel()
+{
+    Channel *channel = ALLOCATE(Channel, 1);
+    atomic_init(&channel->references, 1);
+    atomic_init(&channel->stub.next, NULL);
+    atomic_init(&channel->head, &channel->stub);
+    channel->tail = &channel->stub;
+
+#ifdef BLUE_THREADS
+    pthread_mutex_init(&channel->lock, NULL);
+    pthread_cond_init(&channel->arrived, NULL);
+    atomic_init(&channel->sleepers, 0);
+#endif
+    return channel;
+}
+
+Channel *retainChannel(Channel *channel)
+{
+    atomic_fetch_add_explicit(&channel->references, 1, memory_order_relaxed);
+    return channel;
+}
+
+static void enqueue(Channel *channel, Message *message)
+{
+    atomic_store_explicit(&message->next, NULL, memory_order_relaxed);
+    Message *previous = atomic_exchange_explicit(&channel->head, message, memory_order_acq_rel);
+
+    // between the exchange and this store the receiver can't see past previous
+    atomic_store_explicit(&previous->next, message, memory_order_release);
+}
+
+// only ever run by one receiver at a time
+static Message *dequeue(Channel *channel)
+{
+    Message *tail = channel->tail;
+    Message *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &channel->stub)
+    {
+        if (next == NULL)
+            return NULL;
+
+        channel->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        channel->tail = next;
+        return tail;
+    }
+
+    // a sender is between its exchange and its link, come back later
+    if (tail != atomic_load_explicit(&channel->head, memory_order_acquire))
+        return NULL;
+
+    // tail is the last message, the stub goes behind it so it can be taken
+    enqueue(channel, &channel->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        channel->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+void releaseChannel(Channel *channel)
+{
+    if (atomic_fetch_sub_explicit(&channel->references, 1, memory_order_acq_rel) != 1)
+        return;
+
+    // nobody can send any more, what was never received is dropped
+    Message *message;
+    while ((message = dequeue(channel)) != NULL)
+        freeMessage(message);
+
+#ifdef BLUE_THREADS
+    pthread_mutex_destroy(&channel->lock);
+    pthread_cond_destroy(&channel->arrived);
+#endif
+    FREE(Channel, channel);
+}
+
+void channelSend(Channel *channel, Message *message)
+{
+    enqueue(channel, message);
+
+#ifdef BLUE_THREADS
+    // pairs with the fence in channelReceive: either the receiver sees the
+    // message before sleeping or this sees the receiver and wakes it
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&channel->sleepers, memory_order_relaxed) > 0)
+    {
+        pthread_mutex_lock(&channel->lock);
+        pthread_cond_signal(&channel->arrived);
+        pthread_mutex_unlock(&channel->lock);
+    }
+#endif
+}
+
+#ifdef BLUE_THREADS
+
+Message *channelReceive(Channel *channel, bool wait)
+{
+    pthread_mutex_lock(&channel->lock);
+
+    Message *message = dequeue(channel);
+    while (message == NULL && wait)
+    {
+        atomic_fetch_add_explicit(&channel->sleepers, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        // a send may have landed after the first look
+        message = dequeue(channel);
+        if (message == NULL)
+            pthread_cond_wait(&channel->arrived, &channel->lock);
+
+        atomic_fetch_sub_explicit(&channel->sleepers, 1, memory_order_relaxed);
+        if (message == NULL)
+            message = dequeue(channel);
+    }
+
+    pthread_mutex_unlock(&channel->lock);
+    return message;
+}
+
+#else
+
+// without threads nothing could ever arrive while waiting
+Message *channelReceive(Channel *channel, bool wait)
+{
+    return dequeue(channel);
+}
+
+#endif
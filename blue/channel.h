@@ -0,0 +1,32 @@
+#ifndef blue_channel_h
+#define blue_channel_h
+
+#include "common.h"
+#include "message.h"
+
+// a receiver waits for messages and spawned vms run on posix threads
+#if defined(__unix__) || defined(__APPLE__)
+#define BLUE_THREADS
+#endif
+
+// queue of messages shared by any number of vms. sending never blocks or
+// takes a lock, receivers take turns and sleep while the queue is empty
+typedef struct Channel Channel;
+
+// empty channel holding one reference for the caller
+Channel *createChannel();
+
+// take another reference, returns the channel
+Channel *retainChannel(Channel *channel);
+
+// drop a reference, the last one frees the channel and anything queued
+void releaseChannel(Channel *channel);
+
+// queue a message, the channel owns it from here
+void channelSend(Channel *channel, Message *message);
+
+// take the oldest message, waiting for one when wait is set and threads
+// are available, otherwise NULL if the queue is empty
+Message *channelReceive(Channel *channel, bool wait);
+
+#endif
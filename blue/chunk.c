@@ -2,6 +2,7 @@
 
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 
 // make chunk of code
 void initChunk(Chunk *chunk)
@@ -11,6 +12,15 @@ void initChunk(Chunk *chunk)
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->caches = NULL;
+    chunk->invokeCacheCount = 0;
+    chunk->invokeCacheCapacity = 0;
+    chunk->invokeCaches = NULL;
+    chunk->loopCount = 0;
+    chunk->loopCapacity = 0;
+    chunk->loops = NULL;
 }
 
 // empty chunk of code
@@ -19,6 +29,9 @@ void freeChunk(Chunk *chunk)
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(PropertyCache, chunk->caches, chunk->cacheCapacity);
+    FREE_ARRAY(InvokeCache, chunk->invokeCaches, chunk->invokeCacheCapacity);
+    FREE_ARRAY(LoopHeader, chunk->loops, chunk->loopCapacity);
     initChunk(chunk);
 }
 
@@ -45,4 +58,255 @@ int addConstant(Chunk *chunk, Value value)
 {
     writeArrayValue(&chunk->constants, value);
     return chunk->constants.count - 1;
-}
\ No newline at end of file
+}
+
+// add an inline cache with every entry unused, returns its index
+int addPropertyCache(Chunk *chunk)
+{
+    if (chunk->cacheCapacity < chunk->cacheCount + 1)
+    {
+        int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(PropertyCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+    }
+
+    PropertyCache *cache = &chunk->caches[chunk->cacheCount];
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++)
+    {
+        cache->entries[i].shape = NULL;
+        cache->entries[i].slot = 0;
+        cache->entries[i].transition = NULL;
+    }
+
+    return chunk->cacheCount++;
+}
+
+// add an invoke cache with every entry unused, returns its index
+int addInvokeCache(Chunk *chunk)
+{
+    if (chunk->invokeCacheCapacity < chunk->invokeCacheCount + 1)
+    {
+        int oldCapacity = chunk->invokeCacheCapacity;
+        chunk->invokeCacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->invokeCaches = GROW_ARRAY(InvokeCache, chunk->invokeCaches, oldCapacity, chunk->invokeCacheCapacity);
+    }
+
+    InvokeCache *cache = &chunk->invokeCaches[chunk->invokeCacheCount];
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++)
+    {
+        cache->entries[i].type = -1;
+        cache->entries[i].klass = NULL;
+        cache->entries[i].shape = NULL;
+        cache->entries[i].slot = -1;
+        cache->entries[i].method = NIL_VAL;
+    }
+
+    return chunk->invokeCacheCount++;
+}
+// add a loop header with a cold counter unless the offset already is one
+void addLoop(Chunk *chunk, int offset)
+{
+    for (int i = 0; i < chunk->loopCount; i++)
+    {
+        if (chunk->loops[i].offset == offset)
+            return;
+    }
+
+    if (chunk->loopCapacity < chunk->loopCount + 1)
+    {
+        int oldCapacity = chunk->loopCapacity;
+        chunk->loopCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->loops = GROW_ARRAY(LoopHeader, chunk->loops, oldCapacity, chunk->loopCapacity);
+    }
+
+    LoopHeader *loop = &chunk->loops[chunk->loopCount++];
+    loop->offset = offset;
+    loop->hotness = 0;
+    loop->trace = NULL;
+    loop->blacklisted = false;
+}
+
+// bytes an instruction takes, opcode included
+int instructionLength(Chunk *chunk, int offset)
+{
+    switch (chunk->code[offset])
+    {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_SUPER:
+    case OP_CALL:
+    case OP_BUILD_LIST:
+    case OP_BUILD_MAP:
+    case OP_CLASS:
+    case OP_METHOD:
+        return 2;
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_SUPER_INVOKE:
+        return 3;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+        return 4;
+    case OP_FOR_RANGE:
+    case OP_INVOKE:
+        return 5;
+    case OP_FOR_STEP:
+        return 6;
+    case OP_CLOSURE:
+    {
+        // each upvalue is an isLocal flag and an index
+        ObjFunction *function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+        return 2 + 2 * function->upvalueCount;
+    }
+    default:
+        return 1;
+    }
+}
+
+// values the instruction at offset leaves on the stack, less those it takes
+static int stackEffect(Chunk *chunk, int offset)
+{
+    uint8_t *ip = chunk->code + offset;
+    switch (*ip)
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_GET_GLOBAL:
+    case OP_CLOSURE:
+    case OP_CLASS:
+        return 1;
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_PROPERTY:
+    case OP_GET_SUPER:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_EXPONENT:
+    case OP_PRINT:
+    case OP_CLOSE_UPVALUE:
+    case OP_INDEX_GET:
+    case OP_INHERIT:
+    case OP_METHOD:
+        return -1;
+    case OP_INDEX_SET:
+        return -2;
+    case OP_CALL:
+        return -ip[1];
+    case OP_INVOKE:
+        return -ip[2];
+    case OP_SUPER_INVOKE:
+        // the superclass goes as well as the arguments
+        return -ip[2] - 1;
+    case OP_BUILD_LIST:
+        return 1 - ip[1];
+    case OP_BUILD_MAP:
+        return 1 - 2 * ip[1];
+    default:
+        return 0;
+    }
+}
+
+// where the jump at offset goes, or -1 for other instructions
+static int jumpTarget(Chunk *chunk, int offset)
+{
+    uint8_t *ip = chunk->code + offset;
+    bool forward;
+    switch (*ip)
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_FOR_RANGE:
+        forward = true;
+        break;
+    case OP_LOOP:
+    case OP_FOR_STEP:
+        forward = false;
+        break;
+    default:
+        return -1;
+    }
+
+    // the distance is the last two bytes of the instruction
+    int length = instructionLength(chunk, offset);
+    int distance = (ip[length - 2] << 8) | ip[length - 1];
+    return forward ? offset + length + distance : offset + length - distance;
+}
+
+int maxStackDepth(Chunk *chunk, int entryDepth)
+{
+    // deepest arrival seen at each offset, -1 until some path gets there
+    int *depths = ALLOCATE(int, chunk->count + 1);
+    bool *queued = ALLOCATE(bool, chunk->count + 1);
+    int *pending = ALLOCATE(int, chunk->count + 1);
+    for (int i = 0; i <= chunk->count; i++)
+    {
+        depths[i] = -1;
+        queued[i] = false;
+    }
+
+    int pendingCount = 0;
+    int max = entryDepth;
+    depths[0] = entryDepth;
+    pending[pendingCount++] = 0;
+    queued[0] = true;
+
+    // the compiler's paths meet with equal depths, so every offset is
+    // walked about once
+    while (pendingCount > 0)
+    {
+        int offset = pending[--pendingCount];
+        int depth = depths[offset];
+        queued[offset] = false;
+
+        while (offset < chunk->count)
+        {
+            uint8_t instruction = chunk->code[offset];
+            if (instruction == OP_RETURN)
+                break;
+
+            depth += stackEffect(chunk, offset);
+            if (depth > max)
+                max = depth;
+
+            int target = jumpTarget(chunk, offset);
+            if (target >= 0 && depths[target] < depth)
+            {
+                depths[target] = depth;
+                if (!queued[target])
+                {
+                    queued[target] = true;
+                    pending[pendingCount++] = target;
+                }
+            }
+
+            if (instruction == OP_JUMP || instruction == OP_LOOP)
+                break;
+
+            offset += instructionLength(chunk, offset);
+            if (depths[offset] >= depth)
+                break;
+            depths[offset] = depth;
+        }
+    }
+
+    FREE_ARRAY(int, depths, chunk->count + 1);
+    FREE_ARRAY(bool, queued, chunk->count + 1);
+    FREE_ARRAY(int, pending, chunk->count + 1);
+    return max;
+}
@@ -14,9 +14,14 @@ typedef enum
     OP_POP,
     OP_GET_LOCAL,
     OP_SET_LOCAL,
+    OP_GET_UPVALUE,
+    OP_SET_UPVALUE,
     OP_GET_GLOBAL,
     OP_DEFINE_GLOBAL,
     OP_SET_GLOBAL,
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
+    OP_GET_SUPER,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
@@ -31,10 +36,88 @@ typedef enum
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
+    OP_FOR_RANGE,
+    OP_FOR_STEP,
     OP_CALL,
+    OP_INVOKE,
+    OP_SUPER_INVOKE,
+    OP_CLOSURE,
+    OP_CLOSE_UPVALUE,
+    OP_BUILD_LIST,
+    OP_BUILD_MAP,
+    OP_INDEX_GET,
+    OP_INDEX_SET,
     OP_RETURN,
+    OP_YIELD,
+    OP_CLASS,
+    OP_INHERIT,
+    OP_METHOD,
 } OpCode;
 
+struct ObjClass;
+struct ObjShape;
+struct Trace;
+
+// entries a property cache holds before it stops learning new shapes
+#define PROPERTY_CACHE_SIZE 4
+
+// one shape a property instruction has seen
+typedef struct
+{
+    // shape of the instance, NULL if the entry is unused
+    struct ObjShape *shape;
+
+    // where the field lives in the instance
+    int slot;
+
+    // stores that add a field move the instance to this shape, otherwise NULL
+    struct ObjShape *transition;
+} CacheEntry;
+
+// inline cache for a single property instruction, the first entry is
+// the monomorphic fast path and the others make it polymorphic
+typedef struct
+{
+    CacheEntry entries[PROPERTY_CACHE_SIZE];
+} PropertyCache;
+
+// one receiver an invoke instruction has seen
+typedef struct
+{
+    // object type of the receiver, -1 if the entry is unused
+    int type;
+
+    // class and shape of instance receivers, NULL for built-in types
+    struct ObjClass *klass;
+    struct ObjShape *shape;
+
+    // field holding the callee, or -1 when calling a method
+    int slot;
+
+    // the method, a closure, function or native
+    Value method;
+} InvokeEntry;
+
+// inline cache for a single invoke instruction, filled like a property cache
+typedef struct
+{
+    InvokeEntry entries[PROPERTY_CACHE_SIZE];
+} InvokeCache;
+
+// target of a back-edge, counted until the loop is hot enough to trace
+typedef struct
+{
+    // bytecode offset the back-edge jumps to
+    int offset;
+    int hotness;
+
+    // native code for one iteration, NULL while interpreted
+    struct Trace *trace;
+
+    // the loop could not be traced and stays interpreted
+    bool blacklisted;
+} LoopHeader;
+
 // chunk of code
 typedef struct
 {
@@ -52,6 +135,21 @@ typedef struct
 
     // array of literal values
     ValueArray constants;
+
+    // one inline cache per property instruction
+    int cacheCount;
+    int cacheCapacity;
+    PropertyCache *caches;
+
+    // one inline cache per invoke instruction
+    int invokeCacheCount;
+    int invokeCacheCapacity;
+    InvokeCache *invokeCaches;
+
+    // every loop header, in the order the compiler closed the loops
+    int loopCount;
+    int loopCapacity;
+    LoopHeader *loops;
 } Chunk;
 
 // create chunk
@@ -66,4 +164,20 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line);
 // add literal value
 int addConstant(Chunk *chunk, Value value);
 
+// add an empty inline cache, returns its index
+int addPropertyCache(Chunk *chunk);
+
+// add an empty invoke cache, returns its index
+int addInvokeCache(Chunk *chunk);
+
+// bytes the instruction at offset takes, opcode included
+int instructionLength(Chunk *chunk, int offset);
+
+// the most values the code has on the stack at once, starting from
+// entryDepth, found by following every jump
+int maxStackDepth(Chunk *chunk, int entryDepth);
+
+// record a back-edge target, a header is only added once
+void addLoop(Chunk *chunk, int offset);
+
 #endif
\ No newline at end of file
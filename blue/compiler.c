@@ -4,18 +4,27 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "number.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+// all the state of one compilation, so every vm compiles on its own
 typedef struct
 {
+    VM *vm;
+    Scanner scanner;
+
     Token current;
     Token previous;
     bool hadError;
     bool panicMode;
+
+    // innermost function and class being compiled
+    struct Compiler *compiler;
+    struct ClassCompiler *currentClass;
 } Parser;
 
 typedef enum
@@ -33,7 +42,7 @@ typedef enum
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)(bool canAssign);
+typedef void (*ParseFn)(Parser *parser, bool canAssign);
 
 // rules of which to parse first
 typedef struct
@@ -48,13 +57,26 @@ typedef struct
 {
     Token variable;
     int depth;
+
+    // a nested function refers to it, so it moves to the heap on scope exit
+    bool isCaptured;
 } Local;
 
+// where a closure finds a captured variable: a local slot in the
+// enclosing function, or one of the enclosing function's own upvalues
+typedef struct
+{
+    uint8_t index;
+    bool isLocal;
+} Upvalue;
+
 // determines if compiling top leve or body level
 // all the code in compiled into some function: main or user defined
 typedef enum
 {
     TYPE_FUNCTION,
+    TYPE_INITIALIZER,
+    TYPE_METHOD,
     TYPE_SCRIPT
 } FunctionType;
 
@@ -68,29 +90,33 @@ typedef struct Compiler
 
     Local locals[UINT8_COUNT];
     int localCount;
+    Upvalue upvalues[UINT8_COUNT];
     int scopeDepth;
 } Compiler;
 
-Parser parser;
-Compiler *current = NULL;
-Chunk *compilingChunk;
+// innermost class being compiled, for this and super
+typedef struct ClassCompiler
+{
+    struct ClassCompiler *enclosing;
+    bool hasSuperclass;
+} ClassCompiler;
 
 // the chunk of the function we're compiling: main or user def.
-static Chunk *currentChunk()
+static Chunk *currentChunk(Parser *parser)
 {
-    return &current->function->chunk;
+    return &parser->compiler->function->chunk;
 }
 
 // print where the error occurred and its message
-static void errorAt(Token *token, const char *message)
+static void errorAt(Parser *parser, Token *token, const char *message)
 {
     // ignore other errors
     // todo: remove this so all errors can be logged
-    if (parser.panicMode)
+    if (parser->panicMode)
         return;
 
     // for exceptions
-    parser.panicMode = true;
+    parser->panicMode = true;
 
     // print error line
     fprintf(stderr, "[line %d] Error", token->line);
@@ -113,118 +139,127 @@ static void errorAt(Token *token, const char *message)
     fprintf(stderr, ": %s\n", message);
 
     // inform we had an error
-    parser.hadError = true;
+    parser->hadError = true;
 }
 
 // tell the user of error token from scanner
-static void errorAtCurrent(const char *message)
+static void errorAtCurrent(Parser *parser, const char *message)
 {
-    errorAt(&parser.current, message);
+    errorAt(parser, &parser->current, message);
 }
 
 // "just found an error"
-static void error(const char *message)
+static void error(Parser *parser, const char *message)
 {
-    errorAt(&parser.previous, message);
+    errorAt(parser, &parser->previous, message);
 }
 
 // advance to get next token
-static void advance()
+static void advance(Parser *parser)
 {
-    parser.previous = parser.current;
+    parser->previous = parser->current;
 
     for (;;)
     {
-        parser.current = scanToken();
+        parser->current = scanToken(&parser->scanner);
 
-        if (parser.current.type != TOKEN_ERROR)
+        if (parser->current.type != TOKEN_ERROR)
             break;
 
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(parser, parser->current.start);
     }
 }
 
 // read token and validate expected type
-static void consume(TokenType type, const char *message)
+static void consume(Parser *parser, TokenType type, const char *message)
 {
-    if (parser.current.type == type)
+    if (parser->current.type == type)
     {
-        advance();
+        advance(parser);
         return;
     }
 
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
 }
 
 // return if current token matches type param
-static bool check(TokenType type)
+static bool check(Parser *parser, TokenType type)
 {
-    return parser.current.type == type;
+    return parser->current.type == type;
 }
 
 // if current token matches type param, consume
-static bool match(TokenType type)
+static bool match(Parser *parser, TokenType type)
 {
-    if (!check(type))
+    if (!check(parser, type))
         return false;
 
-    advance();
+    advance(parser);
 
     return true;
 }
 
 // translate parsed code to bytecode
-static void emitByte(uint8_t byte)
+static void emitByte(Parser *parser, uint8_t byte)
 {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+    writeChunk(currentChunk(parser), byte, parser->previous.line);
 }
 
 // write opcode with one byte operand
-static void emitBytes(uint8_t byte1, uint8_t byte2)
+static void emitBytes(Parser *parser, uint8_t byte1, uint8_t byte2)
 {
-    emitByte(byte1);
-    emitByte(byte2);
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
 }
 
 // emitJump + patchJump = emitLoop -> while loop
-static void emitLoop(int loopStart)
+static void emitLoop(Parser *parser, int loopStart)
 {
-    emitByte(OP_LOOP);
+    addLoop(currentChunk(parser), loopStart);
+    emitByte(parser, OP_LOOP);
 
-    int offset = currentChunk()->count - loopStart + 2;
+    int offset = currentChunk(parser)->count - loopStart + 2;
 
     if (offset > UINT16_MAX)
-        error("This loop's body is too large.");
+        error(parser, "This loop's body is too large.");
 
-    emitByte((offset >> 8) & 0xff);
-    emitByte(offset & 0xff);
+    emitByte(parser, (offset >> 8) & 0xff);
+    emitByte(parser, offset & 0xff);
 }
 
 // make space for the else clause code, use placeholders
-static int emitJump(uint8_t instruction)
+static int emitJump(Parser *parser, uint8_t instruction)
 {
-    emitByte(instruction);
-    emitByte(0xff);
-    emitByte(0xff);
-    return currentChunk()->count - 2;
+    emitByte(parser, instruction);
+    emitByte(parser, 0xff);
+    emitByte(parser, 0xff);
+    return currentChunk(parser)->count - 2;
 }
 
-// temporary: print expression value
-static void emitReturn()
+// implicit return, initializers hand back the new instance
+static void emitReturn(Parser *parser)
 {
-    emitByte(OP_NIL);
-    emitByte(OP_RETURN);
+    if (parser->compiler->type == TYPE_INITIALIZER)
+    {
+        emitBytes(parser, OP_GET_LOCAL, 0);
+    }
+    else
+    {
+        emitByte(parser, OP_NIL);
+    }
+
+    emitByte(parser, OP_RETURN);
 }
 
 // add literal and type cast index
-static uint8_t makeConstant(Value value)
+static uint8_t makeConstant(Parser *parser, Value value)
 {
-    int constant = addConstant(currentChunk(), value);
+    int constant = addConstant(currentChunk(parser), value);
 
     // ensure we don't exceed more than 256 constants
     if (constant > UINT8_MAX)
     {
-        error("Too many literals in one chunk.");
+        error(parser, "Too many literals in one chunk.");
         return 0;
     }
 
@@ -232,170 +267,316 @@ static uint8_t makeConstant(Value value)
 }
 
 // append byte instruction of literal value
-static void emitConstant(Value value)
+static void emitConstant(Parser *parser, Value value)
 {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
 }
 
 // after making the space, return to where we came from
 // reset the jump offset
-static void patchJump(int offset)
+static void patchJump(Parser *parser, int offset)
 {
-    int jump = currentChunk()->count - offset - 2;
+    int jump = currentChunk(parser)->count - offset - 2;
 
     if (jump > UINT16_MAX)
     {
-        error("This code body is too large. Try breaking this code into functions");
+        error(parser, "This code body is too large. Try breaking this code into functions");
     }
 
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+    currentChunk(parser)->code[offset] = (jump >> 8) & 0xff;
+    currentChunk(parser)->code[offset + 1] = jump & 0xff;
 }
 
 // todo: document
-static void initCompiler(Compiler *compiler, FunctionType type)
+static void initCompiler(Parser *parser, Compiler *compiler, FunctionType type)
 {
-    compiler->enclosing = current;
+    compiler->enclosing = parser->compiler;
     compiler->function = NULL;
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
-    compiler->function = newFunction();
-    current = compiler;
+    compiler->function = newFunction(parser->vm);
+    parser->compiler = compiler;
 
     if (type != TYPE_SCRIPT)
     {
-        current->function->name = copyString(
-            parser.previous.start, parser.previous.length);
+        parser->compiler->function->name = copyString(parser->vm, 
+            parser->previous.start, parser->previous.length);
     }
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = &parser->compiler->locals[parser->compiler->localCount++];
     local->depth = 0;
-    local->variable.start = "";
-    local->variable.length = 0;
+    local->isCaptured = false;
+
+    // methods keep their receiver in slot 0 under the name this
+    if (type == TYPE_METHOD || type == TYPE_INITIALIZER)
+    {
+        local->variable.start = "this";
+        local->variable.length = 4;
+    }
+    else
+    {
+        local->variable.start = "";
+        local->variable.length = 0;
+    }
 }
 
 // add return and debug
-static ObjFunction *endCompiler()
+static ObjFunction *endCompiler(Parser *parser)
 {
-    emitReturn();
+    emitReturn(parser);
 
-    ObjFunction *function = current->function;
+    ObjFunction *function = parser->compiler->function;
+    if (!parser->hadError)
+        function->maxSlots = maxStackDepth(&function->chunk, function->arity + 1);
 
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError)
+    if (!parser->hadError)
     {
-        disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
+        disassembleChunk(currentChunk(parser), function->name != NULL ? function->name->chars : "<script>");
     }
 #endif
 
-    current = current->enclosing;
+    parser->compiler = parser->compiler->enclosing;
     return function;
 }
 
 // one level deeper
-static void beginScope()
+static void beginScope(Parser *parser)
 {
-    current->scopeDepth++;
+    parser->compiler->scopeDepth++;
 }
 
 // discard local variables from locals array
 // todo: optimize with OP_POPN to remove multiple locals
-static void endScope()
+static void endScope(Parser *parser)
 {
-    current->scopeDepth--;
+    Compiler *compiler = parser->compiler;
+    compiler->scopeDepth--;
 
-    while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth)
+    while (compiler->localCount > 0 && compiler->locals[compiler->localCount - 1].depth > compiler->scopeDepth)
     {
-        emitByte(OP_POP);
-        current->localCount--;
+        // only captured locals pay for closing an upvalue
+        if (compiler->locals[compiler->localCount - 1].isCaptured)
+        {
+            emitByte(parser, OP_CLOSE_UPVALUE);
+        }
+        else
+        {
+            emitByte(parser, OP_POP);
+        }
+        compiler->localCount--;
     }
 }
 
 // function signatures for recursive functions
-static void expression();
-static void statement();
-static void declaration();
+static void expression(Parser *parser);
+static void statement(Parser *parser);
+static void declaration(Parser *parser);
 static ParseRule *getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser *parser, Precedence precedence);
 // todo: fix, removing this makes a bug
-static uint8_t identifierConstant(Token *name);
-static int resolveLocal(Compiler *compiler, Token *variable);
-static uint8_t argumentList();
+static uint8_t identifierConstant(Parser *parser, Token *name);
+static int resolveLocal(Parser *parser, Compiler *compiler, Token *variable);
+static int resolveUpvalue(Parser *parser, Compiler *compiler, Token *variable);
+static uint8_t argumentList(Parser *parser);
 
 // handle value op value expressions
-static void binary(bool canAssign)
+static void binary(Parser *parser, bool canAssign)
 {
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = parser->previous.type;
     ParseRule *rule = getRule(operatorType);
 
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));
 
     switch (operatorType)
     {
     case TOKEN_BANG_EQUAL:
-        emitBytes(OP_EQUAL, OP_NOT);
+        emitBytes(parser, OP_EQUAL, OP_NOT);
         break;
     case TOKEN_EQUAL_EQUAL:
-        emitByte(OP_EQUAL);
+        emitByte(parser, OP_EQUAL);
         break;
     case TOKEN_GREATER:
-        emitByte(OP_GREATER);
+        emitByte(parser, OP_GREATER);
         break;
     case TOKEN_GREATER_EQUAL:
-        emitBytes(OP_LESS, OP_NOT);
+        emitBytes(parser, OP_LESS, OP_NOT);
         break;
     case TOKEN_LESS:
-        emitByte(OP_LESS);
+        emitByte(parser, OP_LESS);
         break;
     case TOKEN_LESS_EQUAL:
-        emitBytes(OP_GREATER, OP_NOT);
+        emitBytes(parser, OP_GREATER, OP_NOT);
         break;
     case TOKEN_PLUS:
-        emitByte(OP_ADD);
+        emitByte(parser, OP_ADD);
         break;
     case TOKEN_MINUS:
-        emitByte(OP_SUBTRACT);
+        emitByte(parser, OP_SUBTRACT);
         break;
     case TOKEN_STAR:
-        emitByte(OP_MULTIPLY);
+        emitByte(parser, OP_MULTIPLY);
         break;
     case TOKEN_CARET:
-        emitByte(OP_EXPONENT);
+        emitByte(parser, OP_EXPONENT);
         break;
     case TOKEN_SLASH:
-        emitByte(OP_DIVIDE);
+        emitByte(parser, OP_DIVIDE);
         break;
     default:
         return;
     }
 }
 
+// property instructions carry a name and their own inline cache
+static void emitPropertyOp(Parser *parser, uint8_t instruction, uint8_t name)
+{
+    int cache = addPropertyCache(currentChunk(parser));
+
+    if (cache > UINT16_MAX)
+    {
+        error(parser, "Too many property accesses in one function.");
+    }
+
+    emitBytes(parser, instruction, name);
+    emitBytes(parser, (cache >> 8) & 0xff, cache & 0xff);
+}
+
+// method call, the name and argument count followed by its invoke cache
+static void emitInvoke(Parser *parser, uint8_t name, uint8_t argCount)
+{
+    int cache = addInvokeCache(currentChunk(parser));
+
+    if (cache > UINT16_MAX)
+    {
+        error(parser, "Too many method calls in one function.");
+    }
+
+    emitBytes(parser, OP_INVOKE, name);
+    emitByte(parser, argCount);
+    emitBytes(parser, (cache >> 8) & 0xff, cache & 0xff);
+}
+
 // todo: document
-static void call(bool canAssign)
+static void call(Parser *parser, bool canAssign)
 {
-    uint8_t argCount = argumentList();
-    emitBytes(OP_CALL, argCount);
+    uint8_t argCount = argumentList(parser);
+    emitBytes(parser, OP_CALL, argCount);
+}
+
+// list literal, items are left on the stack and gathered in one op
+static void list(Parser *parser, bool canAssign)
+{
+    int itemCount = 0;
+
+    if (!check(parser, TOKEN_RIGHT_BRACKET))
+    {
+        do
+        {
+            // allow a trailing comma
+            if (check(parser, TOKEN_RIGHT_BRACKET))
+                break;
+
+            expression(parser);
+            if (itemCount == UINT8_MAX)
+            {
+                error(parser, "Can't have more than 255 items in a list literal.");
+            }
+            itemCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expected ']' after list items.");
+    emitBytes(parser, OP_BUILD_LIST, (uint8_t)itemCount);
+}
+
+// map literal, keys and values alternate on the stack
+static void map(Parser *parser, bool canAssign)
+{
+    int pairCount = 0;
+
+    if (!check(parser, TOKEN_RIGHT_BRACE))
+    {
+        do
+        {
+            // allow a trailing comma
+            if (check(parser, TOKEN_RIGHT_BRACE))
+                break;
+
+            expression(parser);
+            consume(parser, TOKEN_COLON, "Expected ':' after map key.");
+            expression(parser);
+            if (pairCount == UINT8_MAX)
+            {
+                error(parser, "Can't have more than 255 entries in a map literal.");
+            }
+            pairCount++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACE, "Expected '}' after map entries.");
+    emitBytes(parser, OP_BUILD_MAP, (uint8_t)pairCount);
+}
+
+// read or assign an item: value[index] or value[index] = item
+static void subscript(Parser *parser, bool canAssign)
+{
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expected ']' after index.");
+
+    if (canAssign && match(parser, TOKEN_EQUAL))
+    {
+        expression(parser);
+        emitByte(parser, OP_INDEX_SET);
+    }
+    else
+    {
+        emitByte(parser, OP_INDEX_GET);
+    }
+}
+
+// read or assign a property: value.name or value.name = item
+static void dot(Parser *parser, bool canAssign)
+{
+    consume(parser, TOKEN_IDENTIFIER, "Expected property name after '.'.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
+
+    if (canAssign && match(parser, TOKEN_EQUAL))
+    {
+        expression(parser);
+        emitPropertyOp(parser, OP_SET_PROPERTY, name);
+    }
+    else if (match(parser, TOKEN_LEFT_PAREN))
+    {
+        // fused lookup and call, the receiver stays in the callee slot
+        uint8_t argCount = argumentList(parser);
+        emitInvoke(parser, name, argCount);
+    }
+    else
+    {
+        emitPropertyOp(parser, OP_GET_PROPERTY, name);
+    }
 }
 
 // handle nil and boolean keywords in pratt parser table
-static void literal(bool canAssign)
+static void literal(Parser *parser, bool canAssign)
 {
-    switch (parser.previous.type)
+    switch (parser->previous.type)
     {
     case TOKEN_NIL:
     {
-        emitByte(OP_NIL);
+        emitByte(parser, OP_NIL);
         break;
     }
     case TOKEN_TRUE:
     {
-        emitByte(OP_TRUE);
+        emitByte(parser, OP_TRUE);
         break;
     }
     case TOKEN_FALSE:
     {
-        emitByte(OP_FALSE);
+        emitByte(parser, OP_FALSE);
         break;
     }
     default:
@@ -404,90 +585,161 @@ static void literal(bool canAssign)
 }
 
 // handle expressions in parenthesis
-static void grouping(bool canAssign)
+static void grouping(Parser *parser, bool canAssign)
 {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expecting ')' after expression.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expecting ')' after expression.");
+}
+
+// value of a number token, literals without a fraction or exponent
+// become integers unless they are too large for one
+static Value numberValue(Parser *parser, Token *token)
+{
+    Value value;
+    if (!parseNumber(token->start, token->length, &value))
+    {
+        error(parser, "Invalid number literal.");
+        return INT_VAL(0);
+    }
+
+    return value;
 }
 
 // convert string token to number
-// todo: fix whacky stuff i did with numbers
-static void number(bool canAssign)
+static void number(Parser *parser, bool canAssign)
 {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    emitConstant(parser, numberValue(parser, &parser->previous));
 }
 
 // short circuit or
-static void or_(bool canAssign)
+static void or_(Parser *parser, bool canAssign)
 {
-    int elseJump = emitJump(OP_JUMP_IF_FALSE);
-    int endJump = emitJump(OP_JUMP);
+    int elseJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    int endJump = emitJump(parser, OP_JUMP);
 
-    patchJump(elseJump);
-    emitByte(OP_POP);
+    patchJump(parser, elseJump);
+    emitByte(parser, OP_POP);
 
-    parsePrecedence(PREC_OR);
-    patchJump(endJump);
+    parsePrecedence(parser, PREC_OR);
+    patchJump(parser, endJump);
 }
 
 // define constant of string from source
-static void string(bool canAssign)
+static void string(Parser *parser, bool canAssign)
 {
     // the +1 and -2 trim the quotation marks
-    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+    emitConstant(parser, OBJ_VAL(copyString(parser->vm, parser->previous.start + 1, parser->previous.length - 2)));
 }
 
-static void namedVariable(Token variable, bool canAssign)
+static void namedVariable(Parser *parser, Token variable, bool canAssign)
 {
     uint8_t getOp, setOp;
-    int arg = resolveLocal(current, &variable);
+    int arg = resolveLocal(parser, parser->compiler, &variable);
 
     if (arg != -1)
     {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
     }
+    else if ((arg = resolveUpvalue(parser, parser->compiler, &variable)) != -1)
+    {
+        getOp = OP_GET_UPVALUE;
+        setOp = OP_SET_UPVALUE;
+    }
     else
     {
-        arg = identifierConstant(&variable);
+        arg = identifierConstant(parser, &variable);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
-    if (canAssign && match(TOKEN_EQUAL))
+    if (canAssign && match(parser, TOKEN_EQUAL))
     {
-        expression();
-        emitBytes(setOp, (uint8_t)arg);
+        expression(parser);
+        emitBytes(parser, setOp, (uint8_t)arg);
     }
     else
     {
-        emitBytes(getOp, (uint8_t)arg);
+        emitBytes(parser, getOp, (uint8_t)arg);
     }
 }
 
 // identify variables
-static void variable(bool canAssign)
+static void variable(Parser *parser, bool canAssign)
+{
+    namedVariable(parser, parser->previous, canAssign);
+}
+
+// token for a name the compiler declares itself
+static Token syntheticToken(const char *text)
+{
+    Token token;
+    token.start = text;
+    token.length = (int)strlen(text);
+    return token;
+}
+
+// superclass method bound to this: super.name
+static void super_(Parser *parser, bool canAssign)
+{
+    if (parser->currentClass == NULL)
+    {
+        error(parser, "Can't use 'super' outside of a class.");
+    }
+    else if (!parser->currentClass->hasSuperclass)
+    {
+        error(parser, "Can't use 'super' in a class with no superclass.");
+    }
+
+    consume(parser, TOKEN_DOT, "Expected '.' after 'super'.");
+    consume(parser, TOKEN_IDENTIFIER, "Expected superclass method name.");
+    uint8_t name = identifierConstant(parser, &parser->previous);
+
+    namedVariable(parser, syntheticToken("this"), false);
+
+    if (match(parser, TOKEN_LEFT_PAREN))
+    {
+        // super calls resolve statically, so they need no cache
+        uint8_t argCount = argumentList(parser);
+        namedVariable(parser, syntheticToken("super"), false);
+        emitBytes(parser, OP_SUPER_INVOKE, name);
+        emitByte(parser, argCount);
+    }
+    else
+    {
+        namedVariable(parser, syntheticToken("super"), false);
+        emitBytes(parser, OP_GET_SUPER, name);
+    }
+}
+
+// the receiver, an ordinary local in slot 0 of a method
+static void this_(Parser *parser, bool canAssign)
 {
-    namedVariable(parser.previous, canAssign);
+    if (parser->currentClass == NULL)
+    {
+        error(parser, "Can't use 'this' outside of a class.");
+        return;
+    }
+
+    variable(parser, false);
 }
 
 // prefix expression
-static void unary(bool canAssign)
+static void unary(Parser *parser, bool canAssign)
 {
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = parser->previous.type;
 
     // compile operand
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
 
     // write op instruction
     switch (operatorType)
     {
     case TOKEN_BANG:
-        emitByte(OP_NOT);
+        emitByte(parser, OP_NOT);
         break;
     case TOKEN_MINUS:
-        emitByte(OP_NEGATE);
+        emitByte(parser, OP_NEGATE);
         break;
     default:
         // unreachable
@@ -496,44 +748,44 @@ static void unary(bool canAssign)
 }
 
 // compiles code in correct order rather than how things appear
-static void parsePrecedence(Precedence precedence)
+static void parsePrecedence(Parser *parser, Precedence precedence)
 {
     // read next token
-    advance();
+    advance(parser);
 
     // look up parse rule
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+    ParseFn prefixRule = getRule(parser->previous.type)->prefix;
 
     // user syntax error
     if (prefixRule == NULL)
     {
-        error("Expected an expression.");
+        error(parser, "Expected an expression.");
         return;
     }
 
     // compiles rest of prefix expression
     bool canAssign = precedence <= PREC_ASSIGNMENT;
-    prefixRule(canAssign);
+    prefixRule(parser, canAssign);
 
-    while (precedence <= getRule(parser.current.type)->precedence)
+    while (precedence <= getRule(parser->current.type)->precedence)
     {
-        advance();
+        advance(parser);
 
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule(canAssign);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        infixRule(parser, canAssign);
     }
 
     // report an error if equal token is not consumed
-    if (canAssign && match(TOKEN_EQUAL))
+    if (canAssign && match(parser, TOKEN_EQUAL))
     {
-        error("Invalid assignment target");
+        error(parser, "Invalid assignment target");
     }
 }
 
 // add to chunk constant table
-static uint8_t identifierConstant(Token *name)
+static uint8_t identifierConstant(Parser *parser, Token *name)
 {
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+    return makeConstant(parser, OBJ_VAL(copyString(parser->vm, name->start, name->length)));
 }
 
 // check if two identifier token names equate
@@ -545,7 +797,7 @@ static bool identifiersEqual(Token *a, Token *b)
 }
 
 // look for local variable
-static int resolveLocal(Compiler *compiler, Token *variable)
+static int resolveLocal(Parser *parser, Compiler *compiler, Token *variable)
 {
     for (int i = compiler->localCount - 1; i >= 0; i--)
     {
@@ -555,7 +807,7 @@ static int resolveLocal(Compiler *compiler, Token *variable)
         {
             if (local->depth == -1)
             {
-                error("Can't read local variable in initializer");
+                error(parser, "Can't read local variable in initializer");
             }
 
             return i;
@@ -565,128 +817,200 @@ static int resolveLocal(Compiler *compiler, Token *variable)
     return -1;
 }
 
+// reuse or record an upvalue, returns its index in the closure
+static int addUpvalue(Parser *parser, Compiler *compiler, uint8_t index, bool isLocal)
+{
+    int upvalueCount = compiler->function->upvalueCount;
+
+    // a function captures each variable once, however often it's used
+    for (int i = 0; i < upvalueCount; i++)
+    {
+        Upvalue *upvalue = &compiler->upvalues[i];
+        if (upvalue->index == index && upvalue->isLocal == isLocal)
+        {
+            return i;
+        }
+    }
+
+    if (upvalueCount == UINT8_COUNT)
+    {
+        error(parser, "Too many closure variables in function.");
+        return 0;
+    }
+
+    compiler->upvalues[upvalueCount].isLocal = isLocal;
+    compiler->upvalues[upvalueCount].index = index;
+    return compiler->function->upvalueCount++;
+}
+
+// look for the variable in the enclosing functions, each function in
+// between records an upvalue so the capture stays one level deep
+static int resolveUpvalue(Parser *parser, Compiler *compiler, Token *variable)
+{
+    if (compiler->enclosing == NULL)
+        return -1;
+
+    int local = resolveLocal(parser, compiler->enclosing, variable);
+    if (local != -1)
+    {
+        compiler->enclosing->locals[local].isCaptured = true;
+        return addUpvalue(parser, compiler, (uint8_t)local, true);
+    }
+
+    int upvalue = resolveUpvalue(parser, compiler->enclosing, variable);
+    if (upvalue != -1)
+    {
+        return addUpvalue(parser, compiler, (uint8_t)upvalue, false);
+    }
+
+    return -1;
+}
+
 // define a local variable to point to a token
-static void addLocal(Token name)
+static void addLocal(Parser *parser, Token name)
 {
     // todo: change this? its not a bad
-    if (current->localCount == UINT8_COUNT)
+    if (parser->compiler->localCount == UINT8_COUNT)
     {
-        error("Too many local variables.");
+        error(parser, "Too many local variables.");
         return;
     }
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = &parser->compiler->locals[parser->compiler->localCount++];
     local->variable = name;
     local->depth = -1;
+    local->isCaptured = false;
 }
 
 // add a variable to the scope, define its depth, bail if at
 // ground level 0
-static void declareVariable()
+static void declareVariable(Parser *parser)
 {
     // variable is a global at level 0
-    if (current->scopeDepth == 0)
+    if (parser->compiler->scopeDepth == 0)
         return;
 
     // create local variable
-    Token *currVar = &parser.previous;
+    Token *currVar = &parser->previous;
 
     // todo: refactor to not need -1
     // todo: faster approach than looping?
-    for (int i = current->localCount - 1; i >= 0; i--)
+    for (int i = parser->compiler->localCount - 1; i >= 0; i--)
     {
-        Local *local = &current->locals[i];
+        Local *local = &parser->compiler->locals[i];
 
-        if (local->depth != -1 && local->depth < current->scopeDepth)
+        if (local->depth != -1 && local->depth < parser->compiler->scopeDepth)
         {
             break;
         }
 
         if (identifiersEqual(currVar, &local->variable))
         {
-            error("Variable already defined");
+            error(parser, "Variable already defined");
         }
     }
 
-    addLocal(*currVar);
+    addLocal(parser, *currVar);
 }
 
 // requires next token to be an identifier
-static uint8_t parseVariable(const char *errorMessage)
+static uint8_t parseVariable(Parser *parser, const char *errorMessage)
 {
-    consume(TOKEN_IDENTIFIER, errorMessage);
+    consume(parser, TOKEN_IDENTIFIER, errorMessage);
 
-    declareVariable();
+    declareVariable(parser);
 
     // return dummy index for current scope
-    if (current->scopeDepth > 0)
+    if (parser->compiler->scopeDepth > 0)
         return 0;
 
-    return identifierConstant(&parser.previous);
+    return identifierConstant(parser, &parser->previous);
 }
 
 // mark variable or function as initalized
-static void markInitialized()
+static void markInitialized(Parser *parser)
 {
-    if (current->scopeDepth == 0)
+    if (parser->compiler->scopeDepth == 0)
         return;
 
-    current->locals[current->localCount - 1].depth = current->scopeDepth;
+    parser->compiler->locals[parser->compiler->localCount - 1].depth = parser->compiler->scopeDepth;
 }
 
 // op instruction to store initial value for the snew variable
 // make/mark variable available for use
-static void defineVariable(uint8_t global)
+static void defineVariable(Parser *parser, uint8_t global)
 {
-    if (current->scopeDepth > 0)
+    if (parser->compiler->scopeDepth > 0)
     {
-        markInitialized();
+        markInitialized(parser);
         return;
     }
 
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitBytes(parser, OP_DEFINE_GLOBAL, global);
 }
 
 // compile args while present, return number of them
-static uint8_t argumentList()
+static uint8_t argumentList(Parser *parser)
 {
     uint8_t argCount = 0;
 
-    if (!check(TOKEN_RIGHT_PAREN))
+    if (!check(parser, TOKEN_RIGHT_PAREN))
     {
         do
         {
-            expression();
+            expression(parser);
             if (argCount == 255)
             {
-                error("Can't have more than 255 arguments.");
+                error(parser, "Can't have more than 255 arguments.");
             }
             argCount++;
-        } while (match(TOKEN_COMMA));
+        } while (match(parser, TOKEN_COMMA));
     }
 
-    consume(TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
     return argCount;
 }
 
 // short circuit and
-static void and_(bool canAssign)
+static void and_(Parser *parser, bool canAssign)
 {
-    int endJump = emitJump(OP_JUMP_IF_FALSE);
+    int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
+
+    emitByte(parser, OP_POP);
+    parsePrecedence(parser, PREC_AND);
+
+    patchJump(parser, endJump);
+}
+
+// yield value, suspends the fiber running it. the expression evaluates to
+// whatever the fiber is resumed with
+static void yield(Parser *parser, bool canAssign)
+{
+    if (parser->compiler->type == TYPE_SCRIPT)
+    {
+        error(parser, "Can't yield from top-level code.");
+    }
 
-    emitByte(OP_POP);
-    parsePrecedence(PREC_AND);
+    // a bare yield hands back nil
+    if (check(parser, TOKEN_SEMICOLON) || check(parser, TOKEN_RIGHT_PAREN) || check(parser, TOKEN_RIGHT_BRACKET) ||
+        check(parser, TOKEN_RIGHT_BRACE) || check(parser, TOKEN_COMMA))
+        emitByte(parser, OP_NIL);
+    else
+        parsePrecedence(parser, PREC_ASSIGNMENT);
 
-    patchJump(endJump);
+    emitByte(parser, OP_YIELD);
 }
 
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
     [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE] = {map, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACKET] = {list, subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
-    [TOKEN_DOT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
+    [TOKEN_DOT] = {NULL, dot, PREC_CALL},
     [TOKEN_MINUS] = {unary, binary, PREC_TERM},
     [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
     [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
@@ -715,11 +1039,12 @@ ParseRule rules[] = {
     [TOKEN_OR] = {NULL, or_, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
     [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
-    [TOKEN_THIS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SUPER] = {super_, NULL, PREC_NONE},
+    [TOKEN_THIS] = {this_, NULL, PREC_NONE},
     [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
     [TOKEN_VAR] = {NULL, NULL, PREC_NONE},
     [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_YIELD] = {yield, NULL, PREC_NONE},
     [TOKEN_ERROR] = {NULL, NULL, PREC_NONE},
     [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
 };
@@ -731,314 +1056,517 @@ static ParseRule *getRule(TokenType type)
 }
 
 // compile expressions based on precedence
-static void expression()
+static void expression(Parser *parser)
 {
-    parsePrecedence(PREC_ASSIGNMENT);
+    parsePrecedence(parser, PREC_ASSIGNMENT);
 }
 
 // consume delcarations and statements in current block
-static void block()
+static void block(Parser *parser)
 {
-    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF))
     {
-        declaration();
+        declaration(parser);
     }
 
-    consume(TOKEN_RIGHT_BRACE, "Expected closing brace: }");
+    consume(parser, TOKEN_RIGHT_BRACE, "Expected closing brace: }");
 }
 
 // attaches code into a function
-static void function(FunctionType type)
+static void function(Parser *parser, FunctionType type)
 {
     Compiler compiler;
-    initCompiler(&compiler, type);
-    beginScope();
+    initCompiler(parser, &compiler, type);
+    beginScope(parser);
 
-    consume(TOKEN_LEFT_PAREN, "Expected '(' after function name.");
+    consume(parser, TOKEN_LEFT_PAREN, "Expected '(' after function name.");
 
     // parse parameters
-    if (!check(TOKEN_RIGHT_PAREN))
+    if (!check(parser, TOKEN_RIGHT_PAREN))
     {
         do
         {
-            current->function->arity++;
-            if (current->function->arity > 255)
+            parser->compiler->function->arity++;
+            if (parser->compiler->function->arity > 255)
             {
-                errorAtCurrent("Can't have more than 255 parameters");
+                errorAtCurrent(parser, "Can't have more than 255 parameters");
             }
 
-            uint8_t constant = parseVariable("Expected parameter name.");
-            defineVariable(constant);
-        } while (match(TOKEN_COMMA));
+            uint8_t constant = parseVariable(parser, "Expected parameter name.");
+            defineVariable(parser, constant);
+        } while (match(parser, TOKEN_COMMA));
     }
-    consume(TOKEN_RIGHT_PAREN, "Expected ')' after function parameters.");
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ')' after function parameters.");
 
     // new scope for functions block of code
-    consume(TOKEN_LEFT_BRACE, "Expected '{' before function body.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expected '{' before function body.");
 
     // compiles rest of code and closing brace
-    block();
+    block(parser);
+
+    ObjFunction *function = endCompiler(parser);
+
+    // functions that capture nothing stay plain constants,
+    // so calling them never allocates a closure
+    if (function->upvalueCount == 0)
+    {
+        emitBytes(parser, OP_CONSTANT, makeConstant(parser, OBJ_VAL(function)));
+        return;
+    }
+
+    emitBytes(parser, OP_CLOSURE, makeConstant(parser, OBJ_VAL(function)));
 
-    ObjFunction *function = endCompiler();
-    emitBytes(OP_CONSTANT, makeConstant(OBJ_VAL(function)));
+    for (int i = 0; i < function->upvalueCount; i++)
+    {
+        emitByte(parser, compiler.upvalues[i].isLocal ? 1 : 0);
+        emitByte(parser, compiler.upvalues[i].index);
+    }
+}
+
+// method body, stored on the class left on the stack
+static void method(Parser *parser)
+{
+    // methods may be written with or without func
+    match(parser, TOKEN_FUNC);
+
+    consume(parser, TOKEN_IDENTIFIER, "Expected method name.");
+    uint8_t constant = identifierConstant(parser, &parser->previous);
+
+    FunctionType type = TYPE_METHOD;
+    if (parser->previous.length == 4 && memcmp(parser->previous.start, "init", 4) == 0)
+    {
+        type = TYPE_INITIALIZER;
+    }
+
+    function(parser, type);
+    emitBytes(parser, OP_METHOD, constant);
+}
+
+// class Name < Superclass { methods }
+static void classDeclaration(Parser *parser)
+{
+    consume(parser, TOKEN_IDENTIFIER, "Expected class name.");
+    Token className = parser->previous;
+    uint8_t nameConstant = identifierConstant(parser, &parser->previous);
+    declareVariable(parser);
+
+    emitBytes(parser, OP_CLASS, nameConstant);
+    defineVariable(parser, nameConstant);
+
+    ClassCompiler classCompiler;
+    classCompiler.hasSuperclass = false;
+    classCompiler.enclosing = parser->currentClass;
+    parser->currentClass = &classCompiler;
+
+    if (match(parser, TOKEN_LESS))
+    {
+        consume(parser, TOKEN_IDENTIFIER, "Expected superclass name.");
+        variable(parser, false);
+
+        if (identifiersEqual(&className, &parser->previous))
+        {
+            error(parser, "A class can't inherit from itself.");
+        }
+
+        // methods reach the superclass through a local named super
+        beginScope(parser);
+        addLocal(parser, syntheticToken("super"));
+        defineVariable(parser, 0);
+
+        namedVariable(parser, className, false);
+        emitByte(parser, OP_INHERIT);
+        classCompiler.hasSuperclass = true;
+    }
+
+    // keep the class on the stack while methods are attached
+    namedVariable(parser, className, false);
+    consume(parser, TOKEN_LEFT_BRACE, "Expected '{' before class body.");
+
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF))
+    {
+        method(parser);
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACE, "Expected '}' after class body.");
+    emitByte(parser, OP_POP);
+
+    if (classCompiler.hasSuperclass)
+    {
+        endScope(parser);
+    }
+
+    parser->currentClass = parser->currentClass->enclosing;
 }
 
 // create & store user func in variable
-static void funcDeclaration()
+static void funcDeclaration(Parser *parser)
 {
-    uint8_t global = parseVariable("Expected a function name.");
-    markInitialized();
-    function(TYPE_FUNCTION);
-    defineVariable(global);
+    uint8_t global = parseVariable(parser, "Expected a function name.");
+    markInitialized(parser);
+    function(parser, TYPE_FUNCTION);
+    defineVariable(parser, global);
 }
 
 // get variable name and value, default to nil if value isn't present
-static void variableDeclaration()
+static void variableDeclaration(Parser *parser)
 {
-    uint8_t global = parseVariable("Expected variable name");
+    uint8_t global = parseVariable(parser, "Expected variable name");
 
-    if (match(TOKEN_EQUAL))
+    if (match(parser, TOKEN_EQUAL))
     {
-        expression();
+        expression(parser);
     }
     else
     {
-        emitByte(OP_NIL);
+        emitByte(parser, OP_NIL);
     }
 
     // todo: remove
     // expect var declaration to have semi colon
-    consume(TOKEN_SEMICOLON, "Expected ;");
+    consume(parser, TOKEN_SEMICOLON, "Expected ;");
 
-    defineVariable(global);
+    defineVariable(parser, global);
 }
 
 // expression followed by semi color
-static void expressionStatement()
+static void expressionStatement(Parser *parser)
 {
-    expression();
+    expression(parser);
     // todo: remove
-    // consume(TOKEN_SEMICOLON, "Expected ';'");
-    emitByte(OP_POP);
+    // consume(parser, TOKEN_SEMICOLON, "Expected ';'");
+    emitByte(parser, OP_POP);
+}
+
+// tokens after the initializer of a counted loop:
+// `i < bound; i = i + step)`
+#define COUNTED_LOOP_TOKENS 10
+
+// looks ahead for the rest of a canonical counted loop over the local in
+// counterSlot, with a number or local bound and a number step.
+// the scanner is rewound, nothing is consumed
+static bool isCountedLoop(Parser *parser, int counterSlot)
+{
+    Token *counter = &parser->compiler->locals[counterSlot].variable;
+    Token tokens[COUNTED_LOOP_TOKENS];
+    Scanner saved = parser->scanner;
+
+    tokens[0] = parser->current;
+    for (int i = 1; i < COUNTED_LOOP_TOKENS; i++)
+    {
+        tokens[i] = scanToken(&parser->scanner);
+    }
+
+    parser->scanner = saved;
+
+    static const TokenType pattern[COUNTED_LOOP_TOKENS] = {
+        TOKEN_IDENTIFIER, TOKEN_LESS, TOKEN_NUMBER, TOKEN_SEMICOLON,
+        TOKEN_IDENTIFIER, TOKEN_EQUAL, TOKEN_IDENTIFIER, TOKEN_PLUS,
+        TOKEN_NUMBER, TOKEN_RIGHT_PAREN};
+
+    for (int i = 0; i < COUNTED_LOOP_TOKENS; i++)
+    {
+        // the bound may also be a local, other than the counter
+        if (i == 2 && tokens[i].type == TOKEN_IDENTIFIER)
+        {
+            int slot = resolveLocal(parser, parser->compiler, &tokens[i]);
+            if (slot == -1 || slot == counterSlot)
+                return false;
+            continue;
+        }
+
+        if (tokens[i].type != pattern[i])
+            return false;
+    }
+
+    return identifiersEqual(&tokens[0], counter) &&
+           identifiersEqual(&tokens[4], counter) &&
+           identifiersEqual(&tokens[6], counter);
+}
+
+// rest of a loop isCountedLoop matched: the counter and bound stay in stack
+// slots, OP_FOR_RANGE tests them once on entry and OP_FOR_STEP increments,
+// tests and jumps back in one dispatch per iteration. a local bound is read
+// from its slot each time, so the loop behaves as the general form would
+static void countedLoop(Parser *parser, int counterSlot)
+{
+    // counter <
+    advance(parser);
+    advance(parser);
+
+    // a literal bound gets a hidden local no code can name
+    advance(parser);
+    int boundSlot;
+    if (parser->previous.type == TOKEN_NUMBER)
+    {
+        emitConstant(parser, numberValue(parser, &parser->previous));
+        addLocal(parser, syntheticToken(" bound"));
+        markInitialized(parser);
+        boundSlot = parser->compiler->localCount - 1;
+    }
+    else
+    {
+        boundSlot = resolveLocal(parser, parser->compiler, &parser->previous);
+    }
+
+    // ; counter = counter + step )
+    for (int i = 0; i < 6; i++)
+    {
+        advance(parser);
+    }
+    uint8_t step = makeConstant(parser, numberValue(parser, &parser->previous));
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
+
+    emitBytes(parser, OP_FOR_RANGE, (uint8_t)counterSlot);
+    emitByte(parser, (uint8_t)boundSlot);
+    int exitJump = currentChunk(parser)->count;
+    emitBytes(parser, 0xff, 0xff);
+
+    int bodyStart = currentChunk(parser)->count;
+    statement(parser);
+
+    addLoop(currentChunk(parser), bodyStart);
+    emitBytes(parser, OP_FOR_STEP, (uint8_t)counterSlot);
+    emitBytes(parser, (uint8_t)boundSlot, step);
+
+    int offset = currentChunk(parser)->count - bodyStart + 2;
+    if (offset > UINT16_MAX)
+        error(parser, "This loop's body is too large.");
+
+    emitBytes(parser, (offset >> 8) & 0xff, offset & 0xff);
+
+    patchJump(parser, exitJump);
+    endScope(parser);
 }
 
 // c style for loops
-static void forStatement()
+static void forStatement(Parser *parser)
 {
-    beginScope();
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'");
-    if (match(TOKEN_SEMICOLON))
+    beginScope(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'");
+    if (match(parser, TOKEN_SEMICOLON))
     {
         // No initializer.
     }
-    else if (match(TOKEN_VAR))
+    else if (match(parser, TOKEN_VAR))
     {
-        variableDeclaration();
+        variableDeclaration(parser);
+
+        int counterSlot = parser->compiler->localCount - 1;
+        if (isCountedLoop(parser, counterSlot))
+        {
+            countedLoop(parser, counterSlot);
+            return;
+        }
     }
     else
     {
-        expressionStatement();
+        expressionStatement(parser);
     }
 
-    int loopStart = currentChunk()->count;
+    int loopStart = currentChunk(parser)->count;
     int exitJump = -1;
-    if (!match(TOKEN_SEMICOLON))
+    if (!match(parser, TOKEN_SEMICOLON))
     {
-        expression();
-        consume(TOKEN_SEMICOLON, "Expect ';' after loop condition");
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition");
 
         // Jump out of the loop if the condition is false.
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP); // Condition.
+        exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+        emitByte(parser, OP_POP); // Condition.
     }
 
-    if (!match(TOKEN_RIGHT_PAREN))
+    if (!match(parser, TOKEN_RIGHT_PAREN))
     {
-        int bodyJump = emitJump(OP_JUMP);
-        int incrementStart = currentChunk()->count;
-        expression();
-        emitByte(OP_POP);
-        consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
+        int bodyJump = emitJump(parser, OP_JUMP);
+        int incrementStart = currentChunk(parser)->count;
+        expression(parser);
+        emitByte(parser, OP_POP);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
 
-        emitLoop(loopStart);
+        emitLoop(parser, loopStart);
         loopStart = incrementStart;
-        patchJump(bodyJump);
+        patchJump(parser, bodyJump);
     }
 
-    statement();
-    emitLoop(loopStart);
+    statement(parser);
+    emitLoop(parser, loopStart);
 
     if (exitJump != -1)
     {
-        patchJump(exitJump);
-        emitByte(OP_POP); // Condition.
+        patchJump(parser, exitJump);
+        emitByte(parser, OP_POP); // Condition.
     }
 
-    endScope();
+    endScope(parser);
 }
-/*static void forStatement()
+/*static void forStatement(parser)
 {
     // define a scope for this for loop to have local variables
-    beginScope();
+    beginScope(parser);
 
     // consume first statement, that inits a variable
-    consume(TOKEN_LEFT_PAREN, "Expected ( after for");
-    if (match(TOKEN_SEMICOLON))
+    consume(parser, TOKEN_LEFT_PAREN, "Expected ( after for");
+    if (match(parser, TOKEN_SEMICOLON))
     {
         // no initializer
     }
-    else if (match(TOKEN_VAR))
+    else if (match(parser, TOKEN_VAR))
     {
         // create variable
-        variableDeclaration();
+        variableDeclaration(parser);
     }
     else
     {
         // parse function
-        expressionStatement();
+        expressionStatement(parser);
     }
 
     // condition statement
-    int loopStart = currentChunk()->count;
+    int loopStart = currentChunk(parser)->count;
     int exitJump = -1;
-    if (!match(TOKEN_SEMICOLON))
+    if (!match(parser, TOKEN_SEMICOLON))
     {
-        expression();
-        consume(TOKEN_SEMICOLON, "Expected ; in loop condition");
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expected ; in loop condition");
 
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP);
+        exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+        emitByte(parser, OP_POP);
     }
 
-    consume(TOKEN_SEMICOLON, "Expected ;");
-    consume(TOKEN_RIGHT_PAREN, "Expected ) to close the for clause");
+    consume(parser, TOKEN_SEMICOLON, "Expected ;");
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ) to close the for clause");
 
     // increment statement
-    if (!match(TOKEN_RIGHT_PAREN))
+    if (!match(parser, TOKEN_RIGHT_PAREN))
     {
-        int codeJump = emitJump(OP_JUMP);
-        int incrementStart = currentChunk()->count;
-        expression();
-        emitByte(OP_POP);
-        consume(TOKEN_RIGHT_PAREN, "Expected ) to close the for clause");
+        int codeJump = emitJump(parser, OP_JUMP);
+        int incrementStart = currentChunk(parser)->count;
+        expression(parser);
+        emitByte(parser, OP_POP);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expected ) to close the for clause");
 
-        emitLoop(loopStart);
+        emitLoop(parser, loopStart);
         loopStart = incrementStart;
-        patchJump(codeJump);
+        patchJump(parser, codeJump);
     }
 
     // code in the for loop
-    statement();
-    emitLoop(loopStart);
+    statement(parser);
+    emitLoop(parser, loopStart);
 
     // patch the jump, remove conditional clause
     if (exitJump != -1)
     {
-        patchJump(exitJump);
-        emitByte(OP_POP);
+        patchJump(parser, exitJump);
+        emitByte(parser, OP_POP);
     }
 
     // exit loop
-    endScope();
+    endScope(parser);
 }*/
 
 // compile condition, backpatch for else/then
-static void ifStatement()
+static void ifStatement(Parser *parser)
 {
     // todo: do not parenthesis in code?
-    consume(TOKEN_LEFT_PAREN, "Expected ( after if.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expected ) after condition.");
+    consume(parser, TOKEN_LEFT_PAREN, "Expected ( after if.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ) after condition.");
 
     // if ... then move instruction pointer here
     // but also allocate space in the byte array for that code
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    int thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);
 
     // parse the statement
-    statement();
+    statement(parser);
 
     // find place for vm.ip
-    int elseJump = emitJump(OP_JUMP);
+    int elseJump = emitJump(parser, OP_JUMP);
 
     // return
-    patchJump(thenJump);
-    emitByte(OP_POP);
+    patchJump(parser, thenJump);
+    emitByte(parser, OP_POP);
 
     // there's a statement in the else clause
     // expressions are statements in blue
-    if (match(TOKEN_ELSE))
+    if (match(parser, TOKEN_ELSE))
     {
-        statement();
+        statement(parser);
     }
 
     // return
-    patchJump(elseJump);
+    patchJump(parser, elseJump);
 }
 
 // make op code to print user's values
-static void printStatement()
+static void printStatement(Parser *parser)
 {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emitByte(OP_PRINT);
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emitByte(parser, OP_PRINT);
 }
 
 // places the returned value (value or nil) onto the stack
 // along with return bytecode
-static void returnStatement()
+static void returnStatement(Parser *parser)
 {
-    if (current->type == TYPE_SCRIPT)
+    if (parser->compiler->type == TYPE_SCRIPT)
     {
-        error("Cannot return from top-level code.");
+        error(parser, "Cannot return from top-level code.");
     }
 
-    if (match(TOKEN_SEMICOLON))
+    if (match(parser, TOKEN_SEMICOLON))
     {
         // return nothing
-        emitReturn();
+        emitReturn(parser);
     }
     else
     {
-        expression();
-        consume(TOKEN_SEMICOLON, "Expected a ';' after return value");
-        emitByte(OP_RETURN);
+        if (parser->compiler->type == TYPE_INITIALIZER)
+        {
+            error(parser, "Can't return a value from an initializer.");
+        }
+
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expected a ';' after return value");
+        emitByte(parser, OP_RETURN);
     }
 }
 
 // while loop
-static void whileStatement()
+static void whileStatement(Parser *parser)
 {
-    int loopStart = currentChunk()->count;
+    int loopStart = currentChunk(parser)->count;
 
     // evaluate condition
-    consume(TOKEN_LEFT_PAREN, "Expected ( after while.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expected ) after while condition");
+    consume(parser, TOKEN_LEFT_PAREN, "Expected ( after while.");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expected ) after while condition");
 
     // skip the body if condition is false
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    int exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+    emitByte(parser, OP_POP);
 
     // eval inside code
-    statement();
-    emitLoop(loopStart);
+    statement(parser);
+    emitLoop(parser, loopStart);
 
     // return
-    patchJump(exitJump);
-    emitByte(OP_POP);
+    patchJump(parser, exitJump);
+    emitByte(parser, OP_POP);
 }
 
-static void synchronize()
+static void synchronize(Parser *parser)
 {
     // todo: remove
-    parser.panicMode = false;
-    while (parser.current.type != TOKEN_EOF)
+    parser->panicMode = false;
+    while (parser->current.type != TOKEN_EOF)
     {
-        if (parser.previous.type == TOKEN_SEMICOLON)
+        if (parser->previous.type == TOKEN_SEMICOLON)
             return;
 
-        switch (parser.current.type)
+        switch (parser->current.type)
         {
         case TOKEN_CLASS:
         case TOKEN_FUNC:
@@ -1053,88 +1581,96 @@ static void synchronize()
         default:; // nothing for now
         }
 
-        advance();
+        advance(parser);
     }
 }
 
 // supports variables or statements
-static void declaration()
+static void declaration(Parser *parser)
 {
-    if (match(TOKEN_FUNC))
+    if (match(parser, TOKEN_CLASS))
     {
-        funcDeclaration();
+        classDeclaration(parser);
     }
-    else if (match(TOKEN_VAR))
+    else if (match(parser, TOKEN_FUNC))
     {
-        variableDeclaration();
+        funcDeclaration(parser);
+    }
+    else if (match(parser, TOKEN_VAR))
+    {
+        variableDeclaration(parser);
     }
     else
     {
-        statement();
+        statement(parser);
     }
 
-    if (parser.panicMode)
-        synchronize();
+    if (parser->panicMode)
+        synchronize(parser);
 }
 
 // handles: funcs, prints, classes etc
-static void statement()
+static void statement(Parser *parser)
 {
     // programmer has a print statement
-    if (match(TOKEN_PRINT))
+    if (match(parser, TOKEN_PRINT))
     {
-        printStatement();
+        printStatement(parser);
     }
-    else if (match(TOKEN_FOR))
+    else if (match(parser, TOKEN_FOR))
     {
-        forStatement();
+        forStatement(parser);
     }
-    else if (match(TOKEN_IF))
+    else if (match(parser, TOKEN_IF))
     {
-        ifStatement();
+        ifStatement(parser);
     }
-    else if (match(TOKEN_RETURN))
+    else if (match(parser, TOKEN_RETURN))
     {
-        returnStatement();
+        returnStatement(parser);
     }
-    else if (match(TOKEN_WHILE))
+    else if (match(parser, TOKEN_WHILE))
     {
-        whileStatement();
+        whileStatement(parser);
     }
-    else if (match(TOKEN_LEFT_BRACE))
+    else if (match(parser, TOKEN_LEFT_BRACE))
     {
-        beginScope();
-        block();
-        endScope();
+        beginScope(parser);
+        block(parser);
+        endScope(parser);
     }
     else
     {
-        expressionStatement();
+        expressionStatement(parser);
     }
 }
 
 // compilation was successful if no error appeared
-ObjFunction *compile(const char *source)
+ObjFunction *compile(VM *vm, const char *source)
 {
     // make a scanner to generate tokens from code
-    initScanner(source);
+    Parser parser;
+    parser.vm = vm;
+    parser.compiler = NULL;
+    parser.currentClass = NULL;
+    initScanner(&parser.scanner, source);
     Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT);
+    initCompiler(&parser, &compiler, TYPE_SCRIPT);
 
     // initialize parser errors to false
     parser.hadError = false;
     parser.panicMode = false;
 
     // scan all tokens for the program
-    advance();
+    advance(&parser);
 
     // loop to gather all statements or expressions
-    while (!match(TOKEN_EOF))
+    while (!match(&parser, TOKEN_EOF))
     {
-        declaration();
+        declaration(&parser);
     }
 
     // finished compiling chunk
-    ObjFunction *function = endCompiler();
-    return !parser.hadError ? NULL : function;
-}
\ No newline at end of file
+    ObjFunction *function = endCompiler(&parser);
+    return parser.hadError ? NULL : function;
+}
@@ -4,6 +4,6 @@
 #include "vm.h"
 #include "object.h"
 
-ObjFunction *compile(const char *source);
+ObjFunction *compile(VM *vm, const char *source);
 
 #endif
\ No newline at end of file
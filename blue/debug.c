@@ -1,8 +1,21 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "object.h"
 #include "value.h"
 
+// values print through an output of their own, written out right away so
+// they land between the printf calls around them
+static void printDebugValue(Value value, const char *after)
+{
+    Output output;
+    initOutput(&output);
+    fflush(stdout);
+    printValue(&output, value);
+    writeOutputString(&output, after);
+    freeOutput(&output);
+}
+
 // go through bytecode array in chunk
 void disassembleChunk(Chunk *chunk, const char *name)
 {
@@ -29,6 +42,37 @@ static int byteInstruction(const char *variable, Chunk *chunk, int offset)
     return offset + 2;
 }
 
+// property instructions carry a name and an inline cache index
+static int propertyInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)(chunk->code[offset + 2] << 8);
+    cache |= chunk->code[offset + 3];
+    printf("%-16s %4d cache %d: ", name, constant, cache);
+    printDebugValue(chunk->constants.values[constant], "\n");
+    return offset + 4;
+}
+
+// method call with the name, argument count and, for OP_INVOKE, cache index
+static int invokeInstruction(const char *name, Chunk *chunk, int offset, bool cached)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    uint8_t argCount = chunk->code[offset + 2];
+    printf("%-16s (%d args) %4d ", name, argCount, constant);
+
+    if (cached)
+    {
+        uint16_t cache = (uint16_t)(chunk->code[offset + 3] << 8);
+        cache |= chunk->code[offset + 4];
+        printf("cache %d: ", cache);
+        printDebugValue(chunk->constants.values[constant], "\n");
+        return offset + 5;
+    }
+
+    printDebugValue(chunk->constants.values[constant], "\n");
+    return offset + 3;
+}
+
 // disassemble control flow
 static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
 {
@@ -38,12 +82,35 @@ static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
     return offset + 3;
 }
 
+// counted loop with counter and bound slots, step constant for OP_FOR_STEP
+static int forInstruction(const char *name, int sign, Chunk *chunk, int offset)
+{
+    uint8_t counter = chunk->code[offset + 1];
+    uint8_t bound = chunk->code[offset + 2];
+    printf("%-16s slot %d < slot %d", name, counter, bound);
+    offset += 3;
+
+    if (sign < 0)
+    {
+        uint8_t step = chunk->code[offset];
+        printf(" step ");
+        printDebugValue(chunk->constants.values[step], "");
+        offset++;
+    }
+
+    uint16_t jump = (uint16_t)(chunk->code[offset] << 8);
+    jump |= chunk->code[offset + 1];
+    offset += 2;
+    printf(" -> %d\n", offset + sign * jump);
+    return offset;
+}
+
 // print literal value and name of instruction
 static int constantInstruction(const char *name, Chunk *chunk, int offset)
 {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s   %4d: ", name, constant);
-    printlnValue(chunk->constants.values[constant]);
+    printDebugValue(chunk->constants.values[constant], "\n");
     return offset + 2;
 }
 
@@ -78,10 +145,20 @@ int disassembleInstruction(Chunk *chunk, int offset)
         return byteInstruction("OP_GET_LOCAL", chunk, offset);
     case OP_SET_LOCAL:
         return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_GET_UPVALUE:
+        return byteInstruction("OP_GET_UPVALUE", chunk, offset);
+    case OP_SET_UPVALUE:
+        return byteInstruction("OP_SET_UPVALUE", chunk, offset);
     case OP_GET_GLOBAL:
         return constantInstruction("OP_GET_GLOBAL", chunk, offset);
     case OP_DEFINE_GLOBAL:
         return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+    case OP_GET_PROPERTY:
+        return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
+    case OP_SET_PROPERTY:
+        return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
+    case OP_GET_SUPER:
+        return constantInstruction("OP_GET_SUPER", chunk, offset);
     case OP_EQUAL:
         return simpleInstruction("OP_EQUAL", offset);
     case OP_GREATER:
@@ -108,10 +185,54 @@ int disassembleInstruction(Chunk *chunk, int offset)
         return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
     case OP_LOOP:
         return jumpInstruction("OP_LOOP", -1, chunk, offset);
+    case OP_FOR_RANGE:
+        return forInstruction("OP_FOR_RANGE", 1, chunk, offset);
+    case OP_FOR_STEP:
+        return forInstruction("OP_FOR_STEP", -1, chunk, offset);
     case OP_CALL:
         return byteInstruction("OP_CALL", chunk, offset);
+    case OP_INVOKE:
+        return invokeInstruction("OP_INVOKE", chunk, offset, true);
+    case OP_SUPER_INVOKE:
+        return invokeInstruction("OP_SUPER_INVOKE", chunk, offset, false);
+    case OP_CLOSURE:
+    {
+        offset++;
+        uint8_t constant = chunk->code[offset++];
+        printf("%-16s %4d ", "OP_CLOSURE", constant);
+        printDebugValue(chunk->constants.values[constant], "\n");
+
+        // each upvalue is an isLocal flag and an index
+        ObjFunction *function = AS_FUNCTION(chunk->constants.values[constant]);
+        for (int i = 0; i < function->upvalueCount; i++)
+        {
+            int isLocal = chunk->code[offset++];
+            int index = chunk->code[offset++];
+            printf("%04d      |                     %s %d\n", offset - 2, isLocal ? "local" : "upvalue", index);
+        }
+
+        return offset;
+    }
+    case OP_CLOSE_UPVALUE:
+        return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+    case OP_BUILD_LIST:
+        return byteInstruction("OP_BUILD_LIST", chunk, offset);
+    case OP_BUILD_MAP:
+        return byteInstruction("OP_BUILD_MAP", chunk, offset);
+    case OP_INDEX_GET:
+        return simpleInstruction("OP_INDEX_GET", offset);
+    case OP_INDEX_SET:
+        return simpleInstruction("OP_INDEX_SET", offset);
     case OP_RETURN:
         return simpleInstruction("OP_RETURN", offset);
+    case OP_YIELD:
+        return simpleInstruction("OP_YIELD", offset);
+    case OP_CLASS:
+        return constantInstruction("OP_CLASS", chunk, offset);
+    case OP_INHERIT:
+        return simpleInstruction("OP_INHERIT", offset);
+    case OP_METHOD:
+        return constantInstruction("OP_METHOD", chunk, offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
@@ -126,8 +247,7 @@ void printStack(Value stack[], Value *stackTop)
     for (Value *slot = stack; slot < stackTop; slot++)
     {
         printf("[ ");
-        printValue(*slot);
-        printf(" ]");
+        printDebugValue(*slot, " ]");
     }
 
     printf("\n");
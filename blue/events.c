@@ -0,0 +1,997 @@
+// syscall, epoll, eventfd and MAP_POPULATE are outside strict ISO C
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+#include "events.h"
+#include "memory.h"
+#include "object.h"
+
+#ifdef BLUE_THREADS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+typedef enum
+{
+    IO_READ,
+    IO_WRITE,
+} IoType;
+
+// one read or write, from submission until its waiter has the result
+typedef struct IoOperation
+{
+    struct IoOperation *next;
+    struct EventLoop *loop;
+
+    IoType type;
+    int fd;
+
+    // read into or written from, owned by the operation
+    char *buffer;
+    int length;
+
+    // bytes moved so far, a write goes on until all of them are
+    int done;
+
+    // errno once it failed, 0 otherwise
+    int error;
+
+    // fiber to resume or function to call with the result
+    Value waiter;
+} IoOperation;
+
+// first in, first out list of operations
+typedef struct
+{
+    IoOperation *head;
+    IoOperation *tail;
+} IoQueue;
+
+static void queuePush(IoQueue *queue, IoOperation *operation)
+{
+    operation->next = NULL;
+    if (queue->tail == NULL)
+        queue->head = operation;
+    else
+        queue->tail->next = operation;
+    queue->tail = operation;
+}
+
+static IoOperation *queuePop(IoQueue *queue)
+{
+    IoOperation *operation = queue->head;
+    if (operation != NULL)
+    {
+        queue->head = operation->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+    }
+    return operation;
+}
+
+// move all of from onto the end of to
+static void queueTakeAll(IoQueue *to, IoQueue *from)
+{
+    if (from->head == NULL)
+        return;
+
+    if (to->tail == NULL)
+        to->head = from->head;
+    else
+        to->tail->next = from->head;
+    to->tail = from->tail;
+    from->head = NULL;
+    from->tail = NULL;
+}
+
+static void freeOperation(IoOperation *operation)
+{
+    FREE_ARRAY(char, operation->buffer, operation->length + 1);
+    FREE(IoOperation, operation);
+}
+
+// one blocking read, or a write of everything left
+static void runBlocking(IoOperation *operation)
+{
+    while (operation->done < operation->length)
+    {
+        char *at = operation->buffer + operation->done;
+        size_t count = (size_t)(operation->length - operation->done);
+        ssize_t moved = operation->type == IO_READ ? read(operation->fd, at, count) : write(operation->fd, at, count);
+
+        if (moved < 0 && errno == EINTR)
+            continue;
+
+        if (moved < 0)
+        {
+            operation->error = errno;
+            return;
+        }
+
+        operation->done += (int)moved;
+        if (operation->type == IO_READ || moved == 0)
+            return;
+    }
+}
+
+#ifdef __linux__
+
+// the rings shared with the kernel. this thread is the only submitter
+// and the only reaper, the kernel is the other side of each ring
+typedef struct
+{
+    int fd;
+
+    _Atomic unsigned *sqHead;
+    _Atomic unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+
+    _Atomic unsigned *cqHead;
+    _Atomic unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned cqEntries;
+
+    // the kernel keeps completions the queue has no room for, so more
+    // operations can be in flight than it holds
+    bool noDrop;
+
+    // written to the ring but not yet handed to the kernel
+    unsigned unsubmitted;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+} Uring;
+
+// submission queue entries, the completion queue gets twice as many
+#define URING_ENTRIES 256
+
+// most events one epoll_wait hands back
+#define EPOLL_EVENTS 64
+
+#endif
+
+typedef enum
+{
+    BACKEND_URING,
+    BACKEND_EPOLL,
+    BACKEND_POOL,
+} Backend;
+
+struct EventLoop
+{
+    Backend backend;
+
+    // submitted and not yet handed to their waiters
+    int pending;
+
+    // done, waiting for runEventLoop to hand them over
+    IoQueue finished;
+
+#ifdef __linux__
+    Uring uring;
+
+    // operations in the kernel, without noDrop never more than the
+    // completion queue holds
+    unsigned inFlight;
+
+    // waiting for room in the rings
+    IoQueue backlog;
+
+    int epoll;
+
+    // pool threads wake epoll_wait through this
+    int wakeFd;
+
+    // the operation epoll watches each descriptor for, by descriptor.
+    // it watches a descriptor for one at a time, the others wait parked
+    IoOperation **watching;
+    int watchingCapacity;
+    IoQueue parked;
+#endif
+
+    // finished by pool threads, taken under the lock
+    pthread_mutex_t lock;
+    pthread_cond_t poolFinished;
+    IoQueue poolDone;
+
+    // operations on the pool right now. a loop the vm dropped is freed by
+    // the thread finishing its last one
+    int poolOperations;
+    bool abandoned;
+};
+
+// blocking operations run on threads shared by every loop. a read of a
+// pipe holds its thread until data comes, so a thread is added whenever
+// a job finds none idle, up to a limit past which jobs wait their turn
+#define IO_THREADS_MAX 64
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    IoQueue jobs;
+    int queued;
+    int threads;
+    int idle;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {NULL, NULL}, 0, 0, 0};
+
+static void destroyLoop(EventLoop *loop);
+
+static void poolFinish(IoOperation *operation)
+{
+    EventLoop *loop = operation->loop;
+    pthread_mutex_lock(&loop->lock);
+    loop->poolOperations--;
+
+    if (loop->abandoned)
+    {
+        freeOperation(operation);
+        bool last = loop->poolOperations == 0;
+        pthread_mutex_unlock(&loop->lock);
+        if (last)
+            destroyLoop(loop);
+        return;
+    }
+
+    queuePush(&loop->poolDone, operation);
+    pthread_cond_signal(&loop->poolFinished);
+
+#ifdef __linux__
+    // under the lock, the vm can't free the loop in between
+    if (loop->wakeFd >= 0)
+    {
+        uint64_t one = 1;
+        ssize_t written = write(loop->wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+#endif
+    pthread_mutex_unlock(&loop->lock);
+}
+
+static void *ioThread(void *unused)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&pool.lock);
+        pool.idle++;
+        while (pool.jobs.head == NULL)
+            pthread_cond_wait(&pool.ready, &pool.lock);
+        pool.idle--;
+        pool.queued--;
+        IoOperation *operation = queuePop(&pool.jobs);
+        pthread_mutex_unlock(&pool.lock);
+
+        runBlocking(operation);
+        poolFinish(operation);
+    }
+
+    return unused;
+}
+
+static void submitToPool(EventLoop *loop, IoOperation *operation)
+{
+    pthread_mutex_lock(&loop->lock);
+    loop->poolOperations++;
+    pthread_mutex_unlock(&loop->lock);
+
+    pthread_mutex_lock(&pool.lock);
+    queuePush(&pool.jobs, operation);
+    pool.queued++;
+
+    // jobs queued before this one may be about to take every idle thread
+    pthread_t thread;
+    if (pool.queued > pool.idle && pool.threads < IO_THREADS_MAX && pthread_create(&thread, NULL, ioThread, NULL) == 0)
+    {
+        pthread_detach(thread);
+        pool.threads++;
+    }
+
+    pthread_cond_signal(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+#ifdef __linux__
+
+static int uringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static void *mapRing(int fd, size_t size, off_t offset)
+{
+    void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+static void closeUring(Uring *ring)
+{
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != NULL && ring->cqRing != ring->sqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing != NULL)
+        munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+// false if the kernel lacks io_uring, or it is switched off
+static bool openUring(Uring *ring)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = uringSetup(URING_ENTRIES, &params);
+    if (ring->fd < 0)
+        return false;
+
+    // reads and writes at offset -1 go through the file position, like
+    // read and write do, which pipes need and files expect
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(ring->fd);
+        return false;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mapRing(ring->fd, ring->sqRingSize, IORING_OFF_SQ_RING);
+    if (ring->sqRing != NULL && (params.features & IORING_FEAT_SINGLE_MMAP))
+        ring->cqRing = ring->sqRing;
+    else if (ring->sqRing != NULL)
+        ring->cqRing = mapRing(ring->fd, ring->cqRingSize, IORING_OFF_CQ_RING);
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (ring->cqRing != NULL)
+        ring->sqes = mapRing(ring->fd, ring->sqesSize, IORING_OFF_SQES);
+
+    if (ring->sqes == NULL)
+    {
+        closeUring(ring);
+        return false;
+    }
+
+    char *sq = ring->sqRing;
+    ring->sqHead = (_Atomic unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+
+    char *cq = ring->cqRing;
+    ring->cqHead = (_Atomic unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->cqEntries = params.cq_entries;
+    ring->noDrop = (params.features & IORING_FEAT_NODROP) != 0;
+    return true;
+}
+
+// hand what the ring holds to the kernel, waiting for a completion too
+static void enterUring(Uring *ring, bool wait)
+{
+    for (;;)
+    {
+        int submitted = uringEnter(ring->fd, ring->unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0)
+        {
+            ring->unsubmitted -= (unsigned)submitted;
+            return;
+        }
+
+        if (errno != EINTR)
+            return;
+    }
+}
+
+// false if the rings have no room for it yet
+static bool uringPrepare(EventLoop *loop, IoOperation *operation)
+{
+    Uring *ring = &loop->uring;
+    if (!ring->noDrop && loop->inFlight >= ring->cqEntries)
+        return false;
+
+    if (ring->unsubmitted == ring->sqEntries)
+        enterUring(ring, false);
+    if (ring->unsubmitted == ring->sqEntries)
+        return false;
+
+    unsigned tail = atomic_load_explicit(ring->sqTail, memory_order_relaxed);
+    unsigned index = tail & ring->sqMask;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = operation->type == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = operation->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(operation->buffer + operation->done);
+    sqe->len = (uint32_t)(operation->length - operation->done);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = (uint64_t)(uintptr_t)operation;
+
+    ring->sqArray[index] = index;
+    atomic_store_explicit(ring->sqTail, tail + 1, memory_order_release);
+    ring->unsubmitted++;
+    loop->inFlight++;
+    return true;
+}
+
+// operations waiting for room keep their order
+static void submitToUring(EventLoop *loop, IoOperation *operation)
+{
+    if (loop->backlog.head != NULL || !uringPrepare(loop, operation))
+        queuePush(&loop->backlog, operation);
+}
+
+static void reapUring(EventLoop *loop)
+{
+    Uring *ring = &loop->uring;
+    enterUring(ring, true);
+
+    unsigned head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(ring->cqTail, memory_order_acquire);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+        IoOperation *operation = (IoOperation *)(uintptr_t)cqe->user_data;
+        loop->inFlight--;
+
+        if (cqe->res < 0)
+        {
+            operation->error = -cqe->res;
+            queuePush(&loop->finished, operation);
+            continue;
+        }
+
+        operation->done += cqe->res;
+
+        // a short write goes back in for the rest
+        if (operation->type == IO_WRITE && cqe->res > 0 && operation->done < operation->length)
+            queuePush(&loop->backlog, operation);
+        else
+            queuePush(&loop->finished, operation);
+    }
+
+    atomic_store_explicit(ring->cqHead, head, memory_order_release);
+
+    while (loop->backlog.head != NULL && uringPrepare(loop, loop->backlog.head))
+        queuePop(&loop->backlog);
+}
+
+// cancel everything in flight and wait for the kernel to give each one
+// back, false if it can't cancel them all at once
+static bool cancelUring(EventLoop *loop)
+{
+#ifdef IORING_ASYNC_CANCEL_ANY
+    Uring *ring = &loop->uring;
+    if (loop->inFlight == 0)
+        return true;
+
+    if (ring->unsubmitted == ring->sqEntries)
+        enterUring(ring, false);
+    if (ring->unsubmitted == ring->sqEntries)
+        return false;
+
+    unsigned tail = atomic_load_explicit(ring->sqTail, memory_order_relaxed);
+    unsigned index = tail & ring->sqMask;
+
+    // user_data 0 marks the cancel's own completion
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+
+    ring->sqArray[index] = index;
+    atomic_store_explicit(ring->sqTail, tail + 1, memory_order_release);
+    ring->unsubmitted++;
+
+    bool cancelled = false;
+    while (loop->inFlight > 0 || !cancelled)
+    {
+        enterUring(ring, true);
+
+        unsigned head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+        unsigned last = atomic_load_explicit(ring->cqTail, memory_order_acquire);
+        for (; head != last; head++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+            if (cqe->user_data != 0)
+            {
+                freeOperation((IoOperation *)(uintptr_t)cqe->user_data);
+                loop->inFlight--;
+                continue;
+            }
+
+            // an old kernel that only cancels by user_data
+            if (cqe->res < 0 && cqe->res != -ENOENT)
+            {
+                atomic_store_explicit(ring->cqHead, head + 1, memory_order_release);
+                return false;
+            }
+            cancelled = true;
+        }
+
+        atomic_store_explicit(ring->cqHead, head, memory_order_release);
+    }
+
+    return true;
+#else
+    return loop->inFlight == 0;
+#endif
+}
+
+static bool openEpoll(EventLoop *loop)
+{
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll < 0)
+        return false;
+
+    loop->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (loop->wakeFd < 0 || epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->wakeFd, &event) < 0)
+    {
+        if (loop->wakeFd >= 0)
+            close(loop->wakeFd);
+        close(loop->epoll);
+        loop->wakeFd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+static void submitToEpoll(EventLoop *loop, IoOperation *operation)
+{
+    struct epoll_event event;
+    event.events = (operation->type == IO_READ ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+    event.data.ptr = operation;
+
+    if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, operation->fd, &event) == 0)
+    {
+        if (operation->fd >= loop->watchingCapacity)
+        {
+            int oldCapacity = loop->watchingCapacity;
+            loop->watchingCapacity = GROW_CAPACITY(operation->fd);
+            loop->watching = GROW_ARRAY(IoOperation *, loop->watching, oldCapacity, loop->watchingCapacity);
+            memset(loop->watching + oldCapacity, 0, sizeof(IoOperation *) * (loop->watchingCapacity - oldCapacity));
+        }
+
+        loop->watching[operation->fd] = operation;
+        return;
+    }
+
+    if (errno == EEXIST)
+    {
+        queuePush(&loop->parked, operation);
+    }
+    else if (errno == EPERM)
+    {
+        // regular files are always ready to epoll, they block on threads
+        submitToPool(loop, operation);
+    }
+    else
+    {
+        operation->error = errno;
+        queuePush(&loop->finished, operation);
+    }
+}
+
+// one step of an operation epoll says can go ahead, true once finished.
+// a ready pipe takes PIPE_BUF bytes without blocking, more may block
+static bool stepReady(IoOperation *operation)
+{
+    char *at = operation->buffer + operation->done;
+    size_t count = (size_t)(operation->length - operation->done);
+    ssize_t moved;
+
+    if (operation->type == IO_READ)
+        moved = read(operation->fd, at, count);
+    else
+        moved = write(operation->fd, at, count < PIPE_BUF ? count : PIPE_BUF);
+
+    if (moved < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR)
+            return false;
+
+        operation->error = errno;
+        return true;
+    }
+
+    operation->done += (int)moved;
+    return operation->type == IO_READ || moved == 0 || operation->done == operation->length;
+}
+
+// the next parked operation on fd gets its turn
+static void unpark(EventLoop *loop, int fd)
+{
+    IoOperation *previous = NULL;
+    for (IoOperation *operation = loop->parked.head; operation != NULL; operation = operation->next)
+    {
+        if (operation->fd != fd)
+        {
+            previous = operation;
+            continue;
+        }
+
+        if (previous == NULL)
+            loop->parked.head = operation->next;
+        else
+            previous->next = operation->next;
+        if (loop->parked.tail == operation)
+            loop->parked.tail = previous;
+
+        submitToEpoll(loop, operation);
+        return;
+    }
+}
+
+static void pollEpoll(EventLoop *loop)
+{
+    struct epoll_event events[EPOLL_EVENTS];
+    int count = epoll_wait(loop->epoll, events, EPOLL_EVENTS, -1);
+
+    for (int i = 0; i < count; i++)
+    {
+        IoOperation *operation = events[i].data.ptr;
+        if (operation == NULL)
+        {
+            uint64_t wakes;
+            ssize_t drained = read(loop->wakeFd, &wakes, sizeof(wakes));
+            (void)drained;
+            continue;
+        }
+
+        if (!stepReady(operation))
+        {
+            events[i].events = (operation->type == IO_READ ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+            epoll_ctl(loop->epoll, EPOLL_CTL_MOD, operation->fd, &events[i]);
+            continue;
+        }
+
+        epoll_ctl(loop->epoll, EPOLL_CTL_DEL, operation->fd, NULL);
+        loop->watching[operation->fd] = NULL;
+        queuePush(&loop->finished, operation);
+        unpark(loop, operation->fd);
+    }
+}
+
+#endif
+
+static EventLoop *createLoop()
+{
+    EventLoop *loop = ALLOCATE(EventLoop, 1);
+    loop->pending = 0;
+    loop->finished = (IoQueue){NULL, NULL};
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->poolFinished, NULL);
+    loop->poolDone = (IoQueue){NULL, NULL};
+    loop->poolOperations = 0;
+    loop->abandoned = false;
+    loop->backend = BACKEND_POOL;
+
+#ifdef __linux__
+    loop->inFlight = 0;
+    loop->backlog = (IoQueue){NULL, NULL};
+    loop->watching = NULL;
+    loop->watchingCapacity = 0;
+    loop->parked = (IoQueue){NULL, NULL};
+    loop->epoll = -1;
+    loop->wakeFd = -1;
+    loop->uring.fd = -1;
+
+    const char *choice = getenv("BLUE_IO");
+    bool any = choice == NULL || choice[0] == '\0';
+    if ((any || strcmp(choice, "uring") == 0) && openUring(&loop->uring))
+        loop->backend = BACKEND_URING;
+    else if ((any || strcmp(choice, "uring") == 0 || strcmp(choice, "epoll") == 0) && openEpoll(loop))
+        loop->backend = BACKEND_EPOLL;
+#endif
+
+    return loop;
+}
+
+static void destroyLoop(EventLoop *loop)
+{
+    pthread_mutex_destroy(&loop->lock);
+    pthread_cond_destroy(&loop->poolFinished);
+    FREE(EventLoop, loop);
+}
+
+static EventLoop *eventLoop(VM *vm)
+{
+    if (vm->eventLoop == NULL)
+        vm->eventLoop = createLoop();
+    return vm->eventLoop;
+}
+
+static void submit(VM *vm, IoType type, int fd, char *buffer, int length, Value waiter)
+{
+    EventLoop *loop = eventLoop(vm);
+    IoOperation *operation = ALLOCATE(IoOperation, 1);
+    operation->next = NULL;
+    operation->loop = loop;
+    operation->type = type;
+    operation->fd = fd;
+    operation->buffer = buffer;
+    operation->length = length;
+    operation->done = 0;
+    operation->error = 0;
+    operation->waiter = waiter;
+    loop->pending++;
+
+    switch (loop->backend)
+    {
+#ifdef __linux__
+    case BACKEND_URING:
+        submitToUring(loop, operation);
+        break;
+    case BACKEND_EPOLL:
+        submitToEpoll(loop, operation);
+        break;
+#endif
+    default:
+        submitToPool(loop, operation);
+        break;
+    }
+}
+
+bool ioRead(VM *vm, int fd, int length, Value waiter)
+{
+    submit(vm, IO_READ, fd, ALLOCATE(char, length + 1), length, waiter);
+    return true;
+}
+
+bool ioWrite(VM *vm, int fd, const char *bytes, int length, Value waiter)
+{
+    char *buffer = ALLOCATE(char, length + 1);
+    memcpy(buffer, bytes, (size_t)length);
+    submit(vm, IO_WRITE, fd, buffer, length, waiter);
+    return true;
+}
+
+// block until at least one operation has finished
+static void waitForCompletions(EventLoop *loop)
+{
+    switch (loop->backend)
+    {
+#ifdef __linux__
+    case BACKEND_URING:
+        reapUring(loop);
+        break;
+    case BACKEND_EPOLL:
+        pollEpoll(loop);
+        pthread_mutex_lock(&loop->lock);
+        queueTakeAll(&loop->finished, &loop->poolDone);
+        pthread_mutex_unlock(&loop->lock);
+        break;
+#endif
+    default:
+        pthread_mutex_lock(&loop->lock);
+        while (loop->poolDone.head == NULL)
+            pthread_cond_wait(&loop->poolFinished, &loop->lock);
+        queueTakeAll(&loop->finished, &loop->poolDone);
+        pthread_mutex_unlock(&loop->lock);
+        break;
+    }
+}
+
+// the operation's result as the waiter sees it, the buffer goes with it
+static Value takeResult(VM *vm, IoOperation *operation)
+{
+    if (operation->error != 0)
+        return NIL_VAL;
+
+    if (operation->type == IO_WRITE)
+        return INT_VAL(operation->done);
+
+    // the string keeps only the bytes that arrived
+    int length = operation->done;
+    char *chars = GROW_ARRAY(char, operation->buffer, operation->length + 1, length + 1);
+    chars[length] = '\0';
+    operation->buffer = NULL;
+    operation->length = -1;
+    return OBJ_VAL(takeString(vm, chars, length));
+}
+
+static bool deliver(VM *vm, Value waiter, Value result)
+{
+    Value ignored;
+    if (IS_FIBER(waiter))
+    {
+        // the read or write call it is stopped in evaluates to the result
+        AS_FIBER(waiter)->state = FIBER_SUSPENDED;
+        return resumeFiber(vm, AS_FIBER(waiter), 1, &result, &ignored);
+    }
+
+    return interpretCall(vm, waiter, 1, &result, &ignored) == INTERPRET_OK;
+}
+
+bool runEventLoop(VM *vm)
+{
+    EventLoop *loop = vm->eventLoop;
+    if (loop == NULL)
+        return true;
+
+    while (loop->pending > 0)
+    {
+        if (loop->finished.head == NULL)
+            waitForCompletions(loop);
+
+        IoOperation *operation;
+        while ((operation = queuePop(&loop->finished)) != NULL)
+        {
+            loop->pending--;
+            Value waiter = operation->waiter;
+            Value result = takeResult(vm, operation);
+            freeOperation(operation);
+
+            if (!deliver(vm, waiter, result))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void freeEventLoop(VM *vm)
+{
+    EventLoop *loop = vm->eventLoop;
+    if (loop == NULL)
+        return;
+    vm->eventLoop = NULL;
+
+    IoOperation *operation;
+    while ((operation = queuePop(&loop->finished)) != NULL)
+        freeOperation(operation);
+
+#ifdef __linux__
+    while ((operation = queuePop(&loop->backlog)) != NULL)
+        freeOperation(operation);
+    while ((operation = queuePop(&loop->parked)) != NULL)
+        freeOperation(operation);
+
+    // if they can't be cancelled, the kernel may still write into buffers
+    // of operations in the ring, so those are left allocated
+    if (loop->backend == BACKEND_URING)
+    {
+        cancelUring(loop);
+        closeUring(&loop->uring);
+    }
+
+    for (int fd = 0; fd < loop->watchingCapacity; fd++)
+    {
+        if (loop->watching[fd] != NULL)
+            freeOperation(loop->watching[fd]);
+    }
+    FREE_ARRAY(IoOperation *, loop->watching, loop->watchingCapacity);
+
+    if (loop->epoll >= 0)
+        close(loop->epoll);
+#endif
+
+    pthread_mutex_lock(&loop->lock);
+    while ((operation = queuePop(&loop->poolDone)) != NULL)
+        freeOperation(operation);
+
+#ifdef __linux__
+    if (loop->wakeFd >= 0)
+        close(loop->wakeFd);
+    loop->wakeFd = -1;
+#endif
+
+    // pool threads still running operations free the loop after the last
+    loop->abandoned = true;
+    bool idle = loop->poolOperations == 0;
+    pthread_mutex_unlock(&loop->lock);
+
+    if (idle)
+        destroyLoop(loop);
+}
+
+int ioOpen(const char *path, const char *mode)
+{
+    int flags;
+    switch (mode[0])
+    {
+    case 'r':
+        flags = O_RDONLY;
+        break;
+    case 'w':
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+        break;
+    case 'a':
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+        break;
+    default:
+        return -1;
+    }
+
+    return open(path, flags | O_CLOEXEC, 0666);
+}
+
+bool ioPipe(int fds[2])
+{
+    return pipe(fds) == 0;
+}
+
+bool ioClose(int fd)
+{
+    return close(fd) == 0;
+}
+
+#else
+
+bool ioRead(VM *vm, int fd, int length, Value waiter)
+{
+    return false;
+}
+
+bool ioWrite(VM *vm, int fd, const char *bytes, int length, Value waiter)
+{
+    return false;
+}
+
+bool runEventLoop(VM *vm)
+{
+    return true;
+}
+
+void freeEventLoop(VM *vm)
+{
+}
+
+int ioOpen(const char *path, const char *mode)
+{
+    return -1;
+}
+
+bool ioPipe(int fds[2])
+{
+    return false;
+}
+
+bool ioClose(int fd)
+{
+    return false;
+}
+
+#endif
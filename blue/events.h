@@ -0,0 +1,43 @@
+#ifndef blue_events_h
+#define blue_events_h
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+// a vm's event loop: reads and writes on file descriptors run in the
+// background while the vm goes on, and each one's result is handed to a
+// waiter, a fiber to resume or a function to call, once the loop runs.
+// linux uses io_uring, or epoll and a few blocking threads for regular
+// files if io_uring is unavailable. other unix systems use only the
+// threads, where each read waiting on a pipe holds one of them.
+// BLUE_IO=uring, epoll or pool picks one when a vm starts its loop
+typedef struct EventLoop EventLoop;
+
+// start reading up to length bytes from fd. the waiter gets them as a
+// string, "" at the end of the input, or nil if the read failed.
+// false if this platform has no event loop
+bool ioRead(VM *vm, int fd, int length, Value waiter);
+
+// start writing a copy of bytes to fd. the waiter gets the byte count
+// once all of them are written, or nil if writing failed
+bool ioWrite(VM *vm, int fd, const char *bytes, int length, Value waiter);
+
+// hand results to waiters until nothing is left in flight, false if a
+// waiter raised a runtime error. operations the waiters start are
+// waited for too
+bool runEventLoop(VM *vm);
+
+// drop the vm's loop. whatever is still in flight is abandoned
+void freeEventLoop(VM *vm);
+
+// open path for reading "r", writing "w" or appending "a", -1 on failure
+int ioOpen(const char *path, const char *mode);
+
+// a pipe's read and write ends, false on failure
+bool ioPipe(int fds[2]);
+
+// false if fd wasn't open
+bool ioClose(int fd);
+
+#endif
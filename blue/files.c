@@ -0,0 +1,238 @@
+// copy_file_range, splice, sendfile and ftruncate are outside strict ISO C
+#define _GNU_SOURCE
+
+#include <limits.h>
+
+#include "files.h"
+#include "memory.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+// most bytes asked of the kernel in one call, linux moves at most this
+#define STREAM_CHUNK 0x7ffff000
+
+// bytes per read and write when the kernel can't copy on its own
+#define STREAM_BUFFER 65536
+
+// write all of bytes, false on failure
+static bool writeAll(int fd, const char *bytes, size_t count)
+{
+    while (count > 0)
+    {
+        ssize_t written = write(fd, bytes, count);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+
+        bytes += written;
+        count -= (size_t)written;
+    }
+
+    return true;
+}
+
+static long long copyBuffered(int from, int to, long long copied)
+{
+    char buffer[STREAM_BUFFER];
+    for (;;)
+    {
+        ssize_t count = read(from, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return -1;
+        if (count == 0)
+            return copied;
+
+        if (!writeAll(to, buffer, (size_t)count))
+            return -1;
+        copied += count;
+    }
+}
+
+#ifdef __linux__
+
+// the ways the kernel can copy on its own, tried in this order
+typedef enum
+{
+    COPY_FILE_RANGE,
+    COPY_SENDFILE,
+    COPY_SPLICE,
+} KernelCopy;
+
+static ssize_t copyInKernel(KernelCopy how, int from, int to)
+{
+    switch (how)
+    {
+    case COPY_FILE_RANGE:
+        return copy_file_range(from, NULL, to, NULL, STREAM_CHUNK, 0);
+    case COPY_SENDFILE:
+        return sendfile(to, from, NULL, STREAM_CHUNK);
+    case COPY_SPLICE:
+        return splice(from, NULL, to, NULL, STREAM_CHUNK, SPLICE_F_MOVE);
+    }
+
+    return -1;
+}
+
+// errors that only mean this way of copying doesn't fit these descriptors
+static bool unsupported(int error)
+{
+    return error == EINVAL || error == ENOSYS || error == EXDEV || error == EBADF || error == EOPNOTSUPP;
+}
+
+#endif
+
+long long streamFile(int from, int to)
+{
+    long long copied = 0;
+
+#ifdef __linux__
+    struct stat info;
+    if (fstat(from, &info) != 0)
+        return -1;
+
+    // every call goes on from the descriptors' positions, so whichever
+    // one gives up, the next picks up where it stopped
+    KernelCopy first = S_ISREG(info.st_mode) ? COPY_FILE_RANGE : COPY_SPLICE;
+    KernelCopy last = S_ISREG(info.st_mode) ? COPY_SENDFILE : COPY_SPLICE;
+    for (KernelCopy how = first; how <= last; how++)
+    {
+        for (;;)
+        {
+            ssize_t count = copyInKernel(how, from, to);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count == 0)
+                return copied;
+            if (count < 0)
+                break;
+
+            copied += count;
+        }
+
+        if (!unsupported(errno))
+            return -1;
+    }
+#endif
+
+    return copyBuffered(from, to, copied);
+}
+
+char *loadFile(const char *path, int *length)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size >= INT_MAX)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // sized from fstat, but read to the end in case the file grew since
+    size_t capacity = (size_t)info.st_size + 1;
+    size_t size = 0;
+    char *chars = ALLOCATE(char, capacity);
+    bool failed = false;
+
+    for (;;)
+    {
+        // one byte always stays free for the '\0'
+        if (size + 1 == capacity)
+        {
+            if (capacity > INT_MAX / 2)
+            {
+                failed = true;
+                break;
+            }
+
+            chars = GROW_ARRAY(char, chars, capacity, capacity * 2);
+            capacity *= 2;
+        }
+
+        ssize_t count = read(fd, chars + size, capacity - size - 1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+        {
+            failed = count < 0;
+            break;
+        }
+
+        size += (size_t)count;
+    }
+
+    close(fd);
+    if (failed)
+    {
+        FREE_ARRAY(char, chars, capacity);
+        return NULL;
+    }
+
+    // exactly length + 1 bytes, as takeString expects
+    chars = GROW_ARRAY(char, chars, capacity, size + 1);
+    chars[size] = '\0';
+    *length = (int)size;
+    return chars;
+}
+
+bool sameFile(int a, int b)
+{
+    struct stat first, second;
+    if (fstat(a, &first) != 0 || fstat(b, &second) != 0)
+        return false;
+
+    return first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+}
+
+int openTarget(const char *path)
+{
+    return open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+}
+
+bool truncateFile(int fd)
+{
+    return ftruncate(fd, 0) == 0;
+}
+
+#else
+
+long long streamFile(int from, int to)
+{
+    return -1;
+}
+
+char *loadFile(const char *path, int *length)
+{
+    return NULL;
+}
+
+bool sameFile(int a, int b)
+{
+    return false;
+}
+
+int openTarget(const char *path)
+{
+    return -1;
+}
+
+bool truncateFile(int fd)
+{
+    return false;
+}
+
+#endif
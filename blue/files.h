@@ -0,0 +1,26 @@
+#ifndef blue_files_h
+#define blue_files_h
+
+#include "common.h"
+
+// copy everything left to read from one descriptor to another, returns
+// the bytes copied or -1 on failure. the kernel moves the bytes itself
+// where it can: copy_file_range between files, sendfile from a file to
+// anything, splice out of a pipe. a read and write loop does the rest
+long long streamFile(int from, int to);
+
+// read all of a regular file into length + 1 bytes from ALLOCATE, ending
+// in a '\0' like any string, or NULL on failure. ready for takeString
+char *loadFile(const char *path, int *length);
+
+// do both descriptors refer to the same file
+bool sameFile(int a, int b);
+
+// open path for writing, created if missing but not truncated, so it can
+// be checked against the source of a copy first
+int openTarget(const char *path);
+
+// cut a file open for writing down to nothing
+bool truncateFile(int fd);
+
+#endif
@@ -0,0 +1,403 @@
+#include "float64.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FLOAT64_X86
+#include <immintrin.h>
+#include <stdatomic.h>
+#endif
+
+// scalar kernels, also used for the tail a vector loop leaves behind
+
+static double scalarSum(const double *values, int start, int length)
+{
+    double sum = 0;
+    for (int i = start; i < length; i++)
+        sum += values[i];
+    return sum;
+}
+
+static double scalarDot(const double *a, const double *b, int start, int length)
+{
+    double sum = 0;
+    for (int i = start; i < length; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+// same comparison as the vector min/max instructions, so NaNs behave alike
+static double scalarMin(const double *values, int start, int length, double min)
+{
+    for (int i = start; i < length; i++)
+        min = values[i] < min ? values[i] : min;
+    return min;
+}
+
+static double scalarMax(const double *values, int start, int length, double max)
+{
+    for (int i = start; i < length; i++)
+        max = values[i] > max ? values[i] : max;
+    return max;
+}
+
+static void scalarScale(double *dest, const double *values, double factor, int start, int length)
+{
+    for (int i = start; i < length; i++)
+        dest[i] = values[i] * factor;
+}
+
+static void scalarAdd(double *dest, const double *a, const double *b, int start, int length)
+{
+    for (int i = start; i < length; i++)
+        dest[i] = a[i] + b[i];
+}
+
+static void scalarMul(double *dest, const double *a, const double *b, int start, int length)
+{
+    for (int i = start; i < length; i++)
+        dest[i] = a[i] * b[i];
+}
+
+static void scalarPrefixSum(double *dest, const double *values, int start, int length, double carry)
+{
+    for (int i = start; i < length; i++)
+    {
+        carry += values[i];
+        dest[i] = carry;
+    }
+}
+
+#ifdef FLOAT64_X86
+
+// sse2 is part of x86-64, so these need no runtime check
+
+static double sse2Sum(const double *values, int length)
+{
+    // two accumulators hide the add latency
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        sum0 = _mm_add_pd(sum0, _mm_loadu_pd(values + i));
+        sum1 = _mm_add_pd(sum1, _mm_loadu_pd(values + i + 2));
+    }
+
+    __m128d sum = _mm_add_pd(sum0, sum1);
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+    return _mm_cvtsd_f64(sum) + scalarSum(values, i, length);
+}
+
+static double sse2Dot(const double *a, const double *b, int length)
+{
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+
+    __m128d sum = _mm_add_pd(sum0, sum1);
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+    return _mm_cvtsd_f64(sum) + scalarDot(a, b, i, length);
+}
+
+static double sse2Min(const double *values, int length)
+{
+    __m128d min = _mm_set1_pd(values[0]);
+    int i = 0;
+
+    for (; i + 2 <= length; i += 2)
+        min = _mm_min_pd(_mm_loadu_pd(values + i), min);
+
+    min = _mm_min_sd(_mm_unpackhi_pd(min, min), min);
+    return scalarMin(values, i, length, _mm_cvtsd_f64(min));
+}
+
+static double sse2Max(const double *values, int length)
+{
+    __m128d max = _mm_set1_pd(values[0]);
+    int i = 0;
+
+    for (; i + 2 <= length; i += 2)
+        max = _mm_max_pd(_mm_loadu_pd(values + i), max);
+
+    max = _mm_max_sd(_mm_unpackhi_pd(max, max), max);
+    return scalarMax(values, i, length, _mm_cvtsd_f64(max));
+}
+
+static void sse2Scale(double *dest, const double *values, double factor, int length)
+{
+    __m128d scale = _mm_set1_pd(factor);
+    int i = 0;
+
+    for (; i + 2 <= length; i += 2)
+        _mm_storeu_pd(dest + i, _mm_mul_pd(_mm_loadu_pd(values + i), scale));
+
+    scalarScale(dest, values, factor, i, length);
+}
+
+static void sse2Add(double *dest, const double *a, const double *b, int length)
+{
+    int i = 0;
+
+    for (; i + 2 <= length; i += 2)
+        _mm_storeu_pd(dest + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+
+    scalarAdd(dest, a, b, i, length);
+}
+
+static void sse2Mul(double *dest, const double *a, const double *b, int length)
+{
+    int i = 0;
+
+    for (; i + 2 <= length; i += 2)
+        _mm_storeu_pd(dest + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+
+    scalarMul(dest, a, b, i, length);
+}
+
+static void sse2PrefixSum(double *dest, const double *values, int length)
+{
+    __m128d zero = _mm_setzero_pd();
+    __m128d carry = zero;
+    int i = 0;
+
+    for (; i + 2 <= length; i += 2)
+    {
+        // [a0, a1] + [0, a0], then add everything before this pair
+        __m128d x = _mm_loadu_pd(values + i);
+        x = _mm_add_pd(x, _mm_unpacklo_pd(zero, x));
+        x = _mm_add_pd(x, carry);
+        _mm_storeu_pd(dest + i, x);
+        carry = _mm_unpackhi_pd(x, x);
+    }
+
+    scalarPrefixSum(dest, values, i, length, _mm_cvtsd_f64(carry));
+}
+
+// avx2 kernels, only called once the cpu reports support
+
+__attribute__((target("avx2"))) static double avx2Sum(const double *values, int length)
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(values + i));
+        sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(values + i + 4));
+    }
+
+    __m256d sum4 = _mm256_add_pd(sum0, sum1);
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(sum4), _mm256_extractf128_pd(sum4, 1));
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+    return _mm_cvtsd_f64(sum) + scalarSum(values, i, length);
+}
+
+__attribute__((target("avx2"))) static double avx2Dot(const double *a, const double *b, int length)
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+
+    __m256d sum4 = _mm256_add_pd(sum0, sum1);
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(sum4), _mm256_extractf128_pd(sum4, 1));
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+    return _mm_cvtsd_f64(sum) + scalarDot(a, b, i, length);
+}
+
+__attribute__((target("avx2"))) static double avx2Min(const double *values, int length)
+{
+    __m256d min4 = _mm256_set1_pd(values[0]);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        min4 = _mm256_min_pd(_mm256_loadu_pd(values + i), min4);
+
+    __m128d min = _mm_min_pd(_mm256_extractf128_pd(min4, 1), _mm256_castpd256_pd128(min4));
+    min = _mm_min_sd(_mm_unpackhi_pd(min, min), min);
+    return scalarMin(values, i, length, _mm_cvtsd_f64(min));
+}
+
+__attribute__((target("avx2"))) static double avx2Max(const double *values, int length)
+{
+    __m256d max4 = _mm256_set1_pd(values[0]);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        max4 = _mm256_max_pd(_mm256_loadu_pd(values + i), max4);
+
+    __m128d max = _mm_max_pd(_mm256_extractf128_pd(max4, 1), _mm256_castpd256_pd128(max4));
+    max = _mm_max_sd(_mm_unpackhi_pd(max, max), max);
+    return scalarMax(values, i, length, _mm_cvtsd_f64(max));
+}
+
+__attribute__((target("avx2"))) static void avx2Scale(double *dest, const double *values, double factor, int length)
+{
+    __m256d scale = _mm256_set1_pd(factor);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        _mm256_storeu_pd(dest + i, _mm256_mul_pd(_mm256_loadu_pd(values + i), scale));
+
+    scalarScale(dest, values, factor, i, length);
+}
+
+__attribute__((target("avx2"))) static void avx2Add(double *dest, const double *a, const double *b, int length)
+{
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        _mm256_storeu_pd(dest + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+    scalarAdd(dest, a, b, i, length);
+}
+
+__attribute__((target("avx2"))) static void avx2Mul(double *dest, const double *a, const double *b, int length)
+{
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+        _mm256_storeu_pd(dest + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+    scalarMul(dest, a, b, i, length);
+}
+
+__attribute__((target("avx2"))) static void avx2PrefixSum(double *dest, const double *values, int length)
+{
+    __m256d zero = _mm256_setzero_pd();
+    __m256d carry = zero;
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        // log-step scan inside the register:
+        // add the lanes shifted up by one, then by two
+        __m256d x = _mm256_loadu_pd(values + i);
+        __m256d shifted = _mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 0));
+        x = _mm256_add_pd(x, _mm256_blend_pd(shifted, zero, 0x1));
+        shifted = _mm256_permute4x64_pd(x, _MM_SHUFFLE(1, 0, 0, 0));
+        x = _mm256_add_pd(x, _mm256_blend_pd(shifted, zero, 0x3));
+        x = _mm256_add_pd(x, carry);
+        _mm256_storeu_pd(dest + i, x);
+
+        // broadcast the last lane for the next block
+        carry = _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+
+    scalarPrefixSum(dest, values, i, length, _mm256_cvtsd_f64(carry));
+}
+
+// checked once, the answer never changes. tasks on other threads may ask
+// at the same time, and all of them store the same answer
+static bool hasAvx2()
+{
+    static atomic_int supported = -1;
+
+    int answer = atomic_load_explicit(&supported, memory_order_relaxed);
+    if (answer == -1)
+    {
+        __builtin_cpu_init();
+        answer = __builtin_cpu_supports("avx2") ? 1 : 0;
+        atomic_store_explicit(&supported, answer, memory_order_relaxed);
+    }
+
+    return answer == 1;
+}
+
+#endif
+
+double float64Sum(const double *values, int length)
+{
+#ifdef FLOAT64_X86
+    return hasAvx2() ? avx2Sum(values, length) : sse2Sum(values, length);
+#else
+    return scalarSum(values, 0, length);
+#endif
+}
+
+double float64Dot(const double *a, const double *b, int length)
+{
+#ifdef FLOAT64_X86
+    return hasAvx2() ? avx2Dot(a, b, length) : sse2Dot(a, b, length);
+#else
+    return scalarDot(a, b, 0, length);
+#endif
+}
+
+double float64Min(const double *values, int length)
+{
+#ifdef FLOAT64_X86
+    return hasAvx2() ? avx2Min(values, length) : sse2Min(values, length);
+#else
+    return scalarMin(values, 0, length, values[0]);
+#endif
+}
+
+double float64Max(const double *values, int length)
+{
+#ifdef FLOAT64_X86
+    return hasAvx2() ? avx2Max(values, length) : sse2Max(values, length);
+#else
+    return scalarMax(values, 0, length, values[0]);
+#endif
+}
+
+void float64Scale(double *dest, const double *values, double factor, int length)
+{
+#ifdef FLOAT64_X86
+    if (hasAvx2())
+        avx2Scale(dest, values, factor, length);
+    else
+        sse2Scale(dest, values, factor, length);
+#else
+    scalarScale(dest, values, factor, 0, length);
+#endif
+}
+
+void float64Add(double *dest, const double *a, const double *b, int length)
+{
+#ifdef FLOAT64_X86
+    if (hasAvx2())
+        avx2Add(dest, a, b, length);
+    else
+        sse2Add(dest, a, b, length);
+#else
+    scalarAdd(dest, a, b, 0, length);
+#endif
+}
+
+void float64Mul(double *dest, const double *a, const double *b, int length)
+{
+#ifdef FLOAT64_X86
+    if (hasAvx2())
+        avx2Mul(dest, a, b, length);
+    else
+        sse2Mul(dest, a, b, length);
+#else
+    scalarMul(dest, a, b, 0, length);
+#endif
+}
+
+void float64PrefixSum(double *dest, const double *values, int length)
+{
+#ifdef FLOAT64_X86
+    if (hasAvx2())
+        avx2PrefixSum(dest, values, length);
+    else
+        sse2PrefixSum(dest, values, length);
+#else
+    scalarPrefixSum(dest, values, 0, length, 0);
+#endif
+}
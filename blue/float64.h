@@ -0,0 +1,34 @@
+#ifndef blue_float64_h
+#define blue_float64_h
+
+#include "common.h"
+
+// bulk math over raw doubles, used by the Float64Array natives
+// x86-64 picks an AVX2 or SSE2 kernel at runtime, other targets use scalar loops
+// vector kernels add in a different order, so sums may differ in the last bits
+
+// sum of all items
+double float64Sum(const double *values, int length);
+
+// sum of pairwise products
+double float64Dot(const double *a, const double *b, int length);
+
+// smallest item, length must be above zero
+double float64Min(const double *values, int length);
+
+// largest item, length must be above zero
+double float64Max(const double *values, int length);
+
+// dest[i] = values[i] * factor
+void float64Scale(double *dest, const double *values, double factor, int length);
+
+// dest[i] = a[i] + b[i]
+void float64Add(double *dest, const double *a, const double *b, int length);
+
+// dest[i] = a[i] * b[i]
+void float64Mul(double *dest, const double *a, const double *b, int length);
+
+// dest[i] = values[0] + ... + values[i]
+void float64PrefixSum(double *dest, const double *values, int length);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "memory.h"
+#include "object.h"
+
+// grow when is array 75% full
+#define INTERN_MAX_LOAD 0.75
+
+// constructor for new empty set
+void initInternSet(InternSet *set)
+{
+    set->count = 0;
+    set->capacity = 0;
+    set->hashes = NULL;
+    set->keys = NULL;
+}
+
+// deallocate slots, the strings belong to the vm's object list
+void freeInternSet(InternSet *set)
+{
+    FREE_ARRAY(uint32_t, set->hashes, set->capacity);
+    FREE_ARRAY(ObjString *, set->keys, set->capacity);
+    initInternSet(set);
+}
+
+// place a string into the first empty slot of its probe sequence
+static void insertSlot(uint32_t *hashes, ObjString **keys, int capacity, ObjString *string)
+{
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t index = string->hash & mask;
+
+    while (keys[index] != NULL)
+    {
+        index = (index + 1) & mask;
+    }
+
+    hashes[index] = string->hash;
+    keys[index] = string;
+}
+
+// grows or shrinks the set, capacity must be a power of two
+static void adjustCapacity(InternSet *set, int capacity)
+{
+    uint32_t *hashes = ALLOCATE(uint32_t, capacity);
+    ObjString **keys = ALLOCATE(ObjString *, capacity);
+
+    for (int i = 0; i < capacity; i++)
+    {
+        keys[i] = NULL;
+    }
+
+    // hashes are cached, so rehashing never reads a string
+    for (int i = 0; i < set->capacity; i++)
+    {
+        if (set->keys[i] != NULL)
+        {
+            insertSlot(hashes, keys, capacity, set->keys[i]);
+        }
+    }
+
+    FREE_ARRAY(uint32_t, set->hashes, set->capacity);
+    FREE_ARRAY(ObjString *, set->keys, set->capacity);
+
+    set->hashes = hashes;
+    set->keys = keys;
+    set->capacity = capacity;
+}
+
+// look for string in set
+ObjString *internFind(InternSet *set, const char *chars, int length, uint32_t hash)
+{
+    if (set->count == 0)
+        return NULL;
+
+    uint32_t mask = (uint32_t)set->capacity - 1;
+    uint32_t index = hash & mask;
+
+    for (;;)
+    {
+        ObjString *key = set->keys[index];
+
+        // the set never holds tombstones, an empty slot ends the probe
+        if (key == NULL)
+            return NULL;
+
+        if (set->hashes[index] == hash && key->length == length && memcmp(key->chars, chars, length) == 0)
+            return key;
+
+        index = (index + 1) & mask;
+    }
+}
+
+// insert a string the caller already failed to find
+void internAdd(InternSet *set, ObjString *string)
+{
+    if (set->count + 1 > set->capacity * INTERN_MAX_LOAD)
+    {
+        adjustCapacity(set, GROW_CAPACITY(set->capacity));
+    }
+
+    insertSlot(set->hashes, set->keys, set->capacity, string);
+    set->count++;
+}
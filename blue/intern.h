@@ -0,0 +1,36 @@
+#ifndef blue_intern_h
+#define blue_intern_h
+
+#include "common.h"
+#include "value.h"
+
+// set of every live string, used for string interning
+// keeps only the hash and key for each slot, no value
+typedef struct
+{
+    // number of interned strings
+    int count;
+
+    // allocated size, always a power of two
+    int capacity;
+
+    // hashes sit beside the keys so a probe rarely touches a string
+    uint32_t *hashes;
+
+    // interned strings, NULL marks an empty slot
+    ObjString **keys;
+} InternSet;
+
+// constructor to create an empty set
+void initInternSet(InternSet *set);
+
+// return memory
+void freeInternSet(InternSet *set);
+
+// finds a string with a hash the caller already computed
+ObjString *internFind(InternSet *set, const char *chars, int length, uint32_t hash);
+
+// insert a string that is known to be missing
+void internAdd(InternSet *set, ObjString *string);
+
+#endif
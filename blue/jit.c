@@ -0,0 +1,436 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "jit.h"
+#include "memory.h"
+
+#ifdef BLUE_JIT
+
+// a baseline template jit: every instruction of a chunk becomes a fixed
+// piece of machine code. loads, stores, constants, jumps and the integer
+// and double cases of arithmetic and comparison are inlined, every other
+// instruction or operand type calls back into the interpreter for just
+// that instruction. the interpreter stays the reference for behaviour.
+//
+// compiled code keeps the vm value stack in memory with these registers:
+//   rbx  frame->slots
+//   r12  stack top, written back to vm->stackTop around interpreter calls
+//   r13  the vm
+//   r14  the CallFrame
+
+struct JitCode
+{
+    void *code;
+    size_t size;
+};
+
+typedef bool (*JitEntry)(CallFrame *frame, VM *vm);
+
+#define SLOTS RBX
+#define TOP R12
+#define VMREG R13
+#define FRAME R14
+
+#define VALUE_SIZE ((int32_t)sizeof(Value))
+#define TYPE_OFFSET ((int32_t)offsetof(Value, type))
+#define AS_OFFSET ((int32_t)offsetof(Value, as))
+
+// labels are bytecode offsets, then one past the end for the return
+// epilogue and one more for the error exit
+#define ERROR_LABEL(as) ((as)->labelCount - 1)
+
+// push a value known at compile time
+static void emitPushValue(Assembler *as, Value value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value.as, sizeof(bits));
+
+    storeImm32(as, TOP, TYPE_OFFSET, value.type);
+    movImm64(as, RAX, bits);
+    storeQ(as, TOP, AS_OFFSET, RAX);
+    arithImm(as, 0, TOP, VALUE_SIZE);
+}
+
+// call a helper in vm.c with the stack top written back and ip set, then
+// reload the stack top. stepInstruction runs the instruction at ip, the
+// other helpers get ip just past the opcode as the interpreter would have
+// it for error traces. helpers take the vm first, those that can fail
+// return false after reporting a runtime error
+static void emitHelper(Assembler *as, uint8_t *ip, void *helper, bool hasArgument, uint64_t argument, bool canFail)
+{
+    storeQ(as, VMREG, (int32_t)offsetof(VM, stackTop), TOP);
+    movImm64(as, RAX, (uint64_t)(uintptr_t)ip);
+    storeQ(as, FRAME, (int32_t)offsetof(CallFrame, ip), RAX);
+
+    // mov rdi, r13
+    emitReg(as, 0, true, 0x89, VMREG, RDI);
+    if (hasArgument)
+        movImm64(as, RSI, argument);
+
+    // call rax
+    movImm64(as, RAX, (uint64_t)(uintptr_t)helper);
+    emit8(as, 0xff);
+    emit8(as, 0xd0);
+
+    if (canFail)
+    {
+        // test al, al
+        emit8(as, 0x84);
+        emit8(as, 0xc0);
+        jumpToLabel(as, jcc(as, CC_E), ERROR_LABEL(as));
+    }
+
+    loadQ(as, TOP, VMREG, (int32_t)offsetof(VM, stackTop));
+}
+
+// run the instruction at ip in the interpreter
+static void emitInterpret(Assembler *as, uint8_t *ip)
+{
+    emitHelper(as, ip, (void *)stepInstruction, false, 0, true);
+}
+
+// after the interpreter ran a branch, follow it if ip did not fall through
+static void emitFollowBranch(Assembler *as, uint8_t *fallthrough, int target)
+{
+    loadQ(as, RAX, FRAME, (int32_t)offsetof(CallFrame, ip));
+    movImm64(as, RCX, (uint64_t)(uintptr_t)fallthrough);
+    emitReg(as, 0, true, 0x3b, RAX, RCX);
+    jumpToLabel(as, jcc(as, CC_NE), target);
+}
+
+// jumps to fallback unless both operands on top of the stack have type
+static void guardOperands(Assembler *as, ValueType type, int *fallbacks)
+{
+    cmpImm32(as, TOP, -VALUE_SIZE + TYPE_OFFSET, type);
+    fallbacks[0] = jcc(as, CC_NE);
+    cmpImm32(as, TOP, -2 * VALUE_SIZE + TYPE_OFFSET, type);
+    fallbacks[1] = jcc(as, CC_NE);
+}
+
+// a op b for integers and doubles inline, mixed operands and overflow
+// go to the interpreter. opcodes are reg, [mem] forms
+static void emitArithmetic(Assembler *as, uint8_t *ip, int intOpcode, int doubleOpcode)
+{
+    int notInt[2], notDouble[2];
+
+    guardOperands(as, VAL_INT, notInt);
+    loadQ(as, RAX, TOP, -2 * VALUE_SIZE + AS_OFFSET);
+    emitMem(as, 0, true, intOpcode, RAX, TOP, -VALUE_SIZE + AS_OFFSET);
+    int overflow = jcc(as, CC_O);
+    storeQ(as, TOP, -2 * VALUE_SIZE + AS_OFFSET, RAX);
+    arithImm(as, 5, TOP, VALUE_SIZE);
+    int intDone = jmp(as);
+
+    patchHere(as, notInt[0]);
+    patchHere(as, notInt[1]);
+    guardOperands(as, VAL_NUMBER, notDouble);
+    emitMem(as, 0xf2, false, 0x0f10, 0, TOP, -2 * VALUE_SIZE + AS_OFFSET);
+    emitMem(as, 0xf2, false, doubleOpcode, 0, TOP, -VALUE_SIZE + AS_OFFSET);
+    emitMem(as, 0xf2, false, 0x0f11, 0, TOP, -2 * VALUE_SIZE + AS_OFFSET);
+    arithImm(as, 5, TOP, VALUE_SIZE);
+    int doubleDone = jmp(as);
+
+    patchHere(as, overflow);
+    patchHere(as, notDouble[0]);
+    patchHere(as, notDouble[1]);
+    emitInterpret(as, ip);
+
+    patchHere(as, intDone);
+    patchHere(as, doubleDone);
+}
+
+// replace the two operands with a bool from setcc al
+static void storeBool(Assembler *as, int cc)
+{
+    setBool(as, cc);
+    storeImm32(as, TOP, -2 * VALUE_SIZE + TYPE_OFFSET, VAL_BOOL);
+    storeQ(as, TOP, -2 * VALUE_SIZE + AS_OFFSET, RAX);
+    arithImm(as, 5, TOP, VALUE_SIZE);
+}
+
+// a < b or a > b, NaN compares false as in the interpreter
+static void emitComparison(Assembler *as, uint8_t *ip, bool less)
+{
+    int notInt[2], notDouble[2];
+
+    guardOperands(as, VAL_INT, notInt);
+    loadQ(as, RAX, TOP, -2 * VALUE_SIZE + AS_OFFSET);
+    emitMem(as, 0, true, 0x3b, RAX, TOP, -VALUE_SIZE + AS_OFFSET);
+    storeBool(as, less ? CC_L : CC_G);
+    int intDone = jmp(as);
+
+    // ucomisd sets "above" only for ordered operands
+    patchHere(as, notInt[0]);
+    patchHere(as, notInt[1]);
+    guardOperands(as, VAL_NUMBER, notDouble);
+    int first = less ? -VALUE_SIZE : -2 * VALUE_SIZE;
+    int second = less ? -2 * VALUE_SIZE : -VALUE_SIZE;
+    emitMem(as, 0xf2, false, 0x0f10, 0, TOP, first + AS_OFFSET);
+    emitMem(as, 0x66, false, 0x0f2e, 0, TOP, second + AS_OFFSET);
+    storeBool(as, CC_A);
+    int doubleDone = jmp(as);
+
+    patchHere(as, notDouble[0]);
+    patchHere(as, notDouble[1]);
+    emitInterpret(as, ip);
+
+    patchHere(as, intDone);
+    patchHere(as, doubleDone);
+}
+
+// guard that two local slots hold integers
+static void guardSlots(Assembler *as, int counter, int bound, int *fallbacks)
+{
+    cmpImm32(as, SLOTS, counter * VALUE_SIZE + TYPE_OFFSET, VAL_INT);
+    fallbacks[0] = jcc(as, CC_NE);
+    cmpImm32(as, SLOTS, bound * VALUE_SIZE + TYPE_OFFSET, VAL_INT);
+    fallbacks[1] = jcc(as, CC_NE);
+}
+
+static uint16_t readShort(uint8_t *ip)
+{
+    return (uint16_t)((ip[0] << 8) | ip[1]);
+}
+
+// template for one instruction
+static void emitInstruction(Assembler *as, Chunk *chunk, int offset)
+{
+    uint8_t *ip = &chunk->code[offset];
+    int length = instructionLength(chunk, offset);
+
+    switch (*ip)
+    {
+    case OP_CONSTANT:
+        emitPushValue(as, chunk->constants.values[ip[1]]);
+        break;
+    case OP_NIL:
+        emitPushValue(as, NIL_VAL);
+        break;
+    case OP_TRUE:
+        emitPushValue(as, BOOL_VAL(true));
+        break;
+    case OP_FALSE:
+        emitPushValue(as, BOOL_VAL(false));
+        break;
+    case OP_POP:
+        arithImm(as, 5, TOP, VALUE_SIZE);
+        break;
+    case OP_GET_LOCAL:
+        // movups xmm0, [slot]; movups [top], xmm0
+        emitMem(as, 0, false, 0x0f10, 0, SLOTS, ip[1] * VALUE_SIZE);
+        emitMem(as, 0, false, 0x0f11, 0, TOP, 0);
+        arithImm(as, 0, TOP, VALUE_SIZE);
+        break;
+    case OP_SET_LOCAL:
+        emitMem(as, 0, false, 0x0f10, 0, TOP, -VALUE_SIZE);
+        emitMem(as, 0, false, 0x0f11, 0, SLOTS, ip[1] * VALUE_SIZE);
+        break;
+    case OP_ADD:
+        // strings and mixed operands take the interpreter path
+        emitArithmetic(as, ip, 0x03, 0x0f58);
+        break;
+    case OP_SUBTRACT:
+        emitArithmetic(as, ip, 0x2b, 0x0f5c);
+        break;
+    case OP_MULTIPLY:
+        emitArithmetic(as, ip, 0x0faf, 0x0f59);
+        break;
+    case OP_LESS:
+        emitComparison(as, ip, true);
+        break;
+    case OP_GREATER:
+        emitComparison(as, ip, false);
+        break;
+    case OP_JUMP:
+        jumpToLabel(as, jmp(as), offset + length + readShort(ip + 1));
+        break;
+    case OP_LOOP:
+        jumpToLabel(as, jmp(as), offset + length - readShort(ip + 1));
+        break;
+    case OP_JUMP_IF_FALSE:
+    {
+        // nil and false are falsey, the condition stays on the stack
+        int target = offset + length + readShort(ip + 1);
+        cmpImm32(as, TOP, -VALUE_SIZE + TYPE_OFFSET, VAL_NIL);
+        jumpToLabel(as, jcc(as, CC_E), target);
+        cmpImm32(as, TOP, -VALUE_SIZE + TYPE_OFFSET, VAL_BOOL);
+        int notBool = jcc(as, CC_NE);
+        cmpImm8(as, TOP, -VALUE_SIZE + AS_OFFSET, 0);
+        jumpToLabel(as, jcc(as, CC_E), target);
+        patchHere(as, notBool);
+        break;
+    }
+    case OP_FOR_RANGE:
+    {
+        int counter = ip[1];
+        int bound = ip[2];
+        int exit = offset + length + readShort(ip + 3);
+        int fallbacks[2];
+
+        guardSlots(as, counter, bound, fallbacks);
+        loadQ(as, RAX, SLOTS, counter * VALUE_SIZE + AS_OFFSET);
+        emitMem(as, 0, true, 0x3b, RAX, SLOTS, bound * VALUE_SIZE + AS_OFFSET);
+        jumpToLabel(as, jcc(as, CC_GE), exit);
+        int done = jmp(as);
+
+        patchHere(as, fallbacks[0]);
+        patchHere(as, fallbacks[1]);
+        emitInterpret(as, ip);
+        emitFollowBranch(as, ip + length, exit);
+        patchHere(as, done);
+        break;
+    }
+    case OP_FOR_STEP:
+    {
+        int counter = ip[1];
+        int bound = ip[2];
+        Value step = chunk->constants.values[ip[3]];
+        int body = offset + length - readShort(ip + 4);
+
+        // only small integer steps fit the add immediate
+        if (IS_INT(step) && AS_INT(step) >= INT32_MIN && AS_INT(step) <= INT32_MAX)
+        {
+            int fallbacks[2];
+            guardSlots(as, counter, bound, fallbacks);
+            loadQ(as, RAX, SLOTS, counter * VALUE_SIZE + AS_OFFSET);
+            arithImm(as, 0, RAX, (int32_t)AS_INT(step));
+            int overflow = jcc(as, CC_O);
+            storeQ(as, SLOTS, counter * VALUE_SIZE + AS_OFFSET, RAX);
+            emitMem(as, 0, true, 0x3b, RAX, SLOTS, bound * VALUE_SIZE + AS_OFFSET);
+            jumpToLabel(as, jcc(as, CC_L), body);
+            int done = jmp(as);
+
+            patchHere(as, fallbacks[0]);
+            patchHere(as, fallbacks[1]);
+            patchHere(as, overflow);
+            emitInterpret(as, ip);
+            emitFollowBranch(as, ip + length, body);
+            patchHere(as, done);
+        }
+        else
+        {
+            emitInterpret(as, ip);
+            emitFollowBranch(as, ip + length, body);
+        }
+        break;
+    }
+    case OP_GET_GLOBAL:
+    {
+        ObjString *name = AS_STRING(chunk->constants.values[ip[1]]);
+        emitHelper(as, ip + 1, (void *)compiledGetGlobal, true, (uint64_t)(uintptr_t)name, true);
+        break;
+    }
+    case OP_CALL:
+        emitHelper(as, ip + 1, (void *)compiledCall, true, ip[1], true);
+        break;
+    case OP_RETURN:
+    {
+        // the helper pops the frame and pushes the result
+        emitHelper(as, ip + 1, (void *)compiledReturn, false, 0, false);
+        emit8(as, 0xb8);
+        emit32(as, 1);
+        jumpToLabel(as, jmp(as), chunk->count);
+        break;
+    }
+    default:
+        emitInterpret(as, ip);
+        break;
+    }
+}
+
+bool jitCompile(ObjFunction *function)
+{
+    // the top level script runs once, it is never worth compiling
+    if (function->name == NULL || sizeof(Value) != 16)
+        return false;
+
+    Chunk *chunk = &function->chunk;
+    Assembler as;
+    initAssembler(&as, chunk->count + 2);
+
+    // prologue, five pushes keep the stack 16 byte aligned for calls
+    push64(&as, RBP);
+    push64(&as, RBX);
+    push64(&as, R12);
+    push64(&as, R13);
+    push64(&as, R14);
+    emitReg(&as, 0, true, 0x89, RDI, FRAME);
+    emitReg(&as, 0, true, 0x89, RSI, VMREG);
+    loadQ(&as, SLOTS, FRAME, (int32_t)offsetof(CallFrame, slots));
+    loadQ(&as, TOP, VMREG, (int32_t)offsetof(VM, stackTop));
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        placeLabel(&as, offset);
+        emitInstruction(&as, chunk, offset);
+    }
+
+    // returns jump past the last instruction with eax already set to true
+    placeLabel(&as, chunk->count);
+    int epilogue = jmp(&as);
+    placeLabel(&as, ERROR_LABEL(&as));
+    emit8(&as, 0xb8);
+    emit32(&as, 0);
+    patchHere(&as, epilogue);
+    pop64(&as, R14);
+    pop64(&as, R13);
+    pop64(&as, R12);
+    pop64(&as, RBX);
+    pop64(&as, RBP);
+    emit8(&as, 0xc3);
+
+    patchLabels(&as);
+
+    size_t size;
+    void *code = makeExecutable(&as, &size);
+    freeAssembler(&as);
+    if (code == NULL)
+        return false;
+
+    JitCode *jit = ALLOCATE(JitCode, 1);
+    jit->code = code;
+    jit->size = size;
+    function->jit = jit;
+    return true;
+}
+
+bool jitExecute(VM *vm, ObjFunction *function, CallFrame *frame)
+{
+    JitEntry entry = (JitEntry)function->jit->code;
+    return entry(frame, vm);
+}
+
+void freeJitCode(JitCode *code)
+{
+    if (code == NULL)
+        return;
+
+    freeExecutable(code->code, code->size);
+    FREE(JitCode, code);
+}
+
+#else
+
+// no jit on this platform, everything is interpreted
+
+struct JitCode
+{
+    int unused;
+};
+
+bool jitCompile(ObjFunction *function)
+{
+    return false;
+}
+
+bool jitExecute(VM *vm, ObjFunction *function, CallFrame *frame)
+{
+    return false;
+}
+
+void freeJitCode(JitCode *code)
+{
+}
+
+#endif
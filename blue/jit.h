@@ -0,0 +1,28 @@
+#ifndef blue_jit_h
+#define blue_jit_h
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+// calls before a function is compiled to machine code
+#define JIT_THRESHOLD 1000
+
+// the jit emits x86-64 and needs mmap for executable memory
+#if defined(__x86_64__) && defined(__GNUC__) && (defined(__linux__) || defined(__APPLE__))
+#define BLUE_JIT
+#endif
+
+// machine code of one function in its own executable mapping
+typedef struct JitCode JitCode;
+
+// translate a function's chunk, false if it stays interpreted
+bool jitCompile(ObjFunction *function);
+
+// run a compiled function whose frame was just pushed, to its return
+bool jitExecute(VM *vm, ObjFunction *function, CallFrame *frame);
+
+// unmap compiled code, NULL is ignored
+void freeJitCode(JitCode *code);
+
+#endif
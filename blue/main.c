@@ -2,12 +2,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "aot.h"
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "jit.h"
 #include "vm.h"
 
-static void repl()
+#ifdef BLUE_JIT
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+static void repl(VM *vm)
 {
     // make repl length 1024
     char line[1024];
@@ -15,6 +22,8 @@ static void repl()
     // interpret each line until user quits
     for (;;)
     {
+        // everything printed shows before the prompt asks for more
+        flushOutput(&vm->output);
         printf("> ");
 
         if (!fgets(line, sizeof(line), stdin))
@@ -23,7 +32,7 @@ static void repl()
             break;
         }
 
-        interpret(line);
+        interpret(vm, line);
     }
 }
 
@@ -72,13 +81,13 @@ static char *readFile(const char *path)
     return buffer;
 }
 
-static void runFile(const char *path)
+static void runFile(VM *vm, const char *path)
 {
     // dynamically allocates and passes ownership
     char *file = readFile(path);
 
     // convert to byte code
-    InterpretResult result = interpret(file);
+    InterpretResult result = interpret(vm, file);
 
     // clear file since we have our program
     free(file);
@@ -90,28 +99,142 @@ static void runFile(const char *path)
         exit(70);
 }
 
+#ifdef BLUE_JIT
+// run a file in a child process with the given jit thresholds, collecting
+// everything it writes to stdout and stderr followed by its exit status
+static char *runCaptured(VM *vm, const char *path, int jitThreshold, int traceThreshold, size_t *length)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        fprintf(stderr, "Could not create a pipe.\n");
+        exit(74);
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        vm->jitThreshold = jitThreshold;
+        vm->traceThreshold = traceThreshold;
+        runFile(vm, path);
+        exit(0);
+    }
+
+    close(fds[1]);
+
+    size_t capacity = 4096;
+    size_t count = 0;
+    char *output = (char *)malloc(capacity);
+    ssize_t bytes;
+    while (output != NULL && (bytes = read(fds[0], output + count, capacity - count - 16)) > 0)
+    {
+        count += (size_t)bytes;
+        if (capacity - count < 1024)
+        {
+            capacity *= 2;
+            output = (char *)realloc(output, capacity);
+        }
+    }
+    close(fds[0]);
+
+    if (output == NULL)
+    {
+        fprintf(stderr, "Not enough memory to capture output.\n");
+        exit(74);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    count += (size_t)sprintf(output + count, "\nexit %d", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+    *length = count;
+    return output;
+}
+
+// differential test: the interpreter is the reference, the same file is
+// run with every function compiled on its first call, then with every loop
+// traced on its first back-edge, and the outputs compared
+static bool sameOutput(const char *path, const char *mode, char *expected, size_t expectedLength,
+                       char *actual, size_t actualLength)
+{
+    bool same = expectedLength == actualLength && memcmp(expected, actual, expectedLength) == 0;
+    if (!same)
+    {
+        fprintf(stderr, "%s output differs for %s\n--- interpreter\n%.*s\n--- %s\n%.*s\n",
+                mode, path, (int)expectedLength, expected, mode, (int)actualLength, actual);
+    }
+
+    free(actual);
+    return same;
+}
+
+static void diffJit(VM *vm, const char *path)
+{
+    size_t expectedLength, jitLength, traceLength;
+    char *expected = runCaptured(vm, path, 0, 0, &expectedLength);
+    char *jit = runCaptured(vm, path, 1, 0, &jitLength);
+    char *traced = runCaptured(vm, path, 0, 1, &traceLength);
+
+    bool same = sameOutput(path, "jit", expected, expectedLength, jit, jitLength);
+    same = sameOutput(path, "trace", expected, expectedLength, traced, traceLength) && same;
+
+    free(expected);
+    exit(same ? 0 : 1);
+}
+#endif
+
+// the interpreter of this process, too big for the stack
+static VM mainVM;
+
 int main(int argCount, const char *args[])
 {
     // initialize vm
-    initVM();
+    VM *vm = &mainVM;
+    initVM(vm);
 
     // run repl, source file, or throw error
     if (argCount == 1)
     {
-        repl();
+        repl(vm);
     }
     else if (argCount == 2)
     {
-        runFile(args[1]);
+        runFile(vm, args[1]);
+    }
+    else if (argCount == 3 && strcmp(args[1], "--no-jit") == 0)
+    {
+        vm->jitThreshold = 0;
+        vm->traceThreshold = 0;
+        runFile(vm, args[2]);
+    }
+    else if (argCount == 3 && strcmp(args[1], "--compile") == 0)
+    {
+        // translate to C and build an executable beside the file
+        char *source = readFile(args[2]);
+        int status = aotCompileFile(vm, args[2], source);
+        free(source);
+        exit(status);
+    }
+#ifdef BLUE_JIT
+    else if (argCount == 3 && strcmp(args[1], "--jit-diff") == 0)
+    {
+        diffJit(vm, args[2]);
     }
+#endif
     else
     {
-        fprintf(stderr, "Usage: blue [file path]\n");
+        fprintf(stderr, "Usage: blue [--no-jit | --jit-diff | --compile] [file path]\n");
         exit(64);
     }
 
     // free vm and code
-    freeVM();
+    freeVM(vm);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "map.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+// index slot that points at no entry
+#define MAP_EMPTY -1
+
+// keep the index array at most half full
+#define MAP_INDEX_RATIO 2
+
+// constructor for new empty map
+void initMap(Map *map)
+{
+    map->count = 0;
+    map->entryCount = 0;
+    map->entryCapacity = 0;
+    map->entries = NULL;
+    map->indexCapacity = 0;
+    map->indexes = NULL;
+}
+
+// deallocate items
+void freeMap(Map *map)
+{
+    FREE_ARRAY(MapEntry, map->entries, map->entryCapacity);
+    FREE_ARRAY(int32_t, map->indexes, map->indexCapacity);
+    initMap(map);
+}
+
+// removed entries keep their slot with a NULL object key until compaction
+bool mapEntryIsRemoved(MapEntry *entry)
+{
+    return IS_OBJ(entry->key) && AS_OBJ(entry->key) == NULL;
+}
+
+// spread the bits of a 64 bit word, murmur3's finalizer
+static uint32_t mixBits(uint64_t bits)
+{
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+// equal numbers must hash alike, so -0 folds into +0 and
+// every NaN becomes the same key
+static uint32_t hashNumber(double number)
+{
+    if (number == 0)
+        number = 0;
+
+    if (number != number)
+        return 0x7ff80000u;
+
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return mixBits(bits);
+}
+
+// hash any value that can be used as a key
+static uint32_t hashValue(Value value)
+{
+    switch (value.type)
+    {
+    case VAL_BOOL:
+        return AS_BOOL(value) ? 1231u : 1237u;
+    case VAL_NIL:
+        return 0x9e3779b9u;
+    case VAL_NUMBER:
+    case VAL_INT:
+        // integers hash as doubles so 1 and 1.0 find the same key
+        return hashNumber(AS_NUMBER(value));
+    case VAL_OBJ:
+        // strings are interned, so their cached hash matches pointer equality
+        if (IS_STRING(value))
+            return AS_STRING(value)->hash;
+        return mixBits((uint64_t)(uintptr_t)AS_OBJ(value));
+    default:
+        // unreachable
+        return 0;
+    }
+}
+
+// key equality, unlike valuesEquate a NaN key finds itself
+static bool keysEqual(Value a, Value b)
+{
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return numbersEquate(a, b) || (x != x && y != y);
+    }
+
+    if (a.type != b.type)
+        return false;
+
+    return valuesEquate(a, b);
+}
+
+// return the position of the key in the entries array, or MAP_EMPTY
+static int32_t findEntry(Map *map, Value key, uint32_t hash)
+{
+    uint32_t mask = (uint32_t)map->indexCapacity - 1;
+    uint32_t index = hash & mask;
+
+    for (;;)
+    {
+        int32_t position = map->indexes[index];
+
+        if (position == MAP_EMPTY)
+            return MAP_EMPTY;
+
+        // removed entries never match, their index slot acts as a tombstone
+        MapEntry *entry = &map->entries[position];
+        if (entry->hash == hash && !mapEntryIsRemoved(entry) && keysEqual(entry->key, key))
+            return position;
+
+        index = (index + 1) & mask;
+    }
+}
+
+// point the first empty index slot at an entry
+static void insertIndex(Map *map, uint32_t hash, int32_t position)
+{
+    uint32_t mask = (uint32_t)map->indexCapacity - 1;
+    uint32_t index = hash & mask;
+
+    while (map->indexes[index] != MAP_EMPTY)
+    {
+        index = (index + 1) & mask;
+    }
+
+    map->indexes[index] = position;
+}
+
+// drop removed entries, size the arrays for the live ones and rebuild the index
+static void adjustCapacity(Map *map, int entryCapacity)
+{
+    // slide live entries down, insertion order is kept
+    int live = 0;
+    for (int i = 0; i < map->entryCount; i++)
+    {
+        if (!mapEntryIsRemoved(&map->entries[i]))
+        {
+            map->entries[live++] = map->entries[i];
+        }
+    }
+    map->entryCount = live;
+
+    map->entries = GROW_ARRAY(MapEntry, map->entries, map->entryCapacity, entryCapacity);
+    map->entryCapacity = entryCapacity;
+
+    FREE_ARRAY(int32_t, map->indexes, map->indexCapacity);
+    map->indexCapacity = entryCapacity * MAP_INDEX_RATIO;
+    map->indexes = ALLOCATE(int32_t, map->indexCapacity);
+
+    for (int i = 0; i < map->indexCapacity; i++)
+    {
+        map->indexes[i] = MAP_EMPTY;
+    }
+
+    for (int i = 0; i < map->entryCount; i++)
+    {
+        insertIndex(map, map->entries[i].hash, i);
+    }
+}
+
+// return if item exists, set value pointer to this value
+bool mapGet(Map *map, Value key, Value *value)
+{
+    if (map->count == 0)
+        return false;
+
+    int32_t position = findEntry(map, key, hashValue(key));
+    if (position == MAP_EMPTY)
+        return false;
+
+    *value = map->entries[position].value;
+    return true;
+}
+
+// returns true if the key is new, always caches the value
+bool mapSet(Map *map, Value key, Value value)
+{
+    uint32_t hash = hashValue(key);
+
+    if (map->count > 0)
+    {
+        int32_t position = findEntry(map, key, hash);
+        if (position != MAP_EMPTY)
+        {
+            map->entries[position].value = value;
+            return false;
+        }
+    }
+
+    // out of room, compact in place if enough entries were removed,
+    // otherwise grow; either way the index is rebuilt without tombstones
+    if (map->entryCount == map->entryCapacity)
+    {
+        int capacity = map->entryCapacity;
+        if (map->count + 1 > capacity / 2)
+        {
+            capacity = GROW_CAPACITY(capacity);
+        }
+
+        adjustCapacity(map, capacity);
+    }
+
+    MapEntry *entry = &map->entries[map->entryCount];
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+
+    insertIndex(map, hash, map->entryCount);
+    map->entryCount++;
+    map->count++;
+
+    return true;
+}
+
+// mark the entry removed, its slots are reclaimed at the next compaction
+bool mapDelete(Map *map, Value key)
+{
+    if (map->count == 0)
+        return false;
+
+    int32_t position = findEntry(map, key, hashValue(key));
+    if (position == MAP_EMPTY)
+        return false;
+
+    MapEntry *entry = &map->entries[position];
+    entry->key = OBJ_VAL(NULL);
+    entry->value = NIL_VAL;
+    map->count--;
+
+    return true;
+}
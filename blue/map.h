@@ -0,0 +1,57 @@
+#ifndef blue_map_h
+#define blue_map_h
+
+#include "common.h"
+#include "value.h"
+
+// one key/value pair, kept in insertion order
+typedef struct
+{
+    Value key;
+    Value value;
+    uint32_t hash;
+} MapEntry;
+
+// hash map that accepts any value as a key
+// entries live in a dense array in insertion order, and a separate
+// power-of-two array of indexes into it is what gets probed
+typedef struct
+{
+    // number of live key/value pairs
+    int count;
+
+    // entries in use, including removed ones not yet compacted
+    int entryCount;
+
+    // allocated size of the entries array
+    int entryCapacity;
+
+    // pairs in insertion order
+    MapEntry *entries;
+
+    // allocated size of the index array, always a power of two
+    int indexCapacity;
+
+    // position of an entry in the entries array, or MAP_EMPTY
+    int32_t *indexes;
+} Map;
+
+// constructor to create an empty map
+void initMap(Map *map);
+
+// return memory
+void freeMap(Map *map);
+
+// return if exists, place into value pointer
+bool mapGet(Map *map, Value key, Value *value);
+
+// insert into map, returns true if the key is new
+bool mapSet(Map *map, Value key, Value value);
+
+// remove a key, returns true if it existed
+bool mapDelete(Map *map, Value key);
+
+// returns if an entry was removed and only waits for compaction
+bool mapEntryIsRemoved(MapEntry *entry);
+
+#endif
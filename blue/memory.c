@@ -1,6 +1,9 @@
 #include <stdlib.h>
 
+#include "channel.h"
+#include "jit.h"
 #include "memory.h"
+#include "trace.h"
 #include "vm.h"
 
 // return reallocated heap space
@@ -28,16 +31,83 @@ static void freeObject(Obj *object)
 {
     switch (object->type)
     {
+    case OBJ_BOUND_METHOD:
+        FREE(ObjBoundMethod, object);
+        break;
+    case OBJ_CHANNEL:
+        releaseChannel(((ObjChannel *)object)->channel);
+        FREE(ObjChannel, object);
+        break;
+    case OBJ_CLASS:
+    {
+        ObjClass *klass = (ObjClass *)object;
+        freeTable(&klass->methods);
+        FREE(ObjClass, object);
+        break;
+    }
+    case OBJ_CLOSURE:
+    {
+        // the closure owns its array but not the upvalues in it
+        ObjClosure *closure = (ObjClosure *)object;
+        FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalueCount);
+        FREE(ObjClosure, object);
+        break;
+    }
+    case OBJ_FIBER:
+    {
+        ObjFiber *fiber = (ObjFiber *)object;
+        FREE_ARRAY(CallFrame, fiber->frames, fiber->frameCapacity);
+        FREE_ARRAY(Value, fiber->stack, fiber->stackCapacity);
+        FREE(ObjFiber, object);
+        break;
+    }
+    case OBJ_FLOAT64_ARRAY:
+    {
+        ObjFloat64Array *array = (ObjFloat64Array *)object;
+        FREE_ARRAY(double, array->values, array->length);
+        FREE(ObjFloat64Array, object);
+        break;
+    }
     case OBJ_FUNCTION:
     {
         ObjFunction *function = (ObjFunction *)object;
+        freeJitCode(function->jit);
+        freeTraces(&function->chunk);
         freeChunk(&function->chunk);
         FREE(ObjFunction, object);
         break;
     }
+    case OBJ_INSTANCE:
+    {
+        ObjInstance *instance = (ObjInstance *)object;
+        FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+        FREE(ObjInstance, object);
+        break;
+    }
+    case OBJ_LIST:
+    {
+        ObjList *list = (ObjList *)object;
+        freeValueArray(&list->items);
+        FREE(ObjList, object);
+        break;
+    }
+    case OBJ_MAP:
+    {
+        ObjMap *map = (ObjMap *)object;
+        freeMap(&map->map);
+        FREE(ObjMap, object);
+        break;
+    }
     case OBJ_NATIVE:
         FREE(ObjNative, object);
         break;
+    case OBJ_SHAPE:
+    {
+        ObjShape *shape = (ObjShape *)object;
+        freeTable(&shape->transitions);
+        FREE(ObjShape, object);
+        break;
+    }
     case OBJ_STRING:
     {
         ObjString *string = (ObjString *)object;
@@ -45,13 +115,16 @@ static void freeObject(Obj *object)
         FREE(ObjString, object);
         break;
     }
+    case OBJ_UPVALUE:
+        FREE(ObjUpvalue, object);
+        break;
     }
 }
 
 // frees all objects in the vm
-void freeObjects()
+void freeObjects(VM *vm)
 {
-    Obj *curr = vm.objects;
+    Obj *curr = vm->objects;
 
     while (curr != NULL)
     {
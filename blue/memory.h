@@ -27,6 +27,6 @@
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
 
 // frees all objects
-void freeObjects();
+void freeObjects(VM *vm);
 
 #endif
\ No newline at end of file
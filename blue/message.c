@@ -0,0 +1,545 @@
+#include <string.h>
+
+#include "channel.h"
+#include "memory.h"
+#include "message.h"
+#include "vm.h"
+
+// every value starts with a tag. an object is numbered the first time it
+// is written, later occurrences are a reference to that number
+typedef enum
+{
+    TAG_NIL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_NUMBER,
+    TAG_INT,
+    TAG_REFERENCE,
+    TAG_BOUND_METHOD,
+    TAG_CHANNEL,
+    TAG_CLASS,
+    TAG_CLOSURE,
+    TAG_FLOAT64_ARRAY,
+    TAG_FUNCTION,
+    TAG_INSTANCE,
+    TAG_LIST,
+    TAG_MAP,
+    TAG_NATIVE,
+    TAG_STRING,
+    TAG_UPVALUE,
+} Tag;
+
+Message *createMessage()
+{
+    Message *message = ALLOCATE(Message, 1);
+    atomic_init(&message->next, NULL);
+    message->bytes = NULL;
+    message->count = 0;
+    message->capacity = 0;
+    initMap(&message->objects);
+    message->objectCount = 0;
+    message->channelCount = 0;
+    message->channelCapacity = 0;
+    message->channels = NULL;
+    return message;
+}
+
+void freeMessage(Message *message)
+{
+    for (int i = 0; i < message->channelCount; i++)
+        releaseChannel(message->channels[i]);
+
+    FREE_ARRAY(Channel *, message->channels, message->channelCapacity);
+    FREE_ARRAY(uint8_t, message->bytes, message->capacity);
+    freeMap(&message->objects);
+    FREE(Message, message);
+}
+
+static void writeBytes(Message *message, const void *bytes, size_t length)
+{
+    if (length == 0)
+        return;
+
+    if (message->count + length > message->capacity)
+    {
+        size_t capacity = message->capacity;
+        while (message->count + length > capacity)
+            capacity = GROW_CAPACITY(capacity);
+
+        message->bytes = GROW_ARRAY(uint8_t, message->bytes, message->capacity, capacity);
+        message->capacity = capacity;
+    }
+
+    memcpy(message->bytes + message->count, bytes, length);
+    message->count += length;
+}
+
+static void writeByte(Message *message, uint8_t byte)
+{
+    writeBytes(message, &byte, 1);
+}
+
+static void writeInt(Message *message, int32_t value)
+{
+    writeBytes(message, &value, sizeof(value));
+}
+
+// number an object the first time it is seen, afterwards write a reference
+static bool firstWrite(Message *message, Obj *object)
+{
+    Value index;
+    if (mapGet(&message->objects, OBJ_VAL(object), &index))
+    {
+        writeByte(message, TAG_REFERENCE);
+        writeInt(message, (int32_t)AS_INT(index));
+        return false;
+    }
+
+    mapSet(&message->objects, OBJ_VAL(object), INT_VAL(message->objectCount++));
+    return true;
+}
+
+static void writeFunction(Message *message, ObjFunction *function)
+{
+    Chunk *chunk = &function->chunk;
+    writeByte(message, TAG_FUNCTION);
+    writeInt(message, function->arity);
+    writeInt(message, function->upvalueCount);
+    writeValue(message, function->name == NULL ? NIL_VAL : OBJ_VAL(function->name));
+
+    writeInt(message, chunk->count);
+    writeBytes(message, chunk->code, (size_t)chunk->count);
+    writeBytes(message, chunk->lines, sizeof(int) * (size_t)chunk->count);
+
+    writeInt(message, chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++)
+        writeValue(message, chunk->constants.values[i]);
+
+    // caches start empty in the new vm, only their number matters
+    writeInt(message, chunk->cacheCount);
+    writeInt(message, chunk->invokeCacheCount);
+
+    writeInt(message, chunk->loopCount);
+    for (int i = 0; i < chunk->loopCount; i++)
+        writeInt(message, chunk->loops[i].offset);
+}
+
+static void writeInstance(Message *message, ObjInstance *instance)
+{
+    writeByte(message, TAG_INSTANCE);
+    writeValue(message, OBJ_VAL(instance->klass));
+
+    // field names in slot order, the reader builds its own shape from them
+    int fieldCount = instance->shape->fieldCount;
+    writeInt(message, fieldCount);
+
+    ObjString **names = ALLOCATE(ObjString *, fieldCount);
+    for (ObjShape *shape = instance->shape; shape->parent != NULL; shape = shape->parent)
+        names[shape->slot] = shape->name;
+
+    for (int i = 0; i < fieldCount; i++)
+        writeValue(message, OBJ_VAL(names[i]));
+    FREE_ARRAY(ObjString *, names, fieldCount);
+
+    for (int i = 0; i < fieldCount; i++)
+        writeValue(message, instance->fields[i]);
+}
+
+static void writeObject(Message *message, Obj *object)
+{
+    // shapes are never values, instances write their field names instead.
+    // a fiber's frames only mean anything in the vm that runs it
+    if (object->type == OBJ_SHAPE || object->type == OBJ_FIBER)
+    {
+        writeByte(message, TAG_NIL);
+        return;
+    }
+
+    if (!firstWrite(message, object))
+        return;
+
+    switch (object->type)
+    {
+    case OBJ_BOUND_METHOD:
+    {
+        ObjBoundMethod *bound = (ObjBoundMethod *)object;
+        writeByte(message, TAG_BOUND_METHOD);
+        writeValue(message, bound->receiver);
+        writeValue(message, OBJ_VAL(bound->method));
+        break;
+    }
+    case OBJ_CHANNEL:
+    {
+        Channel *channel = ((ObjChannel *)object)->channel;
+        writeByte(message, TAG_CHANNEL);
+        writeBytes(message, &channel, sizeof(channel));
+
+        if (message->channelCount == message->channelCapacity)
+        {
+            int capacity = GROW_CAPACITY(message->channelCapacity);
+            message->channels = GROW_ARRAY(Channel *, message->channels, message->channelCapacity, capacity);
+            message->channelCapacity = capacity;
+        }
+        message->channels[message->channelCount++] = retainChannel(channel);
+        break;
+    }
+    case OBJ_CLASS:
+    {
+        // methods were copied down from the superclass on inherit
+        ObjClass *klass = (ObjClass *)object;
+        writeByte(message, TAG_CLASS);
+        writeValue(message, OBJ_VAL(klass->name));
+        writeInt(message, klass->methods.count);
+        for (int i = 0; i < klass->methods.capacity; i++)
+        {
+            if (klass->methods.keys[i] == NULL)
+                continue;
+
+            writeValue(message, OBJ_VAL(klass->methods.keys[i]));
+            writeValue(message, klass->methods.values[i]);
+        }
+        break;
+    }
+    case OBJ_CLOSURE:
+    {
+        ObjClosure *closure = (ObjClosure *)object;
+        writeByte(message, TAG_CLOSURE);
+        writeValue(message, OBJ_VAL(closure->function));
+        for (int i = 0; i < closure->upvalueCount; i++)
+            writeValue(message, OBJ_VAL(closure->upvalues[i]));
+        break;
+    }
+    case OBJ_FLOAT64_ARRAY:
+    {
+        ObjFloat64Array *array = (ObjFloat64Array *)object;
+        writeByte(message, TAG_FLOAT64_ARRAY);
+        writeInt(message, array->length);
+        writeBytes(message, array->values, sizeof(double) * (size_t)array->length);
+        break;
+    }
+    case OBJ_FUNCTION:
+        writeFunction(message, (ObjFunction *)object);
+        break;
+    case OBJ_INSTANCE:
+        writeInstance(message, (ObjInstance *)object);
+        break;
+    case OBJ_LIST:
+    {
+        ObjList *list = (ObjList *)object;
+        writeByte(message, TAG_LIST);
+        writeInt(message, list->items.count);
+        for (int i = 0; i < list->items.count; i++)
+            writeValue(message, list->items.values[i]);
+        break;
+    }
+    case OBJ_MAP:
+    {
+        Map *map = &((ObjMap *)object)->map;
+        writeByte(message, TAG_MAP);
+        writeInt(message, map->count);
+        for (int i = 0; i < map->entryCount; i++)
+        {
+            if (mapEntryIsRemoved(&map->entries[i]))
+                continue;
+
+            writeValue(message, map->entries[i].key);
+            writeValue(message, map->entries[i].value);
+        }
+        break;
+    }
+    case OBJ_NATIVE:
+    {
+        // the same C function in every vm of the process
+        NativeFunc function = ((ObjNative *)object)->function;
+        writeByte(message, TAG_NATIVE);
+        writeBytes(message, &function, sizeof(function));
+        break;
+    }
+    case OBJ_STRING:
+    {
+        ObjString *string = (ObjString *)object;
+        writeByte(message, TAG_STRING);
+        writeInt(message, string->length);
+        writeBytes(message, string->chars, (size_t)string->length);
+        break;
+    }
+    case OBJ_UPVALUE:
+    {
+        // open or closed, what arrives is the variable's current value
+        ObjUpvalue *upvalue = (ObjUpvalue *)object;
+        writeByte(message, TAG_UPVALUE);
+        writeValue(message, *upvalue->location);
+        break;
+    }
+    case OBJ_FIBER:
+    case OBJ_SHAPE:
+        break;
+    }
+}
+
+void writeValue(Message *message, Value value)
+{
+    switch (value.type)
+    {
+    case VAL_BOOL:
+        writeByte(message, AS_BOOL(value) ? TAG_TRUE : TAG_FALSE);
+        break;
+    case VAL_NIL:
+        writeByte(message, TAG_NIL);
+        break;
+    case VAL_NUMBER:
+        writeByte(message, TAG_NUMBER);
+        writeBytes(message, &value.as.number, sizeof(double));
+        break;
+    case VAL_INT:
+        writeByte(message, TAG_INT);
+        writeBytes(message, &value.as.integer, sizeof(int64_t));
+        break;
+    case VAL_OBJ:
+        writeObject(message, AS_OBJ(value));
+        break;
+    }
+}
+
+void initMessageReader(MessageReader *reader, Message *message)
+{
+    reader->message = message;
+    reader->position = 0;
+    initValueArray(&reader->objects);
+}
+
+void freeMessageReader(MessageReader *reader)
+{
+    freeValueArray(&reader->objects);
+}
+
+static void readBytes(MessageReader *reader, void *bytes, size_t length)
+{
+    if (length == 0)
+        return;
+
+    memcpy(bytes, reader->message->bytes + reader->position, length);
+    reader->position += length;
+}
+
+static uint8_t readByte(MessageReader *reader)
+{
+    return reader->message->bytes[reader->position++];
+}
+
+static int32_t readInt(MessageReader *reader)
+{
+    int32_t value;
+    readBytes(reader, &value, sizeof(value));
+    return value;
+}
+
+// objects are numbered before their contents are read, so a reference
+// back to an object still being read finds it
+static int reserveObject(MessageReader *reader)
+{
+    writeArrayValue(&reader->objects, NIL_VAL);
+    return reader->objects.count - 1;
+}
+
+static Value setObject(MessageReader *reader, int index, void *object)
+{
+    reader->objects.values[index] = OBJ_VAL(object);
+    return reader->objects.values[index];
+}
+
+static Value readFunction(VM *vm, MessageReader *reader)
+{
+    int index = reserveObject(reader);
+    ObjFunction *function = newFunction(vm);
+    setObject(reader, index, function);
+
+    function->arity = readInt(reader);
+    function->upvalueCount = readInt(reader);
+    Value name = readValue(vm, reader);
+    function->name = IS_NIL(name) ? NULL : AS_STRING(name);
+
+    Chunk *chunk = &function->chunk;
+    int count = readInt(reader);
+    uint8_t *code = reader->message->bytes + reader->position;
+    reader->position += (size_t)count;
+    for (int i = 0; i < count; i++)
+    {
+        int line;
+        readBytes(reader, &line, sizeof(line));
+        writeChunk(chunk, code[i], line);
+    }
+
+    int constantCount = readInt(reader);
+    for (int i = 0; i < constantCount; i++)
+        addConstant(chunk, readValue(vm, reader));
+
+    int cacheCount = readInt(reader);
+    for (int i = 0; i < cacheCount; i++)
+        addPropertyCache(chunk);
+
+    int invokeCacheCount = readInt(reader);
+    for (int i = 0; i < invokeCacheCount; i++)
+        addInvokeCache(chunk);
+
+    int loopCount = readInt(reader);
+    for (int i = 0; i < loopCount; i++)
+        addLoop(chunk, readInt(reader));
+
+    function->maxSlots = maxStackDepth(chunk, function->arity + 1);
+    return OBJ_VAL(function);
+}
+
+static Value readInstance(VM *vm, MessageReader *reader)
+{
+    int index = reserveObject(reader);
+    ObjClass *klass = AS_CLASS(readValue(vm, reader));
+    ObjInstance *instance = newInstance(vm, klass, vm->rootShape);
+    setObject(reader, index, instance);
+
+    int fieldCount = readInt(reader);
+    ObjShape *shape = vm->rootShape;
+    for (int i = 0; i < fieldCount; i++)
+        shape = shapeAddField(vm, shape, AS_STRING(readValue(vm, reader)));
+
+    if (fieldCount > 0)
+    {
+        instance->fields = ALLOCATE(Value, fieldCount);
+        instance->fieldCapacity = fieldCount;
+        for (int i = 0; i < fieldCount; i++)
+            instance->fields[i] = NIL_VAL;
+    }
+    instance->shape = shape;
+
+    for (int i = 0; i < fieldCount; i++)
+        instance->fields[i] = readValue(vm, reader);
+
+    return OBJ_VAL(instance);
+}
+
+Value readValue(VM *vm, MessageReader *reader)
+{
+    switch (readByte(reader))
+    {
+    case TAG_NIL:
+        return NIL_VAL;
+    case TAG_FALSE:
+        return BOOL_VAL(false);
+    case TAG_TRUE:
+        return BOOL_VAL(true);
+    case TAG_NUMBER:
+    {
+        double number;
+        readBytes(reader, &number, sizeof(number));
+        return NUMBER_VAL(number);
+    }
+    case TAG_INT:
+    {
+        int64_t integer;
+        readBytes(reader, &integer, sizeof(integer));
+        return INT_VAL(integer);
+    }
+    case TAG_REFERENCE:
+        return reader->objects.values[readInt(reader)];
+    case TAG_BOUND_METHOD:
+    {
+        int index = reserveObject(reader);
+        ObjBoundMethod *bound = newBoundMethod(vm, NIL_VAL, NULL);
+        setObject(reader, index, bound);
+        bound->receiver = readValue(vm, reader);
+        bound->method = AS_OBJ(readValue(vm, reader));
+        return OBJ_VAL(bound);
+    }
+    case TAG_CHANNEL:
+    {
+        Channel *channel;
+        readBytes(reader, &channel, sizeof(channel));
+        return setObject(reader, reserveObject(reader), newChannel(vm, channel));
+    }
+    case TAG_CLASS:
+    {
+        int index = reserveObject(reader);
+        ObjClass *klass = newClass(vm, AS_STRING(readValue(vm, reader)));
+        setObject(reader, index, klass);
+
+        int methodCount = readInt(reader);
+        for (int i = 0; i < methodCount; i++)
+        {
+            ObjString *name = AS_STRING(readValue(vm, reader));
+            tableSet(&klass->methods, name, readValue(vm, reader));
+        }
+        return OBJ_VAL(klass);
+    }
+    case TAG_CLOSURE:
+    {
+        int index = reserveObject(reader);
+        ObjClosure *closure = newClosure(vm, AS_FUNCTION(readValue(vm, reader)));
+        setObject(reader, index, closure);
+        for (int i = 0; i < closure->upvalueCount; i++)
+            closure->upvalues[i] = (ObjUpvalue *)AS_OBJ(readValue(vm, reader));
+        return OBJ_VAL(closure);
+    }
+    case TAG_FLOAT64_ARRAY:
+    {
+        int length = readInt(reader);
+        ObjFloat64Array *array = newFloat64Array(vm, length);
+        readBytes(reader, array->values, sizeof(double) * (size_t)length);
+        return setObject(reader, reserveObject(reader), array);
+    }
+    case TAG_FUNCTION:
+        return readFunction(vm, reader);
+    case TAG_INSTANCE:
+        return readInstance(vm, reader);
+    case TAG_LIST:
+    {
+        int index = reserveObject(reader);
+        ObjList *list = newList(vm);
+        setObject(reader, index, list);
+
+        int count = readInt(reader);
+        reserveValueArray(&list->items, count);
+        for (int i = 0; i < count; i++)
+            writeArrayValue(&list->items, readValue(vm, reader));
+        return OBJ_VAL(list);
+    }
+    case TAG_MAP:
+    {
+        int index = reserveObject(reader);
+        ObjMap *map = newMap(vm);
+        setObject(reader, index, map);
+
+        int count = readInt(reader);
+        for (int i = 0; i < count; i++)
+        {
+            Value key = readValue(vm, reader);
+            mapSet(&map->map, key, readValue(vm, reader));
+        }
+        return OBJ_VAL(map);
+    }
+    case TAG_NATIVE:
+    {
+        NativeFunc function;
+        readBytes(reader, &function, sizeof(function));
+        return setObject(reader, reserveObject(reader), newNative(vm, function));
+    }
+    case TAG_STRING:
+    {
+        int length = readInt(reader);
+        const char *chars = (const char *)reader->message->bytes + reader->position;
+        reader->position += (size_t)length;
+        return setObject(reader, reserveObject(reader), copyString(vm, chars, length));
+    }
+    case TAG_UPVALUE:
+    {
+        int index = reserveObject(reader);
+        ObjUpvalue *upvalue = newUpvalue(vm, NULL);
+        upvalue->location = &upvalue->closed;
+        setObject(reader, index, upvalue);
+        upvalue->closed = readValue(vm, reader);
+        return OBJ_VAL(upvalue);
+    }
+    default:
+        // unreachable, messages are only read by this file
+        return NIL_VAL;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef blue_message_h
+#define blue_message_h
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+struct Channel;
+
+// values copied out of one vm into a flat buffer owned by no vm, so it can
+// cross to another thread. whoever holds the message owns it and moves it
+// on without copying, the values are rebuilt once in the vm that reads it
+typedef struct Message
+{
+    // next message in a channel's queue
+    _Atomic(struct Message *) next;
+
+    // tagged values, written and read in the same order
+    uint8_t *bytes;
+    size_t count;
+    size_t capacity;
+
+    // object -> the index it was written under, so shared and cyclic
+    // structure is written once and arrives shared and cyclic
+    Map objects;
+    int objectCount;
+
+    // channels travel by reference, the message holds one on each
+    int channelCount;
+    int channelCapacity;
+    struct Channel **channels;
+} Message;
+
+// reads a message's values into a vm, in the order they were written
+typedef struct
+{
+    Message *message;
+    size_t position;
+
+    // objects rebuilt so far, by the index they were written under
+    ValueArray objects;
+} MessageReader;
+
+// empty message
+Message *createMessage();
+
+// append a value and everything it references
+void writeValue(Message *message, Value value);
+
+// free the buffer and drop the message's channel references
+void freeMessage(Message *message);
+
+// start reading from the first value
+void initMessageReader(MessageReader *reader, Message *message);
+
+// rebuild the next value inside vm
+Value readValue(VM *vm, MessageReader *reader);
+
+// the reader's bookkeeping, the values read stay in the vm
+void freeMessageReader(MessageReader *reader);
+
+#endif
@@ -0,0 +1,1163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "channel.h"
+#include "events.h"
+#include "files.h"
+#include "float64.h"
+#include "memory.h"
+#include "natives.h"
+#include "object.h"
+#include "scheduler.h"
+#include "spawn.h"
+#include "vm.h"
+
+// methods of built-in types read their receiver from args[-1], slot 0
+// of the call, and leave the result there as every native does.
+// the function forms, like append(list, item), check the receiver
+// themselves and then run the method with args shifted by one
+
+// natives report a wrong number of arguments as a runtime error
+static bool checkArity(VM *vm, const char *name, int expected, int argCount)
+{
+    if (argCount != expected)
+    {
+        runtimeError(vm, "%s() expected %d arguments but got %d.", name, expected, argCount);
+        return false;
+    }
+
+    return true;
+}
+
+// function forms take their receiver as the first argument
+static bool checkReceiver(VM *vm, const char *name, Value receiver, ObjType type, const char *typeName)
+{
+    if (!isObjType(receiver, type))
+    {
+        runtimeError(vm, "%s() expects a %s.", name, typeName);
+        return false;
+    }
+
+    return true;
+}
+
+// run a method with the first argument as its receiver
+static bool callWithReceiver(VM *vm, NativeFunc method, int argCount, Value *args)
+{
+    if (!method(vm, argCount - 1, args + 1))
+        return false;
+
+    // the method left its result where the receiver was
+    args[-1] = args[0];
+    return true;
+}
+
+// written so NaN fails the range check too
+bool toIndex(VM *vm, Value value, int length, int *index)
+{
+    // integers need only the range check
+    if (IS_INT(value) && AS_INT(value) >= 0 && AS_INT(value) < length)
+    {
+        *index = (int)AS_INT(value);
+        return true;
+    }
+
+    if (!IS_NUMBER(value))
+    {
+        runtimeError(vm, "Index must be a number.");
+        return false;
+    }
+
+    double number = AS_NUMBER(value);
+    if (!(number >= 0 && number < length) || number != (int)number)
+    {
+        runtimeError(vm, "Index %g is out of bounds for length %d.", number, length);
+        return false;
+    }
+
+    *index = (int)number;
+    return true;
+}
+
+// an index, or the length itself for a range that runs to the end
+static bool toSliceBound(VM *vm, Value value, int length, int *bound)
+{
+    if (IS_NUMBER(value) && AS_NUMBER(value) == length)
+    {
+        *bound = length;
+        return true;
+    }
+
+    return toIndex(vm, value, length, bound);
+}
+
+// a file descriptor or byte count, which must be a whole number
+static bool toCount(VM *vm, const char *name, Value value, int *count)
+{
+    double number = IS_NUMBER(value) ? AS_NUMBER(value) : -1;
+    if (!(number >= 0 && number <= INT32_MAX) || number != (int)number)
+    {
+        runtimeError(vm, "%s() expects whole numbers.", name);
+        return false;
+    }
+
+    *count = (int)number;
+    return true;
+}
+
+// native functions
+static bool clockNative(VM *vm, int argCount, Value *args)
+{
+    args[-1] = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return true;
+}
+
+// printFile(path), streams the file to stdout, returns the bytes written
+static bool printFileNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "printFile", 1, argCount) || !checkReceiver(vm, "printFile", args[0], OBJ_STRING, "string"))
+        return false;
+
+    int fd = ioOpen(AS_CSTRING(args[0]), "r");
+    if (fd < 0)
+    {
+        runtimeError(vm, "Can't open file '%s'.", AS_CSTRING(args[0]));
+        return false;
+    }
+
+    // whatever print left buffered goes out first, then straight to
+    // stdout's descriptor
+    flushOutput(&vm->output);
+    long long written = streamFile(fd, 1);
+    ioClose(fd);
+
+    if (written < 0)
+    {
+        runtimeError(vm, "Can't print file '%s'.", AS_CSTRING(args[0]));
+        return false;
+    }
+
+    args[-1] = NUMBER_VAL((double)written);
+    return true;
+}
+
+// readFile(path), the file's contents as a string. it is a copy, so
+// later writes to the file can't change a string the program holds
+static bool readFileNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "readFile", 1, argCount) || !checkReceiver(vm, "readFile", args[0], OBJ_STRING, "string"))
+        return false;
+
+    int length;
+    char *chars = loadFile(AS_CSTRING(args[0]), &length);
+    if (chars == NULL)
+    {
+        runtimeError(vm, "Can't read file '%s'.", AS_CSTRING(args[0]));
+        return false;
+    }
+
+    args[-1] = OBJ_VAL(takeString(vm, chars, length));
+    return true;
+}
+
+// copyFile(from, to), replaces to with a copy of from, returns the bytes
+// copied. the kernel copies them, or shares the blocks where it can
+static bool copyFileNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "copyFile", 2, argCount) || !checkReceiver(vm, "copyFile", args[0], OBJ_STRING, "string") ||
+        !checkReceiver(vm, "copyFile", args[1], OBJ_STRING, "string"))
+        return false;
+
+    // the target isn't truncated until it's known not to be the source,
+    // copying a file onto itself would empty it
+    int from = ioOpen(AS_CSTRING(args[0]), "r");
+    int to = from < 0 ? -1 : openTarget(AS_CSTRING(args[1]));
+    if (to < 0)
+    {
+        if (from >= 0)
+            ioClose(from);
+        runtimeError(vm, "Can't copy file '%s' to '%s'.", AS_CSTRING(args[0]), AS_CSTRING(args[1]));
+        return false;
+    }
+
+    if (sameFile(from, to))
+    {
+        ioClose(from);
+        ioClose(to);
+        runtimeError(vm, "Can't copy file '%s' onto itself.", AS_CSTRING(args[0]));
+        return false;
+    }
+
+    long long copied = truncateFile(to) ? streamFile(from, to) : -1;
+    ioClose(from);
+    ioClose(to);
+
+    if (copied < 0)
+    {
+        runtimeError(vm, "Can't copy file '%s' to '%s'.", AS_CSTRING(args[0]), AS_CSTRING(args[1]));
+        return false;
+    }
+
+    args[-1] = NUMBER_VAL((double)copied);
+    return true;
+}
+
+// sendFile(source, fd), streams a file by path, or everything left on a
+// descriptor such as a pipe's read end, to fd. returns the bytes sent
+static bool sendFileNative(VM *vm, int argCount, Value *args)
+{
+    int to;
+    if (!checkArity(vm, "sendFile", 2, argCount) || !toCount(vm, "sendFile", args[1], &to))
+        return false;
+
+    int from;
+    if (IS_STRING(args[0]))
+    {
+        from = ioOpen(AS_CSTRING(args[0]), "r");
+        if (from < 0)
+        {
+            runtimeError(vm, "Can't open file '%s'.", AS_CSTRING(args[0]));
+            return false;
+        }
+    }
+    else if (!toCount(vm, "sendFile", args[0], &from))
+    {
+        return false;
+    }
+
+    // print's buffered output may be headed for the same place
+    flushOutput(&vm->output);
+    long long sent = streamFile(from, to);
+    if (IS_STRING(args[0]))
+        ioClose(from);
+
+    if (sent < 0)
+    {
+        runtimeError(vm, "sendFile() failed.");
+        return false;
+    }
+
+    args[-1] = NUMBER_VAL((double)sent);
+    return true;
+}
+
+// string.length()
+static bool stringLengthMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "length", 0, argCount))
+        return false;
+
+    args[-1] = INT_VAL(AS_STRING(args[-1])->length);
+    return true;
+}
+
+// list.append(item), add an item to the end
+static bool listAppendMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "append", 1, argCount))
+        return false;
+
+    writeArrayValue(&AS_LIST(args[-1])->items, args[0]);
+    args[-1] = NIL_VAL;
+    return true;
+}
+
+// list.pop(), remove and return the last item
+static bool listPopMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "pop", 0, argCount))
+        return false;
+
+    ObjList *list = AS_LIST(args[-1]);
+    if (list->items.count == 0)
+    {
+        runtimeError(vm, "Can't pop from an empty list.");
+        return false;
+    }
+
+    list->items.count--;
+    args[-1] = list->items.values[list->items.count];
+    return true;
+}
+
+// list.length()
+static bool listLengthMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "length", 0, argCount))
+        return false;
+
+    args[-1] = INT_VAL(AS_LIST(args[-1])->items.count);
+    return true;
+}
+
+// list.slice(start, end), copy of the items from start up to, but not including, end
+static bool listSliceMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "slice", 2, argCount))
+        return false;
+
+    ObjList *list = AS_LIST(args[-1]);
+
+    int start, end;
+    if (!toSliceBound(vm, args[0], list->items.count, &start) ||
+        !toSliceBound(vm, args[1], list->items.count, &end))
+        return false;
+
+    if (end < start)
+    {
+        runtimeError(vm, "slice() end %d comes before start %d.", end, start);
+        return false;
+    }
+
+    // one allocation and one copy for the whole range
+    ObjList *result = newList(vm);
+    reserveValueArray(&result->items, end - start);
+    if (end > start)
+    {
+        memcpy(result->items.values, list->items.values + start, sizeof(Value) * (end - start));
+    }
+    result->items.count = end - start;
+
+    args[-1] = OBJ_VAL(result);
+    return true;
+}
+
+// map.has(key)
+static bool mapHasMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "has", 1, argCount))
+        return false;
+
+    Value value;
+    args[-1] = BOOL_VAL(mapGet(&AS_MAP(args[-1])->map, args[0], &value));
+    return true;
+}
+
+// map.remove(key), returns if it was present
+static bool mapRemoveMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "remove", 1, argCount))
+        return false;
+
+    args[-1] = BOOL_VAL(mapDelete(&AS_MAP(args[-1])->map, args[0]));
+    return true;
+}
+
+// map.keys(), list of keys in insertion order
+static bool mapKeysMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "keys", 0, argCount))
+        return false;
+
+    Map *map = &AS_MAP(args[-1])->map;
+    ObjList *list = newList(vm);
+    reserveValueArray(&list->items, map->count);
+
+    // entries are dense, so this is a linear walk
+    for (int i = 0; i < map->entryCount; i++)
+    {
+        if (!mapEntryIsRemoved(&map->entries[i]))
+        {
+            list->items.values[list->items.count++] = map->entries[i].key;
+        }
+    }
+
+    args[-1] = OBJ_VAL(list);
+    return true;
+}
+
+// map.length()
+static bool mapLengthMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "length", 0, argCount))
+        return false;
+
+    args[-1] = INT_VAL(AS_MAP(args[-1])->map.count);
+    return true;
+}
+
+// elementwise methods need both arrays to line up
+static bool checkFloat64Operand(VM *vm, const char *name, Value receiver, Value operand)
+{
+    if (!IS_FLOAT64_ARRAY(operand))
+    {
+        runtimeError(vm, "%s() expects a Float64Array.", name);
+        return false;
+    }
+
+    if (AS_FLOAT64_ARRAY(receiver)->length != AS_FLOAT64_ARRAY(operand)->length)
+    {
+        runtimeError(vm, "%s() expects arrays of the same length.", name);
+        return false;
+    }
+
+    return true;
+}
+
+// array.length()
+static bool float64LengthMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "length", 0, argCount))
+        return false;
+
+    args[-1] = INT_VAL(AS_FLOAT64_ARRAY(args[-1])->length);
+    return true;
+}
+
+// array.sum()
+static bool float64SumMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "sum", 0, argCount))
+        return false;
+
+    ObjFloat64Array *array = AS_FLOAT64_ARRAY(args[-1]);
+    args[-1] = NUMBER_VAL(float64Sum(array->values, array->length));
+    return true;
+}
+
+// array.dot(other)
+static bool float64DotMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "dot", 1, argCount) || !checkFloat64Operand(vm, "dot", args[-1], args[0]))
+        return false;
+
+    ObjFloat64Array *a = AS_FLOAT64_ARRAY(args[-1]);
+    ObjFloat64Array *b = AS_FLOAT64_ARRAY(args[0]);
+    args[-1] = NUMBER_VAL(float64Dot(a->values, b->values, a->length));
+    return true;
+}
+
+// array.min()
+static bool float64MinMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "min", 0, argCount))
+        return false;
+
+    ObjFloat64Array *array = AS_FLOAT64_ARRAY(args[-1]);
+    if (array->length == 0)
+    {
+        runtimeError(vm, "min() of an empty array.");
+        return false;
+    }
+
+    args[-1] = NUMBER_VAL(float64Min(array->values, array->length));
+    return true;
+}
+
+// array.max()
+static bool float64MaxMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "max", 0, argCount))
+        return false;
+
+    ObjFloat64Array *array = AS_FLOAT64_ARRAY(args[-1]);
+    if (array->length == 0)
+    {
+        runtimeError(vm, "max() of an empty array.");
+        return false;
+    }
+
+    args[-1] = NUMBER_VAL(float64Max(array->values, array->length));
+    return true;
+}
+
+// array.scale(factor), new array with every item multiplied by a number
+static bool float64ScaleMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "scale", 1, argCount))
+        return false;
+
+    if (!IS_NUMBER(args[0]))
+    {
+        runtimeError(vm, "scale() factor must be a number.");
+        return false;
+    }
+
+    ObjFloat64Array *array = AS_FLOAT64_ARRAY(args[-1]);
+    ObjFloat64Array *result = newFloat64Array(vm, array->length);
+    float64Scale(result->values, array->values, AS_NUMBER(args[0]), array->length);
+
+    args[-1] = OBJ_VAL(result);
+    return true;
+}
+
+// array.add(other), new array of pairwise sums
+static bool float64AddMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "add", 1, argCount) || !checkFloat64Operand(vm, "add", args[-1], args[0]))
+        return false;
+
+    ObjFloat64Array *a = AS_FLOAT64_ARRAY(args[-1]);
+    ObjFloat64Array *b = AS_FLOAT64_ARRAY(args[0]);
+    ObjFloat64Array *result = newFloat64Array(vm, a->length);
+    float64Add(result->values, a->values, b->values, a->length);
+
+    args[-1] = OBJ_VAL(result);
+    return true;
+}
+
+// array.mul(other), new array of pairwise products
+static bool float64MulMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "mul", 1, argCount) || !checkFloat64Operand(vm, "mul", args[-1], args[0]))
+        return false;
+
+    ObjFloat64Array *a = AS_FLOAT64_ARRAY(args[-1]);
+    ObjFloat64Array *b = AS_FLOAT64_ARRAY(args[0]);
+    ObjFloat64Array *result = newFloat64Array(vm, a->length);
+    float64Mul(result->values, a->values, b->values, a->length);
+
+    args[-1] = OBJ_VAL(result);
+    return true;
+}
+
+// array.prefixSum(), new array of running totals
+static bool float64PrefixSumMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "prefixSum", 0, argCount))
+        return false;
+
+    ObjFloat64Array *array = AS_FLOAT64_ARRAY(args[-1]);
+    ObjFloat64Array *result = newFloat64Array(vm, array->length);
+    float64PrefixSum(result->values, array->values, array->length);
+
+    args[-1] = OBJ_VAL(result);
+    return true;
+}
+
+// channel.send(value), copy a value to whichever vm receives it
+static bool channelSendMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "send", 1, argCount))
+        return false;
+
+    // the receiver may print as soon as it has the value
+    flushOutput(&vm->output);
+
+    Message *message = createMessage();
+    writeValue(message, args[0]);
+    channelSend(AS_CHANNEL(args[-1]), message);
+
+    args[-1] = NIL_VAL;
+    return true;
+}
+
+// channel.receive(), the oldest value sent, waiting for one if need be
+static bool channelReceiveMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "receive", 0, argCount))
+        return false;
+
+    // the sender may print while this vm waits
+    flushOutput(&vm->output);
+
+    Message *message = channelReceive(AS_CHANNEL(args[-1]), true);
+    if (message == NULL)
+    {
+        runtimeError(vm, "Can't wait on an empty channel without threads.");
+        return false;
+    }
+
+    MessageReader reader;
+    initMessageReader(&reader, message);
+    args[-1] = readValue(vm, &reader);
+    freeMessageReader(&reader);
+    freeMessage(message);
+    return true;
+}
+
+// channel(), a new empty channel
+static bool channelNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "channel", 0, argCount))
+        return false;
+
+    Channel *channel = createChannel();
+    args[-1] = OBJ_VAL(newChannel(vm, channel));
+    releaseChannel(channel);
+    return true;
+}
+
+// spawn(function, args...), call function with copies of args in a new vm on
+// a worker thread, returns a channel that receives the call's result.
+// workers are a fixed pool, one per core, so a spawned call waiting on
+// a call queued behind it can wait forever
+static bool spawnNative(VM *vm, int argCount, Value *args)
+{
+    if (argCount == 0 || !(IS_CLOSURE(args[0]) || IS_FUNCTION(args[0]) || IS_BOUND_METHOD(args[0])))
+    {
+        runtimeError(vm, "spawn() expects a function and its arguments.");
+        return false;
+    }
+
+    // what this vm printed goes out before anything the call prints
+    flushOutput(&vm->output);
+
+    Channel *result = spawnCall(vm, args[0], argCount - 1, args + 1);
+    if (result == NULL)
+    {
+        runtimeError(vm, "spawn() needs threads, which this platform lacks.");
+        return false;
+    }
+
+    args[-1] = OBJ_VAL(newChannel(vm, result));
+    releaseChannel(result);
+    return true;
+}
+
+// task(function, args...), like spawn() but run on the work-stealing
+// workers in a vm kept between tasks. a task may await the tasks it starts
+static bool taskNative(VM *vm, int argCount, Value *args)
+{
+    if (argCount == 0 || !(IS_CLOSURE(args[0]) || IS_FUNCTION(args[0]) || IS_BOUND_METHOD(args[0])))
+    {
+        runtimeError(vm, "task() expects a function and its arguments.");
+        return false;
+    }
+
+    // what this vm printed goes out before anything the task prints
+    flushOutput(&vm->output);
+
+    Channel *result = submitTask(vm, args[0], argCount - 1, args + 1);
+    args[-1] = OBJ_VAL(newChannel(vm, result));
+    releaseChannel(result);
+    return true;
+}
+
+// await(channel), receive() that keeps a worker busy with other tasks
+static bool awaitNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "await", 1, argCount) || !checkReceiver(vm, "await", args[0], OBJ_CHANNEL, "channel"))
+        return false;
+
+    // other vms print while this one waits
+    flushOutput(&vm->output);
+
+    Message *message = awaitMessage(AS_CHANNEL(args[0]));
+    if (message == NULL)
+    {
+        runtimeError(vm, "Can't wait on an empty channel without threads.");
+        return false;
+    }
+
+    MessageReader reader;
+    initMessageReader(&reader, message);
+    args[-1] = readValue(vm, &reader);
+    freeMessageReader(&reader);
+    freeMessage(message);
+    return true;
+}
+
+static void setStat(VM *vm, ObjMap *map, const char *name, Value value)
+{
+    mapSet(&map->map, OBJ_VAL(copyString(vm, name, (int)strlen(name))), value);
+}
+
+// taskStats(), a map per worker of tasks run, steals, failed steals, and
+// seconds busy and idle
+static bool taskStatsNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "taskStats", 0, argCount))
+        return false;
+
+    int workerCount = taskStats(NULL, 0);
+    WorkerStats *stats = ALLOCATE(WorkerStats, workerCount);
+    taskStats(stats, workerCount);
+
+    ObjList *list = newList(vm);
+    args[-1] = OBJ_VAL(list);
+    for (int i = 0; i < workerCount; i++)
+    {
+        double busy = stats[i].busyNanos / 1e9;
+        double idle = stats[i].idleNanos / 1e9;
+
+        ObjMap *map = newMap(vm);
+        setStat(vm, map, "tasks", NUMBER_VAL((double)stats[i].tasks));
+        setStat(vm, map, "steals", NUMBER_VAL((double)stats[i].steals));
+        setStat(vm, map, "failedSteals", NUMBER_VAL((double)stats[i].failedSteals));
+        setStat(vm, map, "busy", NUMBER_VAL(busy));
+        setStat(vm, map, "idle", NUMBER_VAL(idle));
+        setStat(vm, map, "utilization", NUMBER_VAL(busy + idle > 0 ? busy / (busy + idle) : 0));
+        writeArrayValue(&list->items, OBJ_VAL(map));
+    }
+
+    FREE_ARRAY(WorkerStats, stats, workerCount);
+    return true;
+}
+
+// fiber(function), suspended before its first instruction
+static bool fiberNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "fiber", 1, argCount))
+        return false;
+
+    if (!(IS_CLOSURE(args[0]) || IS_FUNCTION(args[0]) || IS_BOUND_METHOD(args[0])))
+    {
+        runtimeError(vm, "fiber() expects a function.");
+        return false;
+    }
+
+    args[-1] = OBJ_VAL(newFiber(vm, args[0]));
+    return true;
+}
+
+// fiber.resume(args...), runs it to its next yield or its return
+static bool fiberResumeMethod(VM *vm, int argCount, Value *args)
+{
+    return resumeFiber(vm, AS_FIBER(args[-1]), argCount, args, &args[-1]);
+}
+
+// fiber.done(), whether it returned and can't be resumed again
+static bool fiberDoneMethod(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "done", 0, argCount))
+        return false;
+
+    args[-1] = BOOL_VAL(AS_FIBER(args[-1])->state == FIBER_DONE);
+    return true;
+}
+
+static bool resumeNative(VM *vm, int argCount, Value *args)
+{
+    if (argCount == 0 || !IS_FIBER(args[0]))
+    {
+        runtimeError(vm, "resume() expects a fiber.");
+        return false;
+    }
+
+    return callWithReceiver(vm, fiberResumeMethod, argCount, args);
+}
+
+// who gets the result of a read or write: the callback if there is one,
+// or else the running fiber, which parks until the event loop resumes it
+static bool ioWaiter(VM *vm, const char *name, int argCount, int expected, Value *args, Value *waiter)
+{
+    if (argCount == expected + 1)
+    {
+        *waiter = args[expected];
+        if (IS_CLOSURE(*waiter) || IS_FUNCTION(*waiter) || IS_BOUND_METHOD(*waiter))
+            return true;
+
+        runtimeError(vm, "%s() callback must be a function.", name);
+        return false;
+    }
+
+    if (!checkArity(vm, name, expected, argCount))
+        return false;
+
+    if (vm->fiber == NULL)
+    {
+        runtimeError(vm, "%s() outside a fiber needs a callback.", name);
+        return false;
+    }
+
+    *waiter = OBJ_VAL(vm->fiber);
+    return true;
+}
+
+// the call parked its fiber, it evaluates to the result once resumed
+static void parkOnIo(VM *vm, Value waiter)
+{
+    if (IS_FIBER(waiter))
+        AS_FIBER(waiter)->state = FIBER_WAITING;
+}
+
+// flush(), write out what print has collected so far
+static bool flushNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "flush", 0, argCount))
+        return false;
+
+    flushOutput(&vm->output);
+    args[-1] = NIL_VAL;
+    return true;
+}
+
+// readAsync(fd, length, callback?), up to length bytes as a string, "" at
+// the end of the input or nil on failure
+static bool readAsyncNative(VM *vm, int argCount, Value *args)
+{
+    Value waiter;
+    int fd, length;
+    if (!ioWaiter(vm, "readAsync", argCount, 2, args, &waiter) ||
+        !toCount(vm, "readAsync", args[0], &fd) || !toCount(vm, "readAsync", args[1], &length))
+        return false;
+
+    if (!ioRead(vm, fd, length, waiter))
+    {
+        runtimeError(vm, "readAsync() needs threads, which this platform lacks.");
+        return false;
+    }
+
+    parkOnIo(vm, waiter);
+    args[-1] = NIL_VAL;
+    return true;
+}
+
+// writeAsync(fd, string, callback?), the byte count once all of it is
+// written or nil on failure
+static bool writeAsyncNative(VM *vm, int argCount, Value *args)
+{
+    Value waiter;
+    int fd;
+    if (!ioWaiter(vm, "writeAsync", argCount, 2, args, &waiter) || !toCount(vm, "writeAsync", args[0], &fd) ||
+        !checkReceiver(vm, "writeAsync", args[1], OBJ_STRING, "string"))
+        return false;
+
+    // whatever print left buffered goes out first
+    flushOutput(&vm->output);
+
+    ObjString *string = AS_STRING(args[1]);
+    if (!ioWrite(vm, fd, string->chars, string->length, waiter))
+    {
+        runtimeError(vm, "writeAsync() needs threads, which this platform lacks.");
+        return false;
+    }
+
+    parkOnIo(vm, waiter);
+    args[-1] = NIL_VAL;
+    return true;
+}
+
+// runLoop(), wait for every read and write in flight and hand out results
+static bool runLoopNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "runLoop", 0, argCount))
+        return false;
+
+    // the loop resumes fibers, which can't happen from inside one
+    if (vm->fiber != NULL)
+    {
+        runtimeError(vm, "Can't run the event loop inside a fiber.");
+        return false;
+    }
+
+    args[-1] = NIL_VAL;
+    return runEventLoop(vm);
+}
+
+// openFile(path, mode), a file descriptor for "r", "w" or "a"
+static bool openFileNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "openFile", 2, argCount) || !checkReceiver(vm, "openFile", args[0], OBJ_STRING, "string") ||
+        !checkReceiver(vm, "openFile", args[1], OBJ_STRING, "string"))
+        return false;
+
+    int fd = ioOpen(AS_CSTRING(args[0]), AS_CSTRING(args[1]));
+    if (fd < 0)
+    {
+        runtimeError(vm, "Can't open file '%s' with mode '%s'.", AS_CSTRING(args[0]), AS_CSTRING(args[1]));
+        return false;
+    }
+
+    args[-1] = INT_VAL(fd);
+    return true;
+}
+
+// closeFile(fd), whether it was open
+static bool closeFileNative(VM *vm, int argCount, Value *args)
+{
+    int fd;
+    if (!checkArity(vm, "closeFile", 1, argCount) || !toCount(vm, "closeFile", args[0], &fd))
+        return false;
+
+    args[-1] = BOOL_VAL(ioClose(fd));
+    return true;
+}
+
+// pipe(), a list of the read end's and the write end's descriptors
+static bool pipeNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "pipe", 0, argCount))
+        return false;
+
+    int fds[2];
+    if (!ioPipe(fds))
+    {
+        runtimeError(vm, "Can't create a pipe.");
+        return false;
+    }
+
+    ObjList *list = newList(vm);
+    writeArrayValue(&list->items, INT_VAL(fds[0]));
+    writeArrayValue(&list->items, INT_VAL(fds[1]));
+    args[-1] = OBJ_VAL(list);
+    return true;
+}
+
+// float64Array(length) of zeros, or float64Array(list) of its numbers
+static bool float64ArrayNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "float64Array", 1, argCount))
+        return false;
+
+    if (IS_NUMBER(args[0]))
+    {
+        double length = AS_NUMBER(args[0]);
+        if (!(length >= 0 && length <= INT32_MAX) || length != (int)length)
+        {
+            runtimeError(vm, "float64Array() length must be a whole number.");
+            return false;
+        }
+
+        args[-1] = OBJ_VAL(newFloat64Array(vm, (int)length));
+        return true;
+    }
+
+    if (IS_LIST(args[0]))
+    {
+        ValueArray *items = &AS_LIST(args[0])->items;
+        ObjFloat64Array *array = newFloat64Array(vm, items->count);
+
+        for (int i = 0; i < items->count; i++)
+        {
+            if (!IS_NUMBER(items->values[i]))
+            {
+                runtimeError(vm, "float64Array() list items must be numbers.");
+                return false;
+            }
+
+            array->values[i] = AS_NUMBER(items->values[i]);
+        }
+
+        args[-1] = OBJ_VAL(array);
+        return true;
+    }
+
+    runtimeError(vm, "float64Array() expects a length or a list.");
+    return false;
+}
+
+// function forms of the methods above
+
+static bool appendNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "append", 2, argCount) || !checkReceiver(vm, "append", args[0], OBJ_LIST, "list"))
+        return false;
+
+    return callWithReceiver(vm, listAppendMethod, argCount, args);
+}
+
+static bool popNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "pop", 1, argCount) || !checkReceiver(vm, "pop", args[0], OBJ_LIST, "list"))
+        return false;
+
+    return callWithReceiver(vm, listPopMethod, argCount, args);
+}
+
+static bool sliceNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "slice", 3, argCount) || !checkReceiver(vm, "slice", args[0], OBJ_LIST, "list"))
+        return false;
+
+    return callWithReceiver(vm, listSliceMethod, argCount, args);
+}
+
+// number of items in a list, map or Float64Array, or characters in a string
+static bool lengthNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "length", 1, argCount))
+        return false;
+
+    if (IS_LIST(args[0]))
+        return callWithReceiver(vm, listLengthMethod, argCount, args);
+
+    if (IS_MAP(args[0]))
+        return callWithReceiver(vm, mapLengthMethod, argCount, args);
+
+    if (IS_FLOAT64_ARRAY(args[0]))
+        return callWithReceiver(vm, float64LengthMethod, argCount, args);
+
+    if (IS_STRING(args[0]))
+        return callWithReceiver(vm, stringLengthMethod, argCount, args);
+
+    runtimeError(vm, "length() expects a list, map, Float64Array or string.");
+    return false;
+}
+
+static bool hasNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "has", 2, argCount) || !checkReceiver(vm, "has", args[0], OBJ_MAP, "map"))
+        return false;
+
+    return callWithReceiver(vm, mapHasMethod, argCount, args);
+}
+
+static bool removeNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "remove", 2, argCount) || !checkReceiver(vm, "remove", args[0], OBJ_MAP, "map"))
+        return false;
+
+    return callWithReceiver(vm, mapRemoveMethod, argCount, args);
+}
+
+static bool keysNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "keys", 1, argCount) || !checkReceiver(vm, "keys", args[0], OBJ_MAP, "map"))
+        return false;
+
+    return callWithReceiver(vm, mapKeysMethod, argCount, args);
+}
+
+static bool sendNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "send", 2, argCount) || !checkReceiver(vm, "send", args[0], OBJ_CHANNEL, "channel"))
+        return false;
+
+    return callWithReceiver(vm, channelSendMethod, argCount, args);
+}
+
+static bool receiveNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "receive", 1, argCount) || !checkReceiver(vm, "receive", args[0], OBJ_CHANNEL, "channel"))
+        return false;
+
+    return callWithReceiver(vm, channelReceiveMethod, argCount, args);
+}
+
+static bool f64SumNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64Sum", 1, argCount) || !checkReceiver(vm, "f64Sum", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64SumMethod, argCount, args);
+}
+
+static bool f64DotNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64Dot", 2, argCount) || !checkReceiver(vm, "f64Dot", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64DotMethod, argCount, args);
+}
+
+static bool f64MinNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64Min", 1, argCount) || !checkReceiver(vm, "f64Min", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64MinMethod, argCount, args);
+}
+
+static bool f64MaxNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64Max", 1, argCount) || !checkReceiver(vm, "f64Max", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64MaxMethod, argCount, args);
+}
+
+static bool f64ScaleNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64Scale", 2, argCount) || !checkReceiver(vm, "f64Scale", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64ScaleMethod, argCount, args);
+}
+
+static bool f64AddNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64Add", 2, argCount) || !checkReceiver(vm, "f64Add", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64AddMethod, argCount, args);
+}
+
+static bool f64MulNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64Mul", 2, argCount) || !checkReceiver(vm, "f64Mul", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64MulMethod, argCount, args);
+}
+
+static bool f64PrefixSumNative(VM *vm, int argCount, Value *args)
+{
+    if (!checkArity(vm, "f64PrefixSum", 1, argCount) || !checkReceiver(vm, "f64PrefixSum", args[0], OBJ_FLOAT64_ARRAY, "Float64Array"))
+        return false;
+
+    return callWithReceiver(vm, float64PrefixSumMethod, argCount, args);
+}
+
+// store a native under a name, in the globals or a method table
+static void defineNative(VM *vm, Table *table, const char *name, NativeFunc function)
+{
+    push(vm, OBJ_VAL(copyString(vm, name, (int)strlen(name))));
+    push(vm, OBJ_VAL(newNative(vm, function)));
+    tableSet(table, AS_STRING(vm->stackTop[-2]), vm->stackTop[-1]);
+    pop(vm);
+    pop(vm);
+}
+
+// define more native funcs here
+void defineNatives(VM *vm)
+{
+    defineNative(vm, &vm->globals, "clock", clockNative);
+    defineNative(vm, &vm->globals, "printFile", printFileNative);
+    defineNative(vm, &vm->globals, "flush", flushNative);
+    defineNative(vm, &vm->globals, "readFile", readFileNative);
+    defineNative(vm, &vm->globals, "copyFile", copyFileNative);
+    defineNative(vm, &vm->globals, "sendFile", sendFileNative);
+    defineNative(vm, &vm->globals, "append", appendNative);
+    defineNative(vm, &vm->globals, "pop", popNative);
+    defineNative(vm, &vm->globals, "length", lengthNative);
+    defineNative(vm, &vm->globals, "slice", sliceNative);
+    defineNative(vm, &vm->globals, "has", hasNative);
+    defineNative(vm, &vm->globals, "remove", removeNative);
+    defineNative(vm, &vm->globals, "keys", keysNative);
+    defineNative(vm, &vm->globals, "float64Array", float64ArrayNative);
+    defineNative(vm, &vm->globals, "f64Sum", f64SumNative);
+    defineNative(vm, &vm->globals, "f64Dot", f64DotNative);
+    defineNative(vm, &vm->globals, "f64Min", f64MinNative);
+    defineNative(vm, &vm->globals, "f64Max", f64MaxNative);
+    defineNative(vm, &vm->globals, "f64Scale", f64ScaleNative);
+    defineNative(vm, &vm->globals, "f64Add", f64AddNative);
+    defineNative(vm, &vm->globals, "f64Mul", f64MulNative);
+    defineNative(vm, &vm->globals, "f64PrefixSum", f64PrefixSumNative);
+    defineNative(vm, &vm->globals, "channel", channelNative);
+    defineNative(vm, &vm->globals, "spawn", spawnNative);
+    defineNative(vm, &vm->globals, "send", sendNative);
+    defineNative(vm, &vm->globals, "receive", receiveNative);
+    defineNative(vm, &vm->globals, "task", taskNative);
+    defineNative(vm, &vm->globals, "await", awaitNative);
+    defineNative(vm, &vm->globals, "taskStats", taskStatsNative);
+    defineNative(vm, &vm->globals, "fiber", fiberNative);
+    defineNative(vm, &vm->globals, "resume", resumeNative);
+    defineNative(vm, &vm->globals, "readAsync", readAsyncNative);
+    defineNative(vm, &vm->globals, "writeAsync", writeAsyncNative);
+    defineNative(vm, &vm->globals, "runLoop", runLoopNative);
+    defineNative(vm, &vm->globals, "openFile", openFileNative);
+    defineNative(vm, &vm->globals, "closeFile", closeFileNative);
+    defineNative(vm, &vm->globals, "pipe", pipeNative);
+
+    defineNative(vm, &vm->stringMethods, "length", stringLengthMethod);
+
+    defineNative(vm, &vm->listMethods, "append", listAppendMethod);
+    defineNative(vm, &vm->listMethods, "pop", listPopMethod);
+    defineNative(vm, &vm->listMethods, "length", listLengthMethod);
+    defineNative(vm, &vm->listMethods, "slice", listSliceMethod);
+
+    defineNative(vm, &vm->mapMethods, "has", mapHasMethod);
+    defineNative(vm, &vm->mapMethods, "remove", mapRemoveMethod);
+    defineNative(vm, &vm->mapMethods, "keys", mapKeysMethod);
+    defineNative(vm, &vm->mapMethods, "length", mapLengthMethod);
+
+    defineNative(vm, &vm->float64Methods, "length", float64LengthMethod);
+    defineNative(vm, &vm->float64Methods, "sum", float64SumMethod);
+    defineNative(vm, &vm->float64Methods, "dot", float64DotMethod);
+    defineNative(vm, &vm->float64Methods, "min", float64MinMethod);
+    defineNative(vm, &vm->float64Methods, "max", float64MaxMethod);
+    defineNative(vm, &vm->float64Methods, "scale", float64ScaleMethod);
+    defineNative(vm, &vm->float64Methods, "add", float64AddMethod);
+    defineNative(vm, &vm->float64Methods, "mul", float64MulMethod);
+    defineNative(vm, &vm->float64Methods, "prefixSum", float64PrefixSumMethod);
+
+    defineNative(vm, &vm->channelMethods, "send", channelSendMethod);
+    defineNative(vm, &vm->channelMethods, "receive", channelReceiveMethod);
+
+    defineNative(vm, &vm->fiberMethods, "resume", fiberResumeMethod);
+    defineNative(vm, &vm->fiberMethods, "done", fiberDoneMethod);
+}
@@ -0,0 +1,14 @@
+#ifndef blue_natives_h
+#define blue_natives_h
+
+#include "common.h"
+#include "value.h"
+
+// register the native functions as globals and fill
+// the method tables of the built-in object types
+void defineNatives(VM *vm);
+
+// turn a value into an index below length, raising an error otherwise
+bool toIndex(VM *vm, Value value, int length, int *index);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef blue_number_h
+#define blue_number_h
+
+#include "common.h"
+#include "value.h"
+
+// room for the longest text formatNumber writes, "-2.2250738585072014e-308"
+#define NUMBER_TEXT 32
+
+// write value as the shortest decimal that reads back as exactly value,
+// in plain notation from 1e-6 up to 1e21 and with an exponent past them.
+// returns the length, text is not nul terminated
+int formatNumber(double value, char *text);
+
+// the value of a number literal: decimal with an optional fraction and
+// exponent, or a 0x hex or 0b binary integer, with _ allowed between
+// digits. whole decimals that fit an integer become one. false if the
+// text isn't a well formed literal
+bool parseNumber(const char *text, int length, Value *value);
+
+#endif
@@ -1,17 +1,18 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "channel.h"
+#include "intern.h"
 #include "memory.h"
 #include "object.h"
-#include "table.h"
 #include "value.h"
 #include "vm.h"
 
 // init object macro
-#define ALLOCATE_OBJ(type, objectType) (type *)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_OBJ(type, objectType) (type *)allocateObject(vm, sizeof(type), objectType)
 
 // make space for any object type
-static Obj *allocateObject(size_t size, ObjType type)
+static Obj *allocateObject(VM *vm, size_t size, ObjType type)
 {
     // allocate
     Obj *object = (Obj *)reallocate(NULL, 0, size);
@@ -19,30 +20,186 @@ static Obj *allocateObject(size_t size, ObjType type)
 
     // insert object at the head,
     // the linked list is essentially in reverse
-    object->next = vm.objects;
-    vm.objects = object;
+    object->next = vm->objects;
+    vm->objects = object;
 
     return object;
 }
 
 // request heap space for this function
-ObjFunction *newFunction()
+ObjFunction *newFunction(VM *vm)
 {
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
+    function->upvalueCount = 0;
+    function->maxSlots = 0;
     function->name = NULL;
+    function->callCount = 0;
+    function->jit = NULL;
+    function->aot = NULL;
     initChunk(&function->chunk);
     return function;
 }
 
+// request heap space for a closure, upvalues are filled in by the vm
+ObjClosure *newClosure(VM *vm, ObjFunction *function)
+{
+    ObjUpvalue **upvalues = ALLOCATE(ObjUpvalue *, function->upvalueCount);
+    for (int i = 0; i < function->upvalueCount; i++)
+    {
+        upvalues[i] = NULL;
+    }
+
+    ObjClosure *closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+    closure->function = function;
+    closure->upvalues = upvalues;
+    closure->upvalueCount = function->upvalueCount;
+    return closure;
+}
+
+// request heap space for an upvalue that still points into the stack
+ObjUpvalue *newUpvalue(VM *vm, Value *slot)
+{
+    ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
+    upvalue->location = slot;
+    upvalue->closed = NIL_VAL;
+    upvalue->next = NULL;
+    return upvalue;
+}
+
+// request heap space for a shape, parent is NULL for the root
+ObjShape *newShape(VM *vm, ObjShape *parent, ObjString *name)
+{
+    ObjShape *shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->slot = parent == NULL ? -1 : parent->fieldCount;
+    shape->fieldCount = parent == NULL ? 0 : parent->fieldCount + 1;
+    initTable(&shape->transitions);
+    return shape;
+}
+
+// walk back towards the root, only cache misses pay for this
+int shapeFindSlot(ObjShape *shape, ObjString *name)
+{
+    for (; shape->parent != NULL; shape = shape->parent)
+    {
+        if (shape->name == name)
+            return shape->slot;
+    }
+
+    return -1;
+}
+
+// follow or create the transition for a new field
+ObjShape *shapeAddField(VM *vm, ObjShape *shape, ObjString *name)
+{
+    Value next;
+    if (tableGet(&shape->transitions, name, &next))
+        return (ObjShape *)AS_OBJ(next);
+
+    ObjShape *child = newShape(vm, shape, name);
+    tableSet(&shape->transitions, name, OBJ_VAL(child));
+    return child;
+}
+
+// request heap space for a class
+ObjClass *newClass(VM *vm, ObjString *name)
+{
+    ObjClass *klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+    klass->name = name;
+    initTable(&klass->methods);
+    return klass;
+}
+
+// request heap space for an instance, fields grow as its shape does
+ObjInstance *newInstance(VM *vm, ObjClass *klass, ObjShape *shape)
+{
+    ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    instance->klass = klass;
+    instance->shape = shape;
+    instance->fieldCapacity = 0;
+    instance->fields = NULL;
+    return instance;
+}
+
+// request heap space for a bound method
+ObjBoundMethod *newBoundMethod(VM *vm, Value receiver, Obj *method)
+{
+    ObjBoundMethod *bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
+    bound->receiver = receiver;
+    bound->method = method;
+    return bound;
+}
+
+// request heap space for an empty list
+ObjList *newList(VM *vm)
+{
+    ObjList *list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
+    initValueArray(&list->items);
+    return list;
+}
+
+// request heap space for an empty map
+ObjMap *newMap(VM *vm)
+{
+    ObjMap *map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+    initMap(&map->map);
+    return map;
+}
+
+// request heap space for a zero filled typed array
+ObjFloat64Array *newFloat64Array(VM *vm, int length)
+{
+    ObjFloat64Array *array = ALLOCATE_OBJ(ObjFloat64Array, OBJ_FLOAT64_ARRAY);
+    array->length = 0;
+    array->values = NULL;
+
+    if (length > 0)
+    {
+        array->values = ALLOCATE(double, length);
+        memset(array->values, 0, sizeof(double) * length);
+    }
+    array->length = length;
+
+    return array;
+}
+
 // native C functions, callable in Blue
-ObjNative *newNative(NativeFunc function)
+ObjNative *newNative(VM *vm, NativeFunc function)
 {
     ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
     return native;
 }
 
+// the handle shares the channel with every other vm holding one
+ObjChannel *newChannel(VM *vm, Channel *channel)
+{
+    ObjChannel *handle = ALLOCATE_OBJ(ObjChannel, OBJ_CHANNEL);
+    handle->channel = retainChannel(channel);
+    return handle;
+}
+
+ObjFiber *newFiber(VM *vm, Value function)
+{
+    ObjFiber *fiber = ALLOCATE_OBJ(ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->function = function;
+
+    fiber->frames = ALLOCATE(CallFrame, FIBER_FRAMES);
+    fiber->frameCount = 0;
+    fiber->frameCapacity = FIBER_FRAMES;
+
+    fiber->stack = ALLOCATE(Value, FIBER_STACK);
+    fiber->stackTop = fiber->stack;
+    fiber->stackCapacity = FIBER_STACK;
+
+    fiber->openUpvalues = NULL;
+    fiber->owner = fiber;
+    return fiber;
+}
+
 // uses FNV-1a hash function
 static uint32_t hashString(const char *key, int length)
 {
@@ -59,40 +216,39 @@ static uint32_t hashString(const char *key, int length)
 
 // creates new string on heap and initializes fields
 // todo: perform hashing here
-static ObjString *allocateString(char *chars, int length, uint32_t hash)
+static ObjString *allocateString(VM *vm, char *chars, int length, uint32_t hash)
 {
     ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
 
-    // todo: stop compiler from continuosly setting variable
-    tableSet(&vm.strings, string, NIL_VAL);
+    internAdd(&vm->strings, string);
     return string;
 }
 
 // returns location of string
-ObjString *takeString(char *chars, int length)
+ObjString *takeString(VM *vm, char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
 
     // return reference if string already exists
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString *interned = internFind(&vm->strings, chars, length, hash);
     if (interned != NULL)
     {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
 
-    return allocateString(chars, length, hash);
+    return allocateString(vm, chars, length, hash);
 }
 
 // copy string from source or other location into heap
-ObjString *copyString(const char *chars, int length)
+ObjString *copyString(VM *vm, const char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
 
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString *interned = internFind(&vm->strings, chars, length, hash);
 
     if (interned != NULL)
         return interned;
@@ -101,35 +257,170 @@ ObjString *copyString(const char *chars, int length)
     memcpy(heapString, chars, length);
     heapString[length] = '\0';
 
-    return allocateString(heapString, length, hash);
+    return allocateString(vm, heapString, length, hash);
 }
 
 // allow blue lang to print functions
 // todo: print arguments it expects?
-static void printFunction(ObjFunction *function)
+static void printFunction(Output *output, ObjFunction *function)
 {
     if (function->name == NULL)
     {
-        printf("<script>");
+        writeOutputString(output, "<script>");
         return;
     }
 
-    printf("<func %s>", function->name->chars);
+    writeOutputString(output, "<func ");
+    writeOutput(output, function->name->chars, function->name->length);
+    writeOutputString(output, ">");
+}
+
+// lists and maps being printed, innermost first, so one that contains
+// itself prints as [...] or {...} instead of recursing forever
+typedef struct Printing
+{
+    Obj *object;
+    struct Printing *outer;
+} Printing;
+
+static void printNested(Output *output, Value value, Printing *outer);
+
+// print items between brackets
+static void printList(Output *output, ObjList *list, Printing *outer)
+{
+    Printing printing = {(Obj *)list, outer};
+    writeOutputString(output, "[");
+
+    for (int i = 0; i < list->items.count; i++)
+    {
+        if (i > 0)
+            writeOutputString(output, ", ");
+
+        printNested(output, list->items.values[i], &printing);
+    }
+
+    writeOutputString(output, "]");
+}
+
+// print pairs between braces in insertion order
+static void printMap(Output *output, ObjMap *map, Printing *outer)
+{
+    Printing printing = {(Obj *)map, outer};
+    writeOutputString(output, "{");
+
+    bool first = true;
+    for (int i = 0; i < map->map.entryCount; i++)
+    {
+        MapEntry *entry = &map->map.entries[i];
+        if (mapEntryIsRemoved(entry))
+            continue;
+
+        if (!first)
+            writeOutputString(output, ", ");
+        first = false;
+
+        printNested(output, entry->key, &printing);
+        writeOutputString(output, ": ");
+        printNested(output, entry->value, &printing);
+    }
+
+    writeOutputString(output, "}");
+}
+
+// print a value found inside a list or map
+static void printNested(Output *output, Value value, Printing *outer)
+{
+    if (!IS_LIST(value) && !IS_MAP(value))
+    {
+        printValue(output, value);
+        return;
+    }
+
+    for (Printing *printing = outer; printing != NULL; printing = printing->outer)
+    {
+        if (printing->object == AS_OBJ(value))
+        {
+            writeOutputString(output, IS_LIST(value) ? "[...]" : "{...}");
+            return;
+        }
+    }
+
+    if (IS_LIST(value))
+        printList(output, AS_LIST(value), outer);
+    else
+        printMap(output, AS_MAP(value), outer);
+}
+
+// print numbers between brackets, tagged so they don't look like a list
+static void printFloat64Array(Output *output, ObjFloat64Array *array)
+{
+    writeOutputString(output, "f64[");
+
+    for (int i = 0; i < array->length; i++)
+    {
+        if (i > 0)
+            writeOutputString(output, ", ");
+
+        printValue(output, NUMBER_VAL(array->values[i]));
+    }
+
+    writeOutputString(output, "]");
 }
 
 // handle different objects
-void printObject(Value value)
+void printObject(Output *output, Value value)
 {
     switch (OBJ_TYPE(value))
     {
+    case OBJ_BOUND_METHOD:
+    {
+        Obj *method = AS_BOUND_METHOD(value)->method;
+        printFunction(output, method->type == OBJ_CLOSURE ? ((ObjClosure *)method)->function : (ObjFunction *)method);
+        break;
+    }
+    case OBJ_CHANNEL:
+        writeOutputString(output, "<channel>");
+        break;
+    case OBJ_CLASS:
+        writeOutput(output, AS_CLASS(value)->name->chars, AS_CLASS(value)->name->length);
+        break;
+    case OBJ_CLOSURE:
+        printFunction(output, AS_CLOSURE(value)->function);
+        break;
+    case OBJ_FIBER:
+        writeOutputString(output, "<fiber>");
+        break;
+    case OBJ_FLOAT64_ARRAY:
+        printFloat64Array(output, AS_FLOAT64_ARRAY(value));
+        break;
     case OBJ_FUNCTION:
-        printFunction(AS_FUNCTION(value));
+        printFunction(output, AS_FUNCTION(value));
+        break;
+    case OBJ_INSTANCE:
+    {
+        ObjString *name = AS_INSTANCE(value)->klass->name;
+        writeOutputString(output, "<");
+        writeOutput(output, name->chars, name->length);
+        writeOutputString(output, " instance>");
+        break;
+    }
+    case OBJ_LIST:
+        printList(output, AS_LIST(value), NULL);
+        break;
+    case OBJ_MAP:
+        printMap(output, AS_MAP(value), NULL);
         break;
     case OBJ_NATIVE:
-        printf("<native fn>");
+        writeOutputString(output, "<native fn>");
+        break;
+    case OBJ_SHAPE:
+        writeOutputString(output, "shape");
         break;
     case OBJ_STRING:
-        printf("%s", AS_CSTRING(value));
+        writeOutput(output, AS_CSTRING(value), AS_STRING(value)->length);
+        break;
+    case OBJ_UPVALUE:
+        writeOutputString(output, "upvalue");
         break;
     }
 }
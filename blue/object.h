@@ -3,15 +3,38 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "map.h"
+#include "table.h"
 #include "value.h"
 
+// every object belongs to the vm that allocated it
+typedef struct VM VM;
+
 #define OBJ_TYPE(item) (AS_OBJ(item)->type)
 
+#define IS_BOUND_METHOD(item) isObjType(item, OBJ_BOUND_METHOD)
+#define IS_CHANNEL(item) isObjType(item, OBJ_CHANNEL)
+#define IS_CLASS(item) isObjType(item, OBJ_CLASS)
+#define IS_CLOSURE(item) isObjType(item, OBJ_CLOSURE)
+#define IS_FIBER(item) isObjType(item, OBJ_FIBER)
+#define IS_FLOAT64_ARRAY(item) isObjType(item, OBJ_FLOAT64_ARRAY)
 #define IS_FUNCTION(item) isObjType(item, OBJ_FUNCTION)
+#define IS_INSTANCE(item) isObjType(item, OBJ_INSTANCE)
+#define IS_LIST(item) isObjType(item, OBJ_LIST)
+#define IS_MAP(item) isObjType(item, OBJ_MAP)
 #define IS_NATIVE(item) isObjType(item, OBJ_NATIVE);
 #define IS_STRING(item) isObjType(item, OBJ_STRING)
 
+#define AS_BOUND_METHOD(item) ((ObjBoundMethod *)AS_OBJ(item))
+#define AS_CHANNEL(item) (((ObjChannel *)AS_OBJ(item))->channel)
+#define AS_CLASS(item) ((ObjClass *)AS_OBJ(item))
+#define AS_CLOSURE(item) ((ObjClosure *)AS_OBJ(item))
+#define AS_FIBER(item) ((ObjFiber *)AS_OBJ(item))
+#define AS_FLOAT64_ARRAY(item) ((ObjFloat64Array *)AS_OBJ(item))
 #define AS_FUNCTION(item) ((ObjFunction *)AS_OBJ(item))
+#define AS_INSTANCE(item) ((ObjInstance *)AS_OBJ(item))
+#define AS_LIST(item) ((ObjList *)AS_OBJ(item))
+#define AS_MAP(item) ((ObjMap *)AS_OBJ(item))
 #define AS_NATIVE(item) \
     (((ObjNative *)AS_OBJ(item))->function)
 #define AS_STRING(item) ((ObjString *)AS_OBJ(item))
@@ -20,9 +43,20 @@
 // types of objects for blue
 typedef enum
 {
+    OBJ_BOUND_METHOD,
+    OBJ_CHANNEL,
+    OBJ_CLASS,
+    OBJ_CLOSURE,
+    OBJ_FIBER,
+    OBJ_FLOAT64_ARRAY,
     OBJ_FUNCTION,
+    OBJ_INSTANCE,
+    OBJ_LIST,
+    OBJ_MAP,
     OBJ_NATIVE,
+    OBJ_SHAPE,
     OBJ_STRING,
+    OBJ_UPVALUE,
 } ObjType;
 
 // each blue object will inherit this struct
@@ -35,6 +69,8 @@ struct Obj
     struct Obj *next;
 };
 
+struct CallFrame;
+
 // code chunk representation of a Blue function
 typedef struct
 {
@@ -42,14 +78,117 @@ typedef struct
     Obj obj;
     // number of function parameters
     int arity;
+    // variables captured from enclosing functions
+    int upvalueCount;
     // code in the function
     Chunk chunk;
+    // stack values one call can use from its slot 0, locals and temporaries
+    int maxSlots;
     // function name
     ObjString *name;
+    // calls so far, the jit compiles the function at a threshold
+    int callCount;
+    // machine code for the function, NULL while it is interpreted
+    struct JitCode *jit;
+    // C translation of a program built ahead of time, runs to its return
+    bool (*aot)(struct VM *vm, struct CallFrame *frame);
 } ObjFunction;
 
+// a captured variable: points at the stack slot while the variable
+// is in scope, then at its own closed field once the slot is popped
+typedef struct ObjUpvalue
+{
+    Obj obj;
+    Value *location;
+    Value closed;
+
+    // open upvalues are kept sorted by stack slot, highest first
+    struct ObjUpvalue *next;
+} ObjUpvalue;
+
+// function plus the variables it captured, one flat array per closure
+typedef struct
+{
+    Obj obj;
+    ObjFunction *function;
+    ObjUpvalue **upvalues;
+    int upvalueCount;
+} ObjClosure;
+
+// hidden class: the field layout shared by every instance that
+// gained the same fields in the same order
+typedef struct ObjShape
+{
+    Obj obj;
+
+    // shape this one extends by a single field, NULL for the empty root
+    struct ObjShape *parent;
+
+    // field added by this shape and the slot it lives in
+    ObjString *name;
+    int slot;
+
+    // number of fields, also the slot the next field gets
+    int fieldCount;
+
+    // field name -> shape with that field added
+    Table transitions;
+} ObjShape;
+
+// user defined class, methods are looked up by name
+typedef struct ObjClass
+{
+    Obj obj;
+    ObjString *name;
+    Table methods;
+} ObjClass;
+
+// instance fields are a plain array laid out by its shape
+typedef struct
+{
+    Obj obj;
+    ObjClass *klass;
+    ObjShape *shape;
+    int fieldCapacity;
+    Value *fields;
+} ObjInstance;
+
+// method read off an instance, called later with the receiver in slot 0
+typedef struct
+{
+    Obj obj;
+    Value receiver;
+
+    // closure or bare function
+    Obj *method;
+} ObjBoundMethod;
+
+// contiguous, growable array of values
+typedef struct
+{
+    Obj obj;
+    ValueArray items;
+} ObjList;
+
+// fixed length array of raw, unboxed doubles
+typedef struct
+{
+    Obj obj;
+    int length;
+    double *values;
+} ObjFloat64Array;
+
+// insertion-ordered hash map with any value as a key
+typedef struct
+{
+    Obj obj;
+    Map map;
+} ObjMap;
+
 // native C functions, callable in Blue
-typedef Value (*NativeFunc)(int argCount, Value *args);
+// the result goes in args[-1], the callee's slot, and
+// returning false means the native raised a runtime error
+typedef bool (*NativeFunc)(VM *vm, int argCount, Value *args);
 
 typedef struct
 {
@@ -57,6 +196,50 @@ typedef struct
     NativeFunc function;
 } ObjNative;
 
+// a vm's handle on a channel, every vm holding the channel has its own
+typedef struct
+{
+    Obj obj;
+    struct Channel *channel;
+} ObjChannel;
+
+struct CallFrame;
+
+typedef enum
+{
+    FIBER_NEW,
+    FIBER_RUNNING,
+    FIBER_SUSPENDED,
+    FIBER_WAITING,
+    FIBER_DONE,
+} FiberState;
+
+// a call that can stop at a yield and be resumed later, on stacks of its
+// own that start small and grow. while the fiber runs the vm works on its
+// stacks directly and these fields hold the resumer's, so switching in
+// and back out is one swap of the fields
+typedef struct ObjFiber
+{
+    Obj obj;
+    FiberState state;
+
+    // called by the first resume
+    Value function;
+
+    struct CallFrame *frames;
+    int frameCount;
+    int frameCapacity;
+
+    Value *stack;
+    Value *stackTop;
+    int stackCapacity;
+
+    ObjUpvalue *openUpvalues;
+
+    // the fiber these stacks belong to, NULL for the vm's own
+    struct ObjFiber *owner;
+} ObjFiber;
+
 // extends obj and adds string properties
 struct ObjString
 {
@@ -67,19 +250,58 @@ struct ObjString
 };
 
 // c function to declare byte code function
-ObjFunction *newFunction();
+ObjFunction *newFunction(VM *vm);
+
+// wrap a function that captures variables
+ObjClosure *newClosure(VM *vm, ObjFunction *function);
+
+// open upvalue pointing at a stack slot
+ObjUpvalue *newUpvalue(VM *vm, Value *slot);
+
+// empty shape every instance starts with
+ObjShape *newShape(VM *vm, ObjShape *parent, ObjString *name);
+
+// slot of a field, or -1 if the shape lacks it
+int shapeFindSlot(ObjShape *shape, ObjString *name);
+
+// shape with one more field, shared with every other instance taking the same path
+ObjShape *shapeAddField(VM *vm, ObjShape *shape, ObjString *name);
+
+// class without methods
+ObjClass *newClass(VM *vm, ObjString *name);
+
+// instance of a class starting at the given shape
+ObjInstance *newInstance(VM *vm, ObjClass *klass, ObjShape *shape);
+
+// pair a receiver with a method
+ObjBoundMethod *newBoundMethod(VM *vm, Value receiver, Obj *method);
+
+// empty list, callers reserve space for known lengths
+ObjList *newList(VM *vm);
+
+// empty map
+ObjMap *newMap(VM *vm);
+
+// array of length zeros
+ObjFloat64Array *newFloat64Array(VM *vm, int length);
 
 // native C functions, callable in Blue
-ObjNative *newNative(NativeFunc function);
+ObjNative *newNative(VM *vm, NativeFunc function);
+
+// handle on a channel, holds a reference to it until freed
+ObjChannel *newChannel(VM *vm, struct Channel *channel);
+
+// fiber that calls function when first resumed
+ObjFiber *newFiber(VM *vm, Value function);
 
 // passes ownership of string by making a copy
-ObjString *takeString(char *chars, int length);
+ObjString *takeString(VM *vm, char *chars, int length);
 
 // clone a string
-ObjString *copyString(const char *chars, int length);
+ObjString *copyString(VM *vm, const char *chars, int length);
 
 // handle object printing
-void printObject(Value value);
+void printObject(Output *output, Value value);
 
 // returns if the value/obj matches a certain ObjType
 static inline bool isObjType(Value value, ObjType type)
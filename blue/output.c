@@ -0,0 +1,86 @@
+// isatty is outside strict ISO C
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "output.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// stdio's own buffer is skipped, the bytes go out in one write
+static void writeStdout(const char *bytes, int length)
+{
+    fwrite(bytes, 1, (size_t)length, stdout);
+    fflush(stdout);
+}
+
+void initOutput(Output *output)
+{
+    output->capacity = OUTPUT_BUFFER;
+
+    const char *size = getenv("BLUE_OUTPUT");
+    if (size != NULL && size[0] != '\0')
+    {
+        char *end;
+        long capacity = strtol(size, &end, 10);
+        if (*end == '\0' && capacity >= 0 && capacity <= INT32_MAX / 2)
+            output->capacity = (int)capacity;
+    }
+
+    output->bytes = output->capacity > 0 ? ALLOCATE(char, output->capacity) : NULL;
+    output->count = 0;
+
+#if defined(__unix__) || defined(__APPLE__)
+    output->lineFlush = isatty(STDOUT_FILENO);
+#else
+    output->lineFlush = false;
+#endif
+}
+
+void freeOutput(Output *output)
+{
+    flushOutput(output);
+    FREE_ARRAY(char, output->bytes, output->capacity);
+    output->bytes = NULL;
+    output->capacity = 0;
+}
+
+void writeOutput(Output *output, const char *bytes, int length)
+{
+    if (output->count + length > output->capacity)
+    {
+        flushOutput(output);
+
+        // too big to collect, it goes straight out
+        if (length > output->capacity)
+        {
+            writeStdout(bytes, length);
+            return;
+        }
+    }
+
+    memcpy(output->bytes + output->count, bytes, (size_t)length);
+    output->count += length;
+
+    if (output->lineFlush && memchr(bytes, '\n', (size_t)length) != NULL)
+        flushOutput(output);
+}
+
+void writeOutputString(Output *output, const char *string)
+{
+    writeOutput(output, string, (int)strlen(string));
+}
+
+void flushOutput(Output *output)
+{
+    if (output->count == 0)
+        return;
+
+    writeStdout(output->bytes, output->count);
+    output->count = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef blue_output_h
+#define blue_output_h
+
+#include "common.h"
+
+// bytes print collects before writing them to stdout
+#define OUTPUT_BUFFER 65536
+
+// what a vm prints, collected so stdout sees one write per buffer full
+// instead of a few stdio calls per value. a terminal gets each line as
+// it ends. BLUE_OUTPUT=bytes sizes the buffer, 0 writes every print as
+// it happens
+typedef struct
+{
+    char *bytes;
+    int count;
+    int capacity;
+
+    // flush at the end of each line
+    bool lineFlush;
+} Output;
+
+void initOutput(Output *output);
+
+// flushes what is left first
+void freeOutput(Output *output);
+
+void writeOutput(Output *output, const char *bytes, int length);
+
+// a nul terminated string
+void writeOutputString(Output *output, const char *string);
+
+// write everything collected to stdout now
+void flushOutput(Output *output);
+
+#endif
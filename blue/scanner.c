@@ -4,21 +4,20 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct
-{
-    const char *start;
-    const char *current;
-    int line;
-} Scanner;
-
-Scanner scanner;
+// sse2 is part of x86-64, avx2 only when the build targets it: a runtime
+// check costs a call per token, more than the wider blocks save
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCANNER_X86
+#include <immintrin.h>
+#endif
 
 // default scanner
-void initScanner(const char *source)
+void initScanner(Scanner *scanner, const char *source)
 {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + strlen(source);
+    scanner->line = 1;
 }
 
 // could be a number
@@ -34,83 +33,229 @@ static bool isAlpha(char c)
 }
 
 // is at end
-static bool isAtEnd()
+static bool isAtEnd(Scanner *scanner)
 {
-    return *scanner.current == '\0';
+    return *scanner->current == '\0';
 }
 
 // move up point to token ahead
 // move back to return the previous char
-static char advance()
+static char advance(Scanner *scanner)
 {
-    scanner.current++;
-    return scanner.current[-1];
+    scanner->current++;
+    return scanner->current[-1];
 }
 
 // get current char
-static char peek()
+static char peek(Scanner *scanner)
 {
-    return *scanner.current;
+    return *scanner->current;
 }
 
 // get next char
-static char peekNext()
+static char peekNext(Scanner *scanner)
 {
-    if (isAtEnd())
+    if (isAtEnd(scanner))
         return '\0';
-    return scanner.current[1];
+    return scanner->current[1];
 }
 
 // make a token based on type and current position
-static Token makeToken(TokenType type)
+static Token makeToken(Scanner *scanner, TokenType type)
 {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
 
     return token;
 }
 
 // make a token with an error message
 // todo: optimize
-static Token errorToken(const char *message)
+static Token errorToken(Scanner *scanner, const char *message)
 {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
 
     return token;
 }
 
+// runs of characters the scanner skips over a block at a time
+typedef enum
+{
+    SPAN_BLANK,
+    SPAN_COMMENT,
+    SPAN_IDENTIFIER,
+    SPAN_STRING,
+} Span;
+
+// does c continue the span
+static bool inSpan(Span span, char c)
+{
+    switch (span)
+    {
+    case SPAN_BLANK:
+        return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+    case SPAN_COMMENT:
+        return c != '\n' && c != '\0';
+    case SPAN_IDENTIFIER:
+        return isAlpha(c) || isDigit(c);
+    case SPAN_STRING:
+        return c != '"' && c != '\0';
+    }
+
+    return false;
+}
+
+#ifdef SCANNER_X86
+
+#ifdef __AVX2__
+
+#define BLOCK 32
+
+typedef __m256i Block;
+
+#define loadBlock(at) _mm256_loadu_si256((const Block *)(at))
+#define splat(c) _mm256_set1_epi8(c)
+#define equal(a, b) _mm256_cmpeq_epi8(a, b)
+#define greater(a, b) _mm256_cmpgt_epi8(a, b)
+#define both(a, b) _mm256_and_si256(a, b)
+#define either(a, b) _mm256_or_si256(a, b)
+#define bits(a) (uint32_t) _mm256_movemask_epi8(a)
+
+#else
+
+#define BLOCK 16
+
+typedef __m128i Block;
+
+#define loadBlock(at) _mm_loadu_si128((const Block *)(at))
+#define splat(c) _mm_set1_epi8(c)
+#define equal(a, b) _mm_cmpeq_epi8(a, b)
+#define greater(a, b) _mm_cmpgt_epi8(a, b)
+#define both(a, b) _mm_and_si128(a, b)
+#define either(a, b) _mm_or_si128(a, b)
+#define bits(a) (uint32_t) _mm_movemask_epi8(a)
+
+#endif
+
+// one bit per byte of the block that ends the span, with the newlines
+// before the end in *newlines
+static inline uint32_t blockStops(const char *at, Span span, uint32_t *newlines)
+{
+    Block bytes = loadBlock(at);
+    Block lines = equal(bytes, splat('\n'));
+    uint32_t stops;
+
+    switch (span)
+    {
+    case SPAN_BLANK:
+    {
+        Block blank = either(either(lines, equal(bytes, splat(' '))), either(equal(bytes, splat('\t')), equal(bytes, splat('\r'))));
+        stops = ~bits(blank);
+        break;
+    }
+    case SPAN_COMMENT:
+        stops = bits(lines);
+        break;
+    case SPAN_IDENTIFIER:
+    {
+        // compares are signed, so bytes past ascii fall outside both ranges.
+        // setting 0x20 folds upper case onto lower case
+        Block lower = either(bytes, splat(0x20));
+        Block alpha = both(greater(lower, splat('a' - 1)), greater(splat('z' + 1), lower));
+        Block digit = both(greater(bytes, splat('0' - 1)), greater(splat('9' + 1), bytes));
+        stops = ~bits(either(either(alpha, digit), equal(bytes, splat('_'))));
+        break;
+    }
+    case SPAN_STRING:
+        stops = bits(equal(bytes, splat('"')));
+        break;
+    }
+
+#if BLOCK == 16
+    stops &= 0xffff;
+#endif
+
+    // only the newlines before the stop were crossed
+    uint32_t before = stops == 0 ? ~0u : (stops & -stops) - 1;
+    *newlines = bits(lines) & before;
+    return stops;
+}
+
+#undef loadBlock
+#undef splat
+#undef equal
+#undef greater
+#undef both
+#undef either
+#undef bits
+
+#endif
+
+// move current past the span, counting the lines it crosses
+static inline void skipSpan(Scanner *scanner, Span span)
+{
+#ifdef SCANNER_X86
+    // whole blocks while they fit before the '\0', the bytes after it aren't ours
+    while (scanner->end - scanner->current >= BLOCK)
+    {
+        uint32_t newlines;
+        uint32_t stops = blockStops(scanner->current, span, &newlines);
+
+        if (newlines != 0)
+            scanner->line += __builtin_popcount(newlines);
+
+        if (stops != 0)
+        {
+            scanner->current += __builtin_ctz(stops);
+            return;
+        }
+
+        scanner->current += BLOCK;
+    }
+#endif
+
+    // the tail, or every byte without vectors
+    while (inSpan(span, peek(scanner)))
+    {
+        if (peek(scanner) == '\n')
+            scanner->line++;
+
+        advance(scanner);
+    }
+}
+
 // continuosly skip white-spaces in the source code
 // we dont return in case there is more white space
-static void skipWhitespace()
+static void skipWhitespace(Scanner *scanner)
 {
     for (;;)
     {
-        switch (peek())
+        switch (peek(scanner))
         {
         case ' ':
         case '\r':
         case '\t':
-            // any white space
-            advance();
+            // a lone space between tokens is cheaper stepped over
+            advance(scanner);
             break;
         case '\n':
-            // new lines
-            scanner.line++;
-            advance();
+            // new lines, and the indentation after them as one run
+            scanner->line++;
+            advance(scanner);
+            skipSpan(scanner, SPAN_BLANK);
             break;
         case '/':
-            if (peekNext() == '/')
+            if (peekNext(scanner) == '/')
             {
-                // loop to end of comment
-                while (peek() != '\n' && !isAtEnd())
-                    advance();
+                // skip to end of comment
+                skipSpan(scanner, SPAN_COMMENT);
             }
             else
             {
@@ -126,9 +271,9 @@ static void skipWhitespace()
 
 // conclude if this keyword is ours
 // otherwise return default identifier token
-static TokenType checkKeyword(int start, int length, const char *rest, TokenType type)
+static TokenType checkKeyword(Scanner *scanner, int start, int length, const char *rest, TokenType type)
 {
-    if (scanner.current - scanner.start == start + length && memcmp(scanner.start + start, rest, length) == 0)
+    if (scanner->current - scanner->start == start + length && memcmp(scanner->start + start, rest, length) == 0)
     {
         return type;
     }
@@ -137,196 +282,220 @@ static TokenType checkKeyword(int start, int length, const char *rest, TokenType
 }
 
 // return if token is ours or not
-static TokenType identifierType()
+static TokenType identifierType(Scanner *scanner)
 {
     // todo: here?
-    bool isNotOneChar = scanner.current - scanner.start > 1;
+    bool isNotOneChar = scanner->current - scanner->start > 1;
 
-    switch (scanner.start[0])
+    switch (scanner->start[0])
     {
     case 'a':
-        return checkKeyword(1, 2, "nd", TOKEN_AND);
+        return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
     case 'c':
-        return checkKeyword(1, 4, "lass", TOKEN_CLASS);
+        return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
     case 'e':
-        return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+        return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
     case 'f':
         if (isNotOneChar)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
             case 'a':
-                return checkKeyword(2, 3, "lse", TOKEN_FALSE);
+                return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
             case 'o':
-                return checkKeyword(2, 1, "r", TOKEN_FOR);
+                return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
             case 'u':
-                return checkKeyword(2, 2, "nc", TOKEN_FUNC);
+                return checkKeyword(scanner, 2, 2, "nc", TOKEN_FUNC);
             }
         }
         break;
     case 'i':
-        return checkKeyword(1, 1, "f", TOKEN_IF);
+        return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
     case 'n':
-        return checkKeyword(1, 2, "il", TOKEN_NIL);
+        return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
     case 'o':
-        return checkKeyword(1, 1, "r", TOKEN_OR);
+        return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
     case 'p':
-        return checkKeyword(1, 4, "rint", TOKEN_PRINT);
+        return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
     case 'r':
-        return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
+        return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
     case 's':
-        return checkKeyword(1, 4, "uper", TOKEN_SUPER);
+        return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
     case 't':
         if (isNotOneChar)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
             case 'h':
-                return checkKeyword(2, 2, "is", TOKEN_THIS);
+                return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
             case 'r':
-                return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+                return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
             }
         }
         break;
     case 'v':
-        return checkKeyword(1, 2, "ar", TOKEN_VAR);
+        return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
     case 'w':
-        return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+        return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
+    case 'y':
+        return checkKeyword(scanner, 1, 4, "ield", TOKEN_YIELD);
     }
 
     return TOKEN_IDENTIFIER;
 }
 
 // user or blue reserved keywords
-static Token identifier()
+static Token identifier(Scanner *scanner)
 {
-    while (isAlpha(peek()) || isDigit(peek()))
-        advance();
+    skipSpan(scanner, SPAN_IDENTIFIER);
 
-    return makeToken(identifierType());
+    return makeToken(scanner, identifierType(scanner));
 }
 
 // string literals
-static Token string()
+static Token string(Scanner *scanner)
 {
-    while (peek() != '"' && !isAtEnd())
-    {
-        if (peek() == '\n')
-        {
-            scanner.line++;
-        }
-
-        advance();
-    }
+    skipSpan(scanner, SPAN_STRING);
 
-    if (isAtEnd())
-        return errorToken("Unterminated string.");
+    if (isAtEnd(scanner))
+        return errorToken(scanner, "Unterminated string.");
 
     // get to closing quote
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
 // number literals
 // todo: make sure numbers are properly converted
-static Token number()
+static Token number(Scanner *scanner)
 {
+    // 0x and 0b literals take any letters and digits, the compiler
+    // rejects the ones their base doesn't have
+    char base = peek(scanner);
+    if (scanner->start[0] == '0' && (base == 'x' || base == 'X' || base == 'b' || base == 'B') &&
+        (isAlpha(peekNext(scanner)) || isDigit(peekNext(scanner))))
+    {
+        advance(scanner);
+        while (isAlpha(peek(scanner)) || isDigit(peek(scanner)))
+            advance(scanner);
+
+        return makeToken(scanner, TOKEN_NUMBER);
+    }
+
     // consume all possible digits
-    while (isDigit(peek()))
+    while (isDigit(peek(scanner)))
     {
-        advance();
+        advance(scanner);
     }
 
     // consume if there are two decimals points
-    if (peek() == '.' && isDigit(peekNext()))
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner)))
+    {
+        advance(scanner);
+
+        while (isDigit(peek(scanner)))
+            advance(scanner);
+    }
+
+    // an exponent, 1e9 or 2.5e-3
+    char next = peekNext(scanner);
+    if ((peek(scanner) == 'e' || peek(scanner) == 'E') &&
+        ((next >= '0' && next <= '9') || ((next == '+' || next == '-') && scanner->current[2] >= '0' && scanner->current[2] <= '9')))
     {
-        advance();
+        advance(scanner);
+        advance(scanner);
 
-        while (isDigit(peek()))
-            advance();
+        while (isDigit(peek(scanner)))
+            advance(scanner);
     }
 
     // return number token
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
 // check if current symbol equals symbol param
-static bool match(char expected)
+static bool match(Scanner *scanner, char expected)
 {
     // exit if at end or doesn't match
-    if (isAtEnd() || *scanner.current != expected)
+    if (isAtEnd(scanner) || *scanner->current != expected)
         return false;
 
     // move up if it does
-    scanner.current++;
+    scanner->current++;
 
     // symbols equate
     return true;
 }
 
 // todo: sort functions
-Token scanToken()
+Token scanToken(Scanner *scanner)
 {
-    skipWhitespace();
+    skipWhitespace(scanner);
 
     // begin
-    scanner.start = scanner.current;
+    scanner->start = scanner->current;
 
     // exit if finished
-    if (isAtEnd())
-        return makeToken(TOKEN_EOF);
+    if (isAtEnd(scanner))
+        return makeToken(scanner, TOKEN_EOF);
 
-    char c = advance();
+    char c = advance(scanner);
 
     // reserved and defined keywords
     if (isAlpha(c))
-        return identifier();
+        return identifier(scanner);
 
     // handle numbers
     if (isDigit(c))
-        return number();
+        return number(scanner);
 
     switch (c)
     {
     // one symbol token
     case '(':
-        return makeToken(TOKEN_LEFT_PAREN);
+        return makeToken(scanner, TOKEN_LEFT_PAREN);
     case ')':
-        return makeToken(TOKEN_RIGHT_PAREN);
+        return makeToken(scanner, TOKEN_RIGHT_PAREN);
     case '{':
-        return makeToken(TOKEN_LEFT_BRACE);
+        return makeToken(scanner, TOKEN_LEFT_BRACE);
     case '}':
-        return makeToken(TOKEN_RIGHT_BRACE);
+        return makeToken(scanner, TOKEN_RIGHT_BRACE);
+    case '[':
+        return makeToken(scanner, TOKEN_LEFT_BRACKET);
+    case ']':
+        return makeToken(scanner, TOKEN_RIGHT_BRACKET);
     case ';':
         // todo: remove
-        return makeToken(TOKEN_SEMICOLON);
+        return makeToken(scanner, TOKEN_SEMICOLON);
     case ',':
-        return makeToken(TOKEN_COMMA);
+        return makeToken(scanner, TOKEN_COMMA);
+    case ':':
+        return makeToken(scanner, TOKEN_COLON);
     case '.':
-        return makeToken(TOKEN_DOT);
+        return makeToken(scanner, TOKEN_DOT);
     case '-':
-        return makeToken(TOKEN_MINUS);
+        return makeToken(scanner, TOKEN_MINUS);
     case '+':
-        return makeToken(TOKEN_PLUS);
+        return makeToken(scanner, TOKEN_PLUS);
     case '/':
-        return makeToken(TOKEN_SLASH);
+        return makeToken(scanner, TOKEN_SLASH);
     case '*':
-        return makeToken(TOKEN_STAR);
+        return makeToken(scanner, TOKEN_STAR);
     case '^':
-        return makeToken(TOKEN_CARET);
+        return makeToken(scanner, TOKEN_CARET);
     // two symbol token
     case '!':
-        return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     case '=':
-        return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     case '<':
-        return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     case '>':
-        return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        return makeToken(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     // literal values
     case '"':
-        return string();
+        return string(scanner);
     }
 
-    return errorToken("Unexpected character.");
+    return errorToken(scanner, "Unexpected character.");
 }
\ No newline at end of file
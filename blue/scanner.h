@@ -7,7 +7,10 @@ typedef enum
     TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA,
+    TOKEN_COLON,
     TOKEN_DOT,
     TOKEN_MINUS,
     TOKEN_PLUS,
@@ -42,6 +45,7 @@ typedef enum
     TOKEN_TRUE,
     TOKEN_VAR,
     TOKEN_WHILE,
+    TOKEN_YIELD,
     TOKEN_ERROR,
     TOKEN_EOF
 } TokenType;
@@ -54,8 +58,18 @@ typedef struct
     int line;
 } Token;
 
-void initScanner(const char *source);
+// position in the source, copying it saves a point to rewind to
+typedef struct
+{
+    const char *start;
+    const char *current;
+    // the source's '\0', vector loads stop short of it
+    const char *end;
+    int line;
+} Scanner;
+
+void initScanner(Scanner *scanner, const char *source);
 
-Token scanToken();
+Token scanToken(Scanner *scanner);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,759 @@
+// clock_gettime and sched_yield are outside strict ISO C
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+
+#include "events.h"
+#include "memory.h"
+#include "message.h"
+#include "scheduler.h"
+
+// the code a vm's tasks need, its global functions and classes, written
+// once and read into every worker vm that runs one of its tasks
+typedef struct TaskImage
+{
+    // the vm it was made from and each task and worker vm using it
+    atomic_int references;
+
+    // global count, then name and value pairs
+    Message *code;
+
+    int jitThreshold;
+    int traceThreshold;
+} TaskImage;
+
+// a submitted call
+typedef struct Task
+{
+    // next in the injection queue
+    struct Task *next;
+
+    TaskImage *image;
+
+    // the callee's global name, or nil and the callee itself, then the
+    // argument count and arguments
+    Message *message;
+
+    // receives the return value
+    Channel *result;
+} Task;
+
+// variables are left behind, a task gets them passed in or sent
+static bool isCode(Value value)
+{
+    return IS_FUNCTION(value) || IS_CLOSURE(value) || IS_CLASS(value);
+}
+
+// the name a function or class was declared with, NULL for a script
+static ObjString *codeName(Value value)
+{
+    if (IS_CLOSURE(value))
+        return AS_CLOSURE(value)->function->name;
+    if (IS_FUNCTION(value))
+        return AS_FUNCTION(value)->name;
+    if (IS_CLASS(value))
+        return AS_CLASS(value)->name;
+    return NULL;
+}
+
+static uint64_t mixBits(uint64_t bits)
+{
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return bits;
+}
+
+// changes when a global function or class is added, removed or replaced.
+// a sum, so it doesn't depend on where the table put each entry
+static uint64_t fingerprintCode(Table *globals)
+{
+    uint64_t fingerprint = 0;
+    for (int i = 0; i < globals->capacity; i++)
+    {
+        if (globals->keys[i] == NULL || !isCode(globals->values[i]))
+            continue;
+
+        uint64_t name = (uint64_t)(uintptr_t)globals->keys[i];
+        uint64_t code = (uint64_t)(uintptr_t)AS_OBJ(globals->values[i]);
+        fingerprint += mixBits(name * 31 + code);
+    }
+
+    return fingerprint;
+}
+
+static TaskImage *retainImage(TaskImage *image)
+{
+    atomic_fetch_add_explicit(&image->references, 1, memory_order_relaxed);
+    return image;
+}
+
+static void releaseImage(TaskImage *image)
+{
+    if (atomic_fetch_sub_explicit(&image->references, 1, memory_order_acq_rel) != 1)
+        return;
+
+    freeMessage(image->code);
+    FREE(TaskImage, image);
+}
+
+void freeTaskImage(VM *vm)
+{
+    if (vm->taskImage != NULL)
+        releaseImage(vm->taskImage);
+    vm->taskImage = NULL;
+}
+
+// the vm's image, remade only if its code or thresholds changed since.
+// the globals are only hashed again after a write that could change them
+static TaskImage *currentImage(VM *vm)
+{
+    TaskImage *image = vm->taskImage;
+    if (image != NULL && (image->jitThreshold != vm->jitThreshold || image->traceThreshold != vm->traceThreshold))
+        image = NULL;
+
+    if (image != NULL && vm->taskVersion == vm->globalsVersion)
+        return image;
+
+    Table *globals = &vm->globals;
+    uint64_t fingerprint = fingerprintCode(globals);
+    vm->taskVersion = vm->globalsVersion;
+
+    if (image != NULL && vm->taskFingerprint == fingerprint)
+        return image;
+
+    freeTaskImage(vm);
+    image = ALLOCATE(TaskImage, 1);
+    atomic_init(&image->references, 1);
+    image->code = createMessage();
+    image->jitThreshold = vm->jitThreshold;
+    image->traceThreshold = vm->traceThreshold;
+
+    int globalCount = 0;
+    for (int i = 0; i < globals->capacity; i++)
+    {
+        if (globals->keys[i] != NULL && isCode(globals->values[i]))
+            globalCount++;
+    }
+
+    writeValue(image->code, INT_VAL(globalCount));
+    for (int i = 0; i < globals->capacity; i++)
+    {
+        if (globals->keys[i] == NULL || !isCode(globals->values[i]))
+            continue;
+
+        writeValue(image->code, OBJ_VAL(globals->keys[i]));
+        writeValue(image->code, globals->values[i]);
+    }
+
+    vm->taskImage = image;
+    vm->taskFingerprint = fingerprint;
+    return image;
+}
+
+static void loadImage(VM *vm, TaskImage *image)
+{
+    vm->jitThreshold = image->jitThreshold;
+    vm->traceThreshold = image->traceThreshold;
+
+    MessageReader reader;
+    initMessageReader(&reader, image->code);
+
+    int globalCount = (int)AS_INT(readValue(vm, &reader));
+    for (int i = 0; i < globalCount; i++)
+    {
+        ObjString *name = AS_STRING(readValue(vm, &reader));
+        tableSet(&vm->globals, name, readValue(vm, &reader));
+    }
+
+    freeMessageReader(&reader);
+
+    // tasks this vm submits can share the image while its code is unchanged
+    vm->taskImage = retainImage(image);
+    vm->taskFingerprint = fingerprintCode(&vm->globals);
+    vm->taskVersion = vm->globalsVersion;
+}
+
+// a global callee travels as its name, the image already carries its code
+static Task *createTask(VM *vm, Value callee, int argCount, Value *args)
+{
+    Task *task = ALLOCATE(Task, 1);
+    task->next = NULL;
+    task->image = retainImage(currentImage(vm));
+    task->message = createMessage();
+    task->result = createChannel();
+
+    // the callee's own name finds it, under any other it goes by value
+    Value name = NIL_VAL;
+    ObjString *declared = codeName(callee);
+    Value global;
+    if (declared != NULL && tableGet(&vm->globals, declared, &global) &&
+        IS_OBJ(global) && AS_OBJ(global) == AS_OBJ(callee))
+        name = OBJ_VAL(declared);
+
+    writeValue(task->message, name);
+    if (IS_NIL(name))
+        writeValue(task->message, callee);
+
+    writeValue(task->message, INT_VAL(argCount));
+    for (int i = 0; i < argCount; i++)
+        writeValue(task->message, args[i]);
+
+    return task;
+}
+
+// call the task inside vm, which has its image loaded, and send the result
+static void finishTask(VM *vm, Task *task)
+{
+    MessageReader reader;
+    initMessageReader(&reader, task->message);
+
+    Value callee = readValue(vm, &reader);
+    if (IS_NIL(callee))
+        callee = readValue(vm, &reader);
+    else if (!tableGet(&vm->globals, AS_STRING(callee), &callee))
+        callee = NIL_VAL;
+
+    int argCount = (int)AS_INT(readValue(vm, &reader));
+    Value args[UINT8_COUNT];
+    for (int i = 0; i < argCount; i++)
+        args[i] = readValue(vm, &reader);
+
+    freeMessageReader(&reader);
+
+    // a runtime error was already reported by the vm, the reads and
+    // writes the call started finish before its result goes
+    Value value;
+    if (interpretCall(vm, callee, argCount, args, &value) != INTERPRET_OK || !runEventLoop(vm))
+        value = NIL_VAL;
+    flushOutput(&vm->output);
+
+    Message *result = createMessage();
+    writeValue(result, value);
+    channelSend(task->result, result);
+
+    releaseChannel(task->result);
+    releaseImage(task->image);
+    freeMessage(task->message);
+    FREE(Task, task);
+}
+
+#ifdef BLUE_THREADS
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+// a work-stealing deque (Chase and Lev, with the C11 orderings of Lê et
+// al.). the owner pushes and takes at the bottom, thieves take at the top
+typedef struct DequeBuffer
+{
+    // power of two
+    int64_t capacity;
+
+    // the smaller buffer this one replaced, a thief may still be reading it
+    struct DequeBuffer *retired;
+
+    _Atomic(Task *) slots[];
+} DequeBuffer;
+
+typedef struct
+{
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(DequeBuffer *) buffer;
+} Deque;
+
+#define DEQUE_CAPACITY 64
+
+static DequeBuffer *newDequeBuffer(int64_t capacity, DequeBuffer *retired)
+{
+    size_t size = sizeof(DequeBuffer) + sizeof(_Atomic(Task *)) * (size_t)capacity;
+    DequeBuffer *buffer = reallocate(NULL, 0, size);
+    buffer->capacity = capacity;
+    buffer->retired = retired;
+    return buffer;
+}
+
+static void initDeque(Deque *deque)
+{
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->buffer, newDequeBuffer(DEQUE_CAPACITY, NULL));
+}
+
+static Task *readSlot(DequeBuffer *buffer, int64_t index)
+{
+    return atomic_load_explicit(&buffer->slots[index & (buffer->capacity - 1)], memory_order_relaxed);
+}
+
+static void writeSlot(DequeBuffer *buffer, int64_t index, Task *task)
+{
+    atomic_store_explicit(&buffer->slots[index & (buffer->capacity - 1)], task, memory_order_relaxed);
+}
+
+// owner only
+static void dequePush(Deque *deque, Task *task)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    DequeBuffer *buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+
+    if (bottom - top > buffer->capacity - 1)
+    {
+        DequeBuffer *grown = newDequeBuffer(buffer->capacity * 2, buffer);
+        for (int64_t i = top; i < bottom; i++)
+            writeSlot(grown, i, readSlot(buffer, i));
+
+        atomic_store_explicit(&deque->buffer, grown, memory_order_release);
+        buffer = grown;
+    }
+
+    // the release publishes the task to a thief that sees the new bottom
+    writeSlot(buffer, bottom, task);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+}
+
+// owner only, newest first
+static Task *dequeTake(Deque *deque)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    DequeBuffer *buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Task *task = readSlot(buffer, bottom);
+    if (top == bottom)
+    {
+        // the last task, thieves may be after it too
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            task = NULL;
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+// any thread, oldest first. NULL if empty or another thief won
+static Task *dequeSteal(Deque *deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+        return NULL;
+
+    DequeBuffer *buffer = atomic_load_explicit(&deque->buffer, memory_order_acquire);
+    Task *task = readSlot(buffer, top);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+
+    return task;
+}
+
+static bool dequeEmpty(Deque *deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    return atomic_load_explicit(&deque->bottom, memory_order_relaxed) <= top;
+}
+
+typedef struct
+{
+    int index;
+    Deque deque;
+
+    // kept between tasks, with some task image loaded
+    VM *vm;
+    int tasksRun;
+
+    // tasks running on this thread, more than one while a task awaits
+    int depth;
+
+    uint64_t seed;
+
+    // written by the worker, read by anyone
+    _Atomic uint64_t tasks;
+    _Atomic uint64_t steals;
+    _Atomic uint64_t failedSteals;
+    _Atomic uint64_t busyNanos;
+    _Atomic uint64_t idleNanos;
+} Worker;
+
+// one worker per core, shared by every vm in the process and started by
+// the first task. tasks submitted from outside the workers wait in the
+// injection queue, tasks submitted by a task go on its worker's deque
+static struct
+{
+    pthread_once_t started;
+    int workerCount;
+    Worker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    Task *head;
+    Task *tail;
+    atomic_int injected;
+    atomic_int sleepers;
+
+    TaskHook hook;
+    void *hookContext;
+} scheduler = {
+    .started = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local Worker *currentWorker;
+
+static uint64_t now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + (uint64_t)time.tv_nsec;
+}
+
+static void count(_Atomic uint64_t *counter, uint64_t amount)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount,
+                          memory_order_relaxed);
+}
+
+static void readStats(Worker *worker, WorkerStats *stats)
+{
+    stats->tasks = atomic_load_explicit(&worker->tasks, memory_order_relaxed);
+    stats->steals = atomic_load_explicit(&worker->steals, memory_order_relaxed);
+    stats->failedSteals = atomic_load_explicit(&worker->failedSteals, memory_order_relaxed);
+    stats->busyNanos = atomic_load_explicit(&worker->busyNanos, memory_order_relaxed);
+    stats->idleNanos = atomic_load_explicit(&worker->idleNanos, memory_order_relaxed);
+}
+
+// wake a sleeping worker after work was published
+static void wakeWorker()
+{
+    // pairs with the fence in sleepWorker: either the worker sees the work
+    // before sleeping or this sees the worker and wakes it
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&scheduler.sleepers, memory_order_relaxed) > 0)
+    {
+        pthread_mutex_lock(&scheduler.lock);
+        pthread_cond_signal(&scheduler.wake);
+        pthread_mutex_unlock(&scheduler.lock);
+    }
+}
+
+static Task *takeInjected()
+{
+    if (atomic_load_explicit(&scheduler.injected, memory_order_relaxed) == 0)
+        return NULL;
+
+    pthread_mutex_lock(&scheduler.lock);
+    Task *task = scheduler.head;
+    if (task != NULL)
+    {
+        scheduler.head = task->next;
+        if (scheduler.head == NULL)
+            scheduler.tail = NULL;
+        atomic_fetch_sub_explicit(&scheduler.injected, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&scheduler.lock);
+    return task;
+}
+
+// own deque, then the injection queue, then the others' deques starting
+// from a random one
+static Task *findTask(Worker *worker)
+{
+    Task *task = dequeTake(&worker->deque);
+    if (task == NULL)
+        task = takeInjected();
+    if (task != NULL)
+        return task;
+
+    int workerCount = scheduler.workerCount;
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 7;
+    worker->seed ^= worker->seed << 17;
+    int start = (int)(worker->seed % (uint64_t)workerCount);
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        Worker *victim = &scheduler.workers[(start + i) % workerCount];
+        if (victim == worker)
+            continue;
+
+        task = dequeSteal(&victim->deque);
+        if (task != NULL)
+        {
+            count(&worker->steals, 1);
+            return task;
+        }
+        count(&worker->failedSteals, 1);
+    }
+
+    return NULL;
+}
+
+static bool workWaiting()
+{
+    if (scheduler.head != NULL)
+        return true;
+
+    for (int i = 0; i < scheduler.workerCount; i++)
+    {
+        if (!dequeEmpty(&scheduler.workers[i].deque))
+            return true;
+    }
+
+    return false;
+}
+
+static void sleepWorker(Worker *worker)
+{
+    pthread_mutex_lock(&scheduler.lock);
+    TaskHook hook = scheduler.hook;
+    void *context = scheduler.hookContext;
+    pthread_mutex_unlock(&scheduler.lock);
+
+    if (hook != NULL)
+    {
+        WorkerStats stats;
+        readStats(worker, &stats);
+        hook(worker->index, &stats, context);
+    }
+
+    pthread_mutex_lock(&scheduler.lock);
+    atomic_fetch_add_explicit(&scheduler.sleepers, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // work may have been published after the last look
+    if (!workWaiting())
+        pthread_cond_wait(&scheduler.wake, &scheduler.lock);
+
+    atomic_fetch_sub_explicit(&scheduler.sleepers, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&scheduler.lock);
+}
+
+static void resetWorkerVM(Worker *worker)
+{
+    freeVM(worker->vm);
+    initVM(worker->vm);
+    worker->tasksRun = 0;
+}
+
+static void runTask(Worker *worker, Task *task)
+{
+    count(&worker->tasks, 1);
+
+    // the vm can only be replaced once nothing on this thread is using it.
+    // a task awaiting inside a fiber has the vm on the fiber's stacks,
+    // which may move as they grow while the await native still points in
+    VM *vm = worker->vm;
+    bool recycle = worker->depth == 0 && worker->tasksRun >= TASK_VM_RECYCLE;
+    if (vm->taskImage != task->image || recycle || vm->fiber != NULL)
+    {
+        if (worker->depth == 0)
+        {
+            // different code, or the vm has piled up enough garbage
+            resetWorkerVM(worker);
+            loadImage(vm, task->image);
+        }
+        else
+        {
+            // the worker's vm is busy with a task awaiting this one, so a
+            // task needing other code gets a vm of its own
+            vm = ALLOCATE(VM, 1);
+            initVM(vm);
+            loadImage(vm, task->image);
+        }
+    }
+
+    worker->depth++;
+    finishTask(vm, task);
+    worker->depth--;
+
+    if (vm != worker->vm)
+    {
+        freeVM(vm);
+        FREE(VM, vm);
+    }
+    else
+    {
+        worker->tasksRun++;
+    }
+}
+
+static void *workerLoop(void *argument)
+{
+    Worker *worker = argument;
+    currentWorker = worker;
+
+    uint64_t mark = now();
+    for (;;)
+    {
+        Task *task = findTask(worker);
+        if (task == NULL)
+        {
+            sleepWorker(worker);
+            continue;
+        }
+
+        uint64_t start = now();
+        count(&worker->idleNanos, start - mark);
+        runTask(worker, task);
+        mark = now();
+        count(&worker->busyNanos, mark - start);
+    }
+
+    return NULL;
+}
+
+static void startWorkers()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workerCount = cores > 0 ? (int)cores : 1;
+
+    // every worker exists before any starts stealing
+    scheduler.workers = ALLOCATE(Worker, workerCount);
+    for (int i = 0; i < workerCount; i++)
+    {
+        Worker *worker = &scheduler.workers[i];
+        worker->index = i;
+        initDeque(&worker->deque);
+        worker->vm = ALLOCATE(VM, 1);
+        initVM(worker->vm);
+        worker->tasksRun = 0;
+        worker->depth = 0;
+        worker->seed = mixBits((uint64_t)i + 1);
+        atomic_init(&worker->tasks, 0);
+        atomic_init(&worker->steals, 0);
+        atomic_init(&worker->failedSteals, 0);
+        atomic_init(&worker->busyNanos, 0);
+        atomic_init(&worker->idleNanos, 0);
+    }
+    scheduler.workerCount = workerCount;
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerLoop, &scheduler.workers[i]) == 0)
+            pthread_detach(thread);
+    }
+}
+
+Channel *submitTask(VM *vm, Value callee, int argCount, Value *args)
+{
+    pthread_once(&scheduler.started, startWorkers);
+
+    Task *task = createTask(vm, callee, argCount, args);
+
+    // the task holds one reference until it sends, the caller gets the other
+    Channel *result = retainChannel(task->result);
+
+    Worker *worker = currentWorker;
+    if (worker != NULL)
+    {
+        dequePush(&worker->deque, task);
+    }
+    else
+    {
+        pthread_mutex_lock(&scheduler.lock);
+        if (scheduler.tail == NULL)
+            scheduler.head = task;
+        else
+            scheduler.tail->next = task;
+        scheduler.tail = task;
+        atomic_fetch_add_explicit(&scheduler.injected, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&scheduler.lock);
+    }
+
+    wakeWorker();
+    return result;
+}
+
+Message *awaitMessage(Channel *channel)
+{
+    Worker *worker = currentWorker;
+    if (worker == NULL)
+        return channelReceive(channel, true);
+
+    // sleeping here would hold the worker back from the very tasks being
+    // waited on, so it runs them instead
+    for (;;)
+    {
+        Message *message = channelReceive(channel, false);
+        if (message != NULL)
+            return message;
+
+        Task *task = findTask(worker);
+        if (task != NULL)
+            runTask(worker, task);
+        else
+            sched_yield();
+    }
+}
+
+void setTaskHook(TaskHook hook, void *context)
+{
+    pthread_mutex_lock(&scheduler.lock);
+    scheduler.hook = hook;
+    scheduler.hookContext = context;
+    pthread_mutex_unlock(&scheduler.lock);
+}
+
+int taskStats(WorkerStats *stats, int capacity)
+{
+    pthread_once(&scheduler.started, startWorkers);
+
+    int workerCount = scheduler.workerCount;
+    for (int i = 0; i < workerCount && i < capacity; i++)
+        readStats(&scheduler.workers[i], &stats[i]);
+
+    return workerCount;
+}
+
+#else
+
+// without threads a task runs as soon as it is submitted, in a vm of its own
+Channel *submitTask(VM *vm, Value callee, int argCount, Value *args)
+{
+    Task *task = createTask(vm, callee, argCount, args);
+    Channel *result = retainChannel(task->result);
+
+    VM *taskVM = ALLOCATE(VM, 1);
+    initVM(taskVM);
+    loadImage(taskVM, task->image);
+    finishTask(taskVM, task);
+    freeVM(taskVM);
+    FREE(VM, taskVM);
+
+    return result;
+}
+
+Message *awaitMessage(Channel *channel)
+{
+    return channelReceive(channel, false);
+}
+
+void setTaskHook(TaskHook hook, void *context)
+{
+}
+
+int taskStats(WorkerStats *stats, int capacity)
+{
+    return 0;
+}
+
+#endif
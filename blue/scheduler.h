@@ -0,0 +1,50 @@
+#ifndef blue_scheduler_h
+#define blue_scheduler_h
+
+#include "channel.h"
+#include "common.h"
+#include "vm.h"
+
+// tasks a worker's vm runs before it is replaced. nothing is collected,
+// so this bounds what finished tasks leave behind
+#define TASK_VM_RECYCLE 1024
+
+// what one worker has done since the scheduler started
+typedef struct
+{
+    // tasks run, and how many of them were taken from another worker
+    uint64_t tasks;
+    uint64_t steals;
+
+    // looks into another worker's deque that found nothing
+    uint64_t failedSteals;
+
+    // time spent running tasks and looking for them
+    uint64_t busyNanos;
+    uint64_t idleNanos;
+} WorkerStats;
+
+// called by a worker each time it runs out of work and goes to sleep
+typedef void (*TaskHook)(int worker, const WorkerStats *stats, void *context);
+
+// run callee(args) as a task on the work-stealing workers, one per core.
+// each worker keeps its vm between tasks, loaded with a copy of the
+// submitting vm's global functions and classes that is only remade when
+// they change. returns a channel that receives the return value, nil if
+// the call failed. without threads the call runs right away instead
+Channel *submitTask(VM *vm, Value callee, int argCount, Value *args);
+
+// wait for the next message on channel. a worker waiting inside a task
+// runs other tasks meanwhile, so tasks can wait on the tasks they submit
+Message *awaitMessage(Channel *channel);
+
+// drop the vm's copy of its code
+void freeTaskImage(VM *vm);
+
+// report to hook as workers go idle, NULL stops reporting
+void setTaskHook(TaskHook hook, void *context);
+
+// copy out the stats of up to capacity workers, returns the worker count
+int taskStats(WorkerStats *stats, int capacity);
+
+#endif
@@ -0,0 +1,179 @@
+#include "events.h"
+#include "memory.h"
+#include "message.h"
+#include "spawn.h"
+
+#ifdef BLUE_THREADS
+
+#include <pthread.h>
+#include <unistd.h>
+
+// a spawned call waiting for a worker
+typedef struct Job
+{
+    struct Job *next;
+
+    // the spawning vm's globals, then the callee and its arguments
+    Message *message;
+
+    // receives the return value
+    Channel *result;
+
+    // the new vm compiles and traces like the one that spawned it
+    int jitThreshold;
+    int traceThreshold;
+} Job;
+
+// one worker per core, shared by every vm in the process and started by
+// the first spawn. jobs wait in a first in, first out list
+static struct
+{
+    pthread_once_t started;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    Job *head;
+    Job *tail;
+} pool = {PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL};
+
+static void runJob(Job *job)
+{
+    VM *vm = ALLOCATE(VM, 1);
+    initVM(vm);
+    vm->jitThreshold = job->jitThreshold;
+    vm->traceThreshold = job->traceThreshold;
+
+    MessageReader reader;
+    initMessageReader(&reader, job->message);
+
+    int globalCount = (int)AS_INT(readValue(vm, &reader));
+    for (int i = 0; i < globalCount; i++)
+    {
+        ObjString *name = AS_STRING(readValue(vm, &reader));
+        tableSet(&vm->globals, name, readValue(vm, &reader));
+    }
+
+    Value callee = readValue(vm, &reader);
+    int argCount = (int)AS_INT(readValue(vm, &reader));
+    Value args[UINT8_COUNT];
+    for (int i = 0; i < argCount; i++)
+        args[i] = readValue(vm, &reader);
+
+    freeMessageReader(&reader);
+    freeMessage(job->message);
+
+    // a runtime error was already reported by the worker's vm, the
+    // reads and writes the call started finish before its result goes
+    Value value;
+    if (interpretCall(vm, callee, argCount, args, &value) != INTERPRET_OK || !runEventLoop(vm))
+        value = NIL_VAL;
+    flushOutput(&vm->output);
+
+    Message *result = createMessage();
+    writeValue(result, value);
+    channelSend(job->result, result);
+    releaseChannel(job->result);
+
+    freeVM(vm);
+    FREE(VM, vm);
+    FREE(Job, job);
+}
+
+static void *worker(void *unused)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.head == NULL)
+            pthread_cond_wait(&pool.ready, &pool.lock);
+
+        Job *job = pool.head;
+        pool.head = job->next;
+        if (pool.head == NULL)
+            pool.tail = NULL;
+        pthread_mutex_unlock(&pool.lock);
+
+        runJob(job);
+    }
+
+    return unused;
+}
+
+static void startWorkers()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workerCount = cores > 0 ? (int)cores : 1;
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, NULL) == 0)
+            pthread_detach(thread);
+    }
+}
+
+// functions and classes are the code a spawned call may need, variables
+// are left behind and have to be passed in or sent
+static bool isCode(Value value)
+{
+    return IS_FUNCTION(value) || IS_CLOSURE(value) || IS_CLASS(value);
+}
+
+Channel *spawnCall(VM *vm, Value callee, int argCount, Value *args)
+{
+    pthread_once(&pool.started, startWorkers);
+
+    Message *message = createMessage();
+    Table *globals = &vm->globals;
+
+    int globalCount = 0;
+    for (int i = 0; i < globals->capacity; i++)
+    {
+        if (globals->keys[i] != NULL && isCode(globals->values[i]))
+            globalCount++;
+    }
+
+    writeValue(message, INT_VAL(globalCount));
+    for (int i = 0; i < globals->capacity; i++)
+    {
+        if (globals->keys[i] == NULL || !isCode(globals->values[i]))
+            continue;
+
+        writeValue(message, OBJ_VAL(globals->keys[i]));
+        writeValue(message, globals->values[i]);
+    }
+
+    writeValue(message, callee);
+    writeValue(message, INT_VAL(argCount));
+    for (int i = 0; i < argCount; i++)
+        writeValue(message, args[i]);
+
+    Job *job = ALLOCATE(Job, 1);
+    job->next = NULL;
+    job->message = message;
+    job->result = createChannel();
+    job->jitThreshold = vm->jitThreshold;
+    job->traceThreshold = vm->traceThreshold;
+
+    // the job holds one reference until it sends, the caller gets the other
+    Channel *result = retainChannel(job->result);
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.tail == NULL)
+        pool.head = job;
+    else
+        pool.tail->next = job;
+    pool.tail = job;
+    pthread_cond_signal(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+
+    return result;
+}
+
+#else
+
+Channel *spawnCall(VM *vm, Value callee, int argCount, Value *args)
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef blue_spawn_h
+#define blue_spawn_h
+
+#include "channel.h"
+#include "common.h"
+#include "vm.h"
+
+// run callee(args) in a fresh vm on a worker thread. the new vm starts with
+// copies of the spawning vm's global functions and classes, and the callee
+// and arguments are copied over with them. returns a channel that receives
+// the call's return value, nil if it failed, or NULL without threads
+Channel *spawnCall(VM *vm, Value callee, int argCount, Value *args);
+
+#endif
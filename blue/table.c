@@ -6,95 +6,136 @@
 #include "table.h"
 #include "value.h"
 
-// grow when is array 75% full
-#define TABLE_MAX_LOAD 0.75
+// robin hood keeps probes short, so grow when the array is 87.5% full
+#define TABLE_MAX_LOAD 0.875
+
+// halve the array once it drops below 25% full, the gap to the
+// growth threshold stops a table from resizing back and forth
+#define TABLE_MIN_LOAD 0.25
+
+// smallest array a table shrinks to
+#define TABLE_MIN_CAPACITY 8
 
 // constructor for new empty hash table
 void initTable(Table *table)
 {
     table->count = 0;
     table->capacity = 0;
-    table->entries = NULL;
+    table->keys = NULL;
+    table->hashes = NULL;
+    table->values = NULL;
 }
 
 // deallocate items
 void freeTable(Table *table)
 {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(ObjString *, table->keys, table->capacity);
+    FREE_ARRAY(uint32_t, table->hashes, table->capacity);
+    FREE_ARRAY(Value, table->values, table->capacity);
     initTable(table);
 }
 
-// return a location for the key
-static Entry *findEntry(Entry *entries, int capacity, ObjString *key)
+// how far the entry in a slot sits from the slot its hash maps to
+static inline uint32_t probeDistance(uint32_t hash, uint32_t index, uint32_t mask)
 {
-    uint32_t index = key->hash % capacity;
-    Entry *tombstone = NULL;
+    return (index - (hash & mask)) & mask;
+}
 
-    for (;;)
+// return the slot holding the key, or -1 if it is missing
+static int findSlot(Table *table, ObjString *key)
+{
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t index = key->hash & mask;
+
+    for (uint32_t distance = 0;; distance++)
     {
-        // todo: can we use pointer arithemetic?
-        Entry *entry = &entries[index];
+        ObjString *slotKey = table->keys[index];
+
+        if (slotKey == key)
+            return (int)index;
+
+        // robin hood keeps clusters sorted by distance, so once we meet an
+        // entry closer to its home than we are to ours the key can't be further on
+        if (slotKey == NULL || probeDistance(table->hashes[index], index, mask) < distance)
+            return -1;
 
-        // todo: refactor
-        if (entry->key == NULL)
+        index = (index + 1) & mask;
+    }
+}
+
+// place a key that is known to be missing, taking slots
+// from entries that are closer to their home than the incoming one
+static void insertSlot(Table *table, ObjString *key, Value value)
+{
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t hash = key->hash;
+    uint32_t index = hash & mask;
+    uint32_t distance = 0;
+
+    for (;;)
+    {
+        if (table->keys[index] == NULL)
         {
-            if (IS_NIL(entry->value))
-            {
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else
-            {
-                if (tombstone == NULL)
-                {
-                    tombstone = entry;
-                }
-            }
+            table->keys[index] = key;
+            table->hashes[index] = hash;
+            table->values[index] = value;
+            return;
         }
-        // todo: fix string comparison
-        else if (entry->key == key)
+
+        // the richer entry gives up its slot and keeps probing
+        uint32_t existing = probeDistance(table->hashes[index], index, mask);
+        if (existing < distance)
         {
-            return entry;
+            ObjString *displacedKey = table->keys[index];
+            uint32_t displacedHash = table->hashes[index];
+            Value displacedValue = table->values[index];
+
+            table->keys[index] = key;
+            table->hashes[index] = hash;
+            table->values[index] = value;
+
+            key = displacedKey;
+            hash = displacedHash;
+            value = displacedValue;
+            distance = existing;
         }
 
-        index = (index + 1) % capacity;
+        index = (index + 1) & mask;
+        distance++;
     }
 }
 
-// grows the table
+// grows or shrinks the table, capacity must be a power of two
 static void adjustCapacity(Table *table, int capacity)
 {
-    // make new space
-    Entry *entries = ALLOCATE(Entry, capacity);
+    ObjString **oldKeys = table->keys;
+    uint32_t *oldHashes = table->hashes;
+    Value *oldValues = table->values;
+    int oldCapacity = table->capacity;
+
+    // make new space, only the keys need clearing
+    table->keys = ALLOCATE(ObjString *, capacity);
+    table->hashes = ALLOCATE(uint32_t, capacity);
+    table->values = ALLOCATE(Value, capacity);
+    table->capacity = capacity;
 
-    // init items
     for (int i = 0; i < capacity; i++)
     {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
+        table->keys[i] = NULL;
     }
 
     // copy every existing item
-    table->count = 0;
-    for (int i = 0; i < table->capacity; i++)
+    for (int i = 0; i < oldCapacity; i++)
     {
-        Entry *entry = &table->entries[i];
-
-        if (entry->key == NULL)
+        if (oldKeys[i] != NULL)
         {
-            continue;
+            insertSlot(table, oldKeys[i], oldValues[i]);
         }
-
-        Entry *dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-
-        table->count++;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-
-    table->entries = entries;
-    table->capacity = capacity;
+    FREE_ARRAY(ObjString *, oldKeys, oldCapacity);
+    FREE_ARRAY(uint32_t, oldHashes, oldCapacity);
+    FREE_ARRAY(Value, oldValues, oldCapacity);
 }
 
 // return if item exists, set value pointer to this value
@@ -104,53 +145,89 @@ bool tableGet(Table *table, ObjString *key, Value *value)
     if (table->count == 0)
         return false;
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
+    int slot = findSlot(table, key);
 
     // item not found
-    if (entry->key == NULL)
+    if (slot == -1)
         return false;
 
     // set and return entry
-    *value = entry->value;
+    *value = table->values[slot];
     return true;
 }
 
-// returns true if value already exists, always caches the value
+// return a pointer into the values array, for callers that read a key often
+Value *tableGetSlot(Table *table, ObjString *key)
+{
+    if (table->count == 0)
+        return NULL;
+
+    int slot = findSlot(table, key);
+    if (slot == -1)
+        return NULL;
+
+    return &table->values[slot];
+}
+
+// returns true if the key is new, always caches the value
 bool tableSet(Table *table, ObjString *key, Value value)
 {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    if (table->count > 0)
     {
-        adjustCapacity(table, GROW_CAPACITY(table->capacity));
-    }
+        int slot = findSlot(table, key);
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
+        if (slot != -1)
+        {
+            table->values[slot] = value;
+            return false;
+        }
+    }
 
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value))
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
     {
-        table->count++;
+        adjustCapacity(table, GROW_CAPACITY(table->capacity));
     }
 
-    entry->key = key;
-    entry->value = value;
+    insertSlot(table, key, value);
+    table->count++;
 
-    return isNewKey;
+    return true;
 }
 
-// use tombstoning to override items
+// shift the rest of the cluster back over the deleted entry,
+// so the table never needs tombstones
 bool tableDelete(Table *table, ObjString *key)
 {
     if (table->count == 0)
         return false;
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
+    int slot = findSlot(table, key);
 
-    if (entry->key == NULL)
+    if (slot == -1)
         return false;
 
-    // mark value as skippable
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t hole = (uint32_t)slot;
+    uint32_t next = (hole + 1) & mask;
+
+    // stop at an empty slot or an entry already in its home slot
+    while (table->keys[next] != NULL && probeDistance(table->hashes[next], next, mask) > 0)
+    {
+        table->keys[hole] = table->keys[next];
+        table->hashes[hole] = table->hashes[next];
+        table->values[hole] = table->values[next];
+        hole = next;
+        next = (next + 1) & mask;
+    }
+
+    table->keys[hole] = NULL;
+    table->count--;
+
+    // give memory back after heavy churn
+    if (table->capacity > TABLE_MIN_CAPACITY && table->count < table->capacity * TABLE_MIN_LOAD)
+    {
+        adjustCapacity(table, table->capacity / 2);
+    }
 
     return true;
 }
@@ -160,40 +237,9 @@ void tableAddAll(Table *from, Table *to)
 {
     for (int i = 0; i < from->capacity; i++)
     {
-        Entry *entry = &from->entries[i];
-
-        if (entry->key != NULL)
+        if (from->keys[i] != NULL)
         {
-            tableSet(to, entry->key, entry->value);
+            tableSet(to, from->keys[i], from->values[i]);
         }
     }
 }
-
-// look for string in table
-ObjString *tableFindString(Table *table, const char *chars, int length, uint32_t hash)
-{
-    if (table->count == 0)
-        return NULL;
-
-    uint32_t index = hash % table->capacity;
-
-    for (;;)
-    {
-        Entry *entry = &table->entries[index];
-
-        // todo: refactor
-        if (entry->key == NULL)
-        {
-            // tombstone
-            if (IS_NIL(entry->value))
-                return NULL;
-        }
-        else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0)
-        {
-            // found string
-            return entry->key;
-        }
-
-        index = (index + 1) % table->capacity;
-    }
-}
\ No newline at end of file
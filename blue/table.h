@@ -4,22 +4,20 @@
 #include "common.h"
 #include "value.h"
 
-typedef struct
-{
-    ObjString *key;
-    Value value;
-} Entry;
-
 typedef struct
 {
     // number of key/value pairs
     int count;
 
-    // allocated size, count & capacity = load factor
+    // allocated size, always a power of two
+    // count & capacity = load factor
     int capacity;
 
-    // array of entries
-    Entry *entries;
+    // keys and their cached hashes are the only arrays a probe walks,
+    // values are read once the key is found, NULL marks an empty slot
+    ObjString **keys;
+    uint32_t *hashes;
+    Value *values;
 } Table;
 
 // constructor to create a new hash table
@@ -31,6 +29,10 @@ void freeTable(Table *table);
 // return if exists, place into value pointer
 bool tableGet(Table *table, ObjString *key, Value *value);
 
+// address of the value stored under key, NULL if missing.
+// valid until the next insert or delete
+Value *tableGetSlot(Table *table, ObjString *key);
+
 // insert into table
 bool tableSet(Table *table, ObjString *key, Value value);
 
@@ -40,7 +42,4 @@ bool tableDelete(Table *table, ObjString *key);
 // copy entries over
 void tableAddAll(Table *from, Table *to);
 
-// finds a string
-ObjString *tableFindString(Table *table, const char *chars, int length, uint32_t hash);
-
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#!/bin/sh
+# writes a script whose globals keep the table just under its 7/8 load
+# limit, then reads every one of them in a loop. with the 37 natives and
+# the script's own two, the default 180 fill 219 of 256 slots. a chunk
+# holds at most 256 literals, which is what keeps the count this low.
+# usage: test/benchmark/globals.sh [count] > globals.blue
+#        blue --no-jit globals.blue
+count=${1:-180}
+
+awk -v count="$count" 'BEGIN {
+    for (i = 0; i < count; i++)
+        printf "var g%d = true;\n", i
+
+    print "func readAll() {"
+    print "    var hits = 0;"
+    print "    for (var round = 0; round < 100000; round = round + 1) {"
+    for (i = 0; i < count; i += 10)
+    {
+        printf "        if (g%d", i
+        for (j = i + 1; j < i + 10 && j < count; j++)
+            printf " and g%d", j
+        printf ") hits = hits + 1\n"
+    }
+    print "    }"
+    print "    return hits;"
+    print "}"
+    print "var start = clock();"
+    print "print readAll();"
+    print "print clock() - start;"
+}'
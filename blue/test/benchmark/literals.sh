@@ -0,0 +1,45 @@
+#!/bin/sh
+# writes a script that is almost all number literals, in every form the
+# scanner takes, so compiling it is mostly parsing numbers. a chunk holds
+# at most 256 literals, so each function has 200 and the functions are
+# nested 100 to a group. none of them is called.
+# usage: test/benchmark/literals.sh [groups] > literals.blue
+#        time blue --no-jit literals.blue
+count=${1:-20}
+
+awk -v count="$count" 'BEGIN {
+    srand(1)
+    for (g = 0; g < count; g++)
+    {
+        printf "func group%d() {\n", g
+        for (f = 0; f < 100; f++)
+        {
+            printf "    func f%d() {\n", f
+            for (v = 0; v < 20; v++)
+            {
+                printf "        var v%d = ", v
+                for (i = 0; i < 10; i++)
+                {
+                    if (i > 0)
+                        printf " + "
+
+                    n = int(rand() * 1000000)
+                    if (i % 5 == 0)
+                        printf "%d", n
+                    else if (i % 5 == 1)
+                        printf "%d_%03d", n, n % 1000
+                    else if (i % 5 == 2)
+                        printf "%.6f", rand() * 1000
+                    else if (i % 5 == 3)
+                        printf "%d.%09de%d", n % 10, n * 997 % 1000000000, int(rand() * 600) - 300
+                    else
+                        printf "0x%X", n
+                }
+                printf ";\n"
+            }
+            printf "        return v0;\n    }\n"
+        }
+        printf "}\n"
+    }
+    printf "print %d;\n", count * 100 * 200
+}'
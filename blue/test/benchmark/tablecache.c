@@ -0,0 +1,168 @@
+// counts the cache lines a Table probe touches, for machines without
+// hardware counters. table.c is built with gcc's asan instrumentation in
+// call mode and the load callbacks below feed a simulated 32 KiB 8-way
+// L1 and 1 MiB 16-way L2, both LRU with 64 byte lines. usage, from blue/:
+//   gcc -O2 -c -fsanitize=address --param asan-instrumentation-with-call-threshold=0 \
+//       --param asan-stack=0 --param asan-globals=0 table.c -o /tmp/table.o
+//   gcc -O2 -I. -o /tmp/tablecache $(ls *.c | grep -v -e main.c -e table.c) \
+//       /tmp/table.o test/benchmark/tablecache.c -lm -lpthread
+//   /tmp/tablecache [keys]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define LOOKUPS 1000000
+
+typedef struct
+{
+    int sets;
+    int ways;
+    uint64_t *lines;
+    uint64_t *ages;
+    uint64_t clock;
+    uint64_t misses;
+} Cache;
+
+static void initCache(Cache *cache, int bytes, int ways)
+{
+    cache->ways = ways;
+    cache->sets = bytes / 64 / ways;
+    cache->lines = malloc(sizeof(uint64_t) * cache->sets * ways);
+    cache->ages = calloc((size_t)cache->sets * ways, sizeof(uint64_t));
+    cache->clock = 0;
+    cache->misses = 0;
+
+    for (int i = 0; i < cache->sets * ways; i++)
+        cache->lines[i] = UINT64_MAX;
+}
+
+// true on a hit, a miss replaces the least recently used way
+static bool touchCache(Cache *cache, uint64_t line)
+{
+    uint64_t *lines = cache->lines + (line % cache->sets) * cache->ways;
+    uint64_t *ages = cache->ages + (line % cache->sets) * cache->ways;
+    int oldest = 0;
+    cache->clock++;
+
+    for (int i = 0; i < cache->ways; i++)
+    {
+        if (lines[i] == line)
+        {
+            ages[i] = cache->clock;
+            return true;
+        }
+
+        if (ages[i] < ages[oldest])
+            oldest = i;
+    }
+
+    lines[oldest] = line;
+    ages[oldest] = cache->clock;
+    cache->misses++;
+    return false;
+}
+
+static Cache l1;
+static Cache l2;
+static bool counting = false;
+
+// distinct lines the current lookup has loaded
+static uint64_t touched[256];
+static int touchedCount;
+
+static void load(uintptr_t address, size_t size)
+{
+    if (!counting)
+        return;
+
+    for (uint64_t line = address / 64; line <= (address + size - 1) / 64; line++)
+    {
+        bool seen = false;
+        for (int i = 0; i < touchedCount; i++)
+            seen |= touched[i] == line;
+        if (!seen && touchedCount < 256)
+            touched[touchedCount++] = line;
+
+        if (!touchCache(&l1, line))
+            touchCache(&l2, line);
+    }
+}
+
+// the calls gcc's instrumentation makes, stores aren't counted
+void __asan_init(void) {}
+void __asan_version_mismatch_check_v8(void) {}
+void __asan_handle_no_return(void) {}
+void __asan_load1(uintptr_t address) { load(address, 1); }
+void __asan_load2(uintptr_t address) { load(address, 2); }
+void __asan_load4(uintptr_t address) { load(address, 4); }
+void __asan_load8(uintptr_t address) { load(address, 8); }
+void __asan_load16(uintptr_t address) { load(address, 16); }
+void __asan_loadN(uintptr_t address, size_t size) { load(address, size); }
+void __asan_store1(uintptr_t address) {}
+void __asan_store2(uintptr_t address) {}
+void __asan_store4(uintptr_t address) {}
+void __asan_store8(uintptr_t address) {}
+void __asan_store16(uintptr_t address) {}
+void __asan_storeN(uintptr_t address, size_t size) {}
+
+static void measure(const char *label, Table *table, ObjString **keys)
+{
+    initCache(&l1, 32 * 1024, 8);
+    initCache(&l2, 1024 * 1024, 16);
+
+    uint64_t lines = 0;
+    Value value;
+    counting = true;
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        touchedCount = 0;
+        tableGet(table, keys[i], &value);
+        lines += touchedCount;
+    }
+    counting = false;
+
+    printf("%-6s per lookup: %.2f lines, %.2f L1 misses, %.2f L2 misses\n", label, (double)lines / LOOKUPS,
+           (double)l1.misses / LOOKUPS, (double)l2.misses / LOOKUPS);
+    free(l1.lines);
+    free(l1.ages);
+    free(l2.lines);
+    free(l2.ages);
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 57000;
+
+    VM *vm = malloc(sizeof(VM));
+    initVM(vm);
+
+    Table table;
+    initTable(&table);
+
+    char name[32];
+    ObjString **present = malloc(sizeof(ObjString *) * count);
+    for (int i = 0; i < count; i++)
+    {
+        present[i] = copyString(vm, name, snprintf(name, sizeof(name), "key%d", i));
+        tableSet(&table, present[i], INT_VAL(i));
+    }
+
+    // missing keys are all new strings, present ones are spread by a
+    // multiplicative hash so neighbours aren't looked up in turn
+    ObjString **misses = malloc(sizeof(ObjString *) * LOOKUPS);
+    ObjString **hits = malloc(sizeof(ObjString *) * LOOKUPS);
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        misses[i] = copyString(vm, name, snprintf(name, sizeof(name), "miss%d", i));
+        hits[i] = present[(uint32_t)i * 2654435761u % (uint32_t)count];
+    }
+
+    printf("%d keys, capacity %d, %.1f%% full\n", table.count, table.capacity, 100.0 * table.count / table.capacity);
+    measure("misses", &table, misses);
+    measure("hits", &table, hits);
+    return 0;
+}
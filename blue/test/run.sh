@@ -0,0 +1,25 @@
+#!/bin/sh
+# runs every test script and compares what it prints with its
+# "// expect: " comments, in order. a script that should stop with an
+# error ends with "// expect runtime error: " and the error's first line.
+# usage: test/run.sh path/to/blue
+blue=${1:-./blue}
+dir=$(dirname "$0")
+failed=0
+errors=$(mktemp)
+trap 'rm -f "$errors"' EXIT
+
+for test in $(find "$dir" -name '*.blue' -not -path '*/benchmark/*' | sort)
+do
+    expected=$(sed -n 's/.*\/\/ expect: //p; s/.*\/\/ expect runtime error: //p' "$test")
+    actual=$("$blue" "$test" 2>"$errors"; head -n 1 "$errors")
+    if [ "$expected" != "$actual" ]
+    then
+        echo "FAIL $test"
+        printf 'expected:\n%s\nactual:\n%s\n' "$expected" "$actual"
+        failed=1
+    fi
+done
+
+[ $failed -eq 0 ] && echo "all tests passed"
+exit $failed
@@ -0,0 +1,1095 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "assembler.h"
+#include "memory.h"
+#include "trace.h"
+
+#ifdef BLUE_JIT
+
+// a tracing jit for loops. back-edges count how often each loop header is
+// reached; a hot header has one iteration recorded as the interpreter runs
+// it, instruction by instruction, with the types it read and the way each
+// branch went. the recording is compiled as a straight line of machine code
+// that repeats until something differs from what was recorded:
+//
+//   - values pushed inside the iteration live unboxed in native stack slots
+//     whose types are known at compile time, so they need no checks
+//   - locals below the loop's stack depth and globals stay in memory.
+//     those whose type can't change in an iteration are type checked once
+//     on entry, and read only globals are loaded once before the loop
+//   - a branch going the other way, a type check failing or an integer
+//     overflowing leaves through a side exit, which boxes the native slots
+//     back onto the vm stack and sets ip so the interpreter resumes at the
+//     instruction that exited
+//
+// anything the trace can't express stops the recording and the loop is
+// left to the interpreter for good.
+//
+// trace code uses these registers:
+//   rbx  frame->slots
+//   r13  the vm
+//   r14  the CallFrame
+//   r15  the trace's array of global value addresses
+//   rsp  native slots for the iteration's stack, then hoisted globals
+
+typedef int (*TraceEntry)(CallFrame *frame, VM *vm, Value **globals);
+
+#define SLOTS RBX
+#define VMREG R13
+#define FRAME R14
+#define GLOBALS R15
+
+#define VALUE_SIZE ((int32_t)sizeof(Value))
+#define TYPE_OFFSET ((int32_t)offsetof(Value, type))
+#define AS_OFFSET ((int32_t)offsetof(Value, as))
+
+// deepest iteration stack and most variables a trace keeps track of
+#define TRACE_MAX_STACK 32
+#define TRACE_MAX_CELLS 32
+
+// native stack frame: the iteration's stack, then the hoisted values
+#define NATIVE_SLOT(index) ((int32_t)(8 * (index)))
+#define HOISTED_SLOT(index) ((int32_t)(8 * (TRACE_MAX_STACK + (index))))
+#define FRAME_SIZE (8 * (TRACE_MAX_STACK + TRACE_MAX_CELLS))
+
+// failed entry checks before a trace is thrown away
+#define TRACE_MAX_FAILURES 16
+
+#define LOOP_LABEL 0
+#define EPILOGUE_LABEL 1
+
+// one recorded instruction and what the interpreter saw running it
+typedef struct
+{
+    int offset;
+
+    // type of the value a get read, or of the counter for OP_FOR_STEP
+    uint8_t type;
+
+    // type of the bound for OP_FOR_STEP
+    uint8_t boundType;
+
+    // whether OP_JUMP_IF_FALSE jumped
+    bool taken;
+} TraceStep;
+
+struct TraceRecorder
+{
+    CallFrame *frame;
+    LoopHeader *loop;
+
+    // stack depth at the header, the locals live across iterations
+    int depth;
+
+    int count;
+    TraceStep steps[TRACE_MAX_LENGTH];
+};
+
+struct Trace
+{
+    void *code;
+    size_t size;
+
+    // stack depth the trace was recorded at
+    int depth;
+
+    // exits numbered below this leave before the first iteration
+    int entryExits;
+    int entryFailures;
+
+    // globals the trace reads or writes, and where their values live
+    int globalCount;
+    ObjString **globalNames;
+    Value **globalSlots;
+    Value *globalValues;
+    int globalCapacity;
+};
+
+// a variable that outlives an iteration: a local below the loop's stack
+// depth or a global
+typedef struct
+{
+    bool isGlobal;
+
+    // stack slot, or index into the trace's globals
+    int index;
+
+    // what the first pass found: the first access of an iteration is a
+    // read of entryType, and whether any write stores another type
+    bool readFirst;
+    ValueType entryType;
+    bool written;
+    bool mixed;
+
+    // the type can't change, so it is checked once on entry and writes
+    // leave the type field alone
+    bool stable;
+
+    // native slot of a read only global loaded before the loop, or -1
+    int hoisted;
+
+    // type as the current pass walks the iteration, once touched
+    bool known;
+    ValueType type;
+} Cell;
+
+// where to resume when a check fails, and the native slots to box
+typedef struct
+{
+    int jump;
+    int offset;
+    int top;
+    uint8_t types[TRACE_MAX_STACK];
+} TraceExit;
+
+typedef struct
+{
+    Assembler as;
+    Chunk *chunk;
+    TraceRecorder *recording;
+
+    // the second pass emits the code that is kept
+    bool final;
+
+    Cell cells[TRACE_MAX_CELLS];
+    int cellCount;
+    ObjString *globals[TRACE_MAX_CELLS];
+    int globalCount;
+    int hoistedCount;
+
+    // types of the native slots
+    uint8_t stack[TRACE_MAX_STACK];
+    int top;
+
+    int exitCount;
+    int exitCapacity;
+    TraceExit *exits;
+} TraceCompiler;
+
+static uint16_t readShort(uint8_t *ip)
+{
+    return (uint16_t)((ip[0] << 8) | ip[1]);
+}
+
+static bool isTraceable(ValueType type)
+{
+    return type == VAL_INT || type == VAL_NUMBER || type == VAL_BOOL;
+}
+
+// leave the trace at offset if the flags say cc, or always for cc < 0
+static void exitTrace(TraceCompiler *tc, int cc, int offset)
+{
+    if (tc->exitCapacity < tc->exitCount + 1)
+    {
+        int oldCapacity = tc->exitCapacity;
+        tc->exitCapacity = GROW_CAPACITY(oldCapacity);
+        tc->exits = GROW_ARRAY(TraceExit, tc->exits, oldCapacity, tc->exitCapacity);
+    }
+
+    TraceExit *exit = &tc->exits[tc->exitCount++];
+    exit->jump = cc < 0 ? jmp(&tc->as) : jcc(&tc->as, cc);
+    exit->offset = offset;
+    exit->top = tc->top;
+    memcpy(exit->types, tc->stack, sizeof(exit->types));
+}
+
+static Cell *addCell(TraceCompiler *tc, bool isGlobal, int index)
+{
+    for (int i = 0; i < tc->cellCount; i++)
+    {
+        Cell *cell = &tc->cells[i];
+        if (cell->isGlobal == isGlobal && cell->index == index)
+            return cell;
+    }
+
+    if (tc->cellCount == TRACE_MAX_CELLS)
+        return NULL;
+
+    Cell *cell = &tc->cells[tc->cellCount++];
+    memset(cell, 0, sizeof(Cell));
+    cell->isGlobal = isGlobal;
+    cell->index = index;
+    cell->hoisted = -1;
+    return cell;
+}
+
+static Cell *globalCell(TraceCompiler *tc, ObjString *name)
+{
+    int index = 0;
+    while (index < tc->globalCount && tc->globals[index] != name)
+    {
+        index++;
+    }
+
+    if (index == tc->globalCount)
+    {
+        if (tc->globalCount == TRACE_MAX_CELLS)
+            return NULL;
+        tc->globals[tc->globalCount++] = name;
+    }
+
+    return addCell(tc, true, index);
+}
+
+// register and displacement of a cell's Value, globals go through rdx
+static int cellBase(TraceCompiler *tc, Cell *cell, int32_t *disp)
+{
+    if (!cell->isGlobal)
+    {
+        *disp = cell->index * VALUE_SIZE;
+        return SLOTS;
+    }
+
+    loadQ(&tc->as, RDX, GLOBALS, 8 * cell->index);
+    *disp = 0;
+    return RDX;
+}
+
+// load a cell's payload into reg. the first read of an iteration fixes its
+// type, checked here unless the cell was checked on entry
+static bool loadCell(TraceCompiler *tc, Cell *cell, ValueType observed, int offset, int reg)
+{
+    if (!cell->known)
+    {
+        if (!isTraceable(observed))
+            return false;
+
+        if (!tc->final)
+        {
+            cell->readFirst = true;
+            cell->entryType = observed;
+        }
+        else if (!cell->stable)
+        {
+            int32_t disp;
+            int base = cellBase(tc, cell, &disp);
+            cmpImm32(&tc->as, base, disp + TYPE_OFFSET, observed);
+            exitTrace(tc, CC_NE, offset);
+        }
+
+        cell->known = true;
+        cell->type = observed;
+    }
+
+    if (cell->hoisted >= 0)
+    {
+        loadQ(&tc->as, reg, RSP, HOISTED_SLOT(cell->hoisted));
+        return true;
+    }
+
+    int32_t disp;
+    int base = cellBase(tc, cell, &disp);
+    loadQ(&tc->as, reg, base, disp + AS_OFFSET);
+    return true;
+}
+
+// store reg into a cell as type
+static void storeCell(TraceCompiler *tc, Cell *cell, ValueType type, int reg)
+{
+    if (!tc->final)
+    {
+        cell->written = true;
+        if (cell->readFirst && type != cell->entryType)
+            cell->mixed = true;
+    }
+
+    cell->known = true;
+    cell->type = type;
+
+    int32_t disp;
+    int base = cellBase(tc, cell, &disp);
+    storeQ(&tc->as, base, disp + AS_OFFSET, reg);
+    if (!cell->stable)
+        storeImm32(&tc->as, base, disp + TYPE_OFFSET, type);
+}
+
+static bool pushSlot(TraceCompiler *tc, ValueType type)
+{
+    if (tc->top == TRACE_MAX_STACK)
+        return false;
+
+    storeQ(&tc->as, RSP, NATIVE_SLOT(tc->top), RAX);
+    tc->stack[tc->top++] = type;
+    return true;
+}
+
+static bool readCell(TraceCompiler *tc, Cell *cell, ValueType observed, int offset)
+{
+    if (cell == NULL || !loadCell(tc, cell, observed, offset, RAX))
+        return false;
+    return pushSlot(tc, cell->type);
+}
+
+static bool writeCell(TraceCompiler *tc, Cell *cell)
+{
+    if (cell == NULL || tc->top == 0)
+        return false;
+
+    loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(tc->top - 1));
+    storeCell(tc, cell, tc->stack[tc->top - 1], RAX);
+    return true;
+}
+
+static bool pushConstant(TraceCompiler *tc, Value value)
+{
+    if (!isTraceable(value.type))
+        return false;
+
+    uint64_t bits = 0;
+    if (IS_BOOL(value))
+        bits = AS_BOOL(value);
+    else
+        memcpy(&bits, &value.as, sizeof(bits));
+
+    movImm64(&tc->as, RAX, bits);
+    return pushSlot(tc, value.type);
+}
+
+// convert a native slot holding a number to a double in an xmm register
+static void loadDouble(TraceCompiler *tc, int xmm, int slot)
+{
+    if (tc->stack[slot] == VAL_INT)
+        emitMem(&tc->as, 0xf2, true, 0x0f2a, xmm, RSP, NATIVE_SLOT(slot));
+    else
+        emitMem(&tc->as, 0xf2, false, 0x0f10, xmm, RSP, NATIVE_SLOT(slot));
+}
+
+static bool numberOperands(TraceCompiler *tc)
+{
+    return tc->top >= 2 &&
+           (tc->stack[tc->top - 1] == VAL_INT || tc->stack[tc->top - 1] == VAL_NUMBER) &&
+           (tc->stack[tc->top - 2] == VAL_INT || tc->stack[tc->top - 2] == VAL_NUMBER);
+}
+
+// integers stay integers and exit on overflow, anything else is a double.
+// an intOpcode of 0 always takes the double form
+static bool emitArithmetic(TraceCompiler *tc, int offset, int intOpcode, int doubleOpcode)
+{
+    if (!numberOperands(tc))
+        return false;
+
+    int a = tc->top - 2;
+    int b = tc->top - 1;
+
+    if (intOpcode != 0 && tc->stack[a] == VAL_INT && tc->stack[b] == VAL_INT)
+    {
+        loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(a));
+        emitMem(&tc->as, 0, true, intOpcode, RAX, RSP, NATIVE_SLOT(b));
+        exitTrace(tc, CC_O, offset);
+        storeQ(&tc->as, RSP, NATIVE_SLOT(a), RAX);
+        tc->top--;
+        return true;
+    }
+
+    loadDouble(tc, 0, a);
+    loadDouble(tc, 1, b);
+    emitReg(&tc->as, 0xf2, false, doubleOpcode, 0, 1);
+    emitMem(&tc->as, 0xf2, false, 0x0f11, 0, RSP, NATIVE_SLOT(a));
+    tc->stack[a] = VAL_NUMBER;
+    tc->top--;
+    return true;
+}
+
+// a < b and a > b, mixed operands compare as doubles like numberLess
+static bool emitComparison(TraceCompiler *tc, bool less)
+{
+    if (!numberOperands(tc))
+        return false;
+
+    int a = tc->top - 2;
+    int b = tc->top - 1;
+
+    if (tc->stack[a] == VAL_INT && tc->stack[b] == VAL_INT)
+    {
+        loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(a));
+        emitMem(&tc->as, 0, true, 0x3b, RAX, RSP, NATIVE_SLOT(b));
+        setBool(&tc->as, less ? CC_L : CC_G);
+    }
+    else
+    {
+        // ucomisd, an unordered nan clears above either way
+        loadDouble(tc, 0, a);
+        loadDouble(tc, 1, b);
+        if (less)
+            emitReg(&tc->as, 0x66, false, 0x0f2e, 1, 0);
+        else
+            emitReg(&tc->as, 0x66, false, 0x0f2e, 0, 1);
+        setBool(&tc->as, CC_A);
+    }
+
+    storeQ(&tc->as, RSP, NATIVE_SLOT(a), RAX);
+    tc->stack[a] = VAL_BOOL;
+    tc->top--;
+    return true;
+}
+
+// equality of two values of the same type, an integer against a double
+// needs the exact comparison of numbersEquate and isn't traced
+static bool emitEqual(TraceCompiler *tc)
+{
+    if (tc->top < 2 || tc->stack[tc->top - 1] != tc->stack[tc->top - 2])
+        return false;
+
+    int a = tc->top - 2;
+    int b = tc->top - 1;
+
+    switch (tc->stack[a])
+    {
+    case VAL_INT:
+        loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(a));
+        emitMem(&tc->as, 0, true, 0x3b, RAX, RSP, NATIVE_SLOT(b));
+        setBool(&tc->as, CC_E);
+        break;
+    case VAL_BOOL:
+        // only the low byte of a bool is meaningful, cmp al, cl
+        loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(a));
+        loadQ(&tc->as, RCX, RSP, NATIVE_SLOT(b));
+        emit8(&tc->as, 0x38);
+        emit8(&tc->as, 0xc8);
+        setBool(&tc->as, CC_E);
+        break;
+    default:
+        // equal and ordered: sete al, setnp cl, and al, cl
+        emitMem(&tc->as, 0xf2, false, 0x0f10, 0, RSP, NATIVE_SLOT(a));
+        emitMem(&tc->as, 0x66, false, 0x0f2e, 0, RSP, NATIVE_SLOT(b));
+        emit8(&tc->as, 0x0f);
+        emit8(&tc->as, 0x94);
+        emit8(&tc->as, 0xc0);
+        emit8(&tc->as, 0x0f);
+        emit8(&tc->as, 0x9b);
+        emit8(&tc->as, 0xc1);
+        emit8(&tc->as, 0x20);
+        emit8(&tc->as, 0xc8);
+        emit8(&tc->as, 0x0f);
+        emit8(&tc->as, 0xb6);
+        emit8(&tc->as, 0xc0);
+        break;
+    }
+
+    storeQ(&tc->as, RSP, NATIVE_SLOT(a), RAX);
+    tc->stack[a] = VAL_BOOL;
+    tc->top--;
+    return true;
+}
+
+static bool emitNot(TraceCompiler *tc)
+{
+    if (tc->top == 0)
+        return false;
+
+    int a = tc->top - 1;
+    if (tc->stack[a] == VAL_BOOL)
+    {
+        // test al, al
+        loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(a));
+        emit8(&tc->as, 0x84);
+        emit8(&tc->as, 0xc0);
+        setBool(&tc->as, CC_E);
+    }
+    else
+    {
+        // numbers are truthy
+        movImm64(&tc->as, RAX, 0);
+    }
+
+    storeQ(&tc->as, RSP, NATIVE_SLOT(a), RAX);
+    tc->stack[a] = VAL_BOOL;
+    return true;
+}
+
+static bool emitNegate(TraceCompiler *tc, int offset)
+{
+    if (tc->top == 0)
+        return false;
+
+    int a = tc->top - 1;
+    loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(a));
+
+    if (tc->stack[a] == VAL_INT)
+    {
+        // INT64_MIN becomes a double, the interpreter handles it
+        movImm64(&tc->as, RCX, (uint64_t)INT64_MIN);
+        emitReg(&tc->as, 0, true, 0x3b, RAX, RCX);
+        exitTrace(tc, CC_E, offset);
+        emitReg(&tc->as, 0, true, 0xf7, 3, RAX);
+    }
+    else if (tc->stack[a] == VAL_NUMBER)
+    {
+        // flip the sign bit
+        movImm64(&tc->as, RCX, 0x8000000000000000ull);
+        emitReg(&tc->as, 0, true, 0x33, RAX, RCX);
+    }
+    else
+    {
+        return false;
+    }
+
+    storeQ(&tc->as, RSP, NATIVE_SLOT(a), RAX);
+    return true;
+}
+
+// an OP_FOR_STEP closing the loop with an integer counter and bound
+static bool emitForStep(TraceCompiler *tc, TraceStep *step, uint8_t *ip)
+{
+    int depth = tc->recording->depth;
+    Value increment = tc->chunk->constants.values[ip[3]];
+    if (ip[1] >= depth || ip[2] >= depth || !IS_INT(increment) ||
+        AS_INT(increment) != (int32_t)AS_INT(increment))
+        return false;
+
+    Cell *counter = addCell(tc, false, ip[1]);
+    Cell *bound = addCell(tc, false, ip[2]);
+    if (counter == NULL || bound == NULL)
+        return false;
+
+    // both checks come before the counter changes, so an exit
+    // runs the whole instruction again in the interpreter
+    if (!loadCell(tc, bound, step->boundType, step->offset, RCX) ||
+        !loadCell(tc, counter, step->type, step->offset, RAX) ||
+        counter->type != VAL_INT || bound->type != VAL_INT)
+        return false;
+
+    arithImm(&tc->as, 0, RAX, (int32_t)AS_INT(increment));
+    exitTrace(tc, CC_O, step->offset);
+    storeCell(tc, counter, VAL_INT, RAX);
+
+    emitReg(&tc->as, 0, true, 0x3b, RAX, RCX);
+    jumpToLabel(&tc->as, jcc(&tc->as, CC_L), LOOP_LABEL);
+    exitTrace(tc, -1, step->offset + 6);
+    return true;
+}
+
+// emit one recorded instruction, false if it can't be traced
+static bool emitStep(TraceCompiler *tc, int index)
+{
+    TraceStep *step = &tc->recording->steps[index];
+    bool last = index == tc->recording->count - 1;
+    uint8_t *ip = tc->chunk->code + step->offset;
+    int depth = tc->recording->depth;
+
+    switch (*ip)
+    {
+    case OP_CONSTANT:
+        return pushConstant(tc, tc->chunk->constants.values[ip[1]]);
+    case OP_TRUE:
+        return pushConstant(tc, BOOL_VAL(true));
+    case OP_FALSE:
+        return pushConstant(tc, BOOL_VAL(false));
+    case OP_POP:
+        if (tc->top == 0)
+            return false;
+        tc->top--;
+        return true;
+    case OP_GET_LOCAL:
+    {
+        if (ip[1] < depth)
+            return readCell(tc, addCell(tc, false, ip[1]), step->type, step->offset);
+
+        // a local declared inside the loop is one of the native slots
+        int slot = ip[1] - depth;
+        if (slot >= tc->top)
+            return false;
+        loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(slot));
+        return pushSlot(tc, tc->stack[slot]);
+    }
+    case OP_SET_LOCAL:
+    {
+        if (ip[1] < depth)
+            return writeCell(tc, addCell(tc, false, ip[1]));
+
+        int slot = ip[1] - depth;
+        if (slot >= tc->top - 1)
+            return false;
+        loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(tc->top - 1));
+        storeQ(&tc->as, RSP, NATIVE_SLOT(slot), RAX);
+        tc->stack[slot] = tc->stack[tc->top - 1];
+        return true;
+    }
+    case OP_GET_GLOBAL:
+        return readCell(tc, globalCell(tc, AS_STRING(tc->chunk->constants.values[ip[1]])), step->type, step->offset);
+    case OP_SET_GLOBAL:
+        return writeCell(tc, globalCell(tc, AS_STRING(tc->chunk->constants.values[ip[1]])));
+    case OP_ADD:
+        return emitArithmetic(tc, step->offset, 0x03, 0x0f58);
+    case OP_SUBTRACT:
+        return emitArithmetic(tc, step->offset, 0x2b, 0x0f5c);
+    case OP_MULTIPLY:
+        return emitArithmetic(tc, step->offset, 0x0faf, 0x0f59);
+    case OP_DIVIDE:
+        return emitArithmetic(tc, step->offset, 0, 0x0f5e);
+    case OP_LESS:
+        return emitComparison(tc, true);
+    case OP_GREATER:
+        return emitComparison(tc, false);
+    case OP_EQUAL:
+        return emitEqual(tc);
+    case OP_NOT:
+        return emitNot(tc);
+    case OP_NEGATE:
+        return emitNegate(tc, step->offset);
+    case OP_JUMP:
+        // the trace already continues where the jump went
+        return true;
+    case OP_JUMP_IF_FALSE:
+    {
+        if (tc->top == 0)
+            return false;
+
+        // numbers are truthy and never jump
+        if (tc->stack[tc->top - 1] != VAL_BOOL)
+            return !step->taken;
+
+        // leave for the way the recording didn't go, the condition stays pushed
+        int fallthrough = step->offset + 3;
+        cmpImm8(&tc->as, RSP, NATIVE_SLOT(tc->top - 1), 0);
+        if (step->taken)
+            exitTrace(tc, CC_NE, fallthrough);
+        else
+            exitTrace(tc, CC_E, fallthrough + readShort(ip + 1));
+        return true;
+    }
+    case OP_LOOP:
+        // a back-edge to another header is followed like a jump
+        if (last)
+            jumpToLabel(&tc->as, jmp(&tc->as), LOOP_LABEL);
+        return true;
+    case OP_FOR_STEP:
+        return last && emitForStep(tc, step, ip);
+    default:
+        return false;
+    }
+}
+
+// check and load what stays fixed for the whole loop, before the first iteration
+static void emitEntry(TraceCompiler *tc)
+{
+    int header = tc->recording->loop->offset;
+
+    for (int i = 0; i < tc->cellCount; i++)
+    {
+        Cell *cell = &tc->cells[i];
+        if (!cell->stable)
+            continue;
+
+        int32_t disp;
+        int base = cellBase(tc, cell, &disp);
+        cmpImm32(&tc->as, base, disp + TYPE_OFFSET, cell->entryType);
+        exitTrace(tc, CC_NE, header);
+
+        if (cell->hoisted >= 0)
+        {
+            loadQ(&tc->as, RAX, base, disp + AS_OFFSET);
+            storeQ(&tc->as, RSP, HOISTED_SLOT(cell->hoisted), RAX);
+        }
+    }
+}
+
+// box the native slots back onto the vm stack and resume the interpreter
+static void emitExits(TraceCompiler *tc)
+{
+    int depth = tc->recording->depth;
+
+    for (int i = 0; i < tc->exitCount; i++)
+    {
+        TraceExit *exit = &tc->exits[i];
+        patchHere(&tc->as, exit->jump);
+
+        for (int slot = 0; slot < exit->top; slot++)
+        {
+            int32_t disp = (depth + slot) * VALUE_SIZE;
+            loadQ(&tc->as, RAX, RSP, NATIVE_SLOT(slot));
+            storeQ(&tc->as, SLOTS, disp + AS_OFFSET, RAX);
+            storeImm32(&tc->as, SLOTS, disp + TYPE_OFFSET, exit->types[slot]);
+        }
+
+        // lea rax, [rbx + top]
+        emitMem(&tc->as, 0, true, 0x8d, RAX, SLOTS, (depth + exit->top) * VALUE_SIZE);
+        storeQ(&tc->as, VMREG, (int32_t)offsetof(VM, stackTop), RAX);
+        movImm64(&tc->as, RAX, (uint64_t)(uintptr_t)(tc->chunk->code + exit->offset));
+        storeQ(&tc->as, FRAME, (int32_t)offsetof(CallFrame, ip), RAX);
+
+        // mov eax, exit number
+        emit8(&tc->as, 0xb8);
+        emit32(&tc->as, (uint32_t)i);
+        jumpToLabel(&tc->as, jmp(&tc->as), EPILOGUE_LABEL);
+    }
+}
+
+// one pass over the recording. the first finds how every cell is used,
+// the second emits the code that is kept
+static bool translate(TraceCompiler *tc, int *entryExits)
+{
+    initAssembler(&tc->as, 2);
+    tc->top = 0;
+    tc->exitCount = 0;
+    for (int i = 0; i < tc->cellCount; i++)
+    {
+        tc->cells[i].known = false;
+    }
+
+    push64(&tc->as, RBP);
+    push64(&tc->as, RBX);
+    push64(&tc->as, R13);
+    push64(&tc->as, R14);
+    push64(&tc->as, R15);
+    arithImm(&tc->as, 5, RSP, FRAME_SIZE);
+    emitReg(&tc->as, 0, true, 0x89, RDI, FRAME);
+    emitReg(&tc->as, 0, true, 0x89, RSI, VMREG);
+    emitReg(&tc->as, 0, true, 0x89, RDX, GLOBALS);
+    loadQ(&tc->as, SLOTS, FRAME, (int32_t)offsetof(CallFrame, slots));
+
+    if (tc->final)
+        emitEntry(tc);
+    *entryExits = tc->exitCount;
+
+    placeLabel(&tc->as, LOOP_LABEL);
+    for (int i = 0; i < tc->recording->count; i++)
+    {
+        if (!emitStep(tc, i))
+            return false;
+    }
+
+    emitExits(tc);
+
+    placeLabel(&tc->as, EPILOGUE_LABEL);
+    arithImm(&tc->as, 0, RSP, FRAME_SIZE);
+    pop64(&tc->as, R15);
+    pop64(&tc->as, R14);
+    pop64(&tc->as, R13);
+    pop64(&tc->as, RBX);
+    pop64(&tc->as, RBP);
+    emit8(&tc->as, 0xc3);
+
+    patchLabels(&tc->as);
+    return true;
+}
+
+// the first pass decides which cells can be checked once and which
+// globals can be hoisted, then the second emits the trace
+static Trace *compileTrace(TraceRecorder *recording)
+{
+    if (sizeof(Value) != 16)
+        return NULL;
+
+    TraceCompiler tc;
+    tc.chunk = &recording->frame->function->chunk;
+    tc.recording = recording;
+    tc.final = false;
+    tc.cellCount = 0;
+    tc.globalCount = 0;
+    tc.hoistedCount = 0;
+    tc.exitCapacity = 0;
+    tc.exits = NULL;
+
+    int entryExits;
+    bool translated = translate(&tc, &entryExits);
+    freeAssembler(&tc.as);
+    if (!translated)
+    {
+        FREE_ARRAY(TraceExit, tc.exits, tc.exitCapacity);
+        return NULL;
+    }
+
+    for (int i = 0; i < tc.cellCount; i++)
+    {
+        Cell *cell = &tc.cells[i];
+        cell->stable = cell->readFirst && !cell->mixed;
+        if (cell->stable && cell->isGlobal && !cell->written)
+            cell->hoisted = tc.hoistedCount++;
+    }
+
+    tc.final = true;
+    translated = translate(&tc, &entryExits);
+    FREE_ARRAY(TraceExit, tc.exits, tc.exitCapacity);
+
+    size_t size;
+    void *code = translated ? makeExecutable(&tc.as, &size) : NULL;
+    freeAssembler(&tc.as);
+    if (code == NULL)
+        return NULL;
+
+    Trace *trace = ALLOCATE(Trace, 1);
+    trace->code = code;
+    trace->size = size;
+    trace->depth = recording->depth;
+    trace->entryExits = entryExits;
+    trace->entryFailures = 0;
+    trace->globalCount = tc.globalCount;
+    trace->globalNames = ALLOCATE(ObjString *, tc.globalCount);
+    trace->globalSlots = ALLOCATE(Value *, tc.globalCount);
+    trace->globalValues = NULL;
+    trace->globalCapacity = 0;
+
+    // a trace that reads no globals has no arrays to copy into
+    if (tc.globalCount > 0)
+    {
+        memcpy(trace->globalNames, tc.globals, sizeof(ObjString *) * tc.globalCount);
+    }
+
+    return trace;
+}
+
+static void freeTrace(Trace *trace)
+{
+    freeExecutable(trace->code, trace->size);
+    FREE_ARRAY(ObjString *, trace->globalNames, trace->globalCount);
+    FREE_ARRAY(Value *, trace->globalSlots, trace->globalCount);
+    FREE(Trace, trace);
+}
+
+// point the trace at its globals again if the table moved anything
+static bool resolveGlobals(VM *vm, Trace *trace)
+{
+    Table *globals = &vm->globals;
+    bool moved = trace->globalValues != globals->values || trace->globalCapacity != globals->capacity;
+
+    for (int i = 0; i < trace->globalCount && !moved; i++)
+    {
+        moved = globals->keys[trace->globalSlots[i] - globals->values] != trace->globalNames[i];
+    }
+
+    if (!moved)
+        return true;
+
+    for (int i = 0; i < trace->globalCount; i++)
+    {
+        trace->globalSlots[i] = tableGetSlot(globals, trace->globalNames[i]);
+        if (trace->globalSlots[i] == NULL)
+        {
+            trace->globalValues = NULL;
+            return false;
+        }
+    }
+
+    trace->globalValues = globals->values;
+    trace->globalCapacity = globals->capacity;
+    return true;
+}
+
+static LoopHeader *findLoop(Chunk *chunk, int offset)
+{
+    for (int i = 0; i < chunk->loopCount; i++)
+    {
+        if (chunk->loops[i].offset == offset)
+            return &chunk->loops[i];
+    }
+
+    return NULL;
+}
+
+// stop recording, the loop stays interpreted
+static void giveUp(VM *vm)
+{
+    vm->recorder->loop->blacklisted = true;
+    vm->recorder = NULL;
+}
+
+static void finishRecording(VM *vm)
+{
+    TraceRecorder *recording = vm->recorder;
+    vm->recorder = NULL;
+
+    recording->loop->trace = compileTrace(recording);
+    if (recording->loop->trace == NULL)
+        recording->loop->blacklisted = true;
+}
+
+static void runTrace(VM *vm, LoopHeader *loop, CallFrame *frame)
+{
+    Trace *trace = loop->trace;
+    if (vm->stackTop - frame->slots != trace->depth || !resolveGlobals(vm, trace))
+        return;
+
+    // the trace stores numbers and booleans into globals without looking
+    // at what they held, which may have been a function
+    if (trace->globalCount > 0)
+        vm->globalsVersion++;
+
+    TraceEntry entry = (TraceEntry)trace->code;
+    int exit = entry(frame, vm, trace->globalSlots);
+
+    // a trace whose entry checks keep failing is no use
+    if (exit < trace->entryExits && ++trace->entryFailures == TRACE_MAX_FAILURES)
+    {
+        freeTrace(trace);
+        loop->trace = NULL;
+        loop->blacklisted = true;
+    }
+}
+
+void traceBackEdge(VM *vm, CallFrame *frame)
+{
+    if (vm->recorder != NULL || vm->traceThreshold == 0)
+        return;
+
+    Chunk *chunk = &frame->function->chunk;
+    LoopHeader *loop = findLoop(chunk, (int)(frame->ip - chunk->code));
+    if (loop == NULL || loop->blacklisted)
+        return;
+
+    if (loop->trace != NULL)
+    {
+        runTrace(vm, loop, frame);
+        return;
+    }
+
+    if (++loop->hotness < vm->traceThreshold)
+        return;
+
+    // a vm records one iteration at a time, always into the same buffer
+    if (vm->recorderStorage == NULL)
+        vm->recorderStorage = ALLOCATE(TraceRecorder, 1);
+
+    TraceRecorder *recorder = vm->recorderStorage;
+    recorder->frame = frame;
+    recorder->loop = loop;
+    recorder->depth = (int)(vm->stackTop - frame->slots);
+    recorder->count = 0;
+    vm->recorder = recorder;
+}
+
+void recordInstruction(VM *vm, CallFrame *frame)
+{
+    TraceRecorder *recording = vm->recorder;
+    if (frame != recording->frame || recording->count == TRACE_MAX_LENGTH)
+    {
+        giveUp(vm);
+        return;
+    }
+
+    Chunk *chunk = &frame->function->chunk;
+    uint8_t *ip = frame->ip;
+    TraceStep *step = &recording->steps[recording->count++];
+    step->offset = (int)(ip - chunk->code);
+    step->type = VAL_NIL;
+    step->boundType = VAL_NIL;
+    step->taken = false;
+
+    switch (*ip)
+    {
+    case OP_CONSTANT:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_POP:
+    case OP_SET_LOCAL:
+    case OP_SET_GLOBAL:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_EQUAL:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_JUMP:
+        break;
+    case OP_GET_LOCAL:
+        step->type = frame->slots[ip[1]].type;
+        break;
+    case OP_GET_GLOBAL:
+    {
+        Value value;
+        if (!tableGet(&vm->globals, AS_STRING(chunk->constants.values[ip[1]]), &value))
+        {
+            giveUp(vm);
+            return;
+        }
+        step->type = value.type;
+        break;
+    }
+    case OP_JUMP_IF_FALSE:
+    {
+        Value condition = vm->stackTop[-1];
+        step->taken = IS_NIL(condition) || (IS_BOOL(condition) && !AS_BOOL(condition));
+        break;
+    }
+    case OP_LOOP:
+    {
+        int target = step->offset + 3 - readShort(ip + 1);
+        if (target == recording->loop->offset)
+        {
+            finishRecording(vm);
+            return;
+        }
+
+        // going back into code already recorded would be an inner loop
+        for (int i = 0; i < recording->count; i++)
+        {
+            if (recording->steps[i].offset == target)
+            {
+                giveUp(vm);
+                return;
+            }
+        }
+        break;
+    }
+    case OP_FOR_STEP:
+    {
+        if (step->offset + 6 - readShort(ip + 4) != recording->loop->offset)
+        {
+            giveUp(vm);
+            return;
+        }
+
+        step->type = frame->slots[ip[1]].type;
+        step->boundType = frame->slots[ip[2]].type;
+        finishRecording(vm);
+        return;
+    }
+    default:
+        giveUp(vm);
+        return;
+    }
+}
+
+void abortRecording(VM *vm)
+{
+    vm->recorder = NULL;
+}
+
+void freeRecorder(VM *vm)
+{
+    if (vm->recorderStorage != NULL)
+        FREE(TraceRecorder, vm->recorderStorage);
+    vm->recorderStorage = NULL;
+    vm->recorder = NULL;
+}
+
+void freeTraces(Chunk *chunk)
+{
+    for (int i = 0; i < chunk->loopCount; i++)
+    {
+        if (chunk->loops[i].trace != NULL)
+            freeTrace(chunk->loops[i].trace);
+    }
+}
+
+#else
+
+// no jit on this platform, loops are interpreted
+
+void traceBackEdge(VM *vm, CallFrame *frame)
+{
+}
+
+void recordInstruction(VM *vm, CallFrame *frame)
+{
+}
+
+void abortRecording(VM *vm)
+{
+    vm->recorder = NULL;
+}
+
+void freeRecorder(VM *vm)
+{
+    vm->recorder = NULL;
+}
+
+void freeTraces(Chunk *chunk)
+{
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef blue_trace_h
+#define blue_trace_h
+
+#include "common.h"
+#include "jit.h"
+#include "vm.h"
+
+// back-edges taken to a loop header before its iteration is recorded
+#define TRACE_THRESHOLD 64
+
+// longest recorded iteration, in instructions
+#define TRACE_MAX_LENGTH 256
+
+// an iteration being recorded, opaque outside trace.c
+typedef struct TraceRecorder TraceRecorder;
+
+// native code for one loop, opaque outside trace.c
+typedef struct Trace Trace;
+
+// the interpreter just jumped back to frame->ip: run the loop's trace,
+// or count towards recording one
+void traceBackEdge(VM *vm, CallFrame *frame);
+
+// called before each instruction while vm->recorder is set
+void recordInstruction(VM *vm, CallFrame *frame);
+
+// drop a recording in progress, the loop may be recorded again later
+void abortRecording(VM *vm);
+
+// release the buffer a vm records into
+void freeRecorder(VM *vm);
+
+// unmap the traces of a chunk's loops
+void freeTraces(Chunk *chunk);
+
+#endif
@@ -1,8 +1,8 @@
-#include <stdio.h>
 #include <string.h>
 
 #include "object.h"
 #include "memory.h"
+#include "number.h"
 #include "value.h"
 
 // initialize literal array
@@ -28,6 +28,16 @@ void writeArrayValue(ValueArray *array, Value value)
     array->count++;
 }
 
+// grow straight to a known size instead of doubling towards it
+void reserveValueArray(ValueArray *array, int capacity)
+{
+    if (array->capacity >= capacity)
+        return;
+
+    array->values = GROW_ARRAY(Value, array->values, array->capacity, capacity);
+    array->capacity = capacity;
+}
+
 // free literal array
 void freeValueArray(ValueArray *array)
 {
@@ -35,29 +45,59 @@ void freeValueArray(ValueArray *array)
     initValueArray(array);
 }
 
+// digits written backwards from the end of a small buffer, no printf
+static void printInt(Output *output, int64_t value)
+{
+    char digits[24];
+    char *start = digits + sizeof(digits);
+
+    // negated as unsigned, so INT64_MIN has a magnitude too
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do
+    {
+        *--start = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0)
+        *--start = '-';
+
+    writeOutput(output, start, (int)(digits + sizeof(digits) - start));
+}
+
 // print value
-void printValue(Value value)
+void printValue(Output *output, Value value)
 {
     switch (value.type)
     {
     case VAL_BOOL:
     {
-        printf(AS_BOOL(value) ? "true" : "false");
+        if (AS_BOOL(value))
+            writeOutput(output, "true", 4);
+        else
+            writeOutput(output, "false", 5);
         break;
     }
     case VAL_NIL:
     {
-        printf("nil");
+        writeOutput(output, "nil", 3);
         break;
     }
     case VAL_NUMBER:
     {
-        printf("%g", AS_NUMBER(value));
+        // the shortest digits that read back as the same number
+        char number[NUMBER_TEXT];
+        writeOutput(output, number, formatNumber(AS_NUMBER(value), number));
+        break;
+    }
+    case VAL_INT:
+    {
+        printInt(output, AS_INT(value));
         break;
     }
     case VAL_OBJ:
     {
-        printObject(value);
+        printObject(output, value);
         break;
     }
     default:
@@ -66,15 +106,19 @@ void printValue(Value value)
 }
 
 // print value with new line
-void printlnValue(Value value)
+void printlnValue(Output *output, Value value)
 {
-    printValue(value);
-    printf("\n");
+    printValue(output, value);
+    writeOutput(output, "\n", 1);
 }
 
 // return if both values equate
 bool valuesEquate(Value a, Value b)
 {
+    // an integer and a double can still be the same number
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+        return numbersEquate(a, b);
+
     // mismatched types
     if (a.type != b.type)
         return false;
@@ -87,13 +131,30 @@ bool valuesEquate(Value a, Value b)
     case VAL_BOOL:
         // both are bools
         return AS_BOOL(a) == AS_BOOL(b);
-    case VAL_NUMBER:
-        // both are numbers
-        return AS_NUMBER(a) == AS_NUMBER(b);
     case VAL_OBJ:
         return AS_OBJ(a) == AS_OBJ(b);
     default:
         // unreachable
         return false;
     }
+}
+
+// exact comparison, a double can round to the same value as a large integer
+bool numbersEquate(Value a, Value b)
+{
+    if (IS_INT(a) && IS_INT(b))
+        return AS_INT(a) == AS_INT(b);
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    if (x != y)
+        return false;
+
+    if (IS_INT(a) == IS_INT(b))
+        return true;
+
+    // x == y, so the double is in range unless it is exactly 2^63
+    int64_t integer = IS_INT(a) ? AS_INT(a) : AS_INT(b);
+    double number = IS_INT(a) ? y : x;
+    return number < 9223372036854775808.0 && (int64_t)number == integer;
 }
\ No newline at end of file
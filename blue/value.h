@@ -2,6 +2,7 @@
 #define blue_value_h
 
 #include "common.h"
+#include "output.h"
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
@@ -11,6 +12,7 @@ typedef enum
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
+    VAL_INT,
     VAL_OBJ,
 } ValueType;
 
@@ -23,6 +25,7 @@ typedef struct
         // stack
         bool boolean;
         double number;
+        int64_t integer;
         // heap
         Obj *obj;
     } as;
@@ -31,20 +34,30 @@ typedef struct
 // checking type before using AS_ macros
 #define IS_BOOL(item) ((item).type == VAL_BOOL)
 #define IS_NIL(item) ((item).type == VAL_NIL)
-#define IS_NUMBER(item) ((item).type == VAL_NUMBER)
+#define IS_DOUBLE(item) ((item).type == VAL_NUMBER)
+#define IS_INT(item) ((item).type == VAL_INT)
+#define IS_NUMBER(item) (IS_DOUBLE(item) || IS_INT(item))
 #define IS_OBJ(item) ((item).type == VAL_OBJ)
 
 // unpack struct for C value; nil carries no extra data to rep nil
 #define AS_BOOL(item) ((item).as.boolean)
-#define AS_NUMBER(item) ((item).as.number)
+#define AS_INT(item) ((item).as.integer)
+#define AS_NUMBER(item) valueToDouble(item)
 #define AS_OBJ(item) ((item).as.obj)
 
 // macros to mask C values into our struct
 #define BOOL_VAL(item) ((Value){VAL_BOOL, {.boolean = item}})
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(item) ((Value){VAL_NUMBER, {.number = item}})
+#define INT_VAL(item) ((Value){VAL_INT, {.integer = item}})
 #define OBJ_VAL(item) ((Value){VAL_OBJ, {.obj = (Obj *)item}})
 
+// either kind of number as a double, small integers are exact
+static inline double valueToDouble(Value value)
+{
+    return IS_INT(value) ? (double)AS_INT(value) : value.as.number;
+}
+
 // array of literal values
 typedef struct
 {
@@ -61,19 +74,25 @@ typedef struct
 // returns a C bool for the users code to see
 bool valuesEquate(Value a, Value b);
 
+// numeric equality of two numbers, either of which may be an integer
+bool numbersEquate(Value a, Value b);
+
 // create or clear array
 void initValueArray(ValueArray *array);
 
 // add item
 void writeArrayValue(ValueArray *array, Value value);
 
+// make room for at least capacity items in one allocation
+void reserveValueArray(ValueArray *array, int capacity);
+
 // delete items
 void freeValueArray(ValueArray *array);
 
 // void print value
-void printValue(Value value);
+void printValue(Output *output, Value value);
 
 // print value with newline
-void printlnValue(Value value);
+void printlnValue(Output *output, Value value);
 
 #endif
\ No newline at end of file
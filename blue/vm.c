@@ -7,74 +7,31 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "events.h"
+#include "jit.h"
 #include "object.h"
 #include "math.h"
 #include "memory.h"
+#include "natives.h"
+#include "scheduler.h"
+#include "trace.h"
 #include "vm.h"
 
-VM vm;
-
-// native functions
-static Value clockNative(int argCount, Value *args)
-{
-    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
-}
-
-// prints the contents of file
-static Value printFileNative(int argCount, Value *args)
-{
-    char buf[1024];
-    FILE *file;
-    size_t nread;
-
-    file = fopen(AS_CSTRING(args[0]), "r");
-    if (file)
-    {
-        // print contnets 'sizeof buffer' bytes at a time
-        while ((nread = fread(buf, 1, sizeof buf, file)) > 0)
-        {
-            fwrite(buf, 1, nread, stdout);
-        }
-
-        // deal with error
-        if (ferror(file))
-        {
-            printf("Error printing: %s", AS_CSTRING(args[0]));
-        }
-
-        fclose(file);
-    }
-    else
-    {
-        // file does not exist
-        fclose(file);
-        printf("Error file does not exist: %s", AS_CSTRING(args[0]));
-        exit(1);
-    }
-
-    return NUMBER_VAL(100);
-}
-
 // config: point stackTop to the beginning
-static void resetStack()
+static void resetStack(VM *vm)
 {
-    vm.stackTop = vm.stack;
-    vm.frameCount = 0;
+    vm->stackTop = vm->stack;
+    vm->frameCount = 0;
+    vm->openUpvalues = NULL;
+    abortRecording(vm);
 }
 
-// todo: document
-static void runtimeError(const char *format, ...)
+// innermost call first
+static void printFrames(CallFrame *frames, int frameCount)
 {
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-    fputs("\n", stderr);
-
-    // print stack trace
-    for (int i = vm.frameCount - 1; i > -1; i--)
+    for (int i = frameCount - 1; i > -1; i--)
     {
-        CallFrame *frame = &vm.frames[i];
+        CallFrame *frame = &frames[i];
         ObjFunction *function = frame->function;
 
         size_t instruction = frame->ip - function->chunk.code - 1;
@@ -90,107 +47,272 @@ static void runtimeError(const char *format, ...)
             fprintf(stderr, "%s()\n", function->name->chars);
         }
     }
+}
+
+// report an error with a stack trace and reset the stack
+void runtimeError(VM *vm, const char *format, ...)
+{
+    // what was printed before the error comes before it
+    flushOutput(&vm->output);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
 
-    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    // print stack trace, on through whatever resumed a failing fiber
+    printFrames(vm->frames, vm->frameCount);
+    for (ObjFiber *fiber = vm->fiber; fiber != NULL; fiber = fiber->owner)
+        printFrames(fiber->frames, fiber->frameCount);
+
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
     size_t instruction = frame->ip - frame->function->chunk.code - 1;
     int line = frame->function->chunk.lines[instruction];
     fprintf(stderr, "[line %d] in script.\n", line);
 
-    resetStack();
-}
-
-// push a native function onto the stack
-static void defineNative(const char *name, NativeFunc function)
-{
-    push(OBJ_VAL(copyString(name, (int)strlen(name))));
-    push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
-    pop();
-    pop();
+    resetStack(vm);
 }
 
 // set up vm
-void initVM()
+void initVM(VM *vm)
 {
-    resetStack();
-    vm.objects = NULL;
-    initTable(&vm.globals);
-    initTable(&vm.strings);
+    vm->frames = vm->frameStorage;
+    vm->frameCapacity = FRAMES_MAX;
+    vm->stack = vm->stackStorage;
+    vm->stackCapacity = STACK_MAX;
+    vm->fiber = NULL;
+    vm->resumeDepth = 0;
+    resetStack(vm);
+    vm->objects = NULL;
+    initTable(&vm->globals);
+    initTable(&vm->stringMethods);
+    initTable(&vm->listMethods);
+    initTable(&vm->mapMethods);
+    initTable(&vm->float64Methods);
+    initTable(&vm->channelMethods);
+    initTable(&vm->fiberMethods);
+    initInternSet(&vm->strings);
 
-    // define more native funcs
-    defineNative("clock", clockNative);
-    defineNative("printFile", printFileNative);
+    vm->jitThreshold = JIT_THRESHOLD;
+    vm->traceThreshold = TRACE_THRESHOLD;
+    vm->recorderStorage = NULL;
+    vm->taskImage = NULL;
+    vm->taskFingerprint = 0;
+    vm->globalsVersion = 0;
+    vm->taskVersion = 0;
+    vm->eventLoop = NULL;
+    initOutput(&vm->output);
+    vm->initString = NULL;
+    vm->initString = copyString(vm, "init", 4);
+    vm->rootShape = newShape(vm, NULL, NULL);
+
+    defineNatives(vm);
 }
 
 // clear vm
 // todo: finish function
-void freeVM()
+void freeVM(VM *vm)
 {
-    freeTable(&vm.globals);
-    freeTable(&vm.strings);
-    freeObjects();
+    freeEventLoop(vm);
+    freeOutput(&vm->output);
+    freeTable(&vm->globals);
+    freeTable(&vm->stringMethods);
+    freeTable(&vm->listMethods);
+    freeTable(&vm->mapMethods);
+    freeTable(&vm->float64Methods);
+    freeTable(&vm->channelMethods);
+    freeTable(&vm->fiberMethods);
+    freeInternSet(&vm->strings);
+    freeObjects(vm);
+    freeRecorder(vm);
+    freeTaskImage(vm);
 }
 
 // append value
-void push(Value value)
+void push(VM *vm, Value value)
 {
-    *vm.stackTop = value;
-    vm.stackTop++;
+    *vm->stackTop = value;
+    vm->stackTop++;
 }
 
 // remove element
-Value pop()
+Value pop(VM *vm)
 {
     // since stackTop points to the next available item
     // we don't need to remove this value
     // we label it as available by pointing to it
-    vm.stackTop--;
-    return *vm.stackTop;
+    vm->stackTop--;
+    return *vm->stackTop;
 }
 
 // return element in stack
-static Value peek(int distance)
+static Value peek(VM *vm, int distance)
+{
+    return vm->stackTop[-1 - distance];
+}
+
+// a fiber's value stack grows to hold needed values. grown values move,
+// so frames and open upvalues are pointed at the copy
+static void reserveFiberStack(VM *vm, int needed)
 {
-    return vm.stackTop[-1 - distance];
+    if (needed <= vm->stackCapacity)
+        return;
+
+    int used = (int)(vm->stackTop - vm->stack);
+    int capacity = vm->stackCapacity * 2;
+    while (needed > capacity)
+        capacity *= 2;
+
+    Value *stack = ALLOCATE(Value, capacity);
+    memcpy(stack, vm->stack, sizeof(Value) * used);
+
+    for (int i = 0; i < vm->frameCount; i++)
+        vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+    for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+        upvalue->location = stack + (upvalue->location - vm->stack);
+
+    FREE_ARRAY(Value, vm->stack, vm->stackCapacity);
+    vm->stack = stack;
+    vm->stackTop = stack + used;
+    vm->stackCapacity = capacity;
 }
 
 // just "called" a function in the interpreter, so grow the stack
-static bool call(ObjFunction *function, int argCount)
+// closure is NULL for functions that capture nothing
+static bool call(VM *vm, ObjFunction *function, ObjClosure *closure, int argCount)
 {
     if (argCount != function->arity)
     {
-        runtimeError("Expected %d arguments but go %d.", function->arity, argCount);
+        runtimeError(vm, "Expected %d arguments but go %d.", function->arity, argCount);
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX)
+    if (vm->frameCount == FRAMES_MAX)
     {
-        runtimeError("Call stack is too large (Stack overflow..)");
+        runtimeError(vm, "Call stack is too large (Stack overflow..)");
         return false;
     }
 
-    CallFrame *frame = &vm.frames[vm.frameCount++];
+    // room for every value the callee can push, counted by the compiler
+    int needed = (int)(vm->stackTop - argCount - 1 - vm->stack) + function->maxSlots;
+    if (vm->fiber != NULL)
+    {
+        if (vm->frameCount == vm->frameCapacity)
+        {
+            int capacity = vm->frameCapacity * 2;
+            vm->frames = GROW_ARRAY(CallFrame, vm->frames, vm->frameCapacity, capacity);
+            vm->frameCapacity = capacity;
+        }
+
+        reserveFiberStack(vm, needed);
+    }
+    else if (needed > vm->stackCapacity)
+    {
+        runtimeError(vm, "Call stack is too large (Stack overflow..)");
+        return false;
+    }
+
+    CallFrame *frame = &vm->frames[vm->frameCount++];
     frame->function = function;
+    frame->closure = closure;
     frame->ip = function->chunk.code;
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->slots = vm->stackTop - argCount - 1;
+
+    // compiled code can't stop at a yield, fibers are interpreted
+    if (vm->fiber != NULL)
+        return true;
+
+    if (function->aot != NULL)
+        return function->aot(vm, frame);
+
+#ifdef BLUE_JIT
+    // hot functions run as machine code, to their return
+    if (function->jit == NULL && vm->jitThreshold > 0 && ++function->callCount == vm->jitThreshold)
+    {
+        jitCompile(function);
+    }
+
+    if (function->jit != NULL)
+        return jitExecute(vm, function, frame);
+#endif
+
     return true;
 }
 
+// call a method object with the receiver already in slot 0,
+// a closure, a bare function or a native of a built-in type
+static bool callMethod(VM *vm, Obj *method, int argCount)
+{
+    switch (method->type)
+    {
+    case OBJ_CLOSURE:
+    {
+        ObjClosure *closure = (ObjClosure *)method;
+        return call(vm, closure->function, closure, argCount);
+    }
+    case OBJ_NATIVE:
+    {
+        // the native reads the receiver from and leaves its result in slot 0
+        if (!((ObjNative *)method)->function(vm, argCount, vm->stackTop - argCount))
+            return false;
+
+        vm->stackTop -= argCount;
+        return true;
+    }
+    default:
+        return call(vm, (ObjFunction *)method, NULL, argCount);
+    }
+}
+
 // errors if not a function?
-static bool callValue(Value callee, int argCount)
+static bool callValue(VM *vm, Value callee, int argCount)
 {
     if (IS_OBJ(callee))
     {
         switch (OBJ_TYPE(callee))
         {
+        case OBJ_BOUND_METHOD:
+        {
+            // the receiver takes the callee's slot, where methods expect this
+            ObjBoundMethod *bound = AS_BOUND_METHOD(callee);
+            vm->stackTop[-argCount - 1] = bound->receiver;
+            return callMethod(vm, bound->method, argCount);
+        }
+        case OBJ_CLASS:
+        {
+            // the new instance replaces the class as slot 0 of init
+            ObjClass *klass = AS_CLASS(callee);
+            vm->stackTop[-argCount - 1] = OBJ_VAL(newInstance(vm, klass, vm->rootShape));
+
+            Value initializer;
+            if (tableGet(&klass->methods, vm->initString, &initializer))
+            {
+                return callMethod(vm, AS_OBJ(initializer), argCount);
+            }
+            else if (argCount != 0)
+            {
+                runtimeError(vm, "Expected 0 arguments but got %d.", argCount);
+                return false;
+            }
+
+            return true;
+        }
+        case OBJ_CLOSURE:
+        {
+            ObjClosure *closure = AS_CLOSURE(callee);
+            return call(vm, closure->function, closure, argCount);
+        }
         case OBJ_FUNCTION:
-            return call(AS_FUNCTION(callee), argCount);
+            return call(vm, AS_FUNCTION(callee), NULL, argCount);
         case OBJ_NATIVE:
         {
+            // the native leaves its result in the callee's slot
             NativeFunc native = AS_NATIVE(callee);
-            Value result = native(argCount, vm.stackTop - argCount);
-            vm.stackTop -= argCount + 1;
-            push(result);
+            if (!native(vm, argCount, vm->stackTop - argCount))
+                return false;
+
+            vm->stackTop -= argCount;
             return true;
         }
         default:
@@ -199,22 +321,302 @@ static bool callValue(Value callee, int argCount)
         }
     }
 
-    runtimeError("You can only call functions and classes.");
+    runtimeError(vm, "You can only call functions and classes.");
     return false;
 }
 
+// reuse the open upvalue for a slot or make one, so closures
+// capturing the same variable share it
+static ObjUpvalue *captureUpvalue(VM *vm, Value *local)
+{
+    ObjUpvalue *prevUpvalue = NULL;
+    ObjUpvalue *upvalue = vm->openUpvalues;
+
+    while (upvalue != NULL && upvalue->location > local)
+    {
+        prevUpvalue = upvalue;
+        upvalue = upvalue->next;
+    }
+
+    if (upvalue != NULL && upvalue->location == local)
+        return upvalue;
+
+    ObjUpvalue *createdUpvalue = newUpvalue(vm, local);
+    createdUpvalue->next = upvalue;
+
+    if (prevUpvalue == NULL)
+    {
+        vm->openUpvalues = createdUpvalue;
+    }
+    else
+    {
+        prevUpvalue->next = createdUpvalue;
+    }
+
+    return createdUpvalue;
+}
+
+// move every open upvalue at or above last off the stack
+static void closeUpvalues(VM *vm, Value *last)
+{
+    while (vm->openUpvalues != NULL && vm->openUpvalues->location >= last)
+    {
+        ObjUpvalue *upvalue = vm->openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        vm->openUpvalues = upvalue->next;
+    }
+}
+
+// replace the instance on top of the stack with one of its class's methods
+static bool bindMethod(VM *vm, ObjClass *klass, ObjString *name)
+{
+    Value method;
+    if (!tableGet(&klass->methods, name, &method))
+    {
+        runtimeError(vm, "Undefined property: %s", name->chars);
+        return false;
+    }
+
+    ObjBoundMethod *bound = newBoundMethod(vm, peek(vm, 0), AS_OBJ(method));
+    pop(vm);
+    push(vm, OBJ_VAL(bound));
+    return true;
+}
+
+// attach the method on top of the stack to the class below it
+static void defineMethod(VM *vm, ObjString *name)
+{
+    Value method = peek(vm, 0);
+    ObjClass *klass = AS_CLASS(peek(vm, 1));
+    tableSet(&klass->methods, name, method);
+    pop(vm);
+}
+
+// find the entry for a shape, the first entry is checked first
+static inline CacheEntry *cacheFind(PropertyCache *cache, ObjShape *shape)
+{
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++)
+    {
+        CacheEntry *entry = &cache->entries[i];
+
+        if (entry->shape == shape)
+            return entry;
+
+        // entries fill in order, nothing follows an unused one
+        if (entry->shape == NULL)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+// remember a shape, a full cache is megamorphic and stops learning
+static void cacheAdd(PropertyCache *cache, ObjShape *shape, int slot, ObjShape *transition)
+{
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++)
+    {
+        CacheEntry *entry = &cache->entries[i];
+
+        if (entry->shape == NULL)
+        {
+            entry->shape = shape;
+            entry->slot = slot;
+            entry->transition = transition;
+            return;
+        }
+    }
+}
+
+// make sure an instance can hold a field in slot
+static void ensureFieldCapacity(ObjInstance *instance, int slot)
+{
+    if (slot < instance->fieldCapacity)
+        return;
+
+    int oldCapacity = instance->fieldCapacity;
+    int capacity = oldCapacity;
+    while (capacity <= slot)
+    {
+        capacity = GROW_CAPACITY(capacity);
+    }
+
+    instance->fields = GROW_ARRAY(Value, instance->fields, oldCapacity, capacity);
+    instance->fieldCapacity = capacity;
+}
+
+// method table of a built-in receiver type, NULL if it has none
+static Table *builtinMethods(VM *vm, Value receiver)
+{
+    switch (OBJ_TYPE(receiver))
+    {
+    case OBJ_STRING:
+        return &vm->stringMethods;
+    case OBJ_LIST:
+        return &vm->listMethods;
+    case OBJ_MAP:
+        return &vm->mapMethods;
+    case OBJ_FLOAT64_ARRAY:
+        return &vm->float64Methods;
+    case OBJ_CHANNEL:
+        return &vm->channelMethods;
+    case OBJ_FIBER:
+        return &vm->fiberMethods;
+    default:
+        return NULL;
+    }
+}
+
+// find the entry for a receiver, instances are keyed by class and
+// shape since a field can shadow a method, built-in types by type alone
+static inline InvokeEntry *invokeCacheFind(InvokeCache *cache, int type, ObjClass *klass, ObjShape *shape)
+{
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++)
+    {
+        InvokeEntry *entry = &cache->entries[i];
+
+        if (entry->type == type && entry->klass == klass && entry->shape == shape)
+            return entry;
+
+        // entries fill in order, nothing follows an unused one
+        if (entry->type == -1)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+// remember a receiver, a full cache is megamorphic and stops learning
+static void invokeCacheAdd(InvokeCache *cache, InvokeEntry *resolved)
+{
+    for (int i = 0; i < PROPERTY_CACHE_SIZE; i++)
+    {
+        if (cache->entries[i].type == -1)
+        {
+            cache->entries[i] = *resolved;
+            return;
+        }
+    }
+}
+
+// find what receiver.name refers to the slow way
+static bool invokeResolve(VM *vm, Value receiver, ObjString *name, InvokeEntry *resolved)
+{
+    resolved->slot = -1;
+    resolved->method = NIL_VAL;
+
+    if (resolved->type == OBJ_INSTANCE)
+    {
+        resolved->slot = shapeFindSlot(resolved->shape, name);
+        if (resolved->slot != -1 || tableGet(&resolved->klass->methods, name, &resolved->method))
+            return true;
+
+        runtimeError(vm, "Undefined property: %s", name->chars);
+        return false;
+    }
+
+    Table *methods = builtinMethods(vm, receiver);
+    if (methods == NULL || !tableGet(methods, name, &resolved->method))
+    {
+        runtimeError(vm, "Undefined method: %s", name->chars);
+        return false;
+    }
+
+    return true;
+}
+
+// call receiver.name(args) straight from the stack, no bound method is made
+static bool invoke(VM *vm, ObjString *name, int argCount, InvokeCache *cache)
+{
+    Value receiver = peek(vm, argCount);
+
+    if (!IS_OBJ(receiver))
+    {
+        runtimeError(vm, "Only objects have methods.");
+        return false;
+    }
+
+    int type = OBJ_TYPE(receiver);
+    ObjClass *klass = NULL;
+    ObjShape *shape = NULL;
+
+    if (type == OBJ_INSTANCE)
+    {
+        klass = AS_INSTANCE(receiver)->klass;
+        shape = AS_INSTANCE(receiver)->shape;
+    }
+
+    // cache hit: a few pointer compares and the call
+    InvokeEntry *entry = invokeCacheFind(cache, type, klass, shape);
+    InvokeEntry resolved;
+
+    if (entry == NULL)
+    {
+        resolved.type = type;
+        resolved.klass = klass;
+        resolved.shape = shape;
+
+        if (!invokeResolve(vm, receiver, name, &resolved))
+            return false;
+
+        invokeCacheAdd(cache, &resolved);
+        entry = &resolved;
+    }
+
+    // a field holding a function is called like any other value
+    if (entry->slot != -1)
+    {
+        Value callee = AS_INSTANCE(receiver)->fields[entry->slot];
+        vm->stackTop[-argCount - 1] = callee;
+        return callValue(vm, callee, argCount);
+    }
+
+    return callMethod(vm, AS_OBJ(entry->method), argCount);
+}
+
 // todo: define what our language considers falsey
 static bool isFalsey(Value value)
 {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// integer power by squaring, false if the exponent is negative or the
+// result overflows, in which case the caller uses pow()
+static bool intPower(int64_t base, int64_t exponent, int64_t *result)
+{
+    if (exponent < 0)
+        return false;
+
+    int64_t value = 1;
+    while (exponent > 0)
+    {
+        if ((exponent & 1) && __builtin_mul_overflow(value, base, &value))
+            return false;
+
+        exponent >>= 1;
+        if (exponent > 0 && __builtin_mul_overflow(base, base, &base))
+            return false;
+    }
+
+    *result = value;
+    return true;
+}
+
+// counter < bound for counted loops, integers compare exactly
+static inline bool numberLess(Value a, Value b)
+{
+    if (IS_INT(a) && IS_INT(b))
+        return AS_INT(a) < AS_INT(b);
+
+    return AS_NUMBER(a) < AS_NUMBER(b);
+}
+
 // join strings
 // todo: move this
-static void concatenate()
+static void concatenate(VM *vm)
 {
-    ObjString *b = AS_STRING(pop());
-    ObjString *a = AS_STRING(pop());
+    ObjString *b = AS_STRING(pop(vm));
+    ObjString *a = AS_STRING(pop(vm));
 
     int length = a->length + b->length;
 
@@ -227,14 +629,23 @@ static void concatenate()
     memcpy(newString + a->length, b->chars, b->length);
     newString[length] = '\0';
 
-    ObjString *result = takeString(newString, length);
-    push(OBJ_VAL(result));
+    ObjString *result = takeString(vm, newString, length);
+    push(vm, OBJ_VAL(result));
+}
+
+// a native just parked the running fiber on a read or write, so it stops
+// as at a yield until the event loop resumes it with the result
+static inline bool waitingOnIo(VM *vm)
+{
+    return vm->fiber != NULL && vm->fiber->state == FIBER_WAITING;
 }
 
 // START OF THE RUN PROGRAM
-static InterpretResult run()
+// runs until the frame at baseFrame returns, or in step mode
+// for a single instruction of the top frame
+static InterpretResult run(VM *vm, int baseFrame, bool step)
 {
-    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
 
 // return pointer
 #define READ_BYTE() (*frame->ip++)
@@ -260,14 +671,46 @@ static InterpretResult run()
 #define BINARY_OP(valueType, op)                        \
     do                                                  \
     {                                                   \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) \
         {                                               \
-            runtimeError("Values must be numbers.");    \
+            runtimeError(vm, "Values must be numbers.");    \
             return INTERPRET_RUNTIME_ERROR;             \
         }                                               \
-        double b = AS_NUMBER(pop());                    \
-        double a = AS_NUMBER(pop());                    \
-        push(valueType(a op b));                        \
+        double b = AS_NUMBER(pop(vm));                    \
+        double a = AS_NUMBER(pop(vm));                    \
+        push(vm, valueType(a op b));                        \
+    } while (false)
+
+// integer fast path for arithmetic, checked with the overflow builtins.
+// an overflowing result falls through to the double version of the op
+#define INT_ARITH_OP(overflowOp, op)                                  \
+    do                                                                \
+    {                                                                 \
+        Value b = peek(vm, 0);                                            \
+        Value a = peek(vm, 1);                                            \
+        int64_t result;                                               \
+        if (IS_INT(a) && IS_INT(b) &&                                 \
+            !overflowOp(AS_INT(a), AS_INT(b), &result))               \
+        {                                                             \
+            vm->stackTop--;                                            \
+            vm->stackTop[-1] = INT_VAL(result);                        \
+            break;                                                    \
+        }                                                             \
+        BINARY_OP(NUMBER_VAL, op);                                    \
+    } while (false)
+
+// integer comparisons never need promoting
+#define COMPARE_OP(op)                                                \
+    do                                                                \
+    {                                                                 \
+        if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1)))                       \
+        {                                                             \
+            bool result = AS_INT(peek(vm, 1)) op AS_INT(peek(vm, 0));         \
+            vm->stackTop--;                                            \
+            vm->stackTop[-1] = BOOL_VAL(result);                       \
+            break;                                                    \
+        }                                                             \
+        BINARY_OP(BOOL_VAL, op);                                      \
     } while (false)
 
     // check which instruction to execute
@@ -277,8 +720,11 @@ static InterpretResult run()
 
 // print instruction if in debug
 #ifdef DEBUG_TRACE_EXECUTION
+        // what the program printed goes out before the trace goes on
+        flushOutput(&vm->output);
+
         // print stack values
-        printStack(vm.stack, vm.stackTop);
+        printStack(vm->stack, vm->stackTop);
 
         // print instruction with data
         disassembleInstruction(
@@ -286,6 +732,11 @@ static InterpretResult run()
             (int)(frame->ip - frame->function->chunk.code));
 #endif
 
+#ifdef BLUE_JIT
+        if (vm->recorder != NULL)
+            recordInstruction(vm, frame);
+#endif
+
         uint8_t instruction;
 
         switch (instruction = READ_BYTE())
@@ -296,41 +747,53 @@ static InterpretResult run()
             // print constant vlaue
             // todo: optimize
             Value constant = READ_CONSTANT();
-            push(constant);
+            push(vm, constant);
             break;
         }
         case OP_NIL:
         {
-            push(NIL_VAL);
+            push(vm, NIL_VAL);
             break;
         }
         case OP_TRUE:
         {
-            push(BOOL_VAL(true));
+            push(vm, BOOL_VAL(true));
             break;
         }
         case OP_FALSE:
         {
-            push(BOOL_VAL(false));
+            push(vm, BOOL_VAL(false));
             break;
         }
         // instruction, forgets a value from the stack
         case OP_POP:
         {
-            pop();
+            pop(vm);
             break;
         }
         case OP_GET_LOCAL:
         {
             // push local value to give O(1) read time
             uint8_t slot = READ_BYTE();
-            push(frame->slots[slot]);
+            push(vm, frame->slots[slot]);
             break;
         }
         case OP_SET_LOCAL:
         {
             uint8_t slot = READ_BYTE();
-            frame->slots[slot] = peek(0);
+            frame->slots[slot] = peek(vm, 0);
+            break;
+        }
+        case OP_GET_UPVALUE:
+        {
+            uint8_t slot = READ_BYTE();
+            push(vm, *frame->closure->upvalues[slot]->location);
+            break;
+        }
+        case OP_SET_UPVALUE:
+        {
+            uint8_t slot = READ_BYTE();
+            *frame->closure->upvalues[slot]->location = peek(vm, 0);
             break;
         }
         case OP_GET_GLOBAL:
@@ -338,84 +801,198 @@ static InterpretResult run()
             ObjString *name = READ_STRING();
 
             Value value;
-            if (!tableGet(&vm.globals, name, &value))
+            if (!tableGet(&vm->globals, name, &value))
             {
-                runtimeError("Undefied variable: %s", name->chars);
+                runtimeError(vm, "Undefied variable: %s", name->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
 
-            push(value);
+            push(vm, value);
             break;
         }
         case OP_DEFINE_GLOBAL:
         {
             // places variable from constants into global table
             ObjString *varName = READ_STRING();
-            tableSet(&vm.globals, varName, peek(0));
-            pop();
+            tableSet(&vm->globals, varName, peek(vm, 0));
+            vm->globalsVersion++;
+            pop(vm);
             break;
         }
         case OP_SET_GLOBAL:
         {
             ObjString *name = READ_STRING();
 
-            if (tableSet(&vm.globals, name, peek(0)))
+            Value *global = tableGetSlot(&vm->globals, name);
+            if (global == NULL)
             {
-                // remove variable that we set if
-                tableDelete(&vm.globals, name);
-                runtimeError("Undefined variable: %s", name->chars);
+                runtimeError(vm, "Undefined variable: %s", name->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm.frames[vm.frameCount - 1];
+
+            // only objects can be functions or classes
+            if (IS_OBJ(*global) || IS_OBJ(peek(vm, 0)))
+                vm->globalsVersion++;
+            *global = peek(vm, 0);
+            frame = &vm->frames[vm->frameCount - 1];
+            break;
+        }
+        case OP_GET_PROPERTY:
+        {
+            ObjString *name = READ_STRING();
+            PropertyCache *cache = &frame->function->chunk.caches[READ_SHORT()];
+
+            if (!IS_INSTANCE(peek(vm, 0)))
+            {
+                runtimeError(vm, "Only instances have properties.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
+
+            // cache hit: one shape compare and one indexed load
+            CacheEntry *entry = cacheFind(cache, instance->shape);
+            if (entry != NULL)
+            {
+                vm->stackTop[-1] = instance->fields[entry->slot];
+                break;
+            }
+
+            int slot = shapeFindSlot(instance->shape, name);
+            if (slot != -1)
+            {
+                cacheAdd(cache, instance->shape, slot, NULL);
+                vm->stackTop[-1] = instance->fields[slot];
+                break;
+            }
+
+            // not a field, so it must be a method
+            if (!bindMethod(vm, instance->klass, name))
+                return INTERPRET_RUNTIME_ERROR;
+            break;
+        }
+        case OP_SET_PROPERTY:
+        {
+            ObjString *name = READ_STRING();
+            PropertyCache *cache = &frame->function->chunk.caches[READ_SHORT()];
+
+            if (!IS_INSTANCE(peek(vm, 1)))
+            {
+                runtimeError(vm, "Only instances have fields.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            ObjInstance *instance = AS_INSTANCE(peek(vm, 1));
+            ObjShape *shape = instance->shape;
+            int slot;
+            ObjShape *transition;
+
+            CacheEntry *entry = cacheFind(cache, shape);
+            if (entry != NULL)
+            {
+                slot = entry->slot;
+                transition = entry->transition;
+            }
+            else
+            {
+                // a new field moves the instance to the next shape
+                slot = shapeFindSlot(shape, name);
+                transition = NULL;
+                if (slot == -1)
+                {
+                    transition = shapeAddField(vm, shape, name);
+                    slot = transition->slot;
+                }
+
+                cacheAdd(cache, shape, slot, transition);
+            }
+
+            if (transition != NULL)
+            {
+                ensureFieldCapacity(instance, slot);
+                instance->shape = transition;
+            }
+
+            // assignment is an expression, leave the value on the stack
+            instance->fields[slot] = peek(vm, 0);
+            Value value = pop(vm);
+            pop(vm);
+            push(vm, value);
+            break;
+        }
+        case OP_GET_SUPER:
+        {
+            ObjString *name = READ_STRING();
+            ObjClass *superclass = AS_CLASS(pop(vm));
+
+            if (!bindMethod(vm, superclass, name))
+                return INTERPRET_RUNTIME_ERROR;
+            break;
+        }
+        case OP_SUPER_INVOKE:
+        {
+            ObjString *name = READ_STRING();
+            int argCount = READ_BYTE();
+            ObjClass *superclass = AS_CLASS(pop(vm));
+
+            // this is already in slot 0 below the arguments
+            Value method;
+            if (!tableGet(&superclass->methods, name, &method))
+            {
+                runtimeError(vm, "Undefined property: %s", name->chars);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            if (!callMethod(vm, AS_OBJ(method), argCount))
+                return INTERPRET_RUNTIME_ERROR;
+
+            frame = &vm->frames[vm->frameCount - 1];
             break;
         }
         // logical, comparison
         case OP_EQUAL:
         {
-            Value b = pop();
-            Value a = pop();
-            push(BOOL_VAL(valuesEquate(a, b)));
+            Value b = pop(vm);
+            Value a = pop(vm);
+            push(vm, BOOL_VAL(valuesEquate(a, b)));
             break;
         }
         case OP_GREATER:
         {
-            BINARY_OP(BOOL_VAL, >);
+            COMPARE_OP(>);
             break;
         }
         case OP_LESS:
         {
-            BINARY_OP(BOOL_VAL, <);
+            COMPARE_OP(<);
             break;
         }
         // binary ops, arithametic
         case OP_ADD:
         {
-            if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
+            if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1)))
             {
-                concatenate();
+                concatenate(vm);
             }
-            else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+            else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1)))
             {
-                // todo: retry this BINARY_OP(NUMBER_VAL, +);
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a + b));
+                INT_ARITH_OP(__builtin_add_overflow, +);
             }
             else
             {
-                runtimeError("Values must be two strings or numbers.");
+                runtimeError(vm, "Values must be two strings or numbers.");
                 return INTERPRET_RUNTIME_ERROR;
             }
             break;
         }
         case OP_SUBTRACT:
         {
-            BINARY_OP(NUMBER_VAL, -);
+            INT_ARITH_OP(__builtin_sub_overflow, -);
             break;
         }
         case OP_MULTIPLY:
         {
-            BINARY_OP(NUMBER_VAL, *);
+            INT_ARITH_OP(__builtin_mul_overflow, *);
             break;
         }
         case OP_DIVIDE:
@@ -425,15 +1002,22 @@ static InterpretResult run()
         }
         case OP_EXPONENT:
         {
-            if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+            int64_t result;
+            if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1)) &&
+                intPower(AS_INT(peek(vm, 1)), AS_INT(peek(vm, 0)), &result))
+            {
+                vm->stackTop--;
+                vm->stackTop[-1] = INT_VAL(result);
+            }
+            else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1)))
             {
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(pow(a, b)));
+                double b = AS_NUMBER(pop(vm));
+                double a = AS_NUMBER(pop(vm));
+                push(vm, NUMBER_VAL(pow(a, b)));
             }
             else
             {
-                runtimeError("Values must be numbers.");
+                runtimeError(vm, "Values must be numbers.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
@@ -442,27 +1026,34 @@ static InterpretResult run()
         // urnary ops
         case OP_NOT:
         {
-            push(BOOL_VAL(isFalsey(pop())));
+            push(vm, BOOL_VAL(isFalsey(pop(vm))));
             break;
         }
         case OP_NEGATE:
         {
             // fail if not a number
-            if (!IS_NUMBER(peek(0)))
+            if (!IS_NUMBER(peek(vm, 0)))
             {
-                runtimeError("The operand or value must be a number.");
+                runtimeError(vm, "The operand or value must be a number.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
-            // just push a negative version of that value
-            // todo: just convert the number to negative
-            push(NUMBER_VAL(-AS_NUMBER(pop())));
+            // the one integer without a negative promotes to a double
+            Value value = pop(vm);
+            if (IS_INT(value) && AS_INT(value) != INT64_MIN)
+            {
+                push(vm, INT_VAL(-AS_INT(value)));
+            }
+            else
+            {
+                push(vm, NUMBER_VAL(-AS_NUMBER(value)));
+            }
             break;
         }
         // statements
         case OP_PRINT:
         {
-            printlnValue(pop());
+            printlnValue(&vm->output, pop(vm));
             break;
         }
         case OP_JUMP:
@@ -474,7 +1065,7 @@ static InterpretResult run()
         case OP_JUMP_IF_FALSE:
         {
             uint16_t offset = READ_SHORT();
-            if (isFalsey(peek(0)))
+            if (isFalsey(peek(vm, 0)))
                 frame->ip += offset;
             break;
         }
@@ -482,35 +1073,293 @@ static InterpretResult run()
         {
             uint16_t offset = READ_SHORT();
             frame->ip -= offset;
+#ifdef BLUE_JIT
+            traceBackEdge(vm, frame);
+#endif
+            break;
+        }
+        case OP_FOR_RANGE:
+        {
+            Value counter = frame->slots[READ_BYTE()];
+            Value bound = frame->slots[READ_BYTE()];
+            uint16_t offset = READ_SHORT();
+
+            if (!IS_NUMBER(counter) || !IS_NUMBER(bound))
+            {
+                runtimeError(vm, "Values must be numbers.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            if (!numberLess(counter, bound))
+                frame->ip += offset;
+            break;
+        }
+        case OP_FOR_STEP:
+        {
+            Value *counter = &frame->slots[READ_BYTE()];
+            Value bound = frame->slots[READ_BYTE()];
+            Value step = READ_CONSTANT();
+            uint16_t offset = READ_SHORT();
+
+            // the body may have changed either slot
+            if (!IS_NUMBER(*counter) || !IS_NUMBER(bound))
+            {
+                runtimeError(vm, "Values must be numbers.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            int64_t next;
+            if (IS_INT(*counter) && IS_INT(step) &&
+                !__builtin_add_overflow(AS_INT(*counter), AS_INT(step), &next))
+            {
+                *counter = INT_VAL(next);
+            }
+            else
+            {
+                *counter = NUMBER_VAL(AS_NUMBER(*counter) + AS_NUMBER(step));
+            }
+
+            if (numberLess(*counter, bound))
+            {
+                frame->ip -= offset;
+#ifdef BLUE_JIT
+                traceBackEdge(vm, frame);
+#endif
+            }
             break;
         }
         case OP_CALL:
         {
             int argCount = READ_BYTE();
-            if (!callValue(peek(argCount), argCount))
+            if (!callValue(vm, peek(vm, argCount), argCount))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (waitingOnIo(vm))
+                return INTERPRET_OK;
+            frame = &vm->frames[vm->frameCount - 1];
+            break;
+        }
+        case OP_INVOKE:
+        {
+            ObjString *name = READ_STRING();
+            int argCount = READ_BYTE();
+            InvokeCache *cache = &frame->function->chunk.invokeCaches[READ_SHORT()];
+
+            if (!invoke(vm, name, argCount, cache))
+                return INTERPRET_RUNTIME_ERROR;
+            if (waitingOnIo(vm))
+                return INTERPRET_OK;
+
+            frame = &vm->frames[vm->frameCount - 1];
+            break;
+        }
+        case OP_CLOSURE:
+        {
+            ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
+            ObjClosure *closure = newClosure(vm, function);
+            push(vm, OBJ_VAL(closure));
+
+            for (int i = 0; i < closure->upvalueCount; i++)
+            {
+                uint8_t isLocal = READ_BYTE();
+                uint8_t index = READ_BYTE();
+
+                // capture from this frame's slots, or share the enclosing closure's upvalue
+                if (isLocal)
+                {
+                    closure->upvalues[i] = captureUpvalue(vm, frame->slots + index);
+                }
+                else
+                {
+                    closure->upvalues[i] = frame->closure->upvalues[index];
+                }
+            }
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+        {
+            closeUpvalues(vm, vm->stackTop - 1);
+            pop(vm);
+            break;
+        }
+        // collections
+        case OP_BUILD_LIST:
+        {
+            // items are already on the stack, copy them in one go
+            int itemCount = READ_BYTE();
+            ObjList *list = newList(vm);
+            reserveValueArray(&list->items, itemCount);
+            if (itemCount > 0)
+            {
+                memcpy(list->items.values, vm->stackTop - itemCount, sizeof(Value) * itemCount);
+            }
+            list->items.count = itemCount;
+
+            vm->stackTop -= itemCount;
+            push(vm, OBJ_VAL(list));
+            break;
+        }
+        case OP_BUILD_MAP:
+        {
+            // keys and values alternate on the stack
+            int pairCount = READ_BYTE();
+            ObjMap *map = newMap(vm);
+            Value *pairs = vm->stackTop - pairCount * 2;
+
+            for (int i = 0; i < pairCount; i++)
             {
+                mapSet(&map->map, pairs[i * 2], pairs[i * 2 + 1]);
+            }
+
+            vm->stackTop = pairs;
+            push(vm, OBJ_VAL(map));
+            break;
+        }
+        case OP_INDEX_GET:
+        {
+            Value target = peek(vm, 1);
+            Value item;
+
+            if (IS_LIST(target))
+            {
+                ObjList *list = AS_LIST(target);
+                int index;
+                if (!toIndex(vm, peek(vm, 0), list->items.count, &index))
+                    return INTERPRET_RUNTIME_ERROR;
+
+                item = list->items.values[index];
+            }
+            else if (IS_FLOAT64_ARRAY(target))
+            {
+                ObjFloat64Array *array = AS_FLOAT64_ARRAY(target);
+                int index;
+                if (!toIndex(vm, peek(vm, 0), array->length, &index))
+                    return INTERPRET_RUNTIME_ERROR;
+
+                item = NUMBER_VAL(array->values[index]);
+            }
+            else if (IS_MAP(target))
+            {
+                if (!mapGet(&AS_MAP(target)->map, peek(vm, 0), &item))
+                {
+                    runtimeError(vm, "Key not found in map.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+            }
+            else
+            {
+                runtimeError(vm, "Only lists, maps and Float64Arrays can be indexed.");
                 return INTERPRET_RUNTIME_ERROR;
             }
+
+            vm->stackTop -= 2;
+            push(vm, item);
+            break;
+        }
+        case OP_INDEX_SET:
+        {
+            Value target = peek(vm, 2);
+
+            if (IS_LIST(target))
+            {
+                ObjList *list = AS_LIST(target);
+                int index;
+                if (!toIndex(vm, peek(vm, 1), list->items.count, &index))
+                    return INTERPRET_RUNTIME_ERROR;
+
+                list->items.values[index] = peek(vm, 0);
+            }
+            else if (IS_FLOAT64_ARRAY(target))
+            {
+                ObjFloat64Array *array = AS_FLOAT64_ARRAY(target);
+                int index;
+                if (!toIndex(vm, peek(vm, 1), array->length, &index))
+                    return INTERPRET_RUNTIME_ERROR;
+
+                if (!IS_NUMBER(peek(vm, 0)))
+                {
+                    runtimeError(vm, "Float64Array items must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                array->values[index] = AS_NUMBER(peek(vm, 0));
+            }
+            else if (IS_MAP(target))
+            {
+                mapSet(&AS_MAP(target)->map, peek(vm, 1), peek(vm, 0));
+            }
+            else
+            {
+                runtimeError(vm, "Only lists, maps and Float64Arrays can be indexed.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            // assignment is an expression, leave the item on the stack
+            Value item = pop(vm);
+            vm->stackTop -= 2;
+            push(vm, item);
             break;
         }
         // eof, program, function
         case OP_RETURN:
         {
-            Value value = pop();
-            vm.frameCount--;
+            Value value = pop(vm);
+            closeUpvalues(vm, frame->slots);
+            vm->frameCount--;
 
-            if (vm.frameCount == 0)
-            {
-                pop();
+            vm->stackTop = frame->slots;
+            push(vm, value);
+
+            // back in C, the bottom frame's value is left where its callee was
+            if (vm->frameCount == baseFrame)
                 return INTERPRET_OK;
+
+            frame = &vm->frames[vm->frameCount - 1];
+            break;
+        }
+        case OP_YIELD:
+        {
+            if (vm->fiber == NULL)
+            {
+                runtimeError(vm, "Can only yield inside a fiber.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            // back to resumeFiber, the value stays on top for it to take
+            vm->fiber->state = FIBER_SUSPENDED;
+            return INTERPRET_OK;
+        }
+        // classes
+        case OP_CLASS:
+        {
+            push(vm, OBJ_VAL(newClass(vm, READ_STRING())));
+            break;
+        }
+        case OP_INHERIT:
+        {
+            Value superclass = peek(vm, 1);
+            if (!IS_CLASS(superclass))
+            {
+                runtimeError(vm, "Superclass must be a class.");
+                return INTERPRET_RUNTIME_ERROR;
             }
 
-            vm.stackTop = frame->slots;
-            push(value);
-            frame = &vm.frames[vm.frameCount - 1];
+            // copy the methods down, lookups never walk the hierarchy
+            ObjClass *subclass = AS_CLASS(peek(vm, 0));
+            tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+            pop(vm);
             break;
         }
+        case OP_METHOD:
+        {
+            defineMethod(vm, READ_STRING());
+            break;
         }
+        }
+
+        if (step)
+            return INTERPRET_OK;
     }
 
 #undef READ_BYTE
@@ -518,22 +1367,244 @@ static InterpretResult run()
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef INT_ARITH_OP
+#undef COMPARE_OP
 }
 
 // compile source to byte code
-InterpretResult interpret(const char *source)
+InterpretResult interpret(VM *vm, const char *source)
 {
     // compile source code, get top level code/function
-    ObjFunction *function = compile(source);
+    ObjFunction *function = compile(vm, source);
 
     // if null, there was a compile time error and we
     // dont have a starting place for the code
     if (function == NULL)
         return INTERPRET_COMPILE_ERROR;
 
-    // begin executing
-    call(function, 0);
+    return interpretFunction(vm, function);
+}
+
+InterpretResult interpretFunction(VM *vm, ObjFunction *function)
+{
+    // the script function sits in slot 0, like any callee
+    push(vm, OBJ_VAL(function));
+    if (!call(vm, function, NULL, 0))
+        return INTERPRET_RUNTIME_ERROR;
+
+    // a script translated ahead of time already ran inside call
+    InterpretResult result = vm->frameCount == 0 ? INTERPRET_OK : run(vm, 0, false);
+
+    // nothing wants the script's return value
+    if (result == INTERPRET_OK)
+        pop(vm);
+
+    // then the reads and writes it left in flight finish
+    if (result == INTERPRET_OK && !runEventLoop(vm))
+        result = INTERPRET_RUNTIME_ERROR;
+
+    flushOutput(&vm->output);
+    return result;
+}
+
+InterpretResult interpretCall(VM *vm, Value callee, int argCount, Value *args, Value *result)
+{
+    int frameIndex = vm->frameCount;
+    Value *stackTop = vm->stackTop;
+    ObjUpvalue *openUpvalues = vm->openUpvalues;
+
+    // a native called this from a fiber, whose stack was only sized for the frames in it
+    if (vm->fiber != NULL)
+    {
+        reserveFiberStack(vm, (int)(stackTop - vm->stack) + argCount + 1);
+        stackTop = vm->stackTop;
+    }
+
+    push(vm, callee);
+    for (int i = 0; i < argCount; i++)
+        push(vm, args[i]);
+
+    // natives and compiled code are done after callValue, interpreted calls run here
+    InterpretResult status = INTERPRET_RUNTIME_ERROR;
+    if (callValue(vm, callee, argCount))
+        status = vm->frameCount > frameIndex ? run(vm, frameIndex, false) : INTERPRET_OK;
+
+    if (status != INTERPRET_OK)
+    {
+        // the error reset the stack, put back whatever called in here
+        vm->frameCount = frameIndex;
+        vm->stackTop = stackTop;
+        vm->openUpvalues = openUpvalues;
+        return status;
+    }
+
+    *result = pop(vm);
+    return INTERPRET_OK;
+}
+
+// trade the vm's stacks for the fiber's. called again it trades them back
+static void swapStacks(VM *vm, ObjFiber *fiber)
+{
+#define SWAP(type, field)          \
+    do                             \
+    {                              \
+        type swapped = vm->field;  \
+        vm->field = fiber->field;  \
+        fiber->field = swapped;    \
+    } while (false)
 
-    // run code
-    return run();
+    SWAP(CallFrame *, frames);
+    SWAP(int, frameCount);
+    SWAP(int, frameCapacity);
+    SWAP(Value *, stack);
+    SWAP(Value *, stackTop);
+    SWAP(int, stackCapacity);
+    SWAP(ObjUpvalue *, openUpvalues);
+#undef SWAP
+
+    ObjFiber *owner = vm->fiber;
+    vm->fiber = fiber->owner;
+    fiber->owner = owner;
+}
+
+// a finished fiber never runs again, so its stacks can go
+static void freeFiberStacks(ObjFiber *fiber)
+{
+    FREE_ARRAY(CallFrame, fiber->frames, fiber->frameCapacity);
+    FREE_ARRAY(Value, fiber->stack, fiber->stackCapacity);
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+    fiber->stack = NULL;
+    fiber->stackTop = NULL;
+    fiber->stackCapacity = 0;
+    fiber->openUpvalues = NULL;
+}
+
+bool resumeFiber(VM *vm, ObjFiber *fiber, int argCount, Value *args, Value *result)
+{
+    switch (fiber->state)
+    {
+    case FIBER_RUNNING:
+        runtimeError(vm, "Can't resume a fiber that is already running.");
+        return false;
+    case FIBER_DONE:
+        runtimeError(vm, "Can't resume a fiber that has finished.");
+        return false;
+    case FIBER_WAITING:
+        runtimeError(vm, "Can't resume a fiber waiting on I/O.");
+        return false;
+    case FIBER_SUSPENDED:
+        if (argCount > 1)
+        {
+            runtimeError(vm, "A suspended fiber is resumed with at most 1 value but got %d.", argCount);
+            return false;
+        }
+        break;
+    case FIBER_NEW:
+        break;
+    }
+
+    if (vm->resumeDepth == RESUMES_MAX)
+    {
+        runtimeError(vm, "Fibers are nested too deeply (Stack overflow..)");
+        return false;
+    }
+
+    FiberState state = fiber->state;
+    fiber->state = FIBER_RUNNING;
+    vm->resumeDepth++;
+    swapStacks(vm, fiber);
+
+    bool started = true;
+    if (state == FIBER_NEW)
+    {
+        push(vm, fiber->function);
+        for (int i = 0; i < argCount; i++)
+            push(vm, args[i]);
+        started = callValue(vm, fiber->function, argCount);
+    }
+    else
+    {
+        // what the yield it stopped at evaluates to
+        push(vm, argCount == 1 ? args[0] : NIL_VAL);
+    }
+
+    InterpretResult status = INTERPRET_RUNTIME_ERROR;
+    if (started)
+        status = vm->frameCount > 0 ? run(vm, 0, false) : INTERPRET_OK;
+
+    // the value yielded or returned
+    Value value = NIL_VAL;
+    if (status == INTERPRET_OK)
+        value = pop(vm);
+
+    swapStacks(vm, fiber);
+    vm->resumeDepth--;
+    if (fiber->state == FIBER_RUNNING)
+    {
+        fiber->state = FIBER_DONE;
+        freeFiberStacks(fiber);
+    }
+
+    // the error was reported through the resumer's frames, which unwind too
+    if (status != INTERPRET_OK)
+    {
+        resetStack(vm);
+        return false;
+    }
+
+    *result = value;
+    return true;
+}
+
+bool stepInstruction(VM *vm)
+{
+    int frameIndex = vm->frameCount - 1;
+    if (run(vm, frameIndex, true) != INTERPRET_OK)
+        return false;
+
+    // a call into an interpreted function pushed its frame, finish it here
+    if (vm->frameCount > frameIndex + 1)
+        return run(vm, frameIndex + 1, false) == INTERPRET_OK;
+
+    return true;
+}
+
+// OP_GET_GLOBAL without entering the interpreter loop
+bool compiledGetGlobal(VM *vm, ObjString *name)
+{
+    Value value;
+    if (!tableGet(&vm->globals, name, &value))
+    {
+        runtimeError(vm, "Undefied variable: %s", name->chars);
+        return false;
+    }
+
+    push(vm, value);
+    return true;
+}
+
+// OP_CALL, an interpreted callee runs to its return before this returns
+bool compiledCall(VM *vm, int argCount)
+{
+    int frameIndex = vm->frameCount - 1;
+    if (!callValue(vm, peek(vm, argCount), argCount))
+        return false;
+
+    if (vm->frameCount > frameIndex + 1)
+        return run(vm, frameIndex + 1, false) == INTERPRET_OK;
+
+    return true;
+}
+
+// OP_RETURN of compiled code
+void compiledReturn(VM *vm)
+{
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    Value value = pop(vm);
+    closeUpvalues(vm, frame->slots);
+    vm->frameCount--;
+    vm->stackTop = frame->slots;
+    push(vm, value);
 }
\ No newline at end of file
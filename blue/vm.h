@@ -2,6 +2,7 @@
 #define blue_vm_h
 
 #include "chunk.h"
+#include "intern.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
@@ -10,12 +11,22 @@
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
 
+// a fiber's stacks start this small and grow to fit each call
+#define FIBER_FRAMES 4
+#define FIBER_STACK UINT8_COUNT
+
+// fibers resuming fibers, each one nests the interpreter in C
+#define RESUMES_MAX 64
+
 // single ongoing function call, the current would be at the top
-typedef struct
+typedef struct CallFrame
 {
     // current function being called
     ObjFunction *function;
 
+    // captured variables, NULL when the function captures nothing
+    ObjClosure *closure;
+
     // jump back to before the function call started
     uint8_t *ip;
 
@@ -23,11 +34,13 @@ typedef struct
     Value *slots;
 } CallFrame;
 
-typedef struct
+// one interpreter, nothing in it is shared with any other vm
+typedef struct VM
 {
-    // visualize a function-call stack
-    CallFrame frames[FRAMES_MAX];
+    // visualize a function-call stack, the vm's own or a running fiber's
+    CallFrame *frames;
     int frameCount;
+    int frameCapacity;
 
     // chunk to run
     Chunk *chunk;
@@ -35,8 +48,9 @@ typedef struct
     // pointer of instruction to run
     uint8_t *ip;
 
-    // stack
-    Value stack[STACK_MAX];
+    // stack, next to the frames it belongs to
+    Value *stack;
+    int stackCapacity;
 
     // points to element just past top of stack
     // points to where next new value should go
@@ -45,8 +59,63 @@ typedef struct
     // global variables
     Table globals;
 
-    // hash of all strings
-    Table strings;
+    // upvalues still pointing into the stack, sorted by slot
+    ObjUpvalue *openUpvalues;
+
+    // fiber whose stacks are in use, NULL while on the vm's own
+    ObjFiber *fiber;
+
+    // resumeFiber calls still running, one inside another
+    int resumeDepth;
+
+    // the vm's own stacks, fixed at the most a program may use
+    CallFrame frameStorage[FRAMES_MAX];
+    Value stackStorage[STACK_MAX];
+
+    // name of class initializers, interned once
+    ObjString *initString;
+
+    // shape every new instance starts with
+    ObjShape *rootShape;
+
+    // methods of the built-in types, called as value.name()
+    Table stringMethods;
+    Table listMethods;
+    Table mapMethods;
+    Table float64Methods;
+    Table channelMethods;
+    Table fiberMethods;
+
+    // calls before a function is compiled, 0 keeps everything interpreted
+    int jitThreshold;
+
+    // back-edges before a loop is traced, 0 never traces
+    int traceThreshold;
+
+    // set while an iteration of a hot loop is being recorded
+    struct TraceRecorder *recorder;
+
+    // where iterations are recorded, allocated by the first recording
+    struct TraceRecorder *recorderStorage;
+
+    // global functions and classes as last copied for tasks, and a hash of
+    // which ones they were so the copy is only remade when they change
+    struct TaskImage *taskImage;
+    uint64_t taskFingerprint;
+
+    // moved on by every write that could turn a global into a function or
+    // class or back, the hash is only taken again once it has moved
+    uint64_t globalsVersion;
+    uint64_t taskVersion;
+
+    // reads and writes in flight, allocated by the first one
+    struct EventLoop *eventLoop;
+
+    // what print writes, on its way to stdout
+    Output output;
+
+    // set of all interned strings
+    InternSet strings;
 
     // linked list of all objects
     Obj *objects;
@@ -59,22 +128,44 @@ typedef enum
     INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-// expose vm
-extern VM vm;
-
 // config vm
-void initVM();
+void initVM(VM *vm);
 
 // clear vm contents
-void freeVM();
+void freeVM(VM *vm);
 
 // interpret code
-InterpretResult interpret(const char *source);
+InterpretResult interpret(VM *vm, const char *source);
+
+// run a script the compiler already produced
+InterpretResult interpretFunction(VM *vm, ObjFunction *function);
+
+// call a value with arguments from C and run it to its return. a failed
+// call leaves the frames below it as they were, so it can be nested.
+// args must not point into the stack, which may grow and move
+InterpretResult interpretCall(VM *vm, Value callee, int argCount, Value *args, Value *result);
+
+// switch to fiber and run it until it yields or returns, giving back that
+// value. the first resume passes the arguments of the fiber's function,
+// later ones at most one value, the result of the yield it stopped at
+bool resumeFiber(VM *vm, ObjFiber *fiber, int argCount, Value *args, Value *result);
+
+// report an error with a stack trace and reset the stack
+void runtimeError(VM *vm, const char *format, ...);
+
+// run the instruction at the top frame's ip, and any interpreted call
+// it starts to completion. compiled code uses it for what it can't inline
+bool stepInstruction(VM *vm);
+
+// the hottest instructions have their own entry points for compiled code
+bool compiledGetGlobal(VM *vm, ObjString *name);
+bool compiledCall(VM *vm, int argCount);
+void compiledReturn(VM *vm);
 
 // append value
-void push(Value value);
+void push(VM *vm, Value value);
 
 // remove
-Value pop();
+Value pop(VM *vm);
 
 #endif
\ No newline at end of file